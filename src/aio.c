@@ -0,0 +1,407 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * aio.c - Asynchronous block reads (io_uring or a pread thread pool)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         /* syscall() */
+
+#include "aio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+/* One read per slot */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    uint64_t offset;
+    size_t bytes;               /* Bytes read once complete */
+    int error;                  /* errno of a failed read, 0 if none */
+#ifdef HAVE_IO_URING
+    struct iovec iov;           /* READV target (plain READ needs Linux 5.6) */
+#endif
+} AIORequest;
+
+#ifdef HAVE_IO_URING
+/* Submission and completion rings shared with the kernel */
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+#endif
+
+struct AIO {
+    AIOBackend backend;         /* AIO_URING or AIO_THREADS once open */
+    int fd;                     /* File being read */
+    uint32_t depth;             /* Slots */
+    AIORequest *requests;       /* One per slot */
+    uint32_t in_flight;         /* Reads started and not yet waited for */
+
+    /* Thread pool */
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* Signalled when a read is queued */
+    pthread_cond_t done;        /* Signalled when a read completes */
+    pthread_t workers[AIO_WORKERS];
+    int worker_count;
+    bool stopping;
+    uint32_t *queued;           /* FIFO of slots waiting for a worker */
+    uint32_t queued_head;
+    uint32_t queued_count;
+    uint32_t *completed;        /* FIFO of slots read by a worker */
+    uint32_t completed_head;
+    uint32_t completed_count;
+
+#ifdef HAVE_IO_URING
+    Uring ring;
+#endif
+};
+
+/* Read until 'len' bytes or end of file; returns bytes read or -1 */
+static ssize_t pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t got = pread(fd, buf + done, len - done, (off_t)(offset + done));
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) break;
+        done += (size_t)got;
+    }
+
+    return (ssize_t)done;
+}
+
+/*
+ * io_uring
+ */
+
+#ifdef HAVE_IO_URING
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_free(Uring *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+static bool uring_init(Uring *ring, uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    /* Fails where the kernel lacks io_uring or a sandbox forbids it */
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return false;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *sq = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    ring->fd, IORING_OFF_SQ_RING);
+    void *cq = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    ring->fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      ring->fd, IORING_OFF_SQES);
+    ring->sq_ring = sq == MAP_FAILED ? NULL : sq;
+    ring->cq_ring = cq == MAP_FAILED ? NULL : cq;
+    ring->sqes = sqes == MAP_FAILED ? NULL : sqes;
+    if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+        uring_free(ring);
+        return false;
+    }
+
+    uint8_t *sq_base = ring->sq_ring;
+    uint8_t *cq_base = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq_base + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq_base + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq_base + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq_base + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq_base + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq_base + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq_base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq_base + params.cq_off.cqes);
+    return true;
+}
+
+static bool uring_submit(AIO *aio, uint32_t slot) {
+    Uring *ring = &aio->ring;
+    AIORequest *req = &aio->requests[slot];
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    req->iov.iov_base = req->buf;
+    req->iov.iov_len = req->len;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = aio->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->off = req->offset;
+    sqe->user_data = slot;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (uring_enter(ring->fd, 1, 0, 0) < 0) {
+        if (errno == EINTR) continue;
+
+        /* Withdraw the entry unless the kernel took it anyway, so that
+         * the ring and in_flight agree */
+        if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != tail) return true;
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+/* Reap one completion, blocking until there is one */
+static bool uring_reap(AIO *aio, uint32_t *slot) {
+    Uring *ring = &aio->ring;
+
+    for (;;) {
+        unsigned head = *ring->cq_head;
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            AIORequest *req = &aio->requests[cqe->user_data];
+            int res = cqe->res;
+
+            *slot = (uint32_t)cqe->user_data;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+            req->error = res < 0 ? -res : 0;
+            req->bytes = res < 0 ? 0 : (size_t)res;
+
+            /* Finish a short read that stopped before end of file */
+            if (res > 0 && req->bytes < req->len) {
+                ssize_t more = pread_full(aio->fd, req->buf + req->bytes,
+                                          req->len - req->bytes, req->offset + req->bytes);
+                if (more < 0) req->error = errno;
+                else req->bytes += (size_t)more;
+            }
+            return true;
+        }
+
+        if (uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+}
+#endif /* HAVE_IO_URING */
+
+/*
+ * Thread pool
+ */
+
+static void *worker_main(void *arg) {
+    AIO *aio = arg;
+
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        while (!aio->stopping && aio->queued_count == 0) {
+            pthread_cond_wait(&aio->work, &aio->lock);
+        }
+        if (aio->stopping) break;
+
+        uint32_t slot = aio->queued[aio->queued_head];
+        aio->queued_head = (aio->queued_head + 1) % aio->depth;
+        aio->queued_count--;
+        pthread_mutex_unlock(&aio->lock);
+
+        AIORequest *req = &aio->requests[slot];
+        ssize_t got = pread_full(aio->fd, req->buf, req->len, req->offset);
+        req->error = got < 0 ? errno : 0;
+        req->bytes = got < 0 ? 0 : (size_t)got;
+
+        pthread_mutex_lock(&aio->lock);
+        aio->completed[(aio->completed_head + aio->completed_count) % aio->depth] = slot;
+        aio->completed_count++;
+        pthread_cond_signal(&aio->done);
+    }
+    pthread_mutex_unlock(&aio->lock);
+
+    return NULL;
+}
+
+static bool threads_start(AIO *aio) {
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->work, NULL);
+    pthread_cond_init(&aio->done, NULL);
+    aio->queued = xmalloc(sizeof(uint32_t) * aio->depth);
+    aio->completed = xmalloc(sizeof(uint32_t) * aio->depth);
+
+    int workers = aio->depth < AIO_WORKERS ? (int)aio->depth : AIO_WORKERS;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&aio->workers[aio->worker_count], NULL, worker_main, aio) == 0) {
+            aio->worker_count++;
+        }
+    }
+    return aio->worker_count > 0;
+}
+
+static void threads_stop(AIO *aio) {
+    pthread_mutex_lock(&aio->lock);
+    aio->stopping = true;
+    pthread_cond_broadcast(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+
+    for (int i = 0; i < aio->worker_count; i++) {
+        pthread_join(aio->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&aio->done);
+    pthread_cond_destroy(&aio->work);
+    pthread_mutex_destroy(&aio->lock);
+    xfree(aio->completed);
+    xfree(aio->queued);
+}
+
+/*
+ * Public interface
+ */
+
+AIO *aio_open(int fd, uint32_t depth, AIOBackend backend) {
+    if (fd < 0 || depth == 0) return NULL;
+
+    AIO *aio = xcalloc(1, sizeof(AIO));
+    aio->fd = fd;
+    aio->depth = depth;
+    aio->requests = xcalloc(depth, sizeof(AIORequest));
+
+#ifdef HAVE_IO_URING
+    if (backend != AIO_THREADS && uring_init(&aio->ring, depth)) {
+        aio->backend = AIO_URING;
+        return aio;
+    }
+#else
+    (void)backend;
+#endif
+
+    aio->backend = AIO_THREADS;
+    if (!threads_start(aio)) {
+        threads_stop(aio);
+        xfree(aio->requests);
+        xfree(aio);
+        error_set(ERR_INTERNAL, "Cannot start I/O threads");
+        return NULL;
+    }
+    return aio;
+}
+
+void aio_close(AIO *aio) {
+    if (!aio) return;
+
+#ifdef HAVE_IO_URING
+    if (aio->backend == AIO_URING) {
+        /* The kernel may still be writing into the caller's buffers */
+        uint32_t slot;
+        while (aio->in_flight > 0 && uring_reap(aio, &slot)) {
+            aio->in_flight--;
+        }
+        uring_free(&aio->ring);
+    }
+#endif
+    if (aio->backend == AIO_THREADS) {
+        threads_stop(aio);
+    }
+
+    xfree(aio->requests);
+    xfree(aio);
+}
+
+bool aio_read(AIO *aio, uint32_t slot, void *buf, size_t len, uint64_t offset) {
+    if (!aio || slot >= aio->depth) return false;
+
+    AIORequest *req = &aio->requests[slot];
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+    req->bytes = 0;
+    req->error = 0;
+
+#ifdef HAVE_IO_URING
+    if (aio->backend == AIO_URING) {
+        if (!uring_submit(aio, slot)) {
+            error_set(ERR_FILE_READ, "Cannot submit read: %s", strerror(errno));
+            return false;
+        }
+        aio->in_flight++;
+        return true;
+    }
+#endif
+
+    pthread_mutex_lock(&aio->lock);
+    aio->queued[(aio->queued_head + aio->queued_count) % aio->depth] = slot;
+    aio->queued_count++;
+    aio->in_flight++;
+    pthread_cond_signal(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+    return true;
+}
+
+bool aio_wait(AIO *aio, uint32_t *slot, size_t *bytes) {
+    if (!aio || !slot || aio->in_flight == 0) return false;
+
+#ifdef HAVE_IO_URING
+    if (aio->backend == AIO_URING) {
+        if (!uring_reap(aio, slot)) {
+            error_set(ERR_FILE_READ, "Cannot wait for reads: %s", strerror(errno));
+            return false;
+        }
+    }
+#endif
+    if (aio->backend == AIO_THREADS) {
+        pthread_mutex_lock(&aio->lock);
+        while (aio->completed_count == 0) {
+            pthread_cond_wait(&aio->done, &aio->lock);
+        }
+        *slot = aio->completed[aio->completed_head];
+        aio->completed_head = (aio->completed_head + 1) % aio->depth;
+        aio->completed_count--;
+        pthread_mutex_unlock(&aio->lock);
+    }
+    aio->in_flight--;
+
+    AIORequest *req = &aio->requests[*slot];
+    if (req->error) {
+        error_set(ERR_FILE_READ, "Read failed: %s", strerror(req->error));
+        return false;
+    }
+    if (bytes) *bytes = req->bytes;
+    return true;
+}
+
+const char *aio_backend_name(AIO *aio) {
+    return aio && aio->backend == AIO_URING ? "io_uring" : "threads";
+}
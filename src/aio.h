@@ -0,0 +1,48 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * aio.h - Asynchronous block reads
+ */
+
+#ifndef XBASE3_AIO_H
+#define XBASE3_AIO_H
+
+#include "util.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A queue of positional reads against one file, kept in flight while the
+ * caller works on earlier results. On Linux the reads go through io_uring
+ * when the kernel allows it (built with HAVE_IO_URING); otherwise a small
+ * pool of threads issues them with pread. Requests are identified by a
+ * slot number below the queue depth; a slot holds one read at a time.
+ */
+typedef struct AIO AIO;
+
+typedef enum {
+    AIO_AUTO,                   /* io_uring if available, else threads */
+    AIO_URING,                  /* io_uring (falls back to threads) */
+    AIO_THREADS                 /* Thread pool of preads */
+} AIOBackend;
+
+/* Worker threads of the pread fallback */
+#define AIO_WORKERS 4
+
+/* Open a queue of 'depth' slots on 'fd' */
+AIO *aio_open(int fd, uint32_t depth, AIOBackend backend);
+
+/* Wait for reads in flight and release the queue */
+void aio_close(AIO *aio);
+
+/* Start reading 'len' bytes at 'offset' into 'buf' in slot 'slot' */
+bool aio_read(AIO *aio, uint32_t slot, void *buf, size_t len, uint64_t offset);
+
+/* Wait for any read to complete; 'bytes' is the amount read (short
+ * only at end of file). Fails on an I/O error or with nothing in flight. */
+bool aio_wait(AIO *aio, uint32_t *slot, size_t *bytes);
+
+/* Backend in use: "io_uring" or "threads" */
+const char *aio_backend_name(AIO *aio);
+
+#endif /* XBASE3_AIO_H */
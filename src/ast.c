@@ -92,6 +92,44 @@ ASTExpr *ast_expr_macro(const char *var_name) {
     return expr;
 }
 
+/* Deep copy of an expression tree */
+ASTExpr *ast_expr_clone(const ASTExpr *expr) {
+    if (!expr) return NULL;
+
+    switch (expr->type) {
+        case EXPR_NUMBER:
+            return ast_expr_number(expr->data.number);
+        case EXPR_STRING:
+            return ast_expr_string(expr->data.string);
+        case EXPR_DATE:
+            return ast_expr_date(expr->data.date);
+        case EXPR_LOGICAL:
+            return ast_expr_logical(expr->data.logical);
+        case EXPR_IDENT:
+            return ast_expr_ident(expr->data.ident);
+        case EXPR_FIELD:
+            return ast_expr_field(expr->data.field_ref.alias, expr->data.field_ref.field);
+        case EXPR_ARRAY:
+            return ast_expr_array(expr->data.array.name, ast_expr_clone(expr->data.array.index));
+        case EXPR_FUNC: {
+            int count = expr->data.func.arg_count;
+            ASTExpr **args = count > 0 ? xcalloc((size_t)count, sizeof(ASTExpr *)) : NULL;
+            for (int i = 0; i < count; i++) {
+                args[i] = ast_expr_clone(expr->data.func.args[i]);
+            }
+            return ast_expr_func(expr->data.func.name, args, count);
+        }
+        case EXPR_UNARY:
+            return ast_expr_unary(expr->data.unary.op, ast_expr_clone(expr->data.unary.operand));
+        case EXPR_BINARY:
+            return ast_expr_binary(expr->data.binary.op, ast_expr_clone(expr->data.binary.left),
+                                   ast_expr_clone(expr->data.binary.right));
+        case EXPR_MACRO:
+            return ast_expr_macro(expr->data.macro.var_name);
+    }
+    return NULL;
+}
+
 /* Free expression tree */
 void ast_expr_free(ASTExpr *expr) {
     if (!expr) return;
@@ -192,6 +230,11 @@ void ast_node_free(ASTNode *node) {
             xfree(node->data.use.alias);
             break;
 
+        case CMD_APPEND:
+            xfree(node->data.append.filename);
+            xfree(node->data.append.type);
+            break;
+
         case CMD_LIST:
         case CMD_DISPLAY:
             free_expr_list(node->data.list.fields, node->data.list.field_count);
@@ -300,13 +343,16 @@ void ast_node_free(ASTNode *node) {
         case CMD_SORT:
             xfree(node->data.copy.filename);
             free_string_list(node->data.copy.fields, node->data.copy.field_count);
+            xfree(node->data.copy.type);
+            xfree(node->data.copy.options);
             break;
 
         case CMD_COUNT:
         case CMD_SUM:
         case CMD_AVERAGE:
             free_expr_list(node->data.aggregate.exprs, node->data.aggregate.count);
-            free_string_list(node->data.aggregate.vars, node->data.aggregate.count);
+            free_string_list(node->data.aggregate.vars, node->type == CMD_COUNT ?
+                             node->data.aggregate.count : node->data.aggregate.var_count);
             break;
 
         case CMD_WAIT:
@@ -145,6 +145,13 @@ typedef struct {
     ASTExpr *count;     /* For NEXT n or RECORD n */
 } Scope;
 
+/* Options of a SORT ON field */
+typedef enum {
+    SORT_ASCENDING = 0,
+    SORT_DESCENDING = 1,    /* /D */
+    SORT_NOCASE = 2         /* /C */
+} SortOption;
+
 /* Command node */
 struct ASTNode {
     CommandType type;
@@ -169,8 +176,21 @@ struct ASTNode {
             char *alias;
             bool exclusive;
             bool shared;
+            bool mmap;          /* Read records through a memory mapping */
+            bool inmemory;      /* Decode every field into memory */
         } use;
 
+        /* APPEND */
+        struct {
+            char *filename;     /* APPEND FROM source (NULL = APPEND BLANK) */
+            char *type;         /* TYPE clause (NULL for a DBF file) */
+        } append;
+
+        /* PACK */
+        struct {
+            bool online;        /* Copy without blocking other requests */
+        } pack;
+
         /* CLOSE */
         struct {
             int what;  /* 0=databases, 1=indexes, 2=all */
@@ -313,6 +333,8 @@ struct ASTNode {
             char *filename;
             char **fields;
             int field_count;
+            char *type;         /* TYPE clause (NULL for a DBF file) */
+            int *options;       /* SORT: SortOption bits per ON field */
         } copy;
 
         /* COUNT/SUM/AVERAGE */
@@ -320,6 +342,7 @@ struct ASTNode {
             ASTExpr **exprs;
             char **vars;
             int count;
+            int var_count;      /* SUM/AVERAGE: names after TO (COUNT uses count) */
         } aggregate;
 
         /* WAIT/ACCEPT/INPUT */
@@ -366,6 +389,7 @@ ASTExpr *ast_expr_macro(const char *var_name);
 ASTNode *ast_node_new(CommandType type);
 void ast_node_free(ASTNode *node);
 void ast_expr_free(ASTExpr *expr);
+ASTExpr *ast_expr_clone(const ASTExpr *expr);
 
 /* List allocation helpers */
 ASTExpr **ast_expr_list_new(int capacity);
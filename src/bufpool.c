@@ -0,0 +1,635 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * bufpool.c - Shared page buffer pool implementation
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bufpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Registered file region */
+struct BufFile {
+    int fd;                     /* Underlying file descriptor */
+    uint64_t base;              /* File offset of region byte 0 */
+    uint64_t size;              /* Logical region size in bytes */
+    BufPage *dirty_head;        /* Dirty pages of this region */
+};
+
+/* Page frame */
+struct BufPage {
+    BufFile *file;              /* Owning region (NULL = free frame) */
+    uint32_t pageno;            /* Page number within the region */
+    int pins;                   /* Pin count; pinned pages are not evicted */
+    bool dirty;                 /* Modified since last write-back */
+    bool referenced;            /* CLOCK reference bit */
+    BufPage *hash_next;         /* Next frame in hash chain */
+    BufPage *dirty_prev;        /* Dirty list links */
+    BufPage *dirty_next;
+    uint8_t *data;              /* BUFPOOL_PAGE_SIZE bytes */
+};
+
+/* Global pool state */
+static struct {
+    pthread_mutex_t lock;
+    BufPage **frames;           /* All frames, resident or free */
+    int frame_count;
+    int max_frames;             /* Budget in frames */
+    int clock_hand;
+    BufPage **buckets;          /* Hash table of resident pages */
+    int bucket_count;           /* Power of two */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .max_frames = (BUFPOOL_DEFAULT_MB * 1024 * 1024) / BUFPOOL_PAGE_SIZE
+};
+
+/*
+ * Hash table
+ */
+
+static unsigned hash_slot(BufFile *file, uint32_t pageno) {
+    uint64_t h = ((uint64_t)(uintptr_t)file >> 4) * 0x9E3779B97F4A7C15ULL;
+    h ^= pageno * 0x85EBCA6BU;
+    return (unsigned)(h >> 32) & (unsigned)(g_pool.bucket_count - 1);
+}
+
+static BufPage *hash_find(BufFile *file, uint32_t pageno) {
+    if (g_pool.bucket_count == 0) return NULL;
+
+    BufPage *p = g_pool.buckets[hash_slot(file, pageno)];
+    while (p) {
+        if (p->file == file && p->pageno == pageno) return p;
+        p = p->hash_next;
+    }
+    return NULL;
+}
+
+static void hash_remove(BufPage *page) {
+    BufPage **link = &g_pool.buckets[hash_slot(page->file, page->pageno)];
+    while (*link) {
+        if (*link == page) {
+            *link = page->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    page->hash_next = NULL;
+}
+
+/* Grow the bucket array so chains stay short */
+static bool hash_reserve(int frames) {
+    if (g_pool.bucket_count >= frames && g_pool.bucket_count > 0) return true;
+
+    int count = g_pool.bucket_count ? g_pool.bucket_count : 256;
+    while (count < frames) count *= 2;
+
+    BufPage **buckets = calloc((size_t)count, sizeof(BufPage *));
+    if (!buckets) return false;
+
+    free(g_pool.buckets);
+    g_pool.buckets = buckets;
+    g_pool.bucket_count = count;
+
+    for (int i = 0; i < g_pool.frame_count; i++) {
+        BufPage *p = g_pool.frames[i];
+        p->hash_next = NULL;
+        if (p->file) {
+            unsigned slot = hash_slot(p->file, p->pageno);
+            p->hash_next = g_pool.buckets[slot];
+            g_pool.buckets[slot] = p;
+        }
+    }
+
+    return true;
+}
+
+static void hash_insert(BufPage *page) {
+    unsigned slot = hash_slot(page->file, page->pageno);
+    page->hash_next = g_pool.buckets[slot];
+    g_pool.buckets[slot] = page;
+}
+
+/*
+ * Dirty tracking
+ */
+
+static void mark_dirty(BufPage *page) {
+    if (page->dirty) return;
+
+    page->dirty = true;
+    page->dirty_prev = NULL;
+    page->dirty_next = page->file->dirty_head;
+    if (page->dirty_next) page->dirty_next->dirty_prev = page;
+    page->file->dirty_head = page;
+}
+
+static void clear_dirty(BufPage *page) {
+    if (!page->dirty) return;
+
+    if (page->dirty_prev) {
+        page->dirty_prev->dirty_next = page->dirty_next;
+    } else {
+        page->file->dirty_head = page->dirty_next;
+    }
+    if (page->dirty_next) page->dirty_next->dirty_prev = page->dirty_prev;
+
+    page->dirty = false;
+    page->dirty_prev = NULL;
+    page->dirty_next = NULL;
+}
+
+/*
+ * Page I/O
+ */
+
+/* Bytes of a page that lie inside the region */
+static size_t page_extent(BufFile *file, uint32_t pageno) {
+    uint64_t start = (uint64_t)pageno * BUFPOOL_PAGE_SIZE;
+    if (file->size <= start) return 0;
+    uint64_t left = file->size - start;
+    return left < BUFPOOL_PAGE_SIZE ? (size_t)left : BUFPOOL_PAGE_SIZE;
+}
+
+static bool page_load(BufPage *page) {
+    size_t want = page_extent(page->file, page->pageno);
+    off_t pos = (off_t)(page->file->base + (uint64_t)page->pageno * BUFPOOL_PAGE_SIZE);
+    size_t got = 0;
+
+    while (got < want) {
+        ssize_t n = pread(page->file->fd, page->data + got, want - got, pos + (off_t)got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error_set(ERR_FILE_READ, "Page read failed");
+            return false;
+        }
+        if (n == 0) break;  /* Bytes not yet written back read as zero */
+        got += (size_t)n;
+    }
+
+    memset(page->data + got, 0, BUFPOOL_PAGE_SIZE - got);
+    return true;
+}
+
+static bool page_write_back(BufPage *page) {
+    size_t len = page_extent(page->file, page->pageno);
+    off_t pos = (off_t)(page->file->base + (uint64_t)page->pageno * BUFPOOL_PAGE_SIZE);
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pwrite(page->file->fd, page->data + done, len - done, pos + (off_t)done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error_set(ERR_FILE_WRITE, "Page write failed");
+            return false;
+        }
+        done += (size_t)n;
+    }
+
+    clear_dirty(page);
+    return true;
+}
+
+/* Detach a frame from its page, leaving it free */
+static void frame_release(BufPage *page) {
+    if (!page->file) return;
+    hash_remove(page);
+    clear_dirty(page);
+    page->file = NULL;
+    page->referenced = false;
+}
+
+/*
+ * Frame allocation
+ */
+
+static BufPage *frame_new(void) {
+    if (!hash_reserve(g_pool.frame_count + 1)) return NULL;
+
+    BufPage **frames = realloc(g_pool.frames,
+                               (size_t)(g_pool.frame_count + 1) * sizeof(BufPage *));
+    if (!frames) return NULL;
+    g_pool.frames = frames;
+
+    BufPage *page = calloc(1, sizeof(BufPage));
+    if (!page) return NULL;
+    page->data = malloc(BUFPOOL_PAGE_SIZE);
+    if (!page->data) {
+        free(page);
+        return NULL;
+    }
+
+    g_pool.frames[g_pool.frame_count++] = page;
+    return page;
+}
+
+/* Find a frame for a new page: grow while under budget, else run CLOCK */
+static BufPage *frame_get(void) {
+    if (g_pool.frame_count < g_pool.max_frames) {
+        BufPage *page = frame_new();
+        if (page) return page;
+    }
+
+    for (int scanned = 0; scanned < 2 * g_pool.frame_count; scanned++) {
+        BufPage *page = g_pool.frames[g_pool.clock_hand];
+        g_pool.clock_hand = (g_pool.clock_hand + 1) % g_pool.frame_count;
+
+        if (page->pins > 0) continue;
+        if (!page->file) return page;
+        if (page->referenced) {
+            page->referenced = false;
+            continue;
+        }
+        if (page->dirty && !page_write_back(page)) continue;
+
+        frame_release(page);
+        g_pool.evictions++;
+        return page;
+    }
+
+    /* Everything is pinned: exceed the budget rather than fail */
+    BufPage *page = frame_new();
+    if (!page) error_set(ERR_OUT_OF_MEMORY, "Buffer pool exhausted");
+    return page;
+}
+
+/* Look up a page, loading it unless the caller overwrites it entirely */
+static BufPage *page_get(BufFile *file, uint32_t pageno, bool load) {
+    BufPage *page = hash_find(file, pageno);
+    if (page) {
+        g_pool.hits++;
+        page->referenced = true;
+        return page;
+    }
+
+    g_pool.misses++;
+    page = frame_get();
+    if (!page) return NULL;
+
+    page->file = file;
+    page->pageno = pageno;
+    if (load) {
+        if (!page_load(page)) {
+            page->file = NULL;
+            return NULL;
+        }
+    } else {
+        memset(page->data, 0, BUFPOOL_PAGE_SIZE);
+    }
+
+    page->referenced = true;
+    hash_insert(page);
+    return page;
+}
+
+/* Evict unpinned frames until the pool fits its budget */
+static void shrink_to_budget(void) {
+    int i = 0;
+    while (g_pool.frame_count > g_pool.max_frames && i < g_pool.frame_count) {
+        BufPage *page = g_pool.frames[i];
+        if (page->pins > 0 || (page->dirty && !page_write_back(page))) {
+            i++;
+            continue;
+        }
+
+        if (page->file) g_pool.evictions++;
+        frame_release(page);
+        free(page->data);
+        free(page);
+        g_pool.frames[i] = g_pool.frames[--g_pool.frame_count];
+    }
+
+    if (g_pool.clock_hand >= g_pool.frame_count) g_pool.clock_hand = 0;
+}
+
+/*
+ * Public API
+ */
+
+BufFile *bufpool_attach(int fd, uint64_t base, uint64_t size) {
+    BufFile *file = xcalloc(1, sizeof(BufFile));
+    file->fd = fd;
+    file->base = base;
+    file->size = size;
+    return file;
+}
+
+bool bufpool_detach(BufFile *file) {
+    if (!file) return true;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    /* A page that cannot be written keeps the region attached, so the
+     * data is still there for the caller to retry or discard */
+    while (file->dirty_head) {
+        if (!page_write_back(file->dirty_head)) {
+            pthread_mutex_unlock(&g_pool.lock);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < g_pool.frame_count; i++) {
+        if (g_pool.frames[i]->file == file) {
+            g_pool.frames[i]->pins = 0;
+            frame_release(g_pool.frames[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&g_pool.lock);
+    xfree(file);
+    return true;
+}
+
+uint64_t bufpool_size(BufFile *file) {
+    if (!file) return 0;
+
+    pthread_mutex_lock(&g_pool.lock);
+    uint64_t size = file->size;
+    pthread_mutex_unlock(&g_pool.lock);
+    return size;
+}
+
+void bufpool_truncate(BufFile *file, uint64_t size) {
+    if (!file) return;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    for (int i = 0; i < g_pool.frame_count; i++) {
+        BufPage *page = g_pool.frames[i];
+        if (page->file == file &&
+            (uint64_t)page->pageno * BUFPOOL_PAGE_SIZE >= size) {
+            page->pins = 0;
+            frame_release(page);
+        }
+    }
+
+    /* Clear the tail of the last page so regrowth reads zeros */
+    if (size % BUFPOOL_PAGE_SIZE) {
+        BufPage *page = hash_find(file, (uint32_t)(size / BUFPOOL_PAGE_SIZE));
+        if (page) {
+            size_t keep = size % BUFPOOL_PAGE_SIZE;
+            memset(page->data + keep, 0, BUFPOOL_PAGE_SIZE - keep);
+        }
+    }
+
+    file->size = size;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+BufPage *bufpool_pin(BufFile *file, uint32_t pageno) {
+    if (!file) return NULL;
+
+    pthread_mutex_lock(&g_pool.lock);
+    BufPage *page = page_get(file, pageno, true);
+    if (page) page->pins++;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    return page;
+}
+
+uint8_t *bufpool_page_data(BufPage *page) {
+    return page ? page->data : NULL;
+}
+
+void bufpool_unpin(BufPage *page, bool dirty) {
+    if (!page) return;
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (page->pins > 0) page->pins--;
+    if (dirty && page->file) mark_dirty(page);
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+bool bufpool_read(BufFile *file, uint64_t offset, void *dst, size_t len) {
+    if (!file) return false;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    if (offset + len > file->size) {
+        pthread_mutex_unlock(&g_pool.lock);
+        error_set(ERR_FILE_READ, "Read past end of file");
+        return false;
+    }
+
+    uint8_t *out = dst;
+    while (len > 0) {
+        uint32_t pageno = (uint32_t)(offset / BUFPOOL_PAGE_SIZE);
+        size_t in_page = (size_t)(offset % BUFPOOL_PAGE_SIZE);
+        size_t n = BUFPOOL_PAGE_SIZE - in_page;
+        if (n > len) n = len;
+
+        BufPage *page = page_get(file, pageno, true);
+        if (!page) {
+            pthread_mutex_unlock(&g_pool.lock);
+            return false;
+        }
+        memcpy(out, page->data + in_page, n);
+
+        out += n;
+        offset += n;
+        len -= n;
+    }
+
+    pthread_mutex_unlock(&g_pool.lock);
+    return true;
+}
+
+bool bufpool_write(BufFile *file, uint64_t offset, const void *src, size_t len) {
+    if (!file) return false;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    const uint8_t *in = src;
+    while (len > 0) {
+        uint32_t pageno = (uint32_t)(offset / BUFPOOL_PAGE_SIZE);
+        size_t in_page = (size_t)(offset % BUFPOOL_PAGE_SIZE);
+        size_t n = BUFPOOL_PAGE_SIZE - in_page;
+        if (n > len) n = len;
+
+        /* A page written in full, or lying past the end, need not be read */
+        bool load = n < BUFPOOL_PAGE_SIZE &&
+                    (uint64_t)pageno * BUFPOOL_PAGE_SIZE < file->size;
+
+        BufPage *page = page_get(file, pageno, load);
+        if (!page) {
+            pthread_mutex_unlock(&g_pool.lock);
+            return false;
+        }
+        memcpy(page->data + in_page, in, n);
+
+        if (offset + n > file->size) file->size = offset + n;
+        mark_dirty(page);
+
+        in += n;
+        offset += n;
+        len -= n;
+    }
+
+    pthread_mutex_unlock(&g_pool.lock);
+    return true;
+}
+
+bool bufpool_write_direct(BufFile *file, uint64_t offset, const void *src, size_t len) {
+    if (!file) return false;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    off_t pos = (off_t)(file->base + offset);
+    const uint8_t *in = src;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(file->fd, in + done, len - done, pos + (off_t)done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            pthread_mutex_unlock(&g_pool.lock);
+            error_set(ERR_FILE_WRITE, "Write failed");
+            return false;
+        }
+        done += (size_t)n;
+    }
+
+    if (offset + len > file->size) file->size = offset + len;
+
+    /* Keep resident pages in the range coherent with the file */
+    if (len > 0) {
+        uint32_t first = (uint32_t)(offset / BUFPOOL_PAGE_SIZE);
+        uint32_t last = (uint32_t)((offset + len - 1) / BUFPOOL_PAGE_SIZE);
+        for (uint32_t pageno = first; pageno <= last; pageno++) {
+            BufPage *page = hash_find(file, pageno);
+            if (!page) continue;
+
+            uint64_t start = (uint64_t)pageno * BUFPOOL_PAGE_SIZE;
+            uint64_t from = offset > start ? offset : start;
+            uint64_t to = offset + len < start + BUFPOOL_PAGE_SIZE
+                          ? offset + len : start + BUFPOOL_PAGE_SIZE;
+            memcpy(page->data + (from - start), in + (from - offset), (size_t)(to - from));
+        }
+    }
+
+    pthread_mutex_unlock(&g_pool.lock);
+    return true;
+}
+
+bool bufpool_prefetch(BufFile *file, uint64_t offset, size_t len) {
+    if (!file) return false;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    if (offset >= file->size) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return true;
+    }
+    if (offset + len > file->size) len = (size_t)(file->size - offset);
+
+    uint32_t first = (uint32_t)(offset / BUFPOOL_PAGE_SIZE);
+    uint32_t last = (uint32_t)((offset + len - 1) / BUFPOOL_PAGE_SIZE);
+
+    /* Trim pages that are already resident from both ends */
+    while (first <= last && hash_find(file, first)) first++;
+    while (last > first && hash_find(file, last)) last--;
+    if (first > last) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return true;
+    }
+
+    size_t span = (size_t)(last - first + 1) * BUFPOOL_PAGE_SIZE;
+    uint8_t *buf = malloc(span);
+    if (!buf) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return false;
+    }
+
+    off_t pos = (off_t)(file->base + (uint64_t)first * BUFPOOL_PAGE_SIZE);
+    size_t got = 0;
+    while (got < span) {
+        ssize_t n = pread(file->fd, buf + got, span - got, pos + (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    memset(buf + got, 0, span - got);
+
+    for (uint32_t pageno = first; pageno <= last; pageno++) {
+        if (hash_find(file, pageno)) continue;
+
+        BufPage *page = frame_get();
+        if (!page) break;
+
+        page->file = file;
+        page->pageno = pageno;
+        memcpy(page->data, buf + (size_t)(pageno - first) * BUFPOOL_PAGE_SIZE,
+               BUFPOOL_PAGE_SIZE);
+
+        /* Zero anything past the logical end, as page_load() would */
+        size_t extent = page_extent(file, pageno);
+        memset(page->data + extent, 0, BUFPOOL_PAGE_SIZE - extent);
+
+        page->referenced = true;
+        hash_insert(page);
+        g_pool.misses++;
+    }
+
+    free(buf);
+    pthread_mutex_unlock(&g_pool.lock);
+    return true;
+}
+
+bool bufpool_flush(BufFile *file) {
+    if (!file) return false;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    bool ok = true;
+    while (file->dirty_head) {
+        if (!page_write_back(file->dirty_head)) {
+            ok = false;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_pool.lock);
+    return ok;
+}
+
+void bufpool_set_budget(size_t bytes) {
+    int frames = (int)(bytes / BUFPOOL_PAGE_SIZE);
+    if (frames < BUFPOOL_MIN_PAGES) frames = BUFPOOL_MIN_PAGES;
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.max_frames = frames;
+    shrink_to_budget();
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+size_t bufpool_get_budget(void) {
+    pthread_mutex_lock(&g_pool.lock);
+    size_t bytes = (size_t)g_pool.max_frames * BUFPOOL_PAGE_SIZE;
+    pthread_mutex_unlock(&g_pool.lock);
+    return bytes;
+}
+
+void bufpool_get_stats(BufPoolStats *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_pool.lock);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->budget = (size_t)g_pool.max_frames * BUFPOOL_PAGE_SIZE;
+    for (int i = 0; i < g_pool.frame_count; i++) {
+        if (g_pool.frames[i]->file) {
+            stats->pages++;
+            if (g_pool.frames[i]->dirty) stats->dirty++;
+        }
+    }
+    stats->hits = g_pool.hits;
+    stats->misses = g_pool.misses;
+    stats->evictions = g_pool.evictions;
+
+    pthread_mutex_unlock(&g_pool.lock);
+}
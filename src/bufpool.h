@@ -0,0 +1,85 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * bufpool.h - Shared page buffer pool
+ */
+
+#ifndef XBASE3_BUFPOOL_H
+#define XBASE3_BUFPOOL_H
+
+#include "util.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Pool geometry */
+#define BUFPOOL_PAGE_SIZE   8192
+#define BUFPOOL_DEFAULT_MB  16
+#define BUFPOOL_MIN_PAGES   16
+#define BUFPOOL_MAX_MB      65536   /* Largest SET BUFFERS budget */
+
+/*
+ * The pool caches fixed-size pages of registered file regions. A region
+ * starts at a base offset within its file (so headers written through
+ * stdio stay outside the pool) and has a logical size that grows as the
+ * owner writes past its end. All offsets passed to the pool are relative
+ * to the region base.
+ *
+ * Pages are written back lazily: on eviction, on bufpool_flush() and on
+ * bufpool_detach(). Eviction uses the CLOCK algorithm and never touches
+ * pinned pages. One pool, with one memory budget, is shared by every
+ * open table and index in the process.
+ */
+typedef struct BufFile BufFile;
+typedef struct BufPage BufPage;
+
+/* Pool statistics */
+typedef struct {
+    size_t budget;              /* Memory budget in bytes */
+    uint32_t pages;             /* Resident pages */
+    uint32_t dirty;             /* Resident pages awaiting write-back */
+    uint64_t hits;              /* Page requests served from memory */
+    uint64_t misses;            /* Page requests that went to disk */
+    uint64_t evictions;         /* Pages evicted to stay within budget */
+} BufPoolStats;
+
+/* Register a file region starting at 'base' with 'size' bytes */
+BufFile *bufpool_attach(int fd, uint64_t base, uint64_t size);
+
+/* Write back and drop every page of a region, then forget it. If a page
+ * cannot be written the region stays attached with its pages and false
+ * is returned; bufpool_truncate(file, 0) discards them. */
+bool bufpool_detach(BufFile *file);
+
+/* Logical size of a region */
+uint64_t bufpool_size(BufFile *file);
+
+/* Shrink a region, discarding pages past the new end */
+void bufpool_truncate(BufFile *file, uint64_t size);
+
+/* Pin a page in memory; the pointer stays valid until unpinned */
+BufPage *bufpool_pin(BufFile *file, uint32_t pageno);
+uint8_t *bufpool_page_data(BufPage *page);
+void bufpool_unpin(BufPage *page, bool dirty);
+
+/* Copy bytes out of / into a region through the pool */
+bool bufpool_read(BufFile *file, uint64_t offset, void *dst, size_t len);
+bool bufpool_write(BufFile *file, uint64_t offset, const void *src, size_t len);
+
+/* Write bytes to the file with a single write, bypassing page allocation;
+ * resident pages in the range are updated in place */
+bool bufpool_write_direct(BufFile *file, uint64_t offset, const void *src, size_t len);
+
+/* Load the pages covering a byte range with a single read */
+bool bufpool_prefetch(BufFile *file, uint64_t offset, size_t len);
+
+/* Write back dirty pages of a region */
+bool bufpool_flush(BufFile *file);
+
+/* Memory budget (SET BUFFERS TO <MB>) */
+void bufpool_set_budget(size_t bytes);
+size_t bufpool_get_budget(void);
+
+/* Statistics */
+void bufpool_get_stats(BufPoolStats *stats);
+
+#endif /* XBASE3_BUFPOOL_H */
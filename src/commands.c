@@ -3,14 +3,23 @@
  * commands.c - Command execution implementation
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "commands.h"
 #include "variables.h"
+#include "xcol.h"
+#include "textio.h"
+#include "sort.h"
+#include "parallel.h"
+#include "parser.h"
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
 
 void cmd_context_init(CommandContext *ctx) {
     memset(ctx, 0, sizeof(CommandContext));
@@ -19,6 +28,7 @@ void cmd_context_init(CommandContext *ctx) {
 
     /* Initialize mutex for thread safety */
     pthread_mutex_init(&ctx->mutex, NULL);
+    pthread_cond_init(&ctx->readers_done, NULL);
     ctx->mutex_initialized = true;
 
     /* Default to printf output */
@@ -32,6 +42,8 @@ void cmd_context_init(CommandContext *ctx) {
 }
 
 void cmd_context_cleanup(CommandContext *ctx) {
+    cmd_stop_committer(ctx);
+
     /* Close all indexes */
     for (int i = 0; i < ctx->index_count; i++) {
         if (ctx->indexes[i]) {
@@ -49,8 +61,12 @@ void cmd_context_cleanup(CommandContext *ctx) {
     }
     var_cleanup();
 
+    ast_expr_free(ctx->locate_cond);
+    ctx->locate_cond = NULL;
+
     /* Destroy mutex */
     if (ctx->mutex_initialized) {
+        pthread_cond_destroy(&ctx->readers_done);
         pthread_mutex_destroy(&ctx->mutex);
         ctx->mutex_initialized = false;
     }
@@ -59,15 +75,78 @@ void cmd_context_cleanup(CommandContext *ctx) {
 void cmd_lock(CommandContext *ctx) {
     if (ctx->mutex_initialized) {
         pthread_mutex_lock(&ctx->mutex);
+        ctx->lock_held = true;
     }
 }
 
 void cmd_unlock(CommandContext *ctx) {
     if (ctx->mutex_initialized) {
+        ctx->lock_held = false;
         pthread_mutex_unlock(&ctx->mutex);
     }
 }
 
+void cmd_reader_begin(CommandContext *ctx) {
+    ctx->readers++;
+}
+
+void cmd_reader_end(CommandContext *ctx) {
+    if (--ctx->readers == 0 && ctx->mutex_initialized) {
+        pthread_cond_broadcast(&ctx->readers_done);
+    }
+}
+
+/* Wait, with the context locked, for unlocked readers to finish */
+static void wait_for_readers(CommandContext *ctx) {
+    if (!ctx->lock_held) return;
+    while (ctx->readers > 0) {
+        pthread_cond_wait(&ctx->readers_done, &ctx->mutex);
+        ctx->lock_held = true;
+    }
+}
+
+/* Group commit: in BATCH durability, statements leave their changes
+ * pending and this thread commits every open table, with one sync each,
+ * once per interval */
+static void *commit_thread(void *arg) {
+    CommandContext *ctx = (CommandContext *)arg;
+    struct timespec interval = {0, DBF_GROUP_COMMIT_MS * 1000000L};
+    error_enable_longjmp(false);
+
+    for (;;) {
+        nanosleep(&interval, NULL);
+
+        cmd_lock(ctx);
+        bool stop = ctx->committer_stop;
+        if (!stop && dbf_get_durability() == DBF_DURABILITY_BATCH && !dbf_commit_all_due()) {
+            error_print();
+            error_clear();
+        }
+        cmd_unlock(ctx);
+
+        if (stop) break;
+    }
+
+    return NULL;
+}
+
+void cmd_start_committer(CommandContext *ctx) {
+    if (ctx->committer_running) return;
+    ctx->committer_stop = false;
+    ctx->committer_running = pthread_create(&ctx->committer, NULL, commit_thread, ctx) == 0;
+}
+
+void cmd_stop_committer(CommandContext *ctx) {
+    if (!ctx->committer_running) return;
+
+    cmd_lock(ctx);
+    ctx->committer_stop = true;
+    cmd_unlock(ctx);
+
+    pthread_join(ctx->committer, NULL);
+    ctx->committer_running = false;
+}
+
 void cmd_set_output(CommandContext *ctx, OutputFunc func, void *output_ctx) {
     ctx->output_func = func;
     ctx->output_ctx = output_ctx;
@@ -109,11 +188,33 @@ static void cmd_print(ASTNode *node, CommandContext *ctx, bool newline_first) {
     }
 }
 
+/* Resolve 'filename' against the current directory into 'path' (of
+ * MAX_PATH_LEN bytes), adding 'ext' when it has none; false if the
+ * result does not fit */
+static bool command_path(CommandContext *ctx, const char *filename, const char *ext, char *path) {
+    int n;
+    if (filename[0] == '/' || strchr(filename, ':') != NULL) {
+        n = snprintf(path, MAX_PATH_LEN, "%s", filename);
+    } else {
+        n = snprintf(path, MAX_PATH_LEN, "%s/%s", ctx->current_path, filename);
+    }
+
+    size_t len = n < 0 ? MAX_PATH_LEN : (size_t)n;
+    if (len < MAX_PATH_LEN && !file_extension(path)) len += strlen(ext);
+    if (len >= MAX_PATH_LEN) {
+        error_set(ERR_SYNTAX, "Path too long: %s", filename);
+        return false;
+    }
+
+    if (!file_extension(path)) strcat(path, ext);
+    return true;
+}
+
 /* Execute USE command */
 static void cmd_use(ASTNode *node, CommandContext *ctx) {
     /* Close current database if open */
     if (ctx->eval_ctx.current_dbf) {
-        dbf_close(ctx->eval_ctx.current_dbf);
+        if (!dbf_close(ctx->eval_ctx.current_dbf)) error_print();
         ctx->eval_ctx.current_dbf = NULL;
     }
 
@@ -124,21 +225,22 @@ static void cmd_use(ASTNode *node, CommandContext *ctx) {
 
     /* Build full path */
     char path[MAX_PATH_LEN];
-    if (node->data.use.filename[0] == '/' ||
-        strstr(node->data.use.filename, ":") != NULL) {
-        strncpy(path, node->data.use.filename, MAX_PATH_LEN - 1);
-    } else {
-        snprintf(path, MAX_PATH_LEN, "%s/%s", ctx->current_path, node->data.use.filename);
+    if (!command_path(ctx, node->data.use.filename, ".dbf", path)) {
+        error_print();
+        return;
     }
 
-    /* Add .dbf extension if missing */
-    if (!file_extension(path)) {
-        strcat(path, ".dbf");
+    /* Open database; a columnar snapshot is read-only */
+    if (str_casecmp(file_extension(path), ".xcol") == 0) {
+        ctx->eval_ctx.current_dbf = dbf_open_xcol(path);
+    } else if (node->data.use.inmemory) {
+        ctx->eval_ctx.current_dbf = dbf_open_inmemory(path, false);
+    } else if (node->data.use.mmap) {
+        ctx->eval_ctx.current_dbf = dbf_open_mmap(path, false);
+    } else {
+        ctx->eval_ctx.current_dbf = dbf_open(path, false);
     }
 
-    /* Open database */
-    ctx->eval_ctx.current_dbf = dbf_open(path, false);
-
     if (!ctx->eval_ctx.current_dbf) {
         error_print();
         return;
@@ -155,7 +257,7 @@ static void cmd_use(ASTNode *node, CommandContext *ctx) {
 static void close_indexes(CommandContext *ctx) {
     for (int i = 0; i < ctx->index_count; i++) {
         if (ctx->indexes[i]) {
-            xdx_close(ctx->indexes[i]);
+            if (!xdx_close(ctx->indexes[i])) error_print();
             ctx->indexes[i] = NULL;
         }
     }
@@ -173,7 +275,7 @@ static void cmd_close(ASTNode *node, CommandContext *ctx) {
         /* CLOSE DATABASES or CLOSE ALL */
         close_indexes(ctx);
         if (ctx->eval_ctx.current_dbf) {
-            dbf_close(ctx->eval_ctx.current_dbf);
+            if (!dbf_close(ctx->eval_ctx.current_dbf)) error_print();
             ctx->eval_ctx.current_dbf = NULL;
         }
     }
@@ -191,16 +293,9 @@ static void cmd_create(ASTNode *node, CommandContext *ctx) {
 
     /* Build full path */
     char path[MAX_PATH_LEN];
-    if (node->data.create.filename[0] == '/' ||
-        strstr(node->data.create.filename, ":") != NULL) {
-        strncpy(path, node->data.create.filename, MAX_PATH_LEN - 1);
-    } else {
-        snprintf(path, MAX_PATH_LEN, "%s/%s", ctx->current_path, node->data.create.filename);
-    }
-
-    /* Add .dbf extension if missing */
-    if (!file_extension(path)) {
-        strcat(path, ".dbf");
+    if (!command_path(ctx, node->data.create.filename, ".dbf", path)) {
+        error_print();
+        return;
     }
 
     /* Read field definitions from stdin */
@@ -302,8 +397,8 @@ static void cmd_create(ASTNode *node, CommandContext *ctx) {
     CMD_OUTPUT(ctx, "Database %s created with %d field(s)\n", path, field_count);
 
     /* Close current and open new */
-    if (ctx->eval_ctx.current_dbf) {
-        dbf_close(ctx->eval_ctx.current_dbf);
+    if (ctx->eval_ctx.current_dbf && !dbf_close(ctx->eval_ctx.current_dbf)) {
+        error_print();
     }
     ctx->eval_ctx.current_dbf = dbf;
 }
@@ -352,6 +447,186 @@ static bool check_for_condition(ASTNode *node, CommandContext *ctx) {
     return result;
 }
 
+/* Advance a scan loop: through the scan when there is one, else SKIP */
+static bool next_record(DBF *dbf, DBFScan *scan) {
+    if (!scan) return dbf_skip(dbf, 1);
+    if (dbf_scan_next(scan)) return true;
+    error_print();
+    return false;
+}
+
+/* Most comparisons a FOR condition passes on to a scan */
+#define ZONE_TESTS_MAX 8
+
+/* N or D field an expression names, or -1 */
+static int zone_field(DBF *dbf, ASTExpr *expr) {
+    int idx = -1;
+    if (expr->type == EXPR_IDENT) {
+        idx = dbf_field_index(dbf, expr->data.ident);
+    } else if (expr->type == EXPR_FIELD) {
+        idx = dbf_field_index(dbf, expr->data.field_ref.field);
+    }
+    if (idx < 0) return -1;
+
+    char type = dbf_field_info(dbf, idx)->type;
+    return type == FIELD_TYPE_NUMERIC || type == FIELD_TYPE_DATE ? idx : -1;
+}
+
+/* C field an expression names, possibly trimmed or case-converted, or -1 */
+static int match_field(DBF *dbf, ASTExpr *expr) {
+    static const char *const wrappers[] = {"TRIM", "RTRIM", "LTRIM", "ALLTRIM", "UPPER", "LOWER"};
+
+    while (expr->type == EXPR_FUNC && expr->data.func.arg_count == 1) {
+        size_t i = 0;
+        while (i < sizeof(wrappers) / sizeof(wrappers[0]) &&
+               strcasecmp(expr->data.func.name, wrappers[i]) != 0) {
+            i++;
+        }
+        if (i == sizeof(wrappers) / sizeof(wrappers[0])) return -1;
+        expr = expr->data.func.args[0];
+    }
+
+    int idx = -1;
+    if (expr->type == EXPR_IDENT) {
+        idx = dbf_field_index(dbf, expr->data.ident);
+    } else if (expr->type == EXPR_FIELD) {
+        idx = dbf_field_index(dbf, expr->data.field_ref.field);
+    }
+    return idx >= 0 && dbf_field_info(dbf, idx)->type == FIELD_TYPE_CHAR ? idx : -1;
+}
+
+/* Whether an expression has the same value for every record: a literal,
+ * a memory variable, CTOD() or DATE() of those, or a sign applied to one */
+static bool zone_constant(DBF *dbf, ASTExpr *expr) {
+    switch (expr->type) {
+        case EXPR_NUMBER:
+        case EXPR_STRING:
+        case EXPR_DATE:
+            return true;
+        case EXPR_IDENT:
+            return dbf_field_index(dbf, expr->data.ident) < 0;
+        case EXPR_FUNC:
+            if (strcasecmp(expr->data.func.name, "CTOD") != 0 &&
+                strcasecmp(expr->data.func.name, "DATE") != 0) {
+                return false;
+            }
+            for (int i = 0; i < expr->data.func.arg_count; i++) {
+                if (!zone_constant(dbf, expr->data.func.args[i])) return false;
+            }
+            return true;
+        case EXPR_UNARY:
+            return (expr->data.unary.op == TOK_MINUS || expr->data.unary.op == TOK_PLUS) &&
+                   zone_constant(dbf, expr->data.unary.operand);
+        default:
+            return false;
+    }
+}
+
+/* Collect the "field <op> constant" terms of a condition's top-level .AND.
+ * chain; a record passes the condition only if it passes each of them.
+ * Texts of character matches are allocated. */
+static void zone_tests(ASTExpr *expr, CommandContext *ctx, DBFZoneTest *tests, int *count) {
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (expr->type != EXPR_BINARY || *count >= ZONE_TESTS_MAX) return;
+
+    TokenType op = expr->data.binary.op;
+    ASTExpr *left = expr->data.binary.left;
+    ASTExpr *right = expr->data.binary.right;
+
+    if (op == TOK_AND) {
+        zone_tests(left, ctx, tests, count);
+        zone_tests(right, ctx, tests, count);
+        return;
+    }
+
+    /* A character field equal to a string can only hold that string,
+     * give or take blanks and case */
+    if (op == TOK_EQ) {
+        int field = match_field(dbf, left);
+        ASTExpr *other = right;
+        if (field < 0) {
+            field = match_field(dbf, right);
+            other = left;
+        }
+        if (field >= 0) {
+            if (!zone_constant(dbf, other)) return;
+            Value v = expr_eval(other, &ctx->eval_ctx);
+            if (v.type == VAL_STRING) {
+                tests[*count].field = field;
+                tests[*count].op = DBF_ZONE_MATCH;
+                tests[*count].value = 0;
+                tests[*count].text = xstrdup(v.data.string);
+                (*count)++;
+            }
+            value_free(&v);
+            return;
+        }
+    }
+
+    /* Constant on the left: mirror the comparison */
+    int field = zone_field(dbf, left);
+    if (field < 0) {
+        field = zone_field(dbf, right);
+        right = left;
+        switch (op) {
+            case TOK_LT: op = TOK_GT; break;
+            case TOK_LE: op = TOK_GE; break;
+            case TOK_GT: op = TOK_LT; break;
+            case TOK_GE: op = TOK_LE; break;
+            default: break;
+        }
+    }
+    if (field < 0 || !zone_constant(dbf, right)) return;
+
+    DBFZoneOp zop;
+    switch (op) {
+        case TOK_EQ: zop = DBF_ZONE_EQ; break;
+        case TOK_NE: zop = DBF_ZONE_NE; break;
+        case TOK_LT: zop = DBF_ZONE_LT; break;
+        case TOK_LE: zop = DBF_ZONE_LE; break;
+        case TOK_GT: zop = DBF_ZONE_GT; break;
+        case TOK_GE: zop = DBF_ZONE_GE; break;
+        default: return;
+    }
+
+    /* Only comparisons of like types compare the way the ranges do */
+    Value v = expr_eval(right, &ctx->eval_ctx);
+    ValueType want = dbf_field_info(dbf, field)->type == FIELD_TYPE_DATE ? VAL_DATE : VAL_NUMBER;
+    if (v.type == want) {
+        double value = value_to_number(&v);
+        if (value == value) {
+            tests[*count].field = field;
+            tests[*count].op = zop;
+            tests[*count].value = value;
+            tests[*count].text = NULL;
+            (*count)++;
+        }
+    }
+    value_free(&v);
+}
+
+/* Start a scan at record 'first'. A condition that compares fields with
+ * constants lets the scan pass over blocks in which no record can
+ * satisfy it. */
+static DBFScan *scan_open_from(DBF *dbf, uint32_t first, ASTExpr *cond, CommandContext *ctx) {
+    DBFZoneTest tests[ZONE_TESTS_MAX];
+    int count = 0;
+
+    if (cond) zone_tests(cond, ctx, tests, &count);
+    DBFScan *scan = dbf_scan_open_where(dbf, first, tests, count);
+
+    for (int i = 0; i < count; i++) {
+        xfree((char *)tests[i].text);
+    }
+    return scan;
+}
+
+/* Start the scan of a command; with a scope or WHILE every record counts */
+static DBFScan *scan_open(DBF *dbf, ASTNode *node, CommandContext *ctx) {
+    bool all = node->scope.type == SCOPE_ALL && !node->while_cond;
+    return scan_open_from(dbf, 1, all ? node->condition : NULL, ctx);
+}
+
 /* Execute LIST/DISPLAY command */
 static void cmd_list(ASTNode *node, CommandContext *ctx, bool is_display) {
     DBF *dbf = ctx->eval_ctx.current_dbf;
@@ -361,9 +636,14 @@ static void cmd_list(ASTNode *node, CommandContext *ctx, bool is_display) {
         return;
     }
 
-    /* For DISPLAY, stay on current record; for LIST, start from top */
+    /* For DISPLAY, stay on current record; for LIST, scan from the top */
+    DBFScan *scan = NULL;
     if (!is_display) {
-        dbf_go_top(dbf);
+        scan = scan_open(dbf, node, ctx);
+        if (!scan) {
+            error_print();
+            return;
+        }
     }
 
     /* Handle DISPLAY with no records */
@@ -403,9 +683,11 @@ static void cmd_list(ASTNode *node, CommandContext *ctx, bool is_display) {
                 /* All fields */
                 int fc = dbf_field_count(dbf);
                 for (int i = 0; i < fc; i++) {
-                    char buf[MAX_FIELD_LEN + 1];
-                    dbf_get_string(dbf, i, buf, sizeof(buf));
-                    CMD_OUTPUT(ctx, "%s ", buf);
+                    const uint8_t *value;
+                    size_t len;
+                    if (dbf_field_view(dbf, i, &value, &len)) {
+                        CMD_OUTPUT(ctx, "%.*s ", (int)len, (const char *)value);
+                    }
                 }
             }
 
@@ -419,8 +701,9 @@ static void cmd_list(ASTNode *node, CommandContext *ctx, bool is_display) {
             }
         }
 
-        dbf_skip(dbf, 1);
+        if (!next_record(dbf, scan)) break;
     }
+    dbf_scan_close(scan);
 
     if (processed == 0 && !is_display) {
         CMD_OUTPUT(ctx, "No records found\n");
@@ -448,8 +731,617 @@ static void cmd_go(ASTNode *node, CommandContext *ctx) {
     }
 }
 
-/* Execute SKIP command */
-static void cmd_skip(ASTNode *node, CommandContext *ctx) {
+/* Execute SKIP command */
+static void cmd_skip(ASTNode *node, CommandContext *ctx) {
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (!dbf) {
+        error_set(ERR_NO_DATABASE, NULL);
+        error_print();
+        return;
+    }
+
+    int count = 1;
+    if (node->data.skip.count) {
+        Value v = expr_eval(node->data.skip.count, &ctx->eval_ctx);
+        count = (int)value_to_number(&v);
+        value_free(&v);
+    }
+
+    dbf_skip(dbf, count);
+}
+
+/* Whether a scan of every record may be split between worker threads */
+static bool scan_parallel(DBF *dbf, ASTNode *node) {
+    if (parallel_get_threads() < 2 || dbf_is_snapshot(dbf)) return false;
+    return !node || (node->scope.type == SCOPE_ALL && !node->while_cond);
+}
+
+/* Search from record 'first' for the condition of the last LOCATE */
+static void locate_from(DBF *dbf, uint32_t first, CommandContext *ctx) {
+    if (scan_parallel(dbf, NULL)) {
+        ParallelTask task = {0, NULL, NULL, true};
+        void *partials;
+        int workers;
+        uint32_t found;
+        if (parallel_scan(dbf, first, ctx->locate_cond, &task, &partials, &workers, &found)) {
+            xfree(partials);
+            if (found) {
+                dbf_goto(dbf, found);
+                CMD_OUTPUT(ctx, "Record %u\n", found);
+            } else {
+                dbf_goto(dbf, dbf_reccount(dbf) + 1);
+                CMD_OUTPUT(ctx, "End of LOCATE scope\n");
+            }
+            return;
+        }
+        error_clear();  /* Scan on this thread instead */
+    }
+
+    DBFScan *scan = scan_open_from(dbf, first, ctx->locate_cond, ctx);
+    if (!scan) {
+        error_print();
+        return;
+    }
+
+    while (!dbf_eof(dbf)) {
+        Value v = expr_eval(ctx->locate_cond, &ctx->eval_ctx);
+        bool found = value_to_logical(&v);
+        value_free(&v);
+
+        if (found) {
+            dbf_scan_close(scan);
+            CMD_OUTPUT(ctx, "Record %u\n", dbf_recno(dbf));
+            return;
+        }
+        if (!next_record(dbf, scan)) break;
+    }
+    dbf_scan_close(scan);
+
+    CMD_OUTPUT(ctx, "End of LOCATE scope\n");
+}
+
+/* Execute LOCATE command */
+static void cmd_locate(ASTNode *node, CommandContext *ctx) {
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (!dbf) {
+        error_set(ERR_NO_DATABASE, NULL);
+        error_print();
+        return;
+    }
+
+    /* CONTINUE resumes with the same condition */
+    ast_expr_free(ctx->locate_cond);
+    ctx->locate_cond = node->condition ? ast_expr_clone(node->condition) : ast_expr_logical(true);
+
+    locate_from(dbf, 1, ctx);
+}
+
+/* Execute CONTINUE command */
+static void cmd_continue(ASTNode *node, CommandContext *ctx) {
+    (void)node;
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (!dbf) {
+        error_set(ERR_NO_DATABASE, NULL);
+        error_print();
+        return;
+    }
+    if (!ctx->locate_cond) {
+        error_set(ERR_SYNTAX, "CONTINUE without LOCATE");
+        error_print();
+        return;
+    }
+
+    locate_from(dbf, dbf_recno(dbf) + 1, ctx);
+}
+
+/* Key expression recorded for indexes on anything but a plain field */
+#define INDEX_EXPR_UNKNOWN "(expression)"
+
+/* Store a value as a key of 'xdx' */
+static void index_key_value(XDX *xdx, const Value *val, uint8_t *key) {
+    if (val->type == VAL_NUMBER) {
+        xdx_key_number(xdx, val->data.number, key);
+        return;
+    }
+
+    char buf[256];
+    value_to_string(val, buf, sizeof(buf));
+    xdx_key_text(xdx, buf, key);
+}
+
+/* Key of the current record in 'xdx' */
+static void index_key(XDX *xdx, ASTExpr *key_expr, EvalContext *ctx, uint8_t *key) {
+    Value val = expr_eval(key_expr, ctx);
+    index_key_value(xdx, &val, key);
+    value_free(&val);
+}
+
+/* Parse the key expression an index records; NULL if it has none */
+static ASTExpr *index_key_expr(XDX *xdx) {
+    if (strcmp(xdx_key_expr(xdx), INDEX_EXPR_UNKNOWN) == 0) return NULL;
+
+    Parser p;
+    parser_init(&p, xdx_key_expr(xdx));
+    ASTExpr *key_expr = parser_parse_expr(&p);
+    if (p.had_error) {
+        ast_expr_free(key_expr);
+        key_expr = NULL;
+    }
+    error_clear();
+    return key_expr;
+}
+
+/* Report the keys a unique index left out: those after the first of
+ * equal keys */
+static void report_duplicates(uint32_t duplicates) {
+    if (duplicates == 0) return;
+    error_set(ERR_DUPLICATE_KEY, "%u key(s) left out of unique index", duplicates);
+    error_print();
+    error_clear();
+}
+
+/* Add the keys of records 'first' to RECCOUNT() to every open index, as
+ * one sorted batch per index */
+static void index_appended(DBF *dbf, uint32_t first, CommandContext *ctx) {
+    uint32_t last = dbf_reccount(dbf);
+    if (first > last || ctx->index_count == 0) return;
+
+    uint32_t saved = dbf_recno(dbf);
+
+    for (int i = 0; i < ctx->index_count; i++) {
+        XDX *xdx = ctx->indexes[i];
+        if (!xdx) continue;
+
+        ASTExpr *key_expr = index_key_expr(xdx);
+        if (!key_expr) {
+            CMD_OUTPUT(ctx, "Warning: index on %s not updated\n", xdx_key_expr(xdx));
+            continue;
+        }
+
+        uint16_t key_length = xdx_key_length(xdx);
+        size_t size = key_length + sizeof(uint32_t);
+        uint8_t *entries = xmalloc((size_t)(last - first + 1) * size);
+        uint32_t count = 0;
+
+        for (uint32_t recno = first; recno <= last; recno++) {
+            dbf_goto(dbf, recno);
+            if (dbf_deleted(dbf)) continue;
+
+            uint8_t *entry = entries + (size_t)count++ * size;
+            index_key(xdx, key_expr, &ctx->eval_ctx, entry);
+            memcpy(entry + key_length, &recno, sizeof(uint32_t));
+        }
+
+        uint32_t duplicates;
+        if (xdx_insert_batch(xdx, entries, count, &duplicates)) {
+            report_duplicates(duplicates);
+        } else {
+            error_print();
+        }
+        xfree(entries);
+        ast_expr_free(key_expr);
+    }
+
+    dbf_goto(dbf, saved);
+}
+
+/* Copy one field of the source record into a staged record */
+static void append_copy_field(DBFAppender *ap, uint8_t *record, DBF *dbf, int field,
+                              DBF *src, int src_field) {
+    const DBFField *to = dbf_field_info(dbf, field);
+    const DBFField *from = dbf_field_info(src, src_field);
+
+    if (to->length == from->length && to->decimals == from->decimals) {
+        memcpy(&record[to->offset], &src->record_buffer[from->offset], to->length);
+    } else if (to->type == FIELD_TYPE_NUMERIC) {
+        double value;
+        if (dbf_get_double(src, src_field, &value)) {
+            dbf_appender_put_double(ap, field, value);
+        }
+    } else {
+        char value[256];
+        dbf_get_string(src, src_field, value, sizeof(value));
+        str_trim_right(value);
+        dbf_appender_put_string(ap, field, value);
+    }
+}
+
+/* Execute APPEND FROM ... TYPE DELIMITED|NDJSON */
+static void append_from_text(ASTNode *node, CommandContext *ctx, DBF *dbf,
+                             const char *path, TextFormat format) {
+    if (node->condition || node->while_cond) {
+        error_set(ERR_NOT_IMPLEMENTED, "FOR/WHILE with APPEND FROM ... TYPE %s", node->data.append.type);
+        error_print();
+        return;
+    }
+
+    uint32_t first = dbf_reccount(dbf) + 1;
+    uint32_t appended;
+    bool ok = text_import(dbf, path, format, &appended);
+    if (!ok) error_print();
+
+    index_appended(dbf, first, ctx);
+    CMD_OUTPUT(ctx, "%u record(s) appended\n", appended);
+}
+
+/* Execute APPEND FROM: copy records of another table, matching fields by name */
+static void cmd_append_from(ASTNode *node, CommandContext *ctx, DBF *dbf) {
+    const char *type = node->data.append.type;
+    bool text = type && str_casecmp(type, "DBF") != 0;
+    TextFormat format = TEXT_DELIMITED;
+    if (text && !text_format_from_name(type, &format)) {
+        error_set(ERR_NOT_IMPLEMENTED, "APPEND FROM ... TYPE %s", type);
+        error_print();
+        return;
+    }
+
+    /* Build full path */
+    char path[MAX_PATH_LEN];
+    const char *ext = !text ? ".dbf" : format == TEXT_NDJSON ? ".ndjson" : ".txt";
+    if (!command_path(ctx, node->data.append.filename, ext, path)) {
+        error_print();
+        return;
+    }
+
+    if (text) {
+        append_from_text(node, ctx, dbf, path, format);
+        return;
+    }
+
+    DBF *src = dbf_open(path, true);
+    if (!src) {
+        error_print();
+        return;
+    }
+
+    /* Source field for each target field; -1 when absent or of another type */
+    int field_count = dbf_field_count(dbf);
+    int *src_fields = xmalloc((size_t)field_count * sizeof(int));
+    for (int i = 0; i < field_count; i++) {
+        const DBFField *field = dbf_field_info(dbf, i);
+        int j = dbf_field_index(src, field->name);
+        if (j >= 0 && dbf_field_info(src, j)->type != field->type) j = -1;
+        src_fields[i] = j;
+    }
+
+    uint32_t first = dbf_reccount(dbf) + 1;
+    DBFAppender *ap = dbf_appender_open(dbf, 0);
+    if (!ap) {
+        xfree(src_fields);
+        dbf_close(src);
+        error_print();
+        return;
+    }
+
+    /* FOR and WHILE conditions are evaluated against the source table */
+    ctx->eval_ctx.current_dbf = src;
+
+    bool ok = true;
+    for (dbf_go_top(src); !dbf_eof(src); dbf_skip(src, 1)) {
+        if (!check_conditions(node, ctx, 0)) break;
+        if (!check_for_condition(node, ctx)) continue;
+
+        uint8_t *record = dbf_appender_add(ap);
+        if (!record) {
+            ok = false;
+            break;
+        }
+
+        record[0] = src->record_buffer[0];  /* Keep the deletion mark */
+        for (int i = 0; i < field_count; i++) {
+            if (src_fields[i] >= 0) {
+                append_copy_field(ap, record, dbf, i, src, src_fields[i]);
+            }
+        }
+    }
+
+    ctx->eval_ctx.current_dbf = dbf;
+
+    uint32_t appended = dbf_appender_count(ap);
+    if (!dbf_appender_close(ap)) ok = false;
+    xfree(src_fields);
+    dbf_close(src);
+    index_appended(dbf, first, ctx);
+
+    if (ok) {
+        CMD_OUTPUT(ctx, "%u record(s) appended\n", appended);
+    } else {
+        error_print();
+    }
+}
+
+/* Terms of a condition's top-level .AND. chain */
+static int and_terms(ASTExpr *expr) {
+    if (expr->type == EXPR_BINARY && expr->data.binary.op == TOK_AND) {
+        return and_terms(expr->data.binary.left) + and_terms(expr->data.binary.right);
+    }
+    return 1;
+}
+
+/* FOR condition of a bulk command. When every term of its .AND. chain
+ * compares a field with a constant, records are tested on their field
+ * values directly instead of through the evaluator. */
+typedef struct {
+    ASTNode *node;
+    DBFZoneTest tests[ZONE_TESTS_MAX];
+    int count;
+    bool compiled;
+} RecordFilter;
+
+static void filter_open(RecordFilter *filter, ASTNode *node, CommandContext *ctx) {
+    filter->node = node;
+    filter->count = 0;
+    filter->compiled = false;
+    if (!node->condition) return;
+
+    zone_tests(node->condition, ctx, filter->tests, &filter->count);
+    filter->compiled = filter->count == and_terms(node->condition);
+
+    /* Character matches only rule records out; the evaluator decides */
+    for (int i = 0; i < filter->count; i++) {
+        if (filter->tests[i].op == DBF_ZONE_MATCH) filter->compiled = false;
+    }
+}
+
+static bool filter_pass(RecordFilter *filter, CommandContext *ctx) {
+    if (filter->compiled) {
+        return dbf_test_record(ctx->eval_ctx.current_dbf, filter->tests, filter->count);
+    }
+    return check_for_condition(filter->node, ctx);
+}
+
+static void filter_close(RecordFilter *filter) {
+    for (int i = 0; i < filter->count; i++) {
+        xfree((char *)filter->tests[i].text);
+    }
+}
+
+/* Output of COPY TO, taking record images laid out as its fields say */
+typedef enum {
+    COPY_DBF,
+    COPY_XCOL,
+    COPY_DELIMITED,
+    COPY_NDJSON
+} CopyType;
+
+typedef struct {
+    CopyType type;
+    DBF *dbf;
+    DBFAppender *appender;
+    XColWriter *xcol;
+    TextWriter *text;
+} CopySink;
+
+/* Bytes of records a DBF copy stages before each write */
+#define COPY_BATCH_BYTES ((size_t)8 << 20)
+
+static bool sink_open(CopySink *sink, const char *path, const DBFField *fields, int count) {
+    switch (sink->type) {
+        case COPY_DBF: {
+            sink->dbf = dbf_create(path, fields, count);
+            if (!sink->dbf) return false;
+            uint32_t batch = (uint32_t)(COPY_BATCH_BYTES / sink->dbf->header.record_size);
+            sink->appender = dbf_appender_open(sink->dbf, batch);
+            if (sink->appender) return true;
+            dbf_close(sink->dbf);
+            remove(path);
+            return false;
+        }
+        case COPY_XCOL:
+            sink->xcol = xcol_create(path, fields, count);
+            return sink->xcol != NULL;
+        case COPY_DELIMITED:
+        case COPY_NDJSON:
+            sink->text = text_writer_create(path, sink->type == COPY_NDJSON ? TEXT_NDJSON : TEXT_DELIMITED,
+                                            fields, count);
+            return sink->text != NULL;
+    }
+    return false;
+}
+
+static bool sink_write(CopySink *sink, const uint8_t *record, uint16_t size) {
+    switch (sink->type) {
+        case COPY_DBF: {
+            uint8_t *slot = dbf_appender_add(sink->appender);
+            if (!slot) return false;
+            memcpy(slot, record, size);
+            return true;
+        }
+        case COPY_XCOL:
+            return xcol_write(sink->xcol, record);
+        case COPY_DELIMITED:
+        case COPY_NDJSON:
+            return text_writer_add(sink->text, record);
+    }
+    return false;
+}
+
+/* Finish the file, or remove it when 'ok' is false or finishing fails */
+static bool sink_close(CopySink *sink, const char *path, bool ok, uint32_t *copied) {
+    switch (sink->type) {
+        case COPY_DBF:
+            *copied = dbf_appender_count(sink->appender);
+            ok = dbf_appender_close(sink->appender) && ok;
+            ok = dbf_close(sink->dbf) && ok;
+            if (!ok) remove(path);
+            return ok;
+        case COPY_XCOL:
+            *copied = xcol_written(sink->xcol);
+            if (ok) return xcol_finish(sink->xcol);
+            xcol_discard(sink->xcol);
+            return false;
+        case COPY_DELIMITED:
+        case COPY_NDJSON:
+            *copied = text_writer_written(sink->text);
+            if (ok) return text_writer_finish(sink->text);
+            text_writer_discard(sink->text);
+            return false;
+    }
+    return false;
+}
+
+/* Image of the current record with fields 'src' laid out as 'fields' */
+static void project_record(DBF *dbf, const int *src, const DBFField *fields, int count,
+                           uint8_t *record) {
+    record[0] = dbf_deleted(dbf) ? DBF_RECORD_DELETED : DBF_RECORD_ACTIVE;
+    for (int i = 0; i < count; i++) {
+        const uint8_t *value;
+        size_t len;
+        if (dbf_field_view(dbf, src[i], &value, &len)) {
+            memcpy(&record[fields[i].offset], value, len);
+        } else {
+            memset(&record[fields[i].offset], ' ', fields[i].length);
+        }
+    }
+}
+
+/* Whether two paths name the same file */
+static bool same_file(const char *a, const char *b) {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+           sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/* Execute COPY TO: write the records in scope to a new file. Records
+ * stream from the scan through the FOR filter and the field projection
+ * into a buffered writer; a whole DBF copied to DBF is copied as blocks
+ * of the file. */
+static void cmd_copy(ASTNode *node, CommandContext *ctx) {
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (!dbf) {
+        error_set(ERR_NO_DATABASE, NULL);
+        error_print();
+        return;
+    }
+
+    CopySink sink;
+    memset(&sink, 0, sizeof(sink));
+    const char *type = node->data.copy.type;
+    const char *ext = ".dbf";
+    TextFormat format;
+    if (!type || str_casecmp(type, "DBF") == 0) {
+        sink.type = COPY_DBF;
+    } else if (str_casecmp(type, "XCOL") == 0) {
+        sink.type = COPY_XCOL;
+        ext = ".xcol";
+    } else if (text_format_from_name(type, &format)) {
+        sink.type = format == TEXT_NDJSON ? COPY_NDJSON : COPY_DELIMITED;
+        ext = format == TEXT_NDJSON ? ".ndjson" : ".txt";
+    } else {
+        error_set(ERR_NOT_IMPLEMENTED, "COPY TO ... TYPE %s", type);
+        error_print();
+        return;
+    }
+
+    if (!node->data.copy.filename) {
+        error_set(ERR_SYNTAX, "Expected file name in COPY command");
+        error_print();
+        return;
+    }
+
+    /* Build full path */
+    char path[MAX_PATH_LEN];
+    if (!command_path(ctx, node->data.copy.filename, ext, path)) {
+        error_print();
+        return;
+    }
+
+    if (same_file(path, dbf->filename)) {
+        error_set(ERR_FILE_CREATE, "%s is the table being copied", path);
+        error_print();
+        return;
+    }
+
+    /* Fields copied, in the order given (every field by default) */
+    int count = node->data.copy.field_count > 0 ? node->data.copy.field_count : dbf_field_count(dbf);
+    int *src = xmalloc(sizeof(int) * (size_t)count);
+    DBFField *fields = xmalloc(sizeof(DBFField) * (size_t)count);
+    uint16_t size = 1;
+    bool identity = count == dbf_field_count(dbf);
+
+    for (int i = 0; i < count; i++) {
+        src[i] = node->data.copy.field_count > 0 ?
+                 dbf_field_index(dbf, node->data.copy.fields[i]) : i;
+        if (src[i] < 0) {
+            error_set(ERR_INVALID_FIELD, "Field not found: %s", node->data.copy.fields[i]);
+            error_print();
+            xfree(src);
+            xfree(fields);
+            return;
+        }
+        if (src[i] != i) identity = false;
+        fields[i] = *dbf_field_info(dbf, src[i]);
+        fields[i].offset = size;
+        size = (uint16_t)(size + fields[i].length);
+    }
+
+    /* Every record of the file, unchanged: copy the file itself */
+    if (sink.type == COPY_DBF && identity && node->scope.type == SCOPE_ALL &&
+        !node->condition && !node->while_cond && !dbf_is_snapshot(dbf) &&
+        (!dbf_get_skip_deleted() || dbf_deleted_count(dbf) == 0)) {
+        xfree(src);
+        xfree(fields);
+        if (dbf_copy_file(dbf, path)) {
+            CMD_OUTPUT(ctx, "%u record(s) copied\n", dbf_reccount(dbf));
+        } else {
+            error_print();
+        }
+        return;
+    }
+
+    if (!sink_open(&sink, path, fields, count)) {
+        error_print();
+        xfree(src);
+        xfree(fields);
+        return;
+    }
+    DBFScan *scan = scan_open(dbf, node, ctx);
+    if (!scan) {
+        uint32_t none;
+        error_print();
+        sink_close(&sink, path, false, &none);
+        xfree(src);
+        xfree(fields);
+        return;
+    }
+
+    RecordFilter filter;
+    filter_open(&filter, node, ctx);
+    uint8_t *record = xmalloc(size);
+    uint32_t processed = 0;
+    bool ok = true;
+
+    while (!dbf_eof(dbf)) {
+        if (!check_conditions(node, ctx, processed)) break;
+
+        if (filter_pass(&filter, ctx)) {
+            project_record(dbf, src, fields, count, record);
+            if (!sink_write(&sink, record, size)) {
+                ok = false;
+                break;
+            }
+        }
+        processed++;
+        if (!next_record(dbf, scan)) break;
+    }
+    dbf_scan_close(scan);
+    filter_close(&filter);
+
+    uint32_t copied;
+    ok = sink_close(&sink, path, ok, &copied);
+    xfree(record);
+    xfree(src);
+    xfree(fields);
+
+    if (ok) {
+        CMD_OUTPUT(ctx, "%u record(s) copied\n", copied);
+    } else {
+        error_print();
+    }
+}
+
+/* Execute SORT: write the records in scope to a new table in key order */
+static void cmd_sort(ASTNode *node, CommandContext *ctx) {
     DBF *dbf = ctx->eval_ctx.current_dbf;
     if (!dbf) {
         error_set(ERR_NO_DATABASE, NULL);
@@ -457,60 +1349,115 @@ static void cmd_skip(ASTNode *node, CommandContext *ctx) {
         return;
     }
 
-    int count = 1;
-    if (node->data.skip.count) {
-        Value v = expr_eval(node->data.skip.count, &ctx->eval_ctx);
-        count = (int)value_to_number(&v);
-        value_free(&v);
+    if (!node->data.copy.filename) {
+        error_set(ERR_SYNTAX, "Expected TO <file> in SORT command");
+        error_print();
+        return;
+    }
+    if (node->data.copy.field_count == 0) {
+        error_set(ERR_SYNTAX, "Expected ON <field> in SORT command");
+        error_print();
+        return;
+    }
+    if (node->data.copy.field_count > SORT_MAX_KEYS) {
+        error_set(ERR_SYNTAX, "SORT takes at most %d key fields", SORT_MAX_KEYS);
+        error_print();
+        return;
     }
 
-    dbf_skip(dbf, count);
-}
-
-/* Execute LOCATE command */
-static void cmd_locate(ASTNode *node, CommandContext *ctx) {
-    DBF *dbf = ctx->eval_ctx.current_dbf;
-    if (!dbf) {
-        error_set(ERR_NO_DATABASE, NULL);
+    /* Build full path */
+    char path[MAX_PATH_LEN];
+    if (!command_path(ctx, node->data.copy.filename, ".dbf", path)) {
         error_print();
         return;
     }
 
-    dbf_go_top(dbf);
+    if (same_file(path, dbf->filename)) {
+        error_set(ERR_FILE_CREATE, "%s is the table being sorted", path);
+        error_print();
+        return;
+    }
 
-    while (!dbf_eof(dbf)) {
-        if (check_for_condition(node, ctx)) {
-            CMD_OUTPUT(ctx, "Record %u\n", dbf_recno(dbf));
+    SortKey keys[SORT_MAX_KEYS];
+    for (int i = 0; i < node->data.copy.field_count; i++) {
+        keys[i].field = dbf_field_index(dbf, node->data.copy.fields[i]);
+        if (keys[i].field < 0) {
+            error_set(ERR_INVALID_FIELD, "Field not found: %s", node->data.copy.fields[i]);
+            error_print();
             return;
         }
-        dbf_skip(dbf, 1);
+        if (dbf_field_info(dbf, keys[i].field)->type == FIELD_TYPE_MEMO) {
+            error_set(ERR_TYPE_MISMATCH, "Cannot sort on memo field %s", node->data.copy.fields[i]);
+            error_print();
+            return;
+        }
+        keys[i].descending = (node->data.copy.options[i] & SORT_DESCENDING) != 0;
+        keys[i].nocase = (node->data.copy.options[i] & SORT_NOCASE) != 0;
     }
 
-    CMD_OUTPUT(ctx, "End of LOCATE scope\n");
-}
+    /* The new table has every field of the old one */
+    int count = dbf_field_count(dbf);
+    int *src = xmalloc(sizeof(int) * (size_t)count);
+    DBFField *fields = xmalloc(sizeof(DBFField) * (size_t)count);
+    uint16_t size = 1;
+    for (int i = 0; i < count; i++) {
+        src[i] = i;
+        fields[i] = *dbf_field_info(dbf, i);
+        fields[i].offset = size;
+        size = (uint16_t)(size + fields[i].length);
+    }
 
-/* Execute CONTINUE command */
-static void cmd_continue(ASTNode *node, CommandContext *ctx) {
-    (void)node;
-    DBF *dbf = ctx->eval_ctx.current_dbf;
-    if (!dbf) {
-        error_set(ERR_NO_DATABASE, NULL);
+    Sorter *sorter = sorter_create(path, fields, count, keys, node->data.copy.field_count, 0);
+    DBFScan *scan = sorter ? scan_open(dbf, node, ctx) : NULL;
+    if (!scan) {
         error_print();
+        sorter_discard(sorter);
+        xfree(src);
+        xfree(fields);
         return;
     }
 
-    /* Continue from next record - simplified (should remember LOCATE condition) */
-    dbf_skip(dbf, 1);
-    if (dbf_eof(dbf)) {
-        CMD_OUTPUT(ctx, "End of LOCATE scope\n");
+    RecordFilter filter;
+    filter_open(&filter, node, ctx);
+    uint8_t *record = xmalloc(size);
+    uint32_t processed = 0;
+    bool ok = true;
+
+    while (!dbf_eof(dbf)) {
+        if (!check_conditions(node, ctx, processed)) break;
+
+        if (filter_pass(&filter, ctx)) {
+            project_record(dbf, src, fields, count, record);
+            if (!sorter_add(sorter, record)) {
+                ok = false;
+                break;
+            }
+        }
+        processed++;
+        if (!next_record(dbf, scan)) break;
+    }
+    dbf_scan_close(scan);
+    filter_close(&filter);
+
+    uint32_t sorted = sorter_count(sorter);
+    if (ok) {
+        ok = sorter_finish(sorter);
+    } else {
+        sorter_discard(sorter);
+    }
+    xfree(record);
+    xfree(src);
+    xfree(fields);
+
+    if (ok) {
+        CMD_OUTPUT(ctx, "%u record(s) sorted\n", sorted);
     } else {
-        CMD_OUTPUT(ctx, "Record %u\n", dbf_recno(dbf));
+        error_print();
     }
 }
 
 /* Execute APPEND command */
 static void cmd_append(ASTNode *node, CommandContext *ctx) {
-    (void)node;
     DBF *dbf = ctx->eval_ctx.current_dbf;
     if (!dbf) {
         error_set(ERR_NO_DATABASE, NULL);
@@ -518,6 +1465,11 @@ static void cmd_append(ASTNode *node, CommandContext *ctx) {
         return;
     }
 
+    if (node->data.append.filename) {
+        cmd_append_from(node, ctx, dbf);
+        return;
+    }
+
     if (dbf_append_blank(dbf)) {
         CMD_OUTPUT(ctx, "Record %u appended\n", dbf_recno(dbf));
     } else {
@@ -609,9 +1561,35 @@ static void cmd_recall(ASTNode *node, CommandContext *ctx) {
     CMD_OUTPUT(ctx, "%u record(s) recalled\n", recalled);
 }
 
+/* PACK ONLINE: copy with the context unlocked so that other requests keep
+ * running, then relock to catch up, switch files and renumber indexes */
+static bool pack_online(CommandContext *ctx, DBF *dbf, DBFPackStats *stats) {
+    DBFPack *pack = dbf_pack_begin(dbf);
+    if (!pack) return false;
+
+    bool unlocked = ctx->lock_held;
+    if (unlocked) cmd_unlock(ctx);
+    bool ok = dbf_pack_copy(pack);
+    if (unlocked) cmd_lock(ctx);
+
+    ok = ok && dbf_pack_finish(pack, stats);
+
+    uint32_t count = 0;
+    const uint32_t *map = ok ? dbf_pack_map(pack, &count) : NULL;
+    for (int i = 0; map && i < ctx->index_count; i++) {
+        if (ctx->indexes[i] && !xdx_remap(ctx->indexes[i], map, count)) ok = false;
+    }
+
+    dbf_pack_free(pack);
+    return ok;
+}
+
 /* Execute PACK command */
 static void cmd_pack(ASTNode *node, CommandContext *ctx) {
-    (void)node;
+    /* An offline PACK moves records under readers of the file; other
+     * requests may run while it waits, so the table is looked up after */
+    if (!node->data.pack.online) wait_for_readers(ctx);
+
     DBF *dbf = ctx->eval_ctx.current_dbf;
     if (!dbf) {
         error_set(ERR_NO_DATABASE, NULL);
@@ -619,10 +1597,16 @@ static void cmd_pack(ASTNode *node, CommandContext *ctx) {
         return;
     }
 
-    uint32_t before = dbf_reccount(dbf);
-    if (dbf_pack(dbf)) {
-        uint32_t after = dbf_reccount(dbf);
-        CMD_OUTPUT(ctx, "%u record(s) removed, %u remain\n", before - after, after);
+    DBFPackStats stats;
+    bool ok = node->data.pack.online ? pack_online(ctx, dbf, &stats)
+                                     : dbf_pack_stats(dbf, &stats);
+    if (ok) {
+        double seconds = (double)stats.elapsed_us / 1e6;
+        CMD_OUTPUT(ctx, "%u record(s) removed, %u remain\n",
+                   stats.scanned - stats.kept, stats.kept);
+        CMD_OUTPUT(ctx, "%u record(s) scanned in %.3f s (%.0f records/sec)\n",
+                   stats.scanned, seconds,
+                   seconds > 0 ? (double)stats.scanned / seconds : 0.0);
     } else {
         error_print();
     }
@@ -631,6 +1615,8 @@ static void cmd_pack(ASTNode *node, CommandContext *ctx) {
 /* Execute ZAP command */
 static void cmd_zap(ASTNode *node, CommandContext *ctx) {
     (void)node;
+    wait_for_readers(ctx);
+
     DBF *dbf = ctx->eval_ctx.current_dbf;
     if (!dbf) {
         error_set(ERR_NO_DATABASE, NULL);
@@ -646,28 +1632,78 @@ static void cmd_zap(ASTNode *node, CommandContext *ctx) {
     }
 }
 
-/* Helper: evaluate key expression and store in buffer */
+/* Keys extracted by one worker of a parallel index build */
+typedef struct {
+    XDXBuildPart *part;
+    bool failed;
+    uint8_t key[XDX_MAX_KEY_LEN];
+} IndexPartial;
+
 typedef struct {
+    XDX *xdx;
+    XDXBuild *build;
     ASTExpr *key_expr;
-    EvalContext *eval_ctx;
-} KeyEvalContext;
+} IndexTask;
 
-static bool eval_key_for_reindex(DBF *dbf, void *key, void *ctx) {
-    (void)dbf;
-    KeyEvalContext *kctx = (KeyEvalContext *)ctx;
+static void index_visit(EvalContext *ctx, void *partial, void *arg) {
+    IndexPartial *ip = partial;
+    IndexTask *task = arg;
+    if (ip->failed || dbf_reader_deleted(ctx->reader)) return;
 
-    Value val = expr_eval(kctx->key_expr, kctx->eval_ctx);
-    if (val.type == VAL_NIL) {
-        value_free(&val);
-        return false;
+    if (!ip->part) ip->part = xdx_build_part(task->build);
+    index_key(task->xdx, task->key_expr, ctx, ip->key);
+    if (!xdx_build_part_add(ip->part, ip->key, dbf_reader_recno(ctx->reader))) ip->failed = true;
+}
+
+/* Rebuild 'xdx' from the keys of every record not deleted. With SET
+ * PARALLEL, workers extract and sort keys from morsels of the table, each
+ * through its own reader. */
+static bool build_index(XDX *xdx, DBF *dbf, ASTExpr *key_expr, CommandContext *ctx,
+                        uint32_t *keys, uint32_t *duplicates) {
+    if (scan_parallel(dbf, NULL)) {
+        XDXBuild *build = xdx_build_begin(xdx, 0, parallel_get_threads());
+        if (!build) return false;
+
+        IndexTask task = {xdx, build, key_expr};
+        ParallelTask scan = {sizeof(IndexPartial), index_visit, &task, false};
+        void *partials;
+        int workers;
+        if (parallel_scan(dbf, 1, NULL, &scan, &partials, &workers, NULL)) {
+            bool failed = false;
+            for (int i = 0; i < workers; i++) {
+                if (((IndexPartial *)partials)[i].failed) failed = true;
+            }
+            xfree(partials);
+            if (failed) {
+                xdx_build_discard(build);
+                return false;
+            }
+            return xdx_build_finish(build, keys, duplicates);
+        }
+        xdx_build_discard(build);
+        error_clear();  /* Scan on this thread instead */
     }
 
-    char buf[256];
-    value_to_string(&val, buf, sizeof(buf));
-    memcpy(key, buf, strlen(buf));
+    XDXBuild *build = xdx_build_begin(xdx, 0, 1);
+    if (!build) return false;
 
-    value_free(&val);
-    return true;
+    bool ok = true;
+    uint8_t *key = xcalloc(1, xdx_key_length(xdx));
+    dbf_go_top(dbf);
+    while (ok && !dbf_eof(dbf)) {
+        if (!dbf_deleted(dbf)) {
+            index_key(xdx, key_expr, &ctx->eval_ctx, key);
+            ok = xdx_build_add(build, key, dbf_recno(dbf));
+        }
+        dbf_skip(dbf, 1);
+    }
+    free(key);
+
+    if (!ok) {
+        xdx_build_discard(build);
+        return false;
+    }
+    return xdx_build_finish(build, keys, duplicates);
 }
 
 /* Execute INDEX ON command */
@@ -693,16 +1729,9 @@ static void cmd_index(ASTNode *node, CommandContext *ctx) {
 
     /* Build full path */
     char path[MAX_PATH_LEN];
-    const char *filename = node->data.index.filename;
-    if (filename[0] == '/' || strstr(filename, ":") != NULL) {
-        strncpy(path, filename, MAX_PATH_LEN - 1);
-    } else {
-        snprintf(path, MAX_PATH_LEN, "%s/%s", ctx->current_path, filename);
-    }
-
-    /* Add .xdx extension if missing */
-    if (!file_extension(path)) {
-        strcat(path, ".xdx");
+    if (!command_path(ctx, node->data.index.filename, ".xdx", path)) {
+        error_print();
+        return;
     }
 
     /* Determine key type and length by evaluating on first record */
@@ -716,11 +1745,11 @@ static void cmd_index(ASTNode *node, CommandContext *ctx) {
         switch (val.type) {
             case VAL_NUMBER:
                 key_type = XDX_KEY_NUMERIC;
-                key_length = 20;  /* Enough for double as string */
+                key_length = XDX_NUMBER_KEY_LEN;
                 break;
             case VAL_DATE:
                 key_type = XDX_KEY_DATE;
-                key_length = 8;
+                key_length = XDX_DATE_KEY_LEN;
                 break;
             case VAL_STRING:
                 key_type = XDX_KEY_CHAR;
@@ -748,7 +1777,7 @@ static void cmd_index(ASTNode *node, CommandContext *ctx) {
         strncpy(key_expr_str, node->data.index.key_expr->data.field_ref.field,
                 XDX_MAX_EXPR_LEN - 1);
     } else {
-        strcpy(key_expr_str, "(expression)");
+        strcpy(key_expr_str, INDEX_EXPR_UNKNOWN);
     }
 
     /* Create the index */
@@ -760,40 +1789,13 @@ static void cmd_index(ASTNode *node, CommandContext *ctx) {
         return;
     }
 
-    /* Build index from all records */
-    uint32_t indexed = 0;
-    uint8_t *key_buffer = xcalloc(1, key_length);
-
-    dbf_go_top(dbf);
-    while (!dbf_eof(dbf)) {
-        if (!dbf_deleted(dbf)) {
-            /* Evaluate key expression */
-            Value val = expr_eval(node->data.index.key_expr, &ctx->eval_ctx);
-            memset(key_buffer, ' ', key_length);
-
-            char buf[256];
-            value_to_string(&val, buf, sizeof(buf));
-            size_t len = strlen(buf);
-            if (len > key_length) len = key_length;
-            memcpy(key_buffer, buf, len);
-
-            value_free(&val);
-
-            /* Insert into index */
-            if (xdx_insert(xdx, key_buffer, dbf_recno(dbf))) {
-                indexed++;
-            } else {
-                /* Duplicate key error for unique index */
-                if (node->data.index.unique) {
-                    error_print();
-                    error_clear();
-                }
-            }
-        }
-        dbf_skip(dbf, 1);
+    uint32_t indexed = 0, duplicates = 0;
+    if (!build_index(xdx, dbf, node->data.index.key_expr, ctx, &indexed, &duplicates)) {
+        error_print();
+        xdx_close(xdx);
+        return;
     }
-
-    free(key_buffer);
+    report_duplicates(duplicates);
 
     /* Add to open indexes */
     if (ctx->index_count < MAX_INDEXES) {
@@ -817,16 +1819,9 @@ static void cmd_set_index(ASTNode *node, CommandContext *ctx) {
 
     /* Build full path */
     char path[MAX_PATH_LEN];
-    const char *filename = node->data.index.filename;
-    if (filename[0] == '/' || strstr(filename, ":") != NULL) {
-        strncpy(path, filename, MAX_PATH_LEN - 1);
-    } else {
-        snprintf(path, MAX_PATH_LEN, "%s/%s", ctx->current_path, filename);
-    }
-
-    /* Add .xdx extension if missing */
-    if (!file_extension(path)) {
-        strcat(path, ".xdx");
+    if (!command_path(ctx, node->data.index.filename, ".xdx", path)) {
+        error_print();
+        return;
     }
 
     /* Open the index */
@@ -871,16 +1866,8 @@ static void cmd_seek(ASTNode *node, CommandContext *ctx) {
     Value val = expr_eval(node->data.seek.key, &ctx->eval_ctx);
 
     /* Convert to key format */
-    uint16_t key_len = xdx_key_length(xdx);
-    uint8_t *key_buffer = xcalloc(1, key_len);
-    memset(key_buffer, ' ', key_len);
-
-    char buf[256];
-    value_to_string(&val, buf, sizeof(buf));
-    size_t len = strlen(buf);
-    if (len > key_len) len = key_len;
-    memcpy(key_buffer, buf, len);
-
+    uint8_t *key_buffer = xcalloc(1, xdx_key_length(xdx));
+    index_key_value(xdx, &val, key_buffer);
     value_free(&val);
 
     /* Seek in index */
@@ -921,15 +1908,28 @@ static void cmd_reindex(ASTNode *node, CommandContext *ctx) {
 
     CMD_OUTPUT(ctx, "Rebuilding %d index(es)...\n", ctx->index_count);
 
-    /* Note: Full reindex would need to re-evaluate the key expression
-       for each record. For now, we just report that it would be done. */
+    /* Rebuilt indexes are written in the current file format */
+    uint32_t saved = dbf_recno(dbf);
     for (int i = 0; i < ctx->index_count; i++) {
         XDX *xdx = ctx->indexes[i];
-        if (xdx) {
-            CMD_OUTPUT(ctx, "  Reindexing %s...\n", xdx_key_expr(xdx));
-            /* Would call xdx_reindex here with proper key evaluator */
+        if (!xdx) continue;
+
+        ASTExpr *key_expr = index_key_expr(xdx);
+        if (!key_expr) {
+            CMD_OUTPUT(ctx, "  Cannot rebuild index on %s\n", xdx_key_expr(xdx));
+            continue;
+        }
+
+        CMD_OUTPUT(ctx, "  Reindexing %s...\n", xdx_key_expr(xdx));
+        uint32_t duplicates = 0;
+        if (build_index(xdx, dbf, key_expr, ctx, NULL, &duplicates)) {
+            report_duplicates(duplicates);
+        } else {
+            error_print();
         }
+        ast_expr_free(key_expr);
     }
+    dbf_goto(dbf, saved);
 
     CMD_OUTPUT(ctx, "Reindex complete\n");
 }
@@ -960,6 +1960,117 @@ static void cmd_set_order(ASTNode *node, CommandContext *ctx) {
     }
 }
 
+/* Execute SET BUFFERS [TO <MB>] */
+static void cmd_set_buffers(ASTNode *node, CommandContext *ctx) {
+    if (node->data.set.value) {
+        Value val = expr_eval(node->data.set.value, &ctx->eval_ctx);
+        double mb = value_to_number(&val);
+        value_free(&val);
+
+        /* Checked before scaling so the byte count cannot overflow */
+        if (!(mb >= 1 && mb <= BUFPOOL_MAX_MB) || mb > (double)(SIZE_MAX >> 20)) {
+            CMD_OUTPUT(ctx, "Invalid buffer size: use 1 to %d MB\n", BUFPOOL_MAX_MB);
+            return;
+        }
+        bufpool_set_budget((size_t)mb * 1024 * 1024);
+    }
+
+    BufPoolStats stats;
+    bufpool_get_stats(&stats);
+
+    uint64_t requests = stats.hits + stats.misses;
+    CMD_OUTPUT(ctx, "Buffers: %zu MB, %u pages resident (%u dirty), %.1f%% hit rate\n",
+               stats.budget / (1024 * 1024), stats.pages, stats.dirty,
+               requests ? 100.0 * (double)stats.hits / (double)requests : 0.0);
+}
+
+/* Execute SET BLOOM ON <field> / SET BLOOM OFF [<field>] */
+static void cmd_set_bloom(ASTNode *node, CommandContext *ctx) {
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (!dbf) {
+        error_set(ERR_NO_DATABASE, NULL);
+        error_print();
+        return;
+    }
+
+    ASTExpr *value = node->data.set.value;
+    const char *name = value && value->type == EXPR_IDENT ? value->data.ident : NULL;
+    int field = name ? dbf_field_index(dbf, name) : -1;
+    if (name && field < 0) {
+        error_set(ERR_INVALID_FIELD, "%s", name);
+        error_print();
+        return;
+    }
+
+    if (!node->data.set.on) {
+        dbf_bloom_drop(dbf, field);
+        CMD_OUTPUT(ctx, name ? "Bloom filter off\n" : "Bloom filters off\n");
+        return;
+    }
+
+    if (!name) {
+        CMD_OUTPUT(ctx, "Usage: SET BLOOM ON <field>\n");
+        return;
+    }
+    if (!dbf_bloom_add(dbf, field)) {
+        error_print();
+        return;
+    }
+    CMD_OUTPUT(ctx, "Bloom filter on %s\n", dbf_field_info(dbf, field)->name);
+}
+
+/* Execute SET DURABILITY [TO NONE|BATCH|FULL] */
+static void cmd_set_durability(ASTNode *node, CommandContext *ctx) {
+    ASTExpr *value = node->data.set.value;
+
+    if (value) {
+        const char *mode = NULL;
+        if (value->type == EXPR_IDENT) {
+            mode = value->data.ident;
+        } else if (value->type == EXPR_STRING) {
+            mode = value->data.string;
+        }
+
+        if (mode && strcasecmp(mode, "NONE") == 0) {
+            dbf_set_durability(DBF_DURABILITY_NONE);
+        } else if (mode && strcasecmp(mode, "BATCH") == 0) {
+            dbf_set_durability(DBF_DURABILITY_BATCH);
+        } else if (mode && strcasecmp(mode, "FULL") == 0) {
+            dbf_set_durability(DBF_DURABILITY_FULL);
+        } else {
+            CMD_OUTPUT(ctx, "Invalid durability: use NONE, BATCH or FULL\n");
+            return;
+        }
+
+        /* Changes made under the old mode are committed under the new one */
+        DBF *dbf = ctx->eval_ctx.current_dbf;
+        if (dbf && !dbf_commit(dbf)) {
+            error_print();
+        }
+    }
+
+    CMD_OUTPUT(ctx, "Durability: %s, %llu sync(s)\n",
+               dbf_durability_name(dbf_get_durability()),
+               (unsigned long long)dbf_sync_count());
+}
+
+/* Execute SET PARALLEL [TO <n>]; 0 uses one thread per CPU */
+static void cmd_set_parallel(ASTNode *node, CommandContext *ctx) {
+    if (node->data.set.value) {
+        Value val = expr_eval(node->data.set.value, &ctx->eval_ctx);
+        double threads = value_to_number(&val);
+        value_free(&val);
+
+        if (threads < 0) {
+            CMD_OUTPUT(ctx, "Invalid thread count: must be 0 or more\n");
+            return;
+        }
+        parallel_set_threads(threads > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : (int)threads);
+    }
+
+    CMD_OUTPUT(ctx, "Parallel scans: %d thread(s)\n", parallel_get_threads());
+}
+
 /* Execute REPLACE command */
 static void cmd_replace(ASTNode *node, CommandContext *ctx) {
     DBF *dbf = ctx->eval_ctx.current_dbf;
@@ -1079,6 +2190,36 @@ static void cmd_set(ASTNode *node, CommandContext *ctx) {
         return;
     }
 
+    /* Handle SET BUFFERS TO <MB> */
+    if (strcasecmp(option, "BUFFERS") == 0) {
+        cmd_set_buffers(node, ctx);
+        return;
+    }
+
+    /* Handle SET DELETED ON|OFF */
+    if (strcasecmp(option, "DELETED") == 0) {
+        dbf_set_skip_deleted(node->data.set.on);
+        return;
+    }
+
+    /* Handle SET BLOOM ON|OFF <field> */
+    if (strcasecmp(option, "BLOOM") == 0) {
+        cmd_set_bloom(node, ctx);
+        return;
+    }
+
+    /* Handle SET DURABILITY TO NONE|BATCH|FULL */
+    if (strcasecmp(option, "DURABILITY") == 0) {
+        cmd_set_durability(node, ctx);
+        return;
+    }
+
+    /* Handle SET PARALLEL TO <n> */
+    if (strcasecmp(option, "PARALLEL") == 0) {
+        cmd_set_parallel(node, ctx);
+        return;
+    }
+
     /* Basic SET handling - many options not implemented */
     CMD_OUTPUT(ctx, "SET %s", option);
     if (node->data.set.value) {
@@ -1164,6 +2305,13 @@ static void cmd_wait(ASTNode *node, CommandContext *ctx) {
     CMD_OUTPUT(ctx, "\n");
 }
 
+/* Partial result of a parallel COUNT */
+static void count_visit(EvalContext *ctx, void *partial, void *arg) {
+    (void)ctx;
+    (void)arg;
+    (*(uint32_t *)partial)++;
+}
+
 /* Execute COUNT command */
 static void cmd_count(ASTNode *node, CommandContext *ctx) {
     DBF *dbf = ctx->eval_ctx.current_dbf;
@@ -1173,9 +2321,28 @@ static void cmd_count(ASTNode *node, CommandContext *ctx) {
         return;
     }
 
-    dbf_go_top(dbf);
     uint32_t count = 0;
     uint32_t processed = 0;
+    DBFScan *scan = NULL;
+    ParallelTask task = {sizeof(uint32_t), count_visit, NULL, false};
+    void *partials;
+    int workers;
+
+    /* A plain COUNT is answered from the deleted bitmap */
+    if (node->scope.type == SCOPE_ALL && !node->condition && !node->while_cond) {
+        count = dbf_get_skip_deleted() ? dbf_active_count(dbf) : dbf_reccount(dbf);
+        dbf_goto(dbf, dbf_reccount(dbf) + 1);
+    } else if (scan_parallel(dbf, node) &&
+               parallel_scan(dbf, 1, node->condition, &task, &partials, &workers, NULL)) {
+        for (int i = 0; i < workers; i++) {
+            count += ((uint32_t *)partials)[i];
+        }
+        xfree(partials);
+        dbf_goto(dbf, dbf_reccount(dbf) + 1);
+    } else if (!(scan = scan_open(dbf, node, ctx))) {
+        error_print();
+        return;
+    }
 
     while (!dbf_eof(dbf)) {
         if (!check_conditions(node, ctx, processed)) break;
@@ -1184,8 +2351,9 @@ static void cmd_count(ASTNode *node, CommandContext *ctx) {
             count++;
         }
         processed++;
-        dbf_skip(dbf, 1);
+        if (!next_record(dbf, scan)) break;
     }
+    dbf_scan_close(scan);
 
     CMD_OUTPUT(ctx, "%u record(s)\n", count);
 
@@ -1197,6 +2365,104 @@ static void cmd_count(ASTNode *node, CommandContext *ctx) {
     }
 }
 
+/* Expressions of a SUM/AVERAGE */
+typedef struct {
+    ASTExpr **exprs;
+    int count;
+} SumTask;
+
+/* Add a record to a partial result: records, then one sum per expression */
+static void sum_visit(EvalContext *ctx, void *partial, void *arg) {
+    SumTask *t = arg;
+    double *sums = partial;
+    sums[0]++;
+    for (int i = 0; i < t->count; i++) {
+        Value v = expr_eval(t->exprs[i], ctx);
+        sums[i + 1] += value_to_number(&v);
+        value_free(&v);
+    }
+}
+
+/* Execute SUM/AVERAGE: total (or mean) of each expression over the
+ * records in scope; without expressions, of every numeric field */
+static void cmd_sum(ASTNode *node, CommandContext *ctx, bool average) {
+    DBF *dbf = ctx->eval_ctx.current_dbf;
+    if (!dbf) {
+        error_set(ERR_NO_DATABASE, NULL);
+        error_print();
+        return;
+    }
+
+    SumTask t = {node->data.aggregate.exprs, node->data.aggregate.count};
+    ASTExpr *fields[MAX_FIELDS];
+    if (t.count == 0) {
+        for (int i = 0; i < dbf_field_count(dbf); i++) {
+            if (dbf_field_info(dbf, i)->type == FIELD_TYPE_NUMERIC) {
+                fields[t.count++] = ast_expr_ident(dbf_field_info(dbf, i)->name);
+            }
+        }
+        t.exprs = fields;
+    }
+
+    /* sums[0] counts the records */
+    double *sums = xcalloc((size_t)t.count + 1, sizeof(double));
+    ParallelTask task = {sizeof(double) * ((size_t)t.count + 1), sum_visit, &t, false};
+    void *partials;
+    int workers;
+
+    if (scan_parallel(dbf, node) &&
+        parallel_scan(dbf, 1, node->condition, &task, &partials, &workers, NULL)) {
+        for (int w = 0; w < workers; w++) {
+            const double *part = (const double *)partials + (size_t)w * ((size_t)t.count + 1);
+            for (int i = 0; i <= t.count; i++) sums[i] += part[i];
+        }
+        xfree(partials);
+        dbf_goto(dbf, dbf_reccount(dbf) + 1);
+    } else {
+        DBFScan *scan = scan_open(dbf, node, ctx);
+        if (!scan) {
+            error_print();
+        } else {
+            uint32_t processed = 0;
+            while (!dbf_eof(dbf)) {
+                if (!check_conditions(node, ctx, processed)) break;
+                if (check_for_condition(node, ctx)) {
+                    sum_visit(&ctx->eval_ctx, sums, &t);
+                }
+                processed++;
+                if (!next_record(dbf, scan)) break;
+            }
+            dbf_scan_close(scan);
+        }
+    }
+
+    CMD_OUTPUT(ctx, "%u record(s) %s\n", (uint32_t)sums[0], average ? "averaged" : "summed");
+    for (int i = 0; i < t.count; i++) {
+        double result = sums[i + 1];
+        if (average) result = sums[0] > 0 ? result / sums[0] : 0;
+
+        /* A field's total keeps its decimals */
+        int field = t.exprs[i]->type == EXPR_IDENT ?
+                    dbf_field_index(dbf, t.exprs[i]->data.ident) : -1;
+        int decimals = field >= 0 ? dbf_field_info(dbf, field)->decimals : 2;
+        if (field >= 0) {
+            CMD_OUTPUT(ctx, "%-10s %.*f\n", t.exprs[i]->data.ident, decimals, result);
+        } else {
+            CMD_OUTPUT(ctx, "%-10s %.*f\n", "", decimals, result);
+        }
+
+        if (i < node->data.aggregate.var_count) {
+            Value v = value_number(result);
+            var_set(node->data.aggregate.vars[i], &v);
+        }
+    }
+
+    if (t.exprs == fields) {
+        for (int i = 0; i < t.count; i++) ast_expr_free(fields[i]);
+    }
+    xfree(sums);
+}
+
 /* Execute HELP command */
 static void cmd_help(ASTNode *node, CommandContext *ctx) {
     (void)node;  /* Unused for now */
@@ -1207,6 +2473,12 @@ static void cmd_help(ASTNode *node, CommandContext *ctx) {
 
     CMD_OUTPUT(ctx, CLR_BOLD CLR_BGREEN "  📂 DATABASE" CLR_RESET "\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "USE" CLR_RESET " <file> [ALIAS <name>]    Open database file\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "USE" CLR_RESET " <file> MMAP              Open with memory-mapped reads\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "USE" CLR_RESET " <file> INMEMORY          Open with every field decoded into memory\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "USE" CLR_RESET " <file>.xcol              Open a columnar snapshot (read-only)\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "COPY TO" CLR_RESET " <file> [TYPE <type>] Copy records (DBF, DELIMITED, NDJSON)\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "COPY TO" CLR_RESET " <file> TYPE XCOL     Write a columnar snapshot\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SORT TO" CLR_RESET " <file> ON <fields>   Copy records in key order (/A /D /C)\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "CLOSE" CLR_RESET " [DATABASES|INDEXES]    Close files\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "CREATE" CLR_RESET " <file>                Create new database\n");
     CMD_OUTPUT(ctx, "\n");
@@ -1227,10 +2499,12 @@ static void cmd_help(ASTNode *node, CommandContext *ctx) {
 
     CMD_OUTPUT(ctx, CLR_BOLD CLR_BRED "  ✏️  DATA MODIFICATION" CLR_RESET "\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "APPEND BLANK" CLR_RESET "                 Add new record\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "APPEND FROM" CLR_RESET " <file> [FOR]     Copy records from table\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "APPEND FROM" CLR_RESET " <file> TYPE DELIMITED|NDJSON  Load a text file\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "REPLACE" CLR_RESET " <fld> WITH <expr>    Update field\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "DELETE" CLR_RESET " [FOR <cond>]          Mark as deleted\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "RECALL" CLR_RESET " [FOR <cond>]          Undelete records\n");
-    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "PACK" CLR_RESET "                         Remove deleted\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "PACK" CLR_RESET " [ONLINE]                Remove deleted\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "ZAP" CLR_RESET "                          Delete all records\n");
     CMD_OUTPUT(ctx, "\n");
 
@@ -1260,10 +2534,17 @@ static void cmd_help(ASTNode *node, CommandContext *ctx) {
 
     CMD_OUTPUT(ctx, CLR_BOLD CLR_BMAGENTA "  📊 AGGREGATE" CLR_RESET "\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "COUNT" CLR_RESET " [FOR <cond>] [TO <var>] Count records\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SUM" CLR_RESET " [<exprs>] [TO <vars>]    Total numeric values\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "AVERAGE" CLR_RESET " [<exprs>] [TO <vars>] Mean of numeric values\n");
     CMD_OUTPUT(ctx, "\n");
 
     CMD_OUTPUT(ctx, CLR_BOLD CLR_WHITE "  ⚙️  OTHER" CLR_RESET "\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SET" CLR_RESET " <option> [TO <value>]    Set options\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SET BUFFERS TO" CLR_RESET " <MB>          Buffer pool size\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SET DURABILITY TO" CLR_RESET " <mode>     NONE, BATCH or FULL\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SET DELETED" CLR_RESET " ON|OFF           Hide deleted records\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SET BLOOM" CLR_RESET " ON|OFF <field>     Bloom filters for LOCATE\n");
+    CMD_OUTPUT(ctx, "     " CLR_BYELLOW "SET PARALLEL TO" CLR_RESET " <n>         Scan threads (0 = CPUs)\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "CLEAR" CLR_RESET " [ALL|MEMORY]           Clear screen/vars\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "WAIT" CLR_RESET " [<prompt>] [TO <var>]   Wait for key\n");
     CMD_OUTPUT(ctx, "     " CLR_BYELLOW "HELP" CLR_RESET "                         Show this help\n");
@@ -1344,6 +2625,14 @@ void cmd_execute(ASTNode *node, CommandContext *ctx) {
             cmd_append(node, ctx);
             break;
 
+        case CMD_COPY:
+            cmd_copy(node, ctx);
+            break;
+
+        case CMD_SORT:
+            cmd_sort(node, ctx);
+            break;
+
         case CMD_DELETE:
             cmd_delete(node, ctx);
             break;
@@ -1398,6 +2687,11 @@ void cmd_execute(ASTNode *node, CommandContext *ctx) {
             cmd_count(node, ctx);
             break;
 
+        case CMD_SUM:
+        case CMD_AVERAGE:
+            cmd_sum(node, ctx, node->type == CMD_AVERAGE);
+            break;
+
         case CMD_INDEX:
             cmd_index(node, ctx);
             break;
@@ -1427,4 +2721,9 @@ void cmd_execute(ASTNode *node, CommandContext *ctx) {
             CMD_OUTPUT(ctx, "Command not implemented\n");
             break;
     }
+
+    /* Statement boundary: commit according to the durability mode */
+    if (!dbf_end_statement(ctx->eval_ctx.current_dbf)) {
+        error_print();
+    }
 }
@@ -30,9 +30,20 @@ typedef struct {
     int index_count;                /* Number of open indexes */
     int current_order;              /* Current controlling index (0 = none) */
 
+    /* Condition of the last LOCATE, for CONTINUE */
+    ASTExpr *locate_cond;
+
     /* Thread safety */
     pthread_mutex_t mutex;          /* Protects shared state */
     bool mutex_initialized;
+    bool lock_held;                 /* Mutex held by the executing thread */
+    int readers;                    /* Table readers running unlocked */
+    pthread_cond_t readers_done;    /* Signalled when readers drops to 0 */
+
+    /* Group commit thread */
+    pthread_t committer;
+    bool committer_running;
+    bool committer_stop;            /* Guarded by the mutex */
 
     /* Output redirection */
     OutputFunc output_func;         /* Output callback (NULL = printf) */
@@ -67,6 +78,17 @@ void cmd_set_current_dbf(CommandContext *ctx, DBF *dbf);
 void cmd_lock(CommandContext *ctx);
 void cmd_unlock(CommandContext *ctx);
 
+/* Bracket a read of the current table done with the context unlocked
+ * (both called locked). PACK and ZAP rewrite the file in place, so they
+ * wait until no such reader is left. */
+void cmd_reader_begin(CommandContext *ctx);
+void cmd_reader_end(CommandContext *ctx);
+
+/* Run / stop the thread that commits pending changes of every open table
+ * in BATCH durability. Statements must run with the context locked. */
+void cmd_start_committer(CommandContext *ctx);
+void cmd_stop_committer(CommandContext *ctx);
+
 /* Set output function for redirecting output */
 void cmd_set_output(CommandContext *ctx, OutputFunc func, void *output_ctx);
 
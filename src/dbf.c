@@ -3,11 +3,136 @@
  * dbf.c - DBF file engine implementation
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "dbf.h"
+#include "aio.h"
+#include "xcol.h"
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
+#include <math.h>
+#include <float.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Mappings are grown in steps of this size (bytes) */
+#define DBF_MAP_GRANULE ((size_t)1 << 20)
+
+/* Bytes fetched per read-ahead I/O during sequential scans */
+#define DBF_READAHEAD_BYTES ((size_t)64 * 1024)
+
+/* Durability mode shared by every open table */
+static DBFDurability g_durability = DBF_DURABILITY_NONE;
+
+/* Tables open in the process, for group commits */
+static DBF **g_open_tables = NULL;
+static int g_open_count = 0;
+static int g_open_capacity = 0;
+static pthread_mutex_t g_open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* SET DELETED: navigation steps over deleted records */
+static bool g_skip_deleted = false;
+
+/* I/O used by full-table scans */
+static DBFScanMode g_scan_mode = DBF_SCAN_AUTO;
+
+/* Number of data syncs issued by commits */
+static uint64_t g_syncs = 0;
+
+/* Bytes staged by an appender before it writes a batch */
+#define DBF_APPEND_BATCH_BYTES ((size_t)256 * 1024)
+
+/* Asynchronous scans: bytes per block read, blocks kept in flight, and
+ * the smallest table (bytes of records) worth scanning asynchronously;
+ * below it the pool's read-ahead does as well */
+#define DBF_SCAN_BLOCK_BYTES ((size_t)256 * 1024)
+#define DBF_SCAN_DEPTH       8
+#define DBF_SCAN_MIN_BYTES   ((uint64_t)8 << 20)
+
+/* Records of a columnar snapshot, put together from its columns */
+static bool snapshot_records(DBF *dbf, uint32_t first, uint32_t n, uint8_t *dst);
+
+/* Bytes read and written per I/O while packing */
+#define DBF_PACK_CHUNK_BYTES ((size_t)1 << 20)
+
+/* Bytes read and written per I/O when a table file is copied whole */
+#define DBF_COPY_CHUNK_BYTES ((size_t)8 << 20)
+
+/* Online PACK: the copy runs without the table lock and touches only the
+ * fields marked as its own; the rest is used with the lock held */
+struct DBFPack {
+    DBF *dbf;                  /* Table being packed (NULL once abandoned) */
+    int src_fd;                /* Table file, kept open for the copy */
+    int dst_fd;                /* Shadow file */
+    char shadow[MAX_PATH_LEN]; /* Shadow file path */
+    uint32_t snapshot;         /* Records when the PACK began */
+    uint8_t *dropped;          /* Copy: deleted bitmap as of the snapshot */
+    uint8_t *dirty;            /* Records up to the snapshot written since */
+    uint32_t *map;             /* Copy: old recno -> new recno (0 = removed) */
+    uint32_t map_count;        /* Old records covered by the map */
+    uint32_t kept;             /* Copy: records in the shadow file */
+    uint64_t moved;            /* Copy: record bytes written to the shadow */
+    uint16_t header_size;      /* Table geometry */
+    uint16_t record_size;
+    uint64_t start_us;         /* When the PACK began */
+    bool done;                 /* Table packed; the map is complete */
+    bool installed;            /* Shadow renamed over the table */
+};
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t monotonic_ms(void) {
+    return monotonic_us() / 1000;
+}
+
+/* Clock of group commits; tests may replace it */
+static uint64_t (*g_commit_clock)(void) = NULL;
+
+static uint64_t commit_clock(void) {
+    return g_commit_clock ? g_commit_clock() : monotonic_ms();
+}
+
+static void open_register(DBF *dbf) {
+    pthread_mutex_lock(&g_open_lock);
+    if (g_open_count == g_open_capacity) {
+        g_open_capacity = g_open_capacity ? g_open_capacity * 2 : 8;
+        g_open_tables = xrealloc(g_open_tables, sizeof(DBF *) * (size_t)g_open_capacity);
+    }
+    g_open_tables[g_open_count++] = dbf;
+    pthread_mutex_unlock(&g_open_lock);
+}
+
+static void open_unregister(DBF *dbf) {
+    pthread_mutex_lock(&g_open_lock);
+    for (int i = 0; i < g_open_count; i++) {
+        if (g_open_tables[i] == dbf) {
+            g_open_tables[i] = g_open_tables[--g_open_count];
+            break;
+        }
+    }
+    if (g_open_count == 0) {
+        xfree(g_open_tables);
+        g_open_tables = NULL;
+        g_open_capacity = 0;
+    }
+    pthread_mutex_unlock(&g_open_lock);
+}
+
+/* Alias is the file's base name, cut to fit */
+static void set_default_alias(DBF *dbf) {
+    char base[MAX_PATH_LEN];
+    file_basename(base, dbf->filename);
+    dbf_set_alias(dbf, base);
+}
 
 /* Read DBF header from file */
 static bool read_header(DBF *dbf) {
@@ -34,9 +159,9 @@ static bool read_header(DBF *dbf) {
     return true;
 }
 
-/* Write DBF header to file */
-static bool write_header(DBF *dbf) {
-    uint8_t buf[32] = {0};
+/* Encode the 32-byte DBF header */
+static void encode_header(DBF *dbf, uint8_t *buf) {
+    memset(buf, 0, 32);
 
     /* Update date */
     time_t t = time(NULL);
@@ -58,10 +183,18 @@ static bool write_header(DBF *dbf) {
     write_u32_le(&buf[4], dbf->header.record_count);
     write_u16_le(&buf[8], dbf->header.header_size);
     write_u16_le(&buf[10], dbf->header.record_size);
+}
+
+/* Write DBF header to file */
+static bool write_header(DBF *dbf) {
+    uint8_t buf[32];
+
+    encode_header(dbf, buf);
 
     if (fseek(dbf->fp, 0, SEEK_SET) != 0) return false;
     if (fwrite(buf, 1, 32, dbf->fp) != 32) return false;
 
+    dbf->header_dirty = false;
     return true;
 }
 
@@ -136,657 +269,3629 @@ static bool write_fields(DBF *dbf) {
     return true;
 }
 
-/* Read current record into buffer */
-static bool read_record(DBF *dbf) {
-    if (dbf->current_record == 0 || dbf->current_record > dbf->header.record_count) {
-        return false;
+/* Release the file mapping, if any */
+static void unmap_file(DBF *dbf) {
+    if (dbf->map) {
+        munmap(dbf->map, dbf->map_size);
+        dbf->map = NULL;
+        dbf->map_size = 0;
     }
+}
 
-    long offset = dbf->header.header_size +
-                  (long)(dbf->current_record - 1) * dbf->header.record_size;
-
-    if (fseek(dbf->fp, offset, SEEK_SET) != 0) return false;
-    if (fread(dbf->record_buffer, 1, dbf->header.record_size, dbf->fp)
-        != dbf->header.record_size) return false;
+/* Map the file so that the mapping covers every record. The mapping is
+ * sized with headroom so that a run of appends does not remap on every
+ * record; pages past end-of-file are never touched. */
+static bool map_file(DBF *dbf) {
+    size_t needed = (size_t)dbf->header.header_size +
+                    (size_t)dbf->header.record_count * dbf->header.record_size + 1;
 
-    dbf->deleted = (dbf->record_buffer[0] == DBF_RECORD_DELETED);
-    dbf->modified = false;
+    if (dbf->map && needed <= dbf->map_size) return true;
 
-    return true;
-}
+    unmap_file(dbf);
+    fflush(dbf->fp);
 
-/* Write current record from buffer */
-static bool write_record(DBF *dbf) {
-    if (dbf->readonly) {
-        error_set(ERR_FILE_WRITE, "Database is read-only");
-        return false;
-    }
+    size_t size = needed + needed / 2;
+    size = (size + DBF_MAP_GRANULE - 1) & ~(DBF_MAP_GRANULE - 1);
 
-    if (dbf->current_record == 0 || dbf->current_record > dbf->header.record_count) {
+    int prot = PROT_READ | (dbf->readonly ? 0 : PROT_WRITE);
+    void *map = mmap(NULL, size, prot, MAP_SHARED, fileno(dbf->fp), 0);
+    if (map == MAP_FAILED) {
+        error_set(ERR_FILE_READ, "Cannot map %s", dbf->filename);
         return false;
     }
 
-    long offset = dbf->header.header_size +
-                  (long)(dbf->current_record - 1) * dbf->header.record_size;
-
-    if (fseek(dbf->fp, offset, SEEK_SET) != 0) return false;
-    if (fwrite(dbf->record_buffer, 1, dbf->header.record_size, dbf->fp)
-        != dbf->header.record_size) return false;
-
-    dbf->modified = false;
+    dbf->map = map;
+    dbf->map_size = size;
     return true;
 }
 
-/* Open existing DBF file */
-DBF *dbf_open(const char *filename, bool readonly) {
-    DBF *dbf = xcalloc(1, sizeof(DBF));
+/* Offset of a record within the record area (after the header) */
+static uint64_t record_offset(DBF *dbf, uint32_t recno) {
+    return (uint64_t)(recno - 1) * dbf->header.record_size;
+}
 
-    dbf->fp = fopen(filename, readonly ? "rb" : "r+b");
-    if (!dbf->fp) {
-        error_set(ERR_FILE_NOT_FOUND, "%s", filename);
-        xfree(dbf);
-        return NULL;
+/* Attach the record area to the shared buffer pool */
+static void pool_attach(DBF *dbf) {
+    uint64_t size = 0;
+    struct stat st;
+
+    fflush(dbf->fp);
+    if (fstat(fileno(dbf->fp), &st) == 0 && (uint64_t)st.st_size > dbf->header.header_size) {
+        size = (uint64_t)st.st_size - dbf->header.header_size;
     }
 
-    strncpy(dbf->filename, filename, MAX_PATH_LEN - 1);
-    dbf->readonly = readonly;
+    dbf->pool = bufpool_attach(fileno(dbf->fp), dbf->header.header_size, size);
+}
 
-    /* Read header */
-    if (!read_header(dbf)) {
-        fclose(dbf->fp);
-        xfree(dbf);
-        return NULL;
+/* Keep a window of pages ahead of a forward scan resident in the pool */
+static void read_ahead(DBF *dbf, uint32_t recno) {
+    uint64_t offset = record_offset(dbf, recno);
+
+    if (dbf->last_read == 0 || recno != dbf->last_read + 1) {
+        dbf->readahead_end = 0;
+        return;
     }
 
-    /* Read field descriptors */
-    if (!read_fields(dbf)) {
-        fclose(dbf->fp);
-        xfree(dbf->fields);
-        xfree(dbf);
-        return NULL;
+    if (!dbf->sequential) {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fileno(dbf->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        dbf->sequential = true;
     }
 
-    /* Allocate record buffer */
-    dbf->record_buffer = xcalloc(dbf->header.record_size, 1);
+    if (offset + dbf->header.record_size > dbf->readahead_end) {
+        bufpool_prefetch(dbf->pool, offset, DBF_READAHEAD_BYTES);
+        dbf->readahead_end = offset + DBF_READAHEAD_BYTES;
 
-    /* Set alias from filename */
-    file_basename(dbf->alias, filename);
-    str_upper(dbf->alias);
+#ifdef POSIX_FADV_WILLNEED
+        /* Let the kernel start on the window after this one */
+        posix_fadvise(fileno(dbf->fp),
+                      (off_t)(dbf->header.header_size + dbf->readahead_end),
+                      (off_t)DBF_READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+#endif
+    }
+}
 
-    /* Position at first record */
-    dbf->current_record = 0;
-    dbf->bof = true;
-    dbf->eof = (dbf->header.record_count == 0);
+/*
+ * Deleted bitmap
+ */
 
-    if (dbf->header.record_count > 0) {
-        dbf_go_top(dbf);
-    }
+static size_t delmap_bytes(uint32_t records) {
+    return ((size_t)records + 7) / 8;
+}
 
-    return dbf;
+static bool delmap_test(const DBF *dbf, uint32_t recno) {
+    return (dbf->delmap[(recno - 1) >> 3] >> ((recno - 1) & 7)) & 1;
 }
 
-/* Create new DBF file */
-DBF *dbf_create(const char *filename, const DBFField *fields, int field_count) {
-    if (field_count <= 0 || field_count > MAX_FIELDS) {
-        error_set(ERR_INVALID_FIELD, "Invalid field count");
-        return NULL;
-    }
+static void delmap_touch(DBF *dbf, uint32_t lo, uint32_t hi) {
+    if (!dbf->delmap_dirty || lo < dbf->delmap_lo) dbf->delmap_lo = lo;
+    if (!dbf->delmap_dirty || hi > dbf->delmap_hi) dbf->delmap_hi = hi;
+    dbf->delmap_dirty = true;
+}
 
-    DBF *dbf = xcalloc(1, sizeof(DBF));
+/* Make room for 'records' bits; new bits start clear */
+static void delmap_reserve(DBF *dbf, uint32_t records) {
+    if (dbf->delmap && records <= dbf->delmap_capacity) return;
 
-    dbf->fp = fopen(filename, "w+b");
-    if (!dbf->fp) {
-        error_set(ERR_FILE_CREATE, "%s", filename);
-        xfree(dbf);
-        return NULL;
+    uint32_t capacity = dbf->delmap_capacity ? dbf->delmap_capacity : 1024;
+    while (capacity < records) {
+        capacity = capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
     }
 
-    strncpy(dbf->filename, filename, MAX_PATH_LEN - 1);
-    dbf->readonly = false;
+    size_t old = dbf->delmap ? delmap_bytes(dbf->delmap_capacity) : 0;
+    dbf->delmap = xrealloc(dbf->delmap, delmap_bytes(capacity));
+    memset(dbf->delmap + old, 0, delmap_bytes(capacity) - old);
+    dbf->delmap_capacity = capacity;
+}
 
-    /* Initialize header */
-    dbf->header.version = DBF_VERSION_DBASE3;
-    dbf->header.record_count = 0;
-    dbf->header.header_size = (uint16_t)(32 + field_count * 32 + 1);
+/* Record the deletion flag of one record, if the bitmap is in use */
+static void delmap_set(DBF *dbf, uint32_t recno, bool deleted) {
+    if (!dbf->delmap || recno == 0 || recno > dbf->header.record_count) return;
+    if (delmap_test(dbf, recno) == deleted) return;
 
-    /* Copy and validate fields, calculate record size */
-    dbf->fields = xcalloc((size_t)field_count, sizeof(DBFField));
-    dbf->field_count = field_count;
+    uint32_t byte = (recno - 1) >> 3;
+    dbf->delmap[byte] ^= (uint8_t)(1u << ((recno - 1) & 7));
+    if (deleted) {
+        dbf->deleted_count++;
+    } else {
+        dbf->deleted_count--;
+    }
+    delmap_touch(dbf, byte, byte + 1);
+}
 
-    uint16_t record_size = 1;  /* Delete flag */
-    for (int i = 0; i < field_count; i++) {
-        DBFField *dst = &dbf->fields[i];
-        const DBFField *src = &fields[i];
+/* Reset the bitmap to 'records' records, none deleted */
+static void delmap_clear(DBF *dbf, uint32_t records) {
+    delmap_reserve(dbf, records);
+    memset(dbf->delmap, 0, delmap_bytes(dbf->delmap_capacity));
+    dbf->deleted_count = 0;
+    delmap_touch(dbf, 0, (uint32_t)delmap_bytes(records));
+}
 
-        strncpy(dst->name, src->name, MAX_FIELD_NAME - 1);
-        str_upper(dst->name);
-        dst->type = (char)toupper(src->type);
-        dst->length = src->length;
-        dst->decimals = src->decimals;
-        dst->offset = record_size;
+/* Rebuild the bitmap from the deletion flags of every record */
+static bool delmap_build(DBF *dbf) {
+    uint32_t count = dbf->header.record_count;
+    uint16_t size = dbf->header.record_size;
+    uint32_t chunk = (uint32_t)(DBF_READAHEAD_BYTES / size) + 1;
+    uint8_t *buffer = dbf->map ? NULL : xmalloc((size_t)chunk * size);
 
-        /* Validate field */
-        switch (dst->type) {
-            case FIELD_TYPE_CHAR:
-                if (dst->length == 0 || dst->length > MAX_FIELD_LEN) {
-                    error_set(ERR_INVALID_FIELD, "Invalid character field length");
-                    goto error;
-                }
-                break;
-            case FIELD_TYPE_NUMERIC:
-                if (dst->length == 0 || dst->length > 20) {
-                    error_set(ERR_INVALID_FIELD, "Invalid numeric field length");
-                    goto error;
-                }
-                break;
-            case FIELD_TYPE_DATE:
-                dst->length = 8;
-                dst->decimals = 0;
-                break;
-            case FIELD_TYPE_LOGICAL:
-                dst->length = 1;
-                dst->decimals = 0;
-                break;
-            case FIELD_TYPE_MEMO:
-                dst->length = 10;
-                dst->decimals = 0;
-                break;
-            default:
-                error_set(ERR_INVALID_FIELD, "Unknown field type: %c", dst->type);
-                goto error;
-        }
+    delmap_clear(dbf, count);
 
-        record_size += dst->length;
-    }
+    for (uint32_t first = 1; first <= count; first += chunk) {
+        uint32_t n = count - first + 1 < chunk ? count - first + 1 : chunk;
+        const uint8_t *src;
 
-    dbf->header.record_size = record_size;
+        if (dbf->map) {
+            src = dbf->map + dbf->header.header_size + record_offset(dbf, first);
+        } else if (bufpool_read(dbf->pool, record_offset(dbf, first), buffer, (size_t)n * size)) {
+            src = buffer;
+        } else {
+            xfree(buffer);
+            xfree(dbf->delmap);
+            dbf->delmap = NULL;
+            dbf->delmap_capacity = 0;
+            dbf->delmap_dirty = false;
+            error_set(ERR_FILE_READ, "Cannot read %s", dbf->filename);
+            return false;
+        }
 
-    /* Write header */
-    if (!write_header(dbf)) goto error;
+        for (uint32_t i = 0; i < n; i++) {
+            if (src[(size_t)i * size] == DBF_RECORD_DELETED) {
+                uint32_t bit = first + i - 1;
+                dbf->delmap[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+                dbf->deleted_count++;
+            }
+        }
+    }
 
-    /* Write field descriptors */
-    if (!write_fields(dbf)) goto error;
+    xfree(buffer);
 
-    /* Write EOF marker */
-    uint8_t eof = DBF_EOF_MARKER;
-    if (fwrite(&eof, 1, 1, dbf->fp) != 1) goto error;
+    /* The current record may hold a flag that is not written yet */
+    if (dbf->modified) {
+        delmap_set(dbf, dbf->current_record, dbf->deleted);
+    }
 
-    fflush(dbf->fp);
+    return true;
+}
 
-    /* Allocate record buffer */
-    dbf->record_buffer = xcalloc(dbf->header.record_size, 1);
+/* The bitmap is built on first use unless a current sidecar was loaded */
+static bool delmap_ready(DBF *dbf) {
+    return dbf->delmap || delmap_build(dbf);
+}
 
-    /* Set alias from filename */
-    file_basename(dbf->alias, filename);
-    str_upper(dbf->alias);
+static void delmap_path(const DBF *dbf, char *path) {
+    strncpy(path, dbf->filename, MAX_PATH_LEN - 5);
+    path[MAX_PATH_LEN - 5] = '\0';
+    file_change_ext(path, ".xdm");
+}
 
-    dbf->current_record = 0;
-    dbf->bof = true;
-    dbf->eof = true;
+/* Stamp identifying the table contents the sidecar describes */
+static bool sidecar_stamp(DBF *dbf, uint8_t *buf) {
+    struct stat st;
+    if (fstat(fileno(dbf->fp), &st) != 0) return false;
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    write_u32_le(&buf[16], (uint32_t)size);
+    write_u32_le(&buf[20], (uint32_t)(size >> 32));
+    write_u32_le(&buf[24], (uint32_t)mtime);
+    write_u32_le(&buf[28], (uint32_t)(mtime >> 32));
+    return true;
+}
 
-    return dbf;
+/* Load the sidecar if it matches the table; otherwise leave the bitmap
+ * unbuilt so that it is rebuilt on first use */
+static void delmap_load(DBF *dbf) {
+    char path[MAX_PATH_LEN];
+    uint8_t header[XDM_HEADER_SIZE];
+    uint8_t stamp[XDM_HEADER_SIZE];
+
+    delmap_path(dbf, path);
+    int fd = open(path, dbf->readonly ? O_RDONLY : O_RDWR);
+    if (fd < 0) return;
+
+    uint32_t count = dbf->header.record_count;
+    size_t bytes = delmap_bytes(count);
+
+    if (pread(fd, header, XDM_HEADER_SIZE, 0) != XDM_HEADER_SIZE ||
+        memcmp(header, XDM_MAGIC, 4) != 0 ||
+        header[14] != XDM_SEALED ||
+        read_u32_le(&header[4]) != count ||
+        read_u16_le(&header[12]) != dbf->header.record_size ||
+        !sidecar_stamp(dbf, stamp) ||
+        memcmp(&header[16], &stamp[16], 16) != 0) {
+        goto stale;
+    }
 
-error:
-    fclose(dbf->fp);
-    xfree(dbf->fields);
-    xfree(dbf);
-    return NULL;
-}
+    delmap_reserve(dbf, count);
+    if (bytes && pread(fd, dbf->delmap, bytes, XDM_HEADER_SIZE) != (ssize_t)bytes) goto stale;
 
-/* Close DBF file */
-void dbf_close(DBF *dbf) {
-    if (!dbf) return;
+    /* Bits past the last record must be clear */
+    if (count & 7) dbf->delmap[bytes - 1] &= (uint8_t)((1u << (count & 7)) - 1);
 
-    if (dbf->modified) {
-        write_record(dbf);
+    uint32_t deleted = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        for (uint8_t b = dbf->delmap[i]; b; b &= (uint8_t)(b - 1)) deleted++;
     }
+    if (deleted != read_u32_le(&header[8])) goto stale;
 
-    if (dbf->fp) {
-        fflush(dbf->fp);
-        fclose(dbf->fp);
+    dbf->deleted_count = deleted;
+    if (dbf->readonly) {
+        close(fd);
+    } else {
+        dbf->delmap_fd = fd;
+        dbf->delmap_sealed = true;
     }
-
-    xfree(dbf->record_buffer);
-    xfree(dbf->fields);
-    xfree(dbf);
+    return;
+
+stale:
+    xfree(dbf->delmap);
+    dbf->delmap = NULL;
+    dbf->delmap_capacity = 0;
+    close(fd);
+    if (!dbf->readonly) unlink(path);
 }
 
-/* Navigation functions */
-bool dbf_goto(DBF *dbf, uint32_t recno) {
-    if (!dbf) return false;
+/* Mark the sidecar as not current before the table is first changed after
+ * a save, so that a crash before the next save forces a rebuild */
+static void delmap_unseal(DBF *dbf) {
+    if (!dbf->delmap_sealed) return;
 
-    /* Flush any pending changes */
-    if (dbf->modified) {
-        write_record(dbf);
+    uint8_t state = 0;
+    if (pwrite(dbf->delmap_fd, &state, 1, 14) != 1) {
+        close(dbf->delmap_fd);
+        dbf->delmap_fd = -1;
     }
+    dbf->delmap_sealed = false;
+}
 
-    if (recno == 0) {
-        dbf->current_record = 0;
-        dbf->bof = true;
-        dbf->eof = false;
-        memset(dbf->record_buffer, ' ', dbf->header.record_size);
-        dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
-        return true;
+/* Write the changed part of the bitmap, then the header that vouches for
+ * it. Runs after the table itself has been written; a failure only costs
+ * a rebuild on the next open. */
+static void delmap_save(DBF *dbf) {
+    if (!dbf->delmap || dbf->readonly) return;
+
+    if (dbf->delmap_fd < 0) {
+        char path[MAX_PATH_LEN];
+        delmap_path(dbf, path);
+        dbf->delmap_fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (dbf->delmap_fd < 0) return;
+        delmap_touch(dbf, 0, (uint32_t)delmap_bytes(dbf->header.record_count));
     }
 
-    if (recno > dbf->header.record_count) {
-        dbf->current_record = dbf->header.record_count + 1;
-        dbf->bof = false;
-        dbf->eof = true;
-        memset(dbf->record_buffer, ' ', dbf->header.record_size);
-        dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
-        return true;
+    size_t bytes = delmap_bytes(dbf->header.record_count);
+    uint8_t header[XDM_HEADER_SIZE] = {0};
+
+    if (dbf->delmap_dirty && dbf->delmap_hi > dbf->delmap_lo) {
+        size_t hi = dbf->delmap_hi < bytes ? dbf->delmap_hi : bytes;
+        if (hi > dbf->delmap_lo) {
+            size_t len = hi - dbf->delmap_lo;
+            if (pwrite(dbf->delmap_fd, dbf->delmap + dbf->delmap_lo, len,
+                       (off_t)(XDM_HEADER_SIZE + dbf->delmap_lo)) != (ssize_t)len) {
+                return;
+            }
+        }
     }
 
-    dbf->current_record = recno;
-    dbf->bof = false;
-    dbf->eof = false;
+    memcpy(header, XDM_MAGIC, 4);
+    write_u32_le(&header[4], dbf->header.record_count);
+    write_u32_le(&header[8], dbf->deleted_count);
+    write_u16_le(&header[12], dbf->header.record_size);
+    header[14] = XDM_SEALED;
+    if (!sidecar_stamp(dbf, header)) return;
 
-    return read_record(dbf);
-}
+    if (ftruncate(dbf->delmap_fd, (off_t)(XDM_HEADER_SIZE + bytes)) != 0 ||
+        pwrite(dbf->delmap_fd, header, XDM_HEADER_SIZE, 0) != XDM_HEADER_SIZE) {
+        return;
+    }
 
-bool dbf_skip(DBF *dbf, int count) {
-    if (!dbf) return false;
+    dbf->delmap_dirty = false;
+    dbf->delmap_sealed = true;
+}
 
-    if (count == 0) return true;
+/* First record at or after 'recno' that is not deleted (0 if none) */
+static uint32_t next_active(DBF *dbf, uint32_t recno) {
+    uint32_t count = dbf->header.record_count;
 
-    uint32_t new_recno;
-    if (count > 0) {
-        new_recno = dbf->current_record + (uint32_t)count;
-    } else {
-        if ((uint32_t)(-count) >= dbf->current_record) {
-            new_recno = 0;
-        } else {
-            new_recno = dbf->current_record - (uint32_t)(-count);
+    while (recno <= count) {
+        uint32_t bit = recno - 1;
+        if ((bit & 7) == 0 && dbf->delmap[bit >> 3] == 0xFF) {
+            recno += 8;
+            continue;
         }
+        if (!delmap_test(dbf, recno)) return recno;
+        recno++;
     }
 
-    return dbf_goto(dbf, new_recno);
+    return 0;
 }
 
-bool dbf_go_top(DBF *dbf) {
-    if (!dbf) return false;
+/* First deleted record at or after 'recno' (0 if none) */
+static uint32_t next_deleted(DBF *dbf, uint32_t recno) {
+    uint32_t count = dbf->header.record_count;
 
-    if (dbf->header.record_count == 0) {
-        dbf->bof = true;
-        dbf->eof = true;
-        dbf->current_record = 0;
-        return true;
+    while (recno <= count) {
+        uint32_t bit = recno - 1;
+        if ((bit & 7) == 0 && dbf->delmap[bit >> 3] == 0) {
+            recno += 8;
+            continue;
+        }
+        if (delmap_test(dbf, recno)) return recno;
+        recno++;
     }
 
-    return dbf_goto(dbf, 1);
+    return 0;
 }
 
-bool dbf_go_bottom(DBF *dbf) {
-    if (!dbf) return false;
+/* Last record at or before 'recno' that is not deleted (0 if none) */
+static uint32_t prev_active(DBF *dbf, uint32_t recno) {
+    while (recno > 0) {
+        uint32_t bit = recno - 1;
+        if ((bit & 7) == 7 && dbf->delmap[bit >> 3] == 0xFF) {
+            recno -= 8;
+            continue;
+        }
+        if (!delmap_test(dbf, recno)) return recno;
+        recno--;
+    }
 
-    if (dbf->header.record_count == 0) {
-        dbf->bof = true;
-        dbf->eof = true;
-        dbf->current_record = 0;
-        return true;
+    return 0;
+}
+
+/*
+ * Zone maps
+ */
+
+/* Lowest and highest value of one field over one block of records */
+typedef struct {
+    double min;
+    double max;
+} DBFZone;
+
+struct DBFZones {
+    int *slot;                 /* Range column of each field (-1 for other types) */
+    int width;                 /* Fields with ranges (N and D) */
+    DBFZone *ranges;           /* 'width' ranges per block */
+    uint32_t blocks;           /* Blocks with ranges */
+    uint32_t capacity;         /* Blocks the array has room for */
+    bool dirty;                /* Sidecar behind the ranges */
+    bool sealed;               /* Sidecar on disk is marked current */
+    int fd;                    /* Sidecar file descriptor (-1 if not open) */
+};
+
+static uint32_t zone_blocks(uint32_t records) {
+    return (uint32_t)(((uint64_t)records + DBF_ZONE_RECORDS - 1) / DBF_ZONE_RECORDS);
+}
+
+/* Empty zone maps for the fields of a table (NULL if none has a range) */
+static DBFZones *zones_new(const DBF *dbf) {
+    int width = 0;
+    for (int f = 0; f < dbf->field_count; f++) {
+        if (dbf->fields[f].type == FIELD_TYPE_NUMERIC || dbf->fields[f].type == FIELD_TYPE_DATE) {
+            width++;
+        }
     }
+    if (width == 0) return NULL;
+
+    DBFZones *zones = xcalloc(1, sizeof(DBFZones));
+    zones->slot = xmalloc(sizeof(int) * (size_t)dbf->field_count);
+    for (int f = 0; f < dbf->field_count; f++) {
+        bool ranged = dbf->fields[f].type == FIELD_TYPE_NUMERIC ||
+                      dbf->fields[f].type == FIELD_TYPE_DATE;
+        zones->slot[f] = ranged ? zones->width++ : -1;
+    }
+    zones->fd = -1;
+    return zones;
+}
 
-    return dbf_goto(dbf, dbf->header.record_count);
+static void zones_free(DBFZones *zones) {
+    if (!zones) return;
+    if (zones->fd >= 0) close(zones->fd);
+    xfree(zones->slot);
+    xfree(zones->ranges);
+    xfree(zones);
 }
 
-/* Status functions */
-bool dbf_eof(DBF *dbf) {
-    return dbf ? dbf->eof : true;
+/* Make room for 'blocks' blocks; new ranges start empty */
+static void zones_reserve(DBFZones *zones, uint32_t blocks) {
+    if (blocks <= zones->capacity) return;
+
+    uint32_t capacity = zones->capacity ? zones->capacity : 64;
+    while (capacity < blocks) capacity *= 2;
+
+    zones->ranges = xrealloc(zones->ranges, sizeof(DBFZone) * (size_t)capacity * zones->width);
+    for (size_t i = (size_t)zones->capacity * zones->width; i < (size_t)capacity * zones->width; i++) {
+        zones->ranges[i].min = HUGE_VAL;
+        zones->ranges[i].max = -HUGE_VAL;
+    }
+    zones->capacity = capacity;
 }
 
-bool dbf_bof(DBF *dbf) {
-    return dbf ? dbf->bof : true;
+/* Widen the ranges of record 'recno's block to cover its raw values */
+static void zones_widen(DBF *dbf, uint32_t recno, const uint8_t *record) {
+    DBFZones *zones = dbf->zones;
+    uint32_t block = (recno - 1) / DBF_ZONE_RECORDS;
+
+    zones_reserve(zones, block + 1);
+    if (block >= zones->blocks) zones->blocks = block + 1;
+
+    DBFZone *range = &zones->ranges[(size_t)block * zones->width];
+    for (int f = 0; f < dbf->field_count; f++) {
+        if (zones->slot[f] < 0) continue;
+
+        const DBFField *field = &dbf->fields[f];
+        DBFZone *z = &range[zones->slot[f]];
+        double lo, hi;
+
+        if (field->type == FIELD_TYPE_DATE) {
+            char date[9];
+            memcpy(date, record + field->offset, 8);
+            date[8] = '\0';
+            lo = hi = (double)date_to_julian(date);
+        } else if (dbf_decode_numeric(record + field->offset, field->length, &lo)) {
+            hi = lo;
+        } else {
+            /* Whatever an expression makes of it, nothing is ruled out */
+            lo = -HUGE_VAL;
+            hi = HUGE_VAL;
+        }
+
+        if (lo < z->min) z->min = lo;
+        if (hi > z->max) z->max = hi;
+    }
+    zones->dirty = true;
 }
 
-uint32_t dbf_recno(DBF *dbf) {
-    return dbf ? dbf->current_record : 0;
+/* Forget every range */
+static void zones_clear(DBF *dbf) {
+    DBFZones *zones = dbf->zones;
+    for (size_t i = 0; i < (size_t)zones->capacity * zones->width; i++) {
+        zones->ranges[i].min = HUGE_VAL;
+        zones->ranges[i].max = -HUGE_VAL;
+    }
+    zones->blocks = 0;
+    zones->dirty = true;
 }
 
-uint32_t dbf_reccount(DBF *dbf) {
-    return dbf ? dbf->header.record_count : 0;
+/* Compute the ranges from every record */
+static bool zones_build(DBF *dbf) {
+    uint32_t count = dbf->header.record_count;
+    uint16_t size = dbf->header.record_size;
+    uint32_t chunk = (uint32_t)(DBF_READAHEAD_BYTES / size) + 1;
+
+    if (!dbf->zones) dbf->zones = zones_new(dbf);
+    if (!dbf->zones) return false;
+
+    /* A snapshot keeps the range of every field over each of its chunks */
+    if (dbf->xcol) {
+        DBFZones *zones = dbf->zones;
+        uint32_t blocks = zone_blocks(count);
+
+        zones_clear(dbf);
+        zones_reserve(zones, blocks);
+        for (uint32_t block = 0; block < blocks; block++) {
+            uint32_t chunk = block / (XCOL_CHUNK_RECORDS / DBF_ZONE_RECORDS);
+            for (int f = 0; f < dbf->field_count; f++) {
+                if (zones->slot[f] < 0) continue;
+                DBFZone *z = &zones->ranges[(size_t)block * zones->width + zones->slot[f]];
+                xcol_chunk_range(dbf->xcol, chunk, f, &z->min, &z->max);
+            }
+        }
+        zones->blocks = blocks;
+        return true;
+    }
+
+    uint8_t *buffer = dbf->map ? NULL : xmalloc((size_t)chunk * size);
+    zones_clear(dbf);
+    zones_reserve(dbf->zones, zone_blocks(count));
+
+    for (uint32_t first = 1; first <= count; first += chunk) {
+        uint32_t n = count - first + 1 < chunk ? count - first + 1 : chunk;
+        const uint8_t *src;
+
+        if (dbf->map) {
+            src = dbf->map + dbf->header.header_size + record_offset(dbf, first);
+        } else if (bufpool_read(dbf->pool, record_offset(dbf, first), buffer, (size_t)n * size)) {
+            src = buffer;
+        } else {
+            xfree(buffer);
+            zones_free(dbf->zones);
+            dbf->zones = NULL;
+            error_set(ERR_FILE_READ, "Cannot read %s", dbf->filename);
+            return false;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            zones_widen(dbf, first + i, src + (size_t)i * size);
+        }
+    }
+
+    xfree(buffer);
+
+    /* The current record may hold values that are not written yet */
+    if (dbf->modified && dbf->current_record >= 1 && dbf->current_record <= count) {
+        zones_widen(dbf, dbf->current_record, dbf->record_buffer);
+    }
+
+    return true;
 }
 
-bool dbf_deleted(DBF *dbf) {
-    return dbf ? dbf->deleted : false;
+/* The ranges are computed on first use unless a current sidecar was loaded */
+static bool zones_ready(DBF *dbf) {
+    return dbf->zones || zones_build(dbf);
 }
 
-/* Append blank record */
-bool dbf_append_blank(DBF *dbf) {
-    if (!dbf || dbf->readonly) {
-        error_set(ERR_FILE_WRITE, "Cannot append to read-only database");
-        return false;
+static void zones_path(const DBF *dbf, char *path) {
+    strncpy(path, dbf->filename, MAX_PATH_LEN - 5);
+    path[MAX_PATH_LEN - 5] = '\0';
+    file_change_ext(path, ".xzm");
+}
+
+/* Load the sidecar if it matches the table; otherwise leave the ranges
+ * unbuilt so that they are computed on first use */
+static void zones_load(DBF *dbf) {
+    char path[MAX_PATH_LEN];
+    uint8_t header[XZM_HEADER_SIZE];
+    uint8_t stamp[XZM_HEADER_SIZE];
+
+    zones_path(dbf, path);
+    int fd = open(path, dbf->readonly ? O_RDONLY : O_RDWR);
+    if (fd < 0) return;
+
+    DBFZones *zones = zones_new(dbf);
+    uint32_t blocks = zone_blocks(dbf->header.record_count);
+    size_t bytes = sizeof(DBFZone) * (size_t)blocks * (zones ? zones->width : 0);
+
+    if (!zones ||
+        pread(fd, header, XZM_HEADER_SIZE, 0) != XZM_HEADER_SIZE ||
+        memcmp(header, XZM_MAGIC, 4) != 0 ||
+        header[14] != XDM_SEALED ||
+        read_u32_le(&header[4]) != dbf->header.record_count ||
+        read_u16_le(&header[8]) != (uint16_t)zones->width ||
+        read_u16_le(&header[10]) != dbf->header.record_size ||
+        read_u16_le(&header[12]) != (uint16_t)dbf->field_count ||
+        !sidecar_stamp(dbf, stamp) ||
+        memcmp(&header[16], &stamp[16], 16) != 0) {
+        goto stale;
     }
 
-    /* Flush any pending changes */
-    if (dbf->modified) {
-        write_record(dbf);
+    zones_reserve(zones, blocks);
+    if (bytes && pread(fd, zones->ranges, bytes, XZM_HEADER_SIZE) != (ssize_t)bytes) goto stale;
+    zones->blocks = blocks;
+
+    if (dbf->readonly) {
+        close(fd);
+    } else {
+        zones->fd = fd;
+        zones->sealed = true;
     }
+    dbf->zones = zones;
+    return;
 
-    /* Initialize blank record */
-    memset(dbf->record_buffer, ' ', dbf->header.record_size);
-    dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
+stale:
+    zones_free(zones);
+    close(fd);
+    if (!dbf->readonly) unlink(path);
+}
 
-    /* Position at end of file (before EOF marker) */
-    long offset = dbf->header.header_size +
-                  (long)dbf->header.record_count * dbf->header.record_size;
+/* Mark the sidecar as not current before the table is first changed after
+ * a save */
+static void zones_unseal(DBF *dbf) {
+    DBFZones *zones = dbf->zones;
+    if (!zones || !zones->sealed) return;
 
-    if (fseek(dbf->fp, offset, SEEK_SET) != 0) return false;
+    uint8_t state = 0;
+    if (pwrite(zones->fd, &state, 1, 14) != 1) {
+        close(zones->fd);
+        zones->fd = -1;
+    }
+    zones->sealed = false;
+}
 
-    /* Write blank record */
-    if (fwrite(dbf->record_buffer, 1, dbf->header.record_size, dbf->fp)
-        != dbf->header.record_size) return false;
+/* Write the ranges (native doubles), then the header that vouches for
+ * them; a failure only costs a rebuild */
+static void zones_save(DBF *dbf) {
+    DBFZones *zones = dbf->zones;
+    if (!zones || dbf->readonly || (zones->sealed && !zones->dirty)) return;
+
+    if (zones->fd < 0) {
+        char path[MAX_PATH_LEN];
+        zones_path(dbf, path);
+        zones->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (zones->fd < 0) return;
+    }
 
-    /* Write EOF marker */
-    uint8_t eof = DBF_EOF_MARKER;
-    if (fwrite(&eof, 1, 1, dbf->fp) != 1) return false;
+    uint32_t blocks = zone_blocks(dbf->header.record_count);
+    size_t bytes = sizeof(DBFZone) * (size_t)blocks * zones->width;
+    uint8_t header[XZM_HEADER_SIZE] = {0};
 
-    /* Update header */
-    dbf->header.record_count++;
-    if (!write_header(dbf)) return false;
+    zones_reserve(zones, blocks);
+    if (bytes && pwrite(zones->fd, zones->ranges, bytes, XZM_HEADER_SIZE) != (ssize_t)bytes) return;
 
-    fflush(dbf->fp);
+    memcpy(header, XZM_MAGIC, 4);
+    write_u32_le(&header[4], dbf->header.record_count);
+    write_u16_le(&header[8], (uint16_t)zones->width);
+    write_u16_le(&header[10], dbf->header.record_size);
+    write_u16_le(&header[12], (uint16_t)dbf->field_count);
+    header[14] = XDM_SEALED;
+    if (!sidecar_stamp(dbf, header)) return;
 
-    /* Position at new record */
-    dbf->current_record = dbf->header.record_count;
-    dbf->bof = false;
-    dbf->eof = false;
-    dbf->deleted = false;
-    dbf->modified = false;
+    if (ftruncate(zones->fd, (off_t)(XZM_HEADER_SIZE + bytes)) != 0 ||
+        pwrite(zones->fd, header, XZM_HEADER_SIZE, 0) != XZM_HEADER_SIZE) {
+        return;
+    }
+
+    zones->dirty = false;
+    zones->sealed = true;
+}
+
+/* Whether no value in a range can pass a test */
+static bool zone_excludes(const DBFZone *z, const DBFZoneTest *test) {
+    switch (test->op) {
+        case DBF_ZONE_EQ: return test->value < z->min || test->value > z->max;
+        case DBF_ZONE_NE: return z->min == test->value && z->max == test->value;
+        case DBF_ZONE_LT: return z->min >= test->value;
+        case DBF_ZONE_LE: return z->min > test->value;
+        case DBF_ZONE_GT: return z->max <= test->value;
+        case DBF_ZONE_GE: return z->max < test->value;
+        case DBF_ZONE_MATCH: return false;
+    }
+    return false;
+}
+
+/* Whether the current record passes every test, comparing as
+ * expressions do */
+bool dbf_test_record(DBF *dbf, const DBFZoneTest *tests, int count) {
+    for (int i = 0; i < count; i++) {
+        const DBFZoneTest *test = &tests[i];
+        const DBFField *field = dbf_field_info(dbf, test->field);
+        if (!field) return false;
+
+        if (test->op == DBF_ZONE_MATCH) {
+            char value[MAX_FIELD_LEN + 1];
+            char text[MAX_FIELD_LEN + 1];
+            dbf_get_string(dbf, test->field, value, sizeof(value));
+            strncpy(text, test->text, MAX_FIELD_LEN);
+            text[MAX_FIELD_LEN] = '\0';
+            str_trim(value);
+            str_trim(text);
+            if (str_casecmp(value, text) != 0) return false;
+            continue;
+        }
+
+        double value = 0;
+        if (field->type == FIELD_TYPE_DATE) {
+            char date[9];
+            if (dbf_get_date(dbf, test->field, date)) value = (double)date_to_julian(date);
+        } else {
+            dbf_get_double(dbf, test->field, &value);
+        }
 
+        bool pass = false;
+        switch (test->op) {
+            case DBF_ZONE_EQ: pass = value == test->value; break;
+            case DBF_ZONE_NE: pass = value != test->value; break;
+            case DBF_ZONE_LT: pass = value < test->value; break;
+            case DBF_ZONE_LE: pass = value <= test->value; break;
+            case DBF_ZONE_GT: pass = value > test->value; break;
+            case DBF_ZONE_GE: pass = value >= test->value; break;
+            case DBF_ZONE_MATCH: break;
+        }
+        if (!pass) return false;
+    }
     return true;
 }
 
-/* Delete current record */
-bool dbf_delete(DBF *dbf) {
-    if (!dbf || dbf->readonly) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+/*
+ * Bloom filters
+ */
 
-    dbf->record_buffer[0] = DBF_RECORD_DELETED;
-    dbf->deleted = true;
-    dbf->modified = true;
+struct DBFBlooms {
+    int fields[DBF_BLOOM_FIELDS]; /* Fields with filters */
+    int count;
+    uint8_t *bits;             /* 'count' filters per block */
+    uint32_t blocks;           /* Blocks with filters */
+    uint32_t capacity;         /* Blocks the array has room for */
+    bool built;                /* Filters cover the table (else rebuilt on first use) */
+    bool dirty;                /* Sidecar behind the filters */
+    bool sealed;               /* Sidecar on disk is marked current */
+    int fd;                    /* Sidecar file descriptor (-1 if not open) */
+};
+
+static void blooms_free(DBFBlooms *blooms) {
+    if (!blooms) return;
+    if (blooms->fd >= 0) close(blooms->fd);
+    xfree(blooms->bits);
+    xfree(blooms);
+}
+
+/* Filter of a field, or -1 */
+static int bloom_slot(const DBFBlooms *blooms, int field) {
+    for (int i = 0; blooms && i < blooms->count; i++) {
+        if (blooms->fields[i] == field) return i;
+    }
+    return -1;
+}
+
+static uint8_t *bloom_filter(DBFBlooms *blooms, uint32_t block, int slot) {
+    return blooms->bits + ((size_t)block * blooms->count + (size_t)slot) * DBF_BLOOM_BYTES;
+}
+
+/* Make room for 'blocks' blocks; new filters start empty */
+static void blooms_reserve(DBFBlooms *blooms, uint32_t blocks) {
+    if (blocks <= blooms->capacity) return;
+
+    uint32_t capacity = blooms->capacity ? blooms->capacity : 16;
+    while (capacity < blocks) capacity *= 2;
+
+    size_t stride = (size_t)blooms->count * DBF_BLOOM_BYTES;
+    blooms->bits = xrealloc(blooms->bits, stride * capacity);
+    memset(blooms->bits + stride * blooms->capacity, 0, stride * (capacity - blooms->capacity));
+    blooms->capacity = capacity;
+}
+
+/* Hash of a value trimmed at both ends and in upper case (FNV-1a) */
+static uint64_t bloom_hash(const uint8_t *ptr, size_t len) {
+    len = dbf_view_trim(&ptr, len);
 
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint64_t)toupper(ptr[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Bit positions derived from the two halves of the hash */
+static void bloom_set(uint8_t *filter, uint64_t h) {
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    for (uint32_t i = 0; i < DBF_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % (DBF_BLOOM_BYTES * 8);
+        filter[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    }
+}
+
+static bool bloom_test(const uint8_t *filter, uint64_t h) {
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    for (uint32_t i = 0; i < DBF_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % (DBF_BLOOM_BYTES * 8);
+        if (!((filter[bit >> 3] >> (bit & 7)) & 1)) return false;
+    }
     return true;
 }
 
-/* Recall (undelete) current record */
-bool dbf_recall(DBF *dbf) {
-    if (!dbf || dbf->readonly) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+/* Add the values of a raw record to its block's filters */
+static void blooms_add(DBF *dbf, uint32_t recno, const uint8_t *record) {
+    DBFBlooms *blooms = dbf->blooms;
+    if (!blooms->built) return;
 
-    dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
-    dbf->deleted = false;
-    dbf->modified = true;
+    uint32_t block = (recno - 1) / DBF_ZONE_RECORDS;
+    blooms_reserve(blooms, block + 1);
+    if (block >= blooms->blocks) blooms->blocks = block + 1;
+
+    for (int i = 0; i < blooms->count; i++) {
+        const DBFField *field = &dbf->fields[blooms->fields[i]];
+        bloom_set(bloom_filter(blooms, block, i), bloom_hash(record + field->offset, field->length));
+    }
+    blooms->dirty = true;
+}
+
+/* Empty every filter */
+static void blooms_clear(DBF *dbf) {
+    DBFBlooms *blooms = dbf->blooms;
+    if (blooms->bits) {
+        memset(blooms->bits, 0, (size_t)blooms->capacity * blooms->count * DBF_BLOOM_BYTES);
+    }
+    blooms->blocks = 0;
+    blooms->built = true;
+    blooms->dirty = true;
+}
+
+/* Fill the filters from every record */
+static bool blooms_build(DBF *dbf) {
+    uint32_t count = dbf->header.record_count;
+    uint16_t size = dbf->header.record_size;
+    uint32_t chunk = (uint32_t)(DBF_READAHEAD_BYTES / size) + 1;
+    uint8_t *buffer = dbf->map ? NULL : xmalloc((size_t)chunk * size);
+
+    blooms_clear(dbf);
+    blooms_reserve(dbf->blooms, zone_blocks(count));
+
+    for (uint32_t first = 1; first <= count; first += chunk) {
+        uint32_t n = count - first + 1 < chunk ? count - first + 1 : chunk;
+        const uint8_t *src;
+
+        if (dbf->map) {
+            src = dbf->map + dbf->header.header_size + record_offset(dbf, first);
+        } else if (dbf->xcol ? snapshot_records(dbf, first, n, buffer) :
+                   bufpool_read(dbf->pool, record_offset(dbf, first), buffer, (size_t)n * size)) {
+            src = buffer;
+        } else {
+            xfree(buffer);
+            dbf->blooms->built = false;
+            error_set(ERR_FILE_READ, "Cannot read %s", dbf->filename);
+            return false;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            blooms_add(dbf, first + i, src + (size_t)i * size);
+        }
+    }
+
+    xfree(buffer);
+
+    /* The current record may hold values that are not written yet */
+    if (dbf->modified && dbf->current_record >= 1 && dbf->current_record <= count) {
+        blooms_add(dbf, dbf->current_record, dbf->record_buffer);
+    }
 
     return true;
 }
 
-/* Flush changes to disk */
-bool dbf_flush(DBF *dbf) {
+static bool blooms_ready(DBF *dbf) {
+    return dbf->blooms && (dbf->blooms->built || blooms_build(dbf));
+}
+
+static void blooms_path(const DBF *dbf, char *path) {
+    strncpy(path, dbf->filename, MAX_PATH_LEN - 5);
+    path[MAX_PATH_LEN - 5] = '\0';
+    file_change_ext(path, ".xbl");
+}
+
+/* Load the field list of the sidecar, and its filters if they match the
+ * table; otherwise they are rebuilt on first use */
+static void blooms_load(DBF *dbf) {
+    char path[MAX_PATH_LEN];
+    uint8_t header[XBL_HEADER_SIZE];
+    uint8_t stamp[XBL_HEADER_SIZE];
+    uint8_t names[DBF_BLOOM_FIELDS * XBL_NAME_SIZE];
+
+    blooms_path(dbf, path);
+    int fd = open(path, dbf->readonly ? O_RDONLY : O_RDWR);
+    if (fd < 0) return;
+
+    uint16_t count = 0;
+    if (pread(fd, header, XBL_HEADER_SIZE, 0) != XBL_HEADER_SIZE ||
+        memcmp(header, XBL_MAGIC, 4) != 0 ||
+        (count = read_u16_le(&header[8])) == 0 || count > DBF_BLOOM_FIELDS ||
+        pread(fd, names, (size_t)count * XBL_NAME_SIZE, XBL_HEADER_SIZE) !=
+            (ssize_t)(count * XBL_NAME_SIZE)) {
+        close(fd);
+        return;
+    }
+
+    DBFBlooms *blooms = xcalloc(1, sizeof(DBFBlooms));
+    bool complete = true;
+    for (uint16_t i = 0; i < count; i++) {
+        char name[XBL_NAME_SIZE + 1];
+        memcpy(name, &names[i * XBL_NAME_SIZE], XBL_NAME_SIZE);
+        name[XBL_NAME_SIZE] = '\0';
+
+        int field = dbf_field_index(dbf, name);
+        if (field >= 0 && dbf->fields[field].type == FIELD_TYPE_CHAR) {
+            blooms->fields[blooms->count++] = field;
+        } else {
+            complete = false;
+        }
+    }
+    if (blooms->count == 0) {
+        xfree(blooms);
+        close(fd);
+        return;
+    }
+    dbf->blooms = blooms;
+
+    uint32_t blocks = zone_blocks(dbf->header.record_count);
+    size_t bytes = (size_t)blocks * count * DBF_BLOOM_BYTES;
+    if (complete &&
+        header[14] == XDM_SEALED &&
+        read_u32_le(&header[4]) == dbf->header.record_count &&
+        read_u16_le(&header[10]) == dbf->header.record_size &&
+        read_u16_le(&header[12]) == (uint16_t)dbf->field_count &&
+        sidecar_stamp(dbf, stamp) &&
+        memcmp(&header[16], &stamp[16], 16) == 0) {
+        blooms_reserve(blooms, blocks);
+        if (!bytes || pread(fd, blooms->bits, bytes, (off_t)(XBL_HEADER_SIZE + count * XBL_NAME_SIZE)) ==
+                      (ssize_t)bytes) {
+            blooms->blocks = blocks;
+            blooms->built = true;
+            blooms->sealed = !dbf->readonly;
+        }
+    }
+
+    if (dbf->readonly) {
+        close(fd);
+        blooms->fd = -1;
+    } else {
+        blooms->fd = fd;
+    }
+}
+
+/* Mark the sidecar as not current before the table is first changed after
+ * a save */
+static void blooms_unseal(DBF *dbf) {
+    DBFBlooms *blooms = dbf->blooms;
+    if (!blooms || !blooms->sealed) return;
+
+    uint8_t state = 0;
+    if (pwrite(blooms->fd, &state, 1, 14) != 1) {
+        close(blooms->fd);
+        blooms->fd = -1;
+    }
+    blooms->sealed = false;
+}
+
+/* Write the field list and filters, then the header that vouches for them.
+ * Filters not rebuilt since a stale load are left for the next open. */
+static void blooms_save(DBF *dbf) {
+    DBFBlooms *blooms = dbf->blooms;
+    if (!blooms || dbf->readonly || !blooms->built || (blooms->sealed && !blooms->dirty)) return;
+
+    if (blooms->fd < 0) {
+        char path[MAX_PATH_LEN];
+        blooms_path(dbf, path);
+        blooms->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (blooms->fd < 0) return;
+    }
+
+    uint32_t blocks = zone_blocks(dbf->header.record_count);
+    size_t names = (size_t)blooms->count * XBL_NAME_SIZE;
+    size_t bytes = (size_t)blocks * blooms->count * DBF_BLOOM_BYTES;
+    uint8_t header[XBL_HEADER_SIZE] = {0};
+    uint8_t list[DBF_BLOOM_FIELDS * XBL_NAME_SIZE] = {0};
+
+    for (int i = 0; i < blooms->count; i++) {
+        strncpy((char *)&list[i * XBL_NAME_SIZE], dbf->fields[blooms->fields[i]].name, XBL_NAME_SIZE);
+    }
+    blooms_reserve(blooms, blocks);
+
+    if (pwrite(blooms->fd, list, names, XBL_HEADER_SIZE) != (ssize_t)names ||
+        (bytes && pwrite(blooms->fd, blooms->bits, bytes, (off_t)(XBL_HEADER_SIZE + names)) !=
+                  (ssize_t)bytes)) {
+        return;
+    }
+
+    memcpy(header, XBL_MAGIC, 4);
+    write_u32_le(&header[4], dbf->header.record_count);
+    write_u16_le(&header[8], (uint16_t)blooms->count);
+    write_u16_le(&header[10], dbf->header.record_size);
+    write_u16_le(&header[12], (uint16_t)dbf->field_count);
+    header[14] = XDM_SEALED;
+    if (!sidecar_stamp(dbf, header)) return;
+
+    if (ftruncate(blooms->fd, (off_t)(XBL_HEADER_SIZE + names + bytes)) != 0 ||
+        pwrite(blooms->fd, header, XBL_HEADER_SIZE, 0) != XBL_HEADER_SIZE) {
+        return;
+    }
+
+    blooms->dirty = false;
+    blooms->sealed = true;
+}
+
+bool dbf_bloom_add(DBF *dbf, int field_index) {
     if (!dbf) return false;
+    if (field_index < 0 || field_index >= dbf->field_count ||
+        dbf->fields[field_index].type != FIELD_TYPE_CHAR) {
+        error_set(ERR_TYPE_MISMATCH, "Bloom filters need a character field");
+        return false;
+    }
+    if (bloom_slot(dbf->blooms, field_index) >= 0) return true;
+    if (dbf->blooms && dbf->blooms->count == DBF_BLOOM_FIELDS) {
+        error_set(ERR_OVERFLOW, "At most %d fields can have Bloom filters", DBF_BLOOM_FIELDS);
+        return false;
+    }
 
-    if (dbf->modified) {
-        if (!write_record(dbf)) return false;
+    if (!dbf->blooms) {
+        dbf->blooms = xcalloc(1, sizeof(DBFBlooms));
+        dbf->blooms->fd = -1;
     }
 
-    fflush(dbf->fp);
+    /* The layout changes with the field count; start the filters afresh */
+    DBFBlooms *blooms = dbf->blooms;
+    blooms_unseal(dbf);
+    xfree(blooms->bits);
+    blooms->bits = NULL;
+    blooms->capacity = 0;
+    blooms->fields[blooms->count++] = field_index;
+    return blooms_build(dbf);
+}
+
+bool dbf_bloom_drop(DBF *dbf, int field_index) {
+    if (!dbf || !dbf->blooms) return true;
+
+    DBFBlooms *blooms = dbf->blooms;
+    int slot = bloom_slot(blooms, field_index);
+    if (field_index >= 0 && slot < 0) return true;
+
+    if (field_index < 0 || blooms->count == 1) {
+        char path[MAX_PATH_LEN];
+        blooms_free(blooms);
+        dbf->blooms = NULL;
+        if (!dbf->readonly) {
+            blooms_path(dbf, path);
+            unlink(path);
+        }
+        return true;
+    }
+
+    /* Close up the dropped filter in every block */
+    blooms_unseal(dbf);
+    size_t stride = (size_t)blooms->count * DBF_BLOOM_BYTES;
+    size_t kept = stride - DBF_BLOOM_BYTES;
+    for (uint32_t b = 0; b < blooms->capacity; b++) {
+        uint8_t *src = blooms->bits + b * stride;
+        uint8_t *dst = blooms->bits + b * kept;
+        memmove(dst, src, (size_t)slot * DBF_BLOOM_BYTES);
+        memmove(dst + (size_t)slot * DBF_BLOOM_BYTES, src + (size_t)(slot + 1) * DBF_BLOOM_BYTES,
+                (size_t)(blooms->count - slot - 1) * DBF_BLOOM_BYTES);
+    }
+    memmove(&blooms->fields[slot], &blooms->fields[slot + 1],
+            sizeof(int) * (size_t)(blooms->count - slot - 1));
+    blooms->count--;
+    blooms->dirty = true;
     return true;
 }
 
-/* Field access */
-int dbf_field_index(DBF *dbf, const char *name) {
-    if (!dbf || !name) return -1;
+/*
+ * In-memory columns
+ */
 
-    for (int i = 0; i < dbf->field_count; i++) {
-        if (str_casecmp(dbf->fields[i].name, name) == 0) {
-            return i;
+/* One decoded field across every record */
+typedef struct {
+    double *num;               /* N: values */
+    int32_t *jdn;              /* D: julian day numbers (0 = blank, -1 = not a date) */
+    uint8_t *bits;             /* L: one bit per record, set for true */
+    size_t *offset;            /* C, M: start of each value in the arena */
+    uint8_t *length;           /* C, M: value length without trailing blanks */
+    char *arena;               /* C, M: concatenated values */
+    size_t arena_used;
+    size_t arena_capacity;
+    bool unread;               /* Snapshot field not decoded yet */
+} DBFColumn;
+
+struct DBFColumns {
+    DBFColumn *cols;           /* One per field */
+    uint32_t count;            /* Records decoded */
+    uint32_t capacity;         /* Records the arrays have room for */
+};
+
+/* Julian day number of a YYYYMMDD date (0 for blanks, -1 if not a date) */
+static int32_t date_to_jdn(const uint8_t *p) {
+    if (p[0] == ' ') return 0;
+
+    char date[9];
+    memcpy(date, p, 8);
+    date[8] = '\0';
+    return date_valid(date) ? (int32_t)date_to_julian(date) : -1;
+}
+
+/* YYYYMMDD text (NUL-terminated) of a julian day number */
+static void jdn_to_date(int32_t jdn, char *out) {
+    if (jdn <= 0) {
+        memset(out, ' ', 8);
+        out[8] = '\0';
+        return;
+    }
+    date_from_julian(out, jdn);
+}
+
+static void columns_free(DBFColumns *columns, int field_count) {
+    if (!columns) return;
+    for (int f = 0; f < field_count; f++) {
+        DBFColumn *col = &columns->cols[f];
+        xfree(col->num);
+        xfree(col->jdn);
+        xfree(col->bits);
+        xfree(col->offset);
+        xfree(col->length);
+        xfree(col->arena);
+    }
+    xfree(columns->cols);
+    xfree(columns);
+}
+
+/* Make room for 'records' records in every column */
+static void columns_reserve(DBF *dbf, uint32_t records) {
+    DBFColumns *columns = dbf->columns;
+    if (records <= columns->capacity) return;
+
+    uint32_t capacity = columns->capacity ? columns->capacity : 1024;
+    while (capacity < records) capacity *= 2;
+
+    for (int f = 0; f < dbf->field_count; f++) {
+        DBFColumn *col = &columns->cols[f];
+        switch (dbf->fields[f].type) {
+            case FIELD_TYPE_NUMERIC:
+                col->num = xrealloc(col->num, sizeof(double) * capacity);
+                break;
+            case FIELD_TYPE_DATE:
+                col->jdn = xrealloc(col->jdn, sizeof(int32_t) * capacity);
+                break;
+            case FIELD_TYPE_LOGICAL:
+                col->bits = xrealloc(col->bits, delmap_bytes(capacity));
+                memset(col->bits + delmap_bytes(columns->capacity), 0,
+                       delmap_bytes(capacity) - delmap_bytes(columns->capacity));
+                break;
+            default:
+                col->offset = xrealloc(col->offset, sizeof(size_t) * capacity);
+                col->length = xrealloc(col->length, capacity);
+                break;
         }
     }
+    columns->capacity = capacity;
+}
 
-    return -1;
+/* Decode field 'f' of a raw record into slot 'index'; 'fresh' slots have
+ * no earlier character value to overwrite */
+static void column_store(DBF *dbf, int f, uint32_t index, const uint8_t *record, bool fresh) {
+    const DBFField *field = &dbf->fields[f];
+    DBFColumn *col = &dbf->columns->cols[f];
+    const uint8_t *p = record + field->offset;
+
+    switch (field->type) {
+        case FIELD_TYPE_NUMERIC:
+            if (!dbf_decode_numeric(p, field->length, &col->num[index])) col->num[index] = 0;
+            break;
+        case FIELD_TYPE_DATE:
+            col->jdn[index] = date_to_jdn(p);
+            break;
+        case FIELD_TYPE_LOGICAL:
+            if (p[0] == 'T' || p[0] == 't' || p[0] == 'Y' || p[0] == 'y') {
+                col->bits[index >> 3] |= (uint8_t)(1u << (index & 7));
+            } else {
+                col->bits[index >> 3] &= (uint8_t)~(1u << (index & 7));
+            }
+            break;
+        default: {
+            size_t len = dbf_view_trim_right(p, field->length);
+
+            /* A value that fits reuses its slot; others go at the end */
+            if (fresh || len > col->length[index]) {
+                if (col->arena_used + len > col->arena_capacity) {
+                    size_t capacity = col->arena_capacity ? col->arena_capacity : 4096;
+                    while (capacity < col->arena_used + len) capacity *= 2;
+                    col->arena = xrealloc(col->arena, capacity);
+                    col->arena_capacity = capacity;
+                }
+                col->offset[index] = col->arena_used;
+                col->arena_used += len;
+            }
+            if (len) memcpy(col->arena + col->offset[index], p, len);
+            col->length[index] = (uint8_t)len;
+            break;
+        }
+    }
 }
 
-const DBFField *dbf_field_info(DBF *dbf, int index) {
-    if (!dbf || index < 0 || index >= dbf->field_count) return NULL;
-    return &dbf->fields[index];
+/* Decode 'n' raw records that follow the decoded ones */
+static void columns_add(DBF *dbf, const uint8_t *records, uint32_t n) {
+    DBFColumns *columns = dbf->columns;
+    columns_reserve(dbf, columns->count + n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const uint8_t *record = records + (size_t)i * dbf->header.record_size;
+        for (int f = 0; f < dbf->field_count; f++) {
+            column_store(dbf, f, columns->count, record, true);
+        }
+        columns->count++;
+    }
+}
+
+/* Decode every record of the table */
+static bool columns_build(DBF *dbf) {
+    uint32_t count = dbf->header.record_count;
+    uint16_t size = dbf->header.record_size;
+    uint32_t chunk = (uint32_t)(DBF_READAHEAD_BYTES / size) + 1;
+    uint8_t *buffer = dbf->map ? NULL : xmalloc((size_t)chunk * size);
+
+    columns_free(dbf->columns, dbf->field_count);
+    dbf->columns = xcalloc(1, sizeof(DBFColumns));
+    dbf->columns->cols = xcalloc((size_t)dbf->field_count, sizeof(DBFColumn));
+    columns_reserve(dbf, count);
+
+    for (uint32_t first = 1; first <= count; first += chunk) {
+        uint32_t n = count - first + 1 < chunk ? count - first + 1 : chunk;
+
+        if (dbf->map) {
+            columns_add(dbf, dbf->map + dbf->header.header_size + record_offset(dbf, first), n);
+        } else if (bufpool_read(dbf->pool, record_offset(dbf, first), buffer, (size_t)n * size)) {
+            columns_add(dbf, buffer, n);
+        } else {
+            xfree(buffer);
+            columns_free(dbf->columns, dbf->field_count);
+            dbf->columns = NULL;
+            error_set(ERR_FILE_READ, "Cannot read %s", dbf->filename);
+            return false;
+        }
+    }
+
+    xfree(buffer);
+    return true;
+}
+
+/*
+ * Columnar snapshots
+ */
+
+/* Decode one field of a snapshot into its column */
+static bool column_read(DBF *dbf, int f) {
+    DBFColumn *col = &dbf->columns->cols[f];
+    uint32_t capacity = dbf->columns->capacity ? dbf->columns->capacity : 1;
+    bool ok;
+
+    switch (dbf->fields[f].type) {
+        case FIELD_TYPE_NUMERIC:
+            col->num = xmalloc(sizeof(double) * capacity);
+            ok = xcol_read_numbers(dbf->xcol, f, col->num);
+            break;
+        case FIELD_TYPE_DATE:
+            col->jdn = xmalloc(sizeof(int32_t) * capacity);
+            ok = xcol_read_dates(dbf->xcol, f, col->jdn);
+            break;
+        case FIELD_TYPE_LOGICAL:
+            col->bits = xcalloc(delmap_bytes(capacity), 1);
+            ok = xcol_read_bits(dbf->xcol, f, col->bits);
+            break;
+        default:
+            col->offset = xmalloc(sizeof(size_t) * capacity);
+            col->length = xmalloc(capacity);
+            ok = xcol_read_strings(dbf->xcol, f, col->offset, col->length,
+                                   &col->arena, &col->arena_used);
+            col->arena_capacity = col->arena_used;
+            break;
+    }
+
+    if (!ok) {
+        xfree(col->num);
+        xfree(col->jdn);
+        xfree(col->bits);
+        xfree(col->offset);
+        xfree(col->length);
+        memset(col, 0, sizeof(DBFColumn));
+        col->unread = true;
+        return false;
+    }
+
+    col->unread = false;
+    return true;
+}
+
+/* Encode records 'first'..'first + n - 1' of a snapshot into 'dst' */
+static bool snapshot_records(DBF *dbf, uint32_t first, uint32_t n, uint8_t *dst) {
+    for (int f = 0; f < dbf->field_count; f++) {
+        if (dbf->columns->cols[f].unread && !column_read(dbf, f)) return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *record = dst + (size_t)i * dbf->header.record_size;
+        uint32_t index = first + i - 1;
+
+        record[0] = delmap_test(dbf, first + i) ? DBF_RECORD_DELETED : DBF_RECORD_ACTIVE;
+        for (int f = 0; f < dbf->field_count; f++) {
+            const DBFField *field = &dbf->fields[f];
+            const DBFColumn *col = &dbf->columns->cols[f];
+            uint8_t *p = record + field->offset;
+
+            switch (field->type) {
+                case FIELD_TYPE_NUMERIC:
+                    dbf_encode_numeric(col->num[index], p, field->length, field->decimals);
+                    break;
+                case FIELD_TYPE_DATE: {
+                    char date[9];
+                    jdn_to_date(col->jdn[index], date);
+                    memcpy(p, date, 8);
+                    break;
+                }
+                case FIELD_TYPE_LOGICAL:
+                    p[0] = (col->bits[index >> 3] >> (index & 7)) & 1 ? 'T' : 'F';
+                    break;
+                default:
+                    memset(p, ' ', field->length);
+                    if (col->length[index]) {
+                        memcpy(p, col->arena + col->offset[index], col->length[index]);
+                    }
+                    break;
+            }
+        }
+    }
+    return true;
+}
+
+/* Column of a field of the current record, or NULL when the table is not
+ * in memory or there is no current record */
+static DBFColumn *current_column(DBF *dbf, int field_index) {
+    if (!dbf->columns || dbf->current_record == 0 || dbf->eof) return NULL;
+    if (dbf->current_record > dbf->columns->count) return NULL;
+
+    DBFColumn *col = &dbf->columns->cols[field_index];
+    if (col->unread && !column_read(dbf, field_index)) return NULL;
+    return col;
+}
+
+/* Read current record into buffer */
+static bool fetch_record(DBF *dbf) {
+    uint32_t recno = dbf->current_record;
+
+    if (dbf->map) {
+        memcpy(dbf->record_buffer,
+               dbf->map + dbf->header.header_size + record_offset(dbf, recno),
+               dbf->header.record_size);
+    } else if (dbf->xcol) {
+        if (!snapshot_records(dbf, recno, 1, dbf->record_buffer)) return false;
+    } else {
+        read_ahead(dbf, recno);
+        if (!bufpool_read(dbf->pool, record_offset(dbf, recno),
+                          dbf->record_buffer, dbf->header.record_size)) {
+            return false;
+        }
+    }
+
+    dbf->last_read = recno;
+
+    dbf->deleted = (dbf->record_buffer[0] == DBF_RECORD_DELETED);
+    dbf->modified = false;
+    dbf->loaded = true;
+
+    return true;
+}
+
+/* Move to the current record. In-memory tables answer field reads from
+ * their columns, so the record itself is fetched only when needed. */
+static bool read_record(DBF *dbf) {
+    if (dbf->current_record == 0 || dbf->current_record > dbf->header.record_count) {
+        return false;
+    }
+
+    if (dbf->columns) {
+        dbf->loaded = false;
+        dbf->deleted = delmap_ready(dbf) && delmap_test(dbf, dbf->current_record);
+        dbf->modified = false;
+        return true;
+    }
+
+    return fetch_record(dbf);
+}
+
+/* Make sure the record buffer holds the current record */
+static bool record_ready(DBF *dbf) {
+    if (!dbf->columns || dbf->loaded || dbf->current_record == 0 ||
+        dbf->current_record > dbf->header.record_count) {
+        return true;
+    }
+    return fetch_record(dbf);
+}
+
+/* Write current record from buffer */
+static bool write_record(DBF *dbf) {
+    if (dbf->readonly) {
+        error_set(ERR_FILE_WRITE, "Database is read-only");
+        return false;
+    }
+
+    if (dbf->current_record == 0 || dbf->current_record > dbf->header.record_count) {
+        return false;
+    }
+
+    uint64_t offset = record_offset(dbf, dbf->current_record);
+    delmap_unseal(dbf);
+    zones_unseal(dbf);
+    blooms_unseal(dbf);
+    if (dbf->zones) zones_widen(dbf, dbf->current_record, dbf->record_buffer);
+    if (dbf->blooms) blooms_add(dbf, dbf->current_record, dbf->record_buffer);
+
+    /* An online PACK copies this record again when it finishes */
+    if (dbf->packer && dbf->current_record <= dbf->packer->snapshot) {
+        uint32_t bit = dbf->current_record - 1;
+        dbf->packer->dirty[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    }
+
+    if (dbf->map) {
+        memcpy(dbf->map + dbf->header.header_size + offset,
+               dbf->record_buffer, dbf->header.record_size);
+    } else if (!bufpool_write(dbf->pool, offset, dbf->record_buffer,
+                              dbf->header.record_size)) {
+        return false;
+    }
+
+    dbf->modified = false;
+    dbf->pending = true;
+    return true;
+}
+
+/* Write the EOF marker after the last record */
+static bool write_eof_marker(DBF *dbf) {
+    uint8_t eof = DBF_EOF_MARKER;
+    uint64_t offset = (uint64_t)dbf->header.record_count * dbf->header.record_size;
+
+    if (dbf->map) {
+        if (fseek(dbf->fp, (long)(dbf->header.header_size + offset), SEEK_SET) != 0) return false;
+        return fwrite(&eof, 1, 1, dbf->fp) == 1;
+    }
+
+    bufpool_truncate(dbf->pool, offset);
+    return bufpool_write(dbf->pool, offset, &eof, 1);
+}
+
+/* Open existing DBF file */
+DBF *dbf_open(const char *filename, bool readonly) {
+    DBF *dbf = xcalloc(1, sizeof(DBF));
+
+    dbf->fp = fopen(filename, readonly ? "rb" : "r+b");
+    if (!dbf->fp) {
+        error_set(ERR_FILE_NOT_FOUND, "%s", filename);
+        xfree(dbf);
+        return NULL;
+    }
+
+    strncpy(dbf->filename, filename, MAX_PATH_LEN - 1);
+    dbf->readonly = readonly;
+
+    /* Read header */
+    if (!read_header(dbf)) {
+        fclose(dbf->fp);
+        xfree(dbf);
+        return NULL;
+    }
+
+    /* Read field descriptors */
+    if (!read_fields(dbf)) {
+        fclose(dbf->fp);
+        xfree(dbf->fields);
+        xfree(dbf);
+        return NULL;
+    }
+
+    /* Allocate record buffer */
+    dbf->record_buffer = xcalloc(dbf->header.record_size, 1);
+
+    /* Records are read and written through the shared buffer pool */
+    pool_attach(dbf);
+
+    /* Deletion flags come from the sidecar when it is current */
+    dbf->delmap_fd = -1;
+    delmap_load(dbf);
+    zones_load(dbf);
+    blooms_load(dbf);
+
+    /* Set alias from filename */
+    set_default_alias(dbf);
+
+    /* Position at first record */
+    dbf->current_record = 0;
+    dbf->bof = true;
+    dbf->eof = (dbf->header.record_count == 0);
+
+    if (dbf->header.record_count > 0) {
+        dbf_go_top(dbf);
+    }
+
+    open_register(dbf);
+    return dbf;
+}
+
+/* Open existing DBF file with records read through a memory mapping */
+DBF *dbf_open_mmap(const char *filename, bool readonly) {
+    DBF *dbf = dbf_open(filename, readonly);
+    if (!dbf) return NULL;
+
+    if (!map_file(dbf)) {
+        dbf_close(dbf);
+        return NULL;
+    }
+
+    /* The mapping replaces the buffer pool for this table */
+    if (!bufpool_detach(dbf->pool)) {
+        dbf_close(dbf);
+        return NULL;
+    }
+    dbf->pool = NULL;
+
+    /* Reload the current record through the mapping */
+    if (dbf->current_record > 0) {
+        dbf_goto(dbf, dbf->current_record);
+    }
+
+    return dbf;
+}
+
+/* Open existing DBF file with every field decoded into memory */
+DBF *dbf_open_inmemory(const char *filename, bool readonly) {
+    DBF *dbf = dbf_open(filename, readonly);
+    if (!dbf) return NULL;
+
+    /* Deletion flags come from the bitmap once records are not read */
+    if (!delmap_ready(dbf) || !columns_build(dbf)) {
+        dbf_close(dbf);
+        return NULL;
+    }
+
+    if (dbf->current_record > 0) {
+        dbf_goto(dbf, dbf->current_record);
+    }
+
+    return dbf;
+}
+
+/* Open a columnar snapshot as a read-only in-memory table */
+DBF *dbf_open_xcol(const char *filename) {
+    XCol *xcol = xcol_open(filename);
+    if (!xcol) return NULL;
+
+    DBF *dbf = xcalloc(1, sizeof(DBF));
+    dbf->xcol = xcol;
+    strncpy(dbf->filename, filename, MAX_PATH_LEN - 1);
+    dbf->readonly = true;
+    dbf->delmap_fd = -1;
+
+    dbf->field_count = xcol_field_count(xcol);
+    dbf->fields = xmalloc(sizeof(DBFField) * (size_t)dbf->field_count);
+    memcpy(dbf->fields, xcol_fields(xcol), sizeof(DBFField) * (size_t)dbf->field_count);
+
+    uint32_t count = xcol_record_count(xcol);
+    dbf->header.version = DBF_VERSION_DBASE3;
+    dbf->header.record_count = count;
+    dbf->header.header_size = (uint16_t)(32 + 32 * dbf->field_count + 1);
+    dbf->header.record_size = xcol_record_size(xcol);
+    dbf->record_buffer = xcalloc(dbf->header.record_size, 1);
+
+    /* Deletion flags are read now, the fields when first used */
+    delmap_reserve(dbf, count);
+    if (!xcol_read_bits(xcol, -1, dbf->delmap)) {
+        dbf_close(dbf);
+        return NULL;
+    }
+    for (size_t i = 0; i < delmap_bytes(count); i++) {
+        for (uint8_t bits = dbf->delmap[i]; bits; bits &= (uint8_t)(bits - 1)) {
+            dbf->deleted_count++;
+        }
+    }
+
+    dbf->columns = xcalloc(1, sizeof(DBFColumns));
+    dbf->columns->cols = xcalloc((size_t)dbf->field_count, sizeof(DBFColumn));
+    dbf->columns->count = count;
+    dbf->columns->capacity = count;
+    for (int f = 0; f < dbf->field_count; f++) {
+        dbf->columns->cols[f].unread = true;
+    }
+
+    set_default_alias(dbf);
+
+    dbf->current_record = 0;
+    dbf->bof = true;
+    dbf->eof = (count == 0);
+    if (count > 0) {
+        dbf_go_top(dbf);
+    }
+
+    return dbf;
+}
+
+/* Create new DBF file */
+DBF *dbf_create(const char *filename, const DBFField *fields, int field_count) {
+    if (field_count <= 0 || field_count > MAX_FIELDS) {
+        error_set(ERR_INVALID_FIELD, "Invalid field count");
+        return NULL;
+    }
+
+    DBF *dbf = xcalloc(1, sizeof(DBF));
+
+    dbf->fp = fopen(filename, "w+b");
+    if (!dbf->fp) {
+        error_set(ERR_FILE_CREATE, "%s", filename);
+        xfree(dbf);
+        return NULL;
+    }
+
+    strncpy(dbf->filename, filename, MAX_PATH_LEN - 1);
+    dbf->readonly = false;
+
+    /* Initialize header */
+    dbf->header.version = DBF_VERSION_DBASE3;
+    dbf->header.record_count = 0;
+    dbf->header.header_size = (uint16_t)(32 + field_count * 32 + 1);
+
+    /* Copy and validate fields, calculate record size */
+    dbf->fields = xcalloc((size_t)field_count, sizeof(DBFField));
+    dbf->field_count = field_count;
+
+    uint16_t record_size = 1;  /* Delete flag */
+    for (int i = 0; i < field_count; i++) {
+        DBFField *dst = &dbf->fields[i];
+        const DBFField *src = &fields[i];
+
+        strncpy(dst->name, src->name, MAX_FIELD_NAME - 1);
+        str_upper(dst->name);
+        dst->type = (char)toupper(src->type);
+        dst->length = src->length;
+        dst->decimals = src->decimals;
+        dst->offset = record_size;
+
+        /* Validate field */
+        switch (dst->type) {
+            case FIELD_TYPE_CHAR:
+                if (dst->length == 0 || dst->length > MAX_FIELD_LEN) {
+                    error_set(ERR_INVALID_FIELD, "Invalid character field length");
+                    goto error;
+                }
+                break;
+            case FIELD_TYPE_NUMERIC:
+                if (dst->length == 0 || dst->length > 20) {
+                    error_set(ERR_INVALID_FIELD, "Invalid numeric field length");
+                    goto error;
+                }
+                break;
+            case FIELD_TYPE_DATE:
+                dst->length = 8;
+                dst->decimals = 0;
+                break;
+            case FIELD_TYPE_LOGICAL:
+                dst->length = 1;
+                dst->decimals = 0;
+                break;
+            case FIELD_TYPE_MEMO:
+                dst->length = 10;
+                dst->decimals = 0;
+                break;
+            default:
+                error_set(ERR_INVALID_FIELD, "Unknown field type: %c", dst->type);
+                goto error;
+        }
+
+        record_size += dst->length;
+    }
+
+    dbf->header.record_size = record_size;
+
+    /* Write header */
+    if (!write_header(dbf)) goto error;
+
+    /* Write field descriptors */
+    if (!write_fields(dbf)) goto error;
+
+    /* Write EOF marker */
+    uint8_t eof = DBF_EOF_MARKER;
+    if (fwrite(&eof, 1, 1, dbf->fp) != 1) goto error;
+
+    fflush(dbf->fp);
+
+    /* Allocate record buffer */
+    dbf->record_buffer = xcalloc(dbf->header.record_size, 1);
+
+    pool_attach(dbf);
+
+    /* A new table starts with an empty bitmap */
+    dbf->delmap_fd = -1;
+    delmap_clear(dbf, 0);
+
+    /* Set alias from filename */
+    set_default_alias(dbf);
+
+    dbf->current_record = 0;
+    dbf->bof = true;
+    dbf->eof = true;
+
+    open_register(dbf);
+    return dbf;
+
+error:
+    fclose(dbf->fp);
+    xfree(dbf->fields);
+    xfree(dbf);
+    return NULL;
+}
+
+/* Detach an online PACK from its table; its finish step will fail */
+static void pack_abandon(DBF *dbf) {
+    if (dbf->packer) {
+        dbf->packer->dbf = NULL;
+        dbf->packer = NULL;
+    }
+}
+
+/* Close DBF file; false if pending changes could not be written */
+bool dbf_close(DBF *dbf) {
+    if (!dbf) return true;
+
+    bool ok = true;
+    open_unregister(dbf);
+    pack_abandon(dbf);
+
+    if (dbf->modified || dbf->pending) {
+        ok = dbf_commit(dbf);
+    }
+    if (dbf->delmap_dirty) {
+        delmap_save(dbf);
+    }
+    if (dbf->delmap_fd >= 0) {
+        close(dbf->delmap_fd);
+    }
+    zones_save(dbf);
+    zones_free(dbf->zones);
+    blooms_save(dbf);
+    blooms_free(dbf->blooms);
+
+    unmap_file(dbf);
+    if (!bufpool_detach(dbf->pool)) {
+        /* The table is going away, so the unwritten pages go with it */
+        error_set(ERR_FILE_WRITE, "Cannot write back %s", dbf->filename);
+        bufpool_truncate(dbf->pool, 0);
+        bufpool_detach(dbf->pool);
+        ok = false;
+    }
+
+    if (dbf->fp) {
+        if (fflush(dbf->fp) != 0) {
+            error_set(ERR_FILE_WRITE, "Cannot write %s", dbf->filename);
+            ok = false;
+        }
+        fclose(dbf->fp);
+    }
+
+    columns_free(dbf->columns, dbf->field_count);
+    xcol_close(dbf->xcol);
+    xfree(dbf->record_buffer);
+    xfree(dbf->delmap);
+    xfree(dbf->fields);
+    xfree(dbf);
+    return ok;
+}
+
+/* Navigation functions */
+bool dbf_goto(DBF *dbf, uint32_t recno) {
+    if (!dbf) return false;
+
+    /* Flush any pending changes */
+    if (dbf->modified) {
+        write_record(dbf);
+    }
+
+    if (recno == 0) {
+        dbf->current_record = 0;
+        dbf->bof = true;
+        dbf->eof = false;
+        memset(dbf->record_buffer, ' ', dbf->header.record_size);
+        dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
+        dbf->loaded = true;
+        return true;
+    }
+
+    if (recno > dbf->header.record_count) {
+        dbf->current_record = dbf->header.record_count + 1;
+        dbf->bof = false;
+        dbf->eof = true;
+        memset(dbf->record_buffer, ' ', dbf->header.record_size);
+        dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
+        dbf->loaded = true;
+        return true;
+    }
+
+    dbf->current_record = recno;
+    dbf->bof = false;
+    dbf->eof = false;
+
+    return read_record(dbf);
+}
+
+/* SKIP under SET DELETED ON: step over deleted records with the bitmap */
+static bool skip_active(DBF *dbf, int count) {
+    uint32_t recno = dbf->current_record;
+
+    /* Flag the current record before consulting the bitmap */
+    if (dbf->modified) {
+        write_record(dbf);
+    }
+
+    for (; count > 0; count--) {
+        recno = recno >= dbf->header.record_count ? 0 : next_active(dbf, recno + 1);
+        if (recno == 0) return dbf_goto(dbf, dbf->header.record_count + 1);
+    }
+    for (; count < 0; count++) {
+        recno = recno <= 1 ? 0 : prev_active(dbf, recno - 1);
+        if (recno == 0) return dbf_goto(dbf, 0);
+    }
+
+    return dbf_goto(dbf, recno);
+}
+
+bool dbf_skip(DBF *dbf, int count) {
+    if (!dbf) return false;
+
+    if (count == 0) return true;
+
+    if (g_skip_deleted && delmap_ready(dbf)) {
+        return skip_active(dbf, count);
+    }
+
+    uint32_t new_recno;
+    if (count > 0) {
+        new_recno = dbf->current_record + (uint32_t)count;
+    } else {
+        if ((uint32_t)(-count) >= dbf->current_record) {
+            new_recno = 0;
+        } else {
+            new_recno = dbf->current_record - (uint32_t)(-count);
+        }
+    }
+
+    return dbf_goto(dbf, new_recno);
+}
+
+bool dbf_go_top(DBF *dbf) {
+    if (!dbf) return false;
+
+    if (dbf->header.record_count == 0) {
+        dbf->bof = true;
+        dbf->eof = true;
+        dbf->current_record = 0;
+        return true;
+    }
+
+    if (g_skip_deleted && delmap_ready(dbf)) {
+        uint32_t recno = next_active(dbf, 1);
+        return dbf_goto(dbf, recno ? recno : dbf->header.record_count + 1);
+    }
+
+    return dbf_goto(dbf, 1);
+}
+
+bool dbf_go_bottom(DBF *dbf) {
+    if (!dbf) return false;
+
+    if (dbf->header.record_count == 0) {
+        dbf->bof = true;
+        dbf->eof = true;
+        dbf->current_record = 0;
+        return true;
+    }
+
+    if (g_skip_deleted && delmap_ready(dbf)) {
+        uint32_t recno = prev_active(dbf, dbf->header.record_count);
+        return dbf_goto(dbf, recno ? recno : dbf->header.record_count + 1);
+    }
+
+    return dbf_goto(dbf, dbf->header.record_count);
+}
+
+/* Status functions */
+bool dbf_eof(DBF *dbf) {
+    return dbf ? dbf->eof : true;
+}
+
+bool dbf_bof(DBF *dbf) {
+    return dbf ? dbf->bof : true;
+}
+
+uint32_t dbf_recno(DBF *dbf) {
+    return dbf ? dbf->current_record : 0;
+}
+
+uint32_t dbf_reccount(DBF *dbf) {
+    return dbf ? dbf->header.record_count : 0;
+}
+
+bool dbf_deleted(DBF *dbf) {
+    return dbf ? dbf->deleted : false;
+}
+
+bool dbf_is_mapped(DBF *dbf) {
+    return dbf ? dbf->map != NULL : false;
+}
+
+bool dbf_is_inmemory(DBF *dbf) {
+    return dbf ? dbf->columns != NULL : false;
+}
+
+bool dbf_is_snapshot(DBF *dbf) {
+    return dbf ? dbf->xcol != NULL : false;
+}
+
+/* Deleted records, from the bitmap (built on first use) */
+uint32_t dbf_deleted_count(DBF *dbf) {
+    if (!dbf || !delmap_ready(dbf)) return 0;
+    return dbf->deleted_count;
+}
+
+uint32_t dbf_active_count(DBF *dbf) {
+    if (!dbf) return 0;
+    return dbf->header.record_count - dbf_deleted_count(dbf);
+}
+
+bool dbf_record_deleted(DBF *dbf, uint32_t recno) {
+    if (!dbf || recno == 0 || recno > dbf->header.record_count) return false;
+    if (recno == dbf->current_record && dbf->modified) return dbf->deleted;
+    if (!delmap_ready(dbf)) return false;
+    return delmap_test(dbf, recno);
+}
+
+void dbf_set_skip_deleted(bool on) {
+    g_skip_deleted = on;
+}
+
+bool dbf_get_skip_deleted(void) {
+    return g_skip_deleted;
+}
+
+/* Write 'n' records after the last one, then the EOF marker and the header.
+ * 'records' may alias the record buffer. */
+static bool append_records(DBF *dbf, const uint8_t *records, uint32_t n) {
+    size_t bytes = (size_t)n * dbf->header.record_size;
+    uint64_t offset = record_offset(dbf, dbf->header.record_count + 1);
+    delmap_unseal(dbf);
+    zones_unseal(dbf);
+    blooms_unseal(dbf);
+
+    /* Write the records at end of file (over the EOF marker) */
+    if (dbf->map) {
+        if (fseek(dbf->fp, (long)(dbf->header.header_size + offset), SEEK_SET) != 0) return false;
+        if (fwrite(records, 1, bytes, dbf->fp) != bytes) return false;
+    } else if (bytes < BUFPOOL_PAGE_SIZE) {
+        /* Small appends stay resident for the field writes that follow */
+        if (!bufpool_write(dbf->pool, offset, records, bytes)) return false;
+    } else if (!bufpool_write_direct(dbf->pool, offset, records, bytes)) {
+        return false;
+    }
+
+    /* Write EOF marker; the header follows at the next commit */
+    uint32_t first = dbf->header.record_count + 1;
+    dbf->header.record_count += n;
+    if (!write_eof_marker(dbf)) return false;
+    dbf->header_dirty = true;
+    dbf->pending = true;
+
+    /* Extend the bitmap; appended records may carry a deletion mark */
+    if (dbf->delmap) {
+        delmap_reserve(dbf, dbf->header.record_count);
+        delmap_touch(dbf, (first - 1) >> 3, (uint32_t)delmap_bytes(dbf->header.record_count));
+        for (uint32_t i = 0; i < n; i++) {
+            if (records[(size_t)i * dbf->header.record_size] == DBF_RECORD_DELETED) {
+                delmap_set(dbf, first + i, true);
+            }
+        }
+    }
+
+    /* Grow the mapping to cover the new records */
+    if (dbf->map && !map_file(dbf)) return false;
+
+    if (dbf->columns) columns_add(dbf, records, n);
+    if (dbf->zones) {
+        for (uint32_t i = 0; i < n; i++) {
+            zones_widen(dbf, first + i, records + (size_t)i * dbf->header.record_size);
+        }
+    }
+    if (dbf->blooms) {
+        for (uint32_t i = 0; i < n; i++) {
+            blooms_add(dbf, first + i, records + (size_t)i * dbf->header.record_size);
+        }
+    }
+
+    /* Position at the last new record */
+    memmove(dbf->record_buffer, records + bytes - dbf->header.record_size,
+            dbf->header.record_size);
+    dbf->current_record = dbf->header.record_count;
+    dbf->bof = false;
+    dbf->eof = false;
+    dbf->deleted = (dbf->record_buffer[0] == DBF_RECORD_DELETED);
+    dbf->modified = false;
+    dbf->loaded = true;
+
+    return true;
+}
+
+/* Append blank record */
+bool dbf_append_blank(DBF *dbf) {
+    if (!dbf || dbf->readonly) {
+        error_set(ERR_FILE_WRITE, "Cannot append to read-only database");
+        return false;
+    }
+
+    /* Flush any pending changes */
+    if (dbf->modified) {
+        write_record(dbf);
+    }
+
+    /* Initialize blank record */
+    memset(dbf->record_buffer, ' ', dbf->header.record_size);
+    dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
+
+    return append_records(dbf, dbf->record_buffer, 1);
+}
+
+/* Append a block of raw records */
+bool dbf_append_batch(DBF *dbf, const uint8_t *records, uint32_t n) {
+    if (!dbf || dbf->readonly) {
+        error_set(ERR_FILE_WRITE, "Cannot append to read-only database");
+        return false;
+    }
+    if (n == 0) return true;
+    if (!records) return false;
+
+    /* Flush any pending changes */
+    if (dbf->modified) {
+        write_record(dbf);
+    }
+
+    return append_records(dbf, records, n);
+}
+
+/* Delete current record */
+bool dbf_delete(DBF *dbf) {
+    if (!dbf || dbf->readonly) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+    if (!record_ready(dbf)) return false;
+
+    dbf->record_buffer[0] = DBF_RECORD_DELETED;
+    dbf->deleted = true;
+    dbf->modified = true;
+    delmap_set(dbf, dbf->current_record, true);
+
+    return true;
+}
+
+/* Recall (undelete) current record */
+bool dbf_recall(DBF *dbf) {
+    if (!dbf || dbf->readonly) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+    if (!record_ready(dbf)) return false;
+
+    dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
+    dbf->deleted = false;
+    dbf->modified = true;
+    delmap_set(dbf, dbf->current_record, false);
+
+    return true;
+}
+
+/* Write back the current record; it reaches the disk at the next commit */
+bool dbf_flush(DBF *dbf) {
+    if (!dbf) return false;
+
+    if (dbf->modified) {
+        if (!write_record(dbf)) return false;
+    }
+
+    return true;
+}
+
+/* Field access */
+int dbf_field_index(DBF *dbf, const char *name) {
+    if (!dbf || !name) return -1;
+
+    for (int i = 0; i < dbf->field_count; i++) {
+        if (str_casecmp(dbf->fields[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const DBFField *dbf_field_info(DBF *dbf, int index) {
+    if (!dbf || index < 0 || index >= dbf->field_count) return NULL;
+    return &dbf->fields[index];
+}
+
+int dbf_field_count(DBF *dbf) {
+    return dbf ? dbf->field_count : 0;
+}
+
+/*
+ * Numeric field codec
+ *
+ * N fields hold right-aligned ASCII decimals. The fast paths below cover
+ * every value that fits a double exactly, which is all that fixed-width
+ * fields normally contain; anything else (exponents, stray characters,
+ * values near a rounding tie) falls back to str_to_num()/num_to_str(), so
+ * results match theirs.
+ */
+
+/* Powers of ten that are exact in a double */
+static const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MANTISSA_LIMIT ((uint64_t)1 << 53)
+
+static bool decode_numeric_slow(const uint8_t *ptr, size_t len, double *value) {
+    char buf[256];
+    size_t n = len < sizeof(buf) - 1 ? len : sizeof(buf) - 1;
+    memcpy(buf, ptr, n);
+    buf[n] = '\0';
+    return str_to_num(buf, value);
+}
+
+/* Decode a numeric field; false if the text is not a number */
+bool dbf_decode_numeric(const uint8_t *ptr, size_t len, double *value) {
+    size_t i = 0;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int frac = -1;
+    bool neg = false;
+
+    while (i < len && ptr[i] == ' ') i++;
+    if (i == len) {
+        *value = 0.0;
+        return true;
+    }
+
+    if (ptr[i] == '-' || ptr[i] == '+') neg = ptr[i++] == '-';
+
+    for (; i < len; i++) {
+        uint8_t c = ptr[i];
+        if (c >= '0' && c <= '9') {
+            mantissa = mantissa * 10 + (uint64_t)(c - '0');
+            if (mantissa > MANTISSA_LIMIT) return decode_numeric_slow(ptr, len, value);
+            digits++;
+            if (frac >= 0) frac++;
+        } else if (c == '.' && frac < 0) {
+            frac = 0;
+        } else {
+            break;
+        }
+    }
+
+    while (i < len && ptr[i] == ' ') i++;
+    if (i != len || digits == 0) return decode_numeric_slow(ptr, len, value);
+
+    /* Exact mantissa and power of ten: one correctly rounded division */
+    if (frac > 22) return decode_numeric_slow(ptr, len, value);
+    double v = (double)mantissa;
+    if (frac > 0) v /= pow10_exact[frac];
+    *value = neg ? -v : v;
+    return true;
+}
+
+/* Encode a number right-aligned into a 'width'-byte field */
+void dbf_encode_numeric(double value, uint8_t *ptr, size_t width, int decimals) {
+    char text[64];
+    size_t len = 0;
+
+    if (decimals < 0) decimals = 0;
+
+    double scaled = value * (decimals <= 22 ? pow10_exact[decimals] : 0.0);
+    double whole = floor(scaled);
+    double margin = fabs(scaled) * DBL_EPSILON * 2;
+
+    /* The product is within one ulp of the exact value, so rounding it
+     * matches printf unless it lies that close to a tie */
+    bool fast = decimals <= 22 && fabs(scaled) < 1e15 &&
+                fabs(scaled - whole - 0.5) > margin;
+    uint64_t n = 0;
+    if (fast) {
+        n = (uint64_t)fabs(scaled - whole < 0.5 ? whole : whole + 1);
+        if (signbit(value) && n == 0) fast = false;  /* printf keeps the sign of -0.00 */
+    }
+
+    if (fast) {
+        char digits[64];
+        int nd = 0;
+        do {
+            digits[nd++] = (char)('0' + n % 10);
+            n /= 10;
+        } while (n > 0);
+        while (nd <= decimals) digits[nd++] = '0';  /* Leading "0." */
+
+        if (value < 0) text[len++] = '-';
+        for (int i = nd - 1; i >= 0; i--) {
+            text[len++] = digits[i];
+            if (i == decimals && decimals > 0) text[len++] = '.';
+        }
+    } else {
+        num_to_str(value, text, (int)(sizeof(text) - 1), decimals);
+        char *start = text;
+        while (*start == ' ') start++;
+        len = strlen(start);
+        memmove(text, start, len);
+    }
+
+    /* Right-align; a value too wide keeps its leftmost characters, as
+     * printf truncation did */
+    if (len >= width) {
+        memcpy(ptr, text, width);
+    } else {
+        memset(ptr, ' ', width - len);
+        memcpy(ptr + (width - len), text, len);
+    }
+}
+
+/* Zero-copy view of a field of the current record */
+bool dbf_field_view(DBF *dbf, int field_index, const uint8_t **ptr, size_t *len) {
+    if (!dbf || !ptr || !len) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+
+    if (!record_ready(dbf)) return false;
+
+    const DBFField *field = &dbf->fields[field_index];
+    const uint8_t *record = dbf->record_buffer;
+
+    /* An unmodified mapped record is read straight from the mapping */
+    if (dbf->map && !dbf->modified) {
+        record = dbf->map + dbf->header.header_size + record_offset(dbf, dbf->current_record);
+    }
+
+    *ptr = record + field->offset;
+    *len = field->length;
+    return true;
+}
+
+/* Trimmed view of a character field from the columns */
+bool dbf_column_view(DBF *dbf, int field_index, const uint8_t **ptr, size_t *len) {
+    if (!dbf || !ptr || !len) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+
+    DBFColumn *col = current_column(dbf, field_index);
+    if (!col || !col->offset) return false;
+
+    uint32_t index = dbf->current_record - 1;
+    *len = col->length[index];
+    *ptr = *len ? (const uint8_t *)col->arena + col->offset[index] : (const uint8_t *)"";
+    return true;
+}
+
+/* Length of a field view without trailing blanks */
+size_t dbf_view_trim_right(const uint8_t *ptr, size_t len) {
+    while (len > 0 && (ptr[len - 1] == ' ' || ptr[len - 1] == '\0')) len--;
+    return len;
+}
+
+/* Strip leading and trailing blanks from a field view */
+size_t dbf_view_trim(const uint8_t **ptr, size_t len) {
+    const uint8_t *p = *ptr;
+    while (len > 0 && *p == ' ') {
+        p++;
+        len--;
+    }
+    *ptr = p;
+    return dbf_view_trim_right(p, len);
+}
+
+/* Get field value as string */
+bool dbf_get_string(DBF *dbf, int field_index, char *buffer, size_t bufsize) {
+    if (!dbf || !buffer || bufsize == 0) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+
+    if (!record_ready(dbf)) return false;
+
+    const DBFField *field = &dbf->fields[field_index];
+    size_t len = field->length < bufsize - 1 ? field->length : bufsize - 1;
+
+    memcpy(buffer, &dbf->record_buffer[field->offset], len);
+    buffer[len] = '\0';
+
+    return true;
+}
+
+/* Get field value as double */
+bool dbf_get_double(DBF *dbf, int field_index, double *value) {
+    if (!dbf || !value) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+
+    const DBFField *field = &dbf->fields[field_index];
+    if (field->type != FIELD_TYPE_NUMERIC) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not numeric");
+        return false;
+    }
+
+    DBFColumn *col = current_column(dbf, field_index);
+    if (col) {
+        *value = col->num[dbf->current_record - 1];
+        return true;
+    }
+    if (!record_ready(dbf)) return false;
+
+    return dbf_decode_numeric(&dbf->record_buffer[field->offset], field->length, value);
+}
+
+/* Get field value as logical */
+bool dbf_get_logical(DBF *dbf, int field_index, bool *value) {
+    if (!dbf || !value) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+
+    const DBFField *field = &dbf->fields[field_index];
+    if (field->type != FIELD_TYPE_LOGICAL) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not logical");
+        return false;
+    }
+
+    DBFColumn *col = current_column(dbf, field_index);
+    if (col) {
+        uint32_t bit = dbf->current_record - 1;
+        *value = (col->bits[bit >> 3] >> (bit & 7)) & 1;
+        return true;
+    }
+    if (!record_ready(dbf)) return false;
+
+    char c = dbf->record_buffer[field->offset];
+    *value = (c == 'T' || c == 't' || c == 'Y' || c == 'y');
+
+    return true;
+}
+
+/* Get field value as date (YYYYMMDD) */
+bool dbf_get_date(DBF *dbf, int field_index, char *buffer) {
+    if (!dbf || !buffer) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+
+    const DBFField *field = &dbf->fields[field_index];
+    if (field->type != FIELD_TYPE_DATE) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not date");
+        return false;
+    }
+
+    /* Text that is not a valid date is returned as stored */
+    DBFColumn *col = current_column(dbf, field_index);
+    if (col && col->jdn[dbf->current_record - 1] >= 0) {
+        jdn_to_date(col->jdn[dbf->current_record - 1], buffer);
+        return true;
+    }
+    if (!record_ready(dbf)) return false;
+
+    memcpy(buffer, &dbf->record_buffer[field->offset], 8);
+    buffer[8] = '\0';
+
+    return true;
+}
+
+/* Encode a string into a field of a record buffer */
+static bool encode_string(const DBFField *field, uint8_t *record, const char *value) {
+    /* Clear field with spaces */
+    memset(&record[field->offset], ' ', field->length);
+
+    if (value) {
+        size_t len = strlen(value);
+        if (len > field->length) len = field->length;
+        memcpy(&record[field->offset], value, len);
+    }
+
+    return true;
+}
+
+/* Encode a number into a field of a record buffer */
+static bool encode_double(const DBFField *field, uint8_t *record, double value) {
+    if (field->type != FIELD_TYPE_NUMERIC) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not numeric");
+        return false;
+    }
+
+    dbf_encode_numeric(value, &record[field->offset], field->length, field->decimals);
+    return true;
+}
+
+/* Encode a logical into a field of a record buffer */
+static bool encode_logical(const DBFField *field, uint8_t *record, bool value) {
+    if (field->type != FIELD_TYPE_LOGICAL) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not logical");
+        return false;
+    }
+
+    record[field->offset] = value ? 'T' : 'F';
+    return true;
+}
+
+/* Encode a date (YYYYMMDD) into a field of a record buffer */
+static bool encode_date(const DBFField *field, uint8_t *record, const char *value) {
+    if (field->type != FIELD_TYPE_DATE) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not date");
+        return false;
+    }
+
+    /* Clear field with spaces */
+    memset(&record[field->offset], ' ', 8);
+
+    if (value && strlen(value) == 8) {
+        memcpy(&record[field->offset], value, 8);
+    }
+
+    return true;
+}
+
+/* Check that the current record can be written */
+static bool can_put(DBF *dbf, int field_index) {
+    if (!dbf || dbf->readonly) return false;
+    if (field_index < 0 || field_index >= dbf->field_count) return false;
+    if (dbf->current_record == 0 || dbf->eof) return false;
+    return record_ready(dbf);
+}
+
+/* Keep the column of a field just written coherent */
+static void put_column(DBF *dbf, int field_index) {
+    if (current_column(dbf, field_index)) {
+        column_store(dbf, field_index, dbf->current_record - 1, dbf->record_buffer, false);
+    }
+}
+
+/* Set field value as string */
+bool dbf_put_string(DBF *dbf, int field_index, const char *value) {
+    if (!can_put(dbf, field_index)) return false;
+    if (!encode_string(&dbf->fields[field_index], dbf->record_buffer, value)) return false;
+    dbf->modified = true;
+    put_column(dbf, field_index);
+    return true;
+}
+
+/* Set field value as double */
+bool dbf_put_double(DBF *dbf, int field_index, double value) {
+    if (!can_put(dbf, field_index)) return false;
+    if (!encode_double(&dbf->fields[field_index], dbf->record_buffer, value)) return false;
+    dbf->modified = true;
+    put_column(dbf, field_index);
+    return true;
+}
+
+/* Set field value as logical */
+bool dbf_put_logical(DBF *dbf, int field_index, bool value) {
+    if (!can_put(dbf, field_index)) return false;
+    if (!encode_logical(&dbf->fields[field_index], dbf->record_buffer, value)) return false;
+    dbf->modified = true;
+    put_column(dbf, field_index);
+    return true;
+}
+
+/* Set field value as date (YYYYMMDD) */
+bool dbf_put_date(DBF *dbf, int field_index, const char *value) {
+    if (!can_put(dbf, field_index)) return false;
+    if (!encode_date(&dbf->fields[field_index], dbf->record_buffer, value)) return false;
+    dbf->modified = true;
+    put_column(dbf, field_index);
+    return true;
+}
+
+/*
+ * Buffered appender
+ */
+
+struct DBFAppender {
+    DBF *dbf;                  /* Target table */
+    uint8_t *buffer;           /* Staged records */
+    uint32_t capacity;         /* Records staged per batch */
+    uint32_t staged;           /* Records currently staged */
+    uint32_t appended;         /* Records written by earlier batches */
+};
+
+/* Open an appender staging up to 'batch_records' records (0 = default) */
+DBFAppender *dbf_appender_open(DBF *dbf, uint32_t batch_records) {
+    if (!dbf || dbf->readonly) {
+        error_set(ERR_FILE_WRITE, "Cannot append to read-only database");
+        return NULL;
+    }
+
+    if (batch_records == 0) {
+        batch_records = (uint32_t)(DBF_APPEND_BATCH_BYTES / dbf->header.record_size);
+        if (batch_records == 0) batch_records = 1;
+    }
+
+    DBFAppender *ap = xcalloc(1, sizeof(DBFAppender));
+    ap->dbf = dbf;
+    ap->capacity = batch_records;
+    ap->buffer = xmalloc((size_t)batch_records * dbf->header.record_size);
+    return ap;
+}
+
+/* Stage a blank record; returns its buffer for direct field writes */
+uint8_t *dbf_appender_add(DBFAppender *ap) {
+    if (!ap) return NULL;
+    if (ap->staged == ap->capacity && !dbf_appender_flush(ap)) return NULL;
+
+    uint8_t *record = ap->buffer + (size_t)ap->staged * ap->dbf->header.record_size;
+    memset(record, ' ', ap->dbf->header.record_size);
+    record[0] = DBF_RECORD_ACTIVE;
+    ap->staged++;
+    return record;
+}
+
+/* The most recently staged record */
+static uint8_t *appender_record(DBFAppender *ap, int field_index) {
+    if (!ap || ap->staged == 0) return NULL;
+    if (field_index < 0 || field_index >= ap->dbf->field_count) return NULL;
+    return ap->buffer + (size_t)(ap->staged - 1) * ap->dbf->header.record_size;
+}
+
+bool dbf_appender_put_string(DBFAppender *ap, int field_index, const char *value) {
+    uint8_t *record = appender_record(ap, field_index);
+    return record && encode_string(&ap->dbf->fields[field_index], record, value);
+}
+
+bool dbf_appender_put_double(DBFAppender *ap, int field_index, double value) {
+    uint8_t *record = appender_record(ap, field_index);
+    return record && encode_double(&ap->dbf->fields[field_index], record, value);
+}
+
+bool dbf_appender_put_logical(DBFAppender *ap, int field_index, bool value) {
+    uint8_t *record = appender_record(ap, field_index);
+    return record && encode_logical(&ap->dbf->fields[field_index], record, value);
+}
+
+bool dbf_appender_put_date(DBFAppender *ap, int field_index, const char *value) {
+    uint8_t *record = appender_record(ap, field_index);
+    return record && encode_date(&ap->dbf->fields[field_index], record, value);
+}
+
+/* Write staged records as one batch */
+bool dbf_appender_flush(DBFAppender *ap) {
+    if (!ap) return false;
+    if (ap->staged == 0) return true;
+
+    if (!dbf_append_batch(ap->dbf, ap->buffer, ap->staged)) return false;
+
+    ap->appended += ap->staged;
+    ap->staged = 0;
+    return true;
+}
+
+/* Records appended so far, including those still staged */
+uint32_t dbf_appender_count(DBFAppender *ap) {
+    return ap ? ap->appended + ap->staged : 0;
+}
+
+/* Flush remaining records and release the appender */
+bool dbf_appender_close(DBFAppender *ap) {
+    if (!ap) return false;
+
+    bool ok = dbf_appender_flush(ap);
+    xfree(ap->buffer);
+    xfree(ap);
+    return ok;
+}
+
+/*
+ * Reader handles
+ */
+
+struct DBFReader {
+    int fd;                    /* Private descriptor, read with pread only */
+    char filename[MAX_PATH_LEN]; /* For error messages */
+    DBFField *fields;          /* Copy of the field descriptors */
+    int field_count;
+    uint16_t header_size;      /* Table geometry */
+    uint16_t record_size;
+    uint32_t record_count;     /* Records when the reader was opened */
+    uint8_t *window;           /* Block of consecutive records */
+    uint32_t window_capacity;  /* Records the window has room for */
+    uint32_t window_first;     /* First record in the window (0 = empty) */
+    uint32_t window_count;     /* Records in the window */
+    const uint8_t *record;     /* Current record within the window */
+    uint32_t current_record;   /* Cursor (1-based, 0 = BOF) */
+    bool eof;
+    bool bof;
+};
+
+/* Open a reader with its own descriptor and a copy of the field table, so
+ * that it stays usable after the table is closed or packed */
+DBFReader *dbf_reader_open(DBF *dbf) {
+    if (!dbf) return NULL;
+    if (dbf->xcol) {
+        error_set(ERR_NOT_IMPLEMENTED, "Reader handles need a DBF file");
+        return NULL;
+    }
+
+    /* Pending changes must be in the file for pread to see them */
+    if (dbf->modified && !write_record(dbf)) return NULL;
+    if (dbf->pool && !bufpool_flush(dbf->pool)) return NULL;
+
+    int fd = open(dbf->filename, O_RDONLY);
+    if (fd < 0) {
+        error_set(ERR_FILE_NOT_FOUND, "Cannot open %s", dbf->filename);
+        return NULL;
+    }
+
+    DBFReader *rd = xcalloc(1, sizeof(DBFReader));
+    rd->fd = fd;
+    strncpy(rd->filename, dbf->filename, MAX_PATH_LEN - 1);
+    rd->field_count = dbf->field_count;
+    rd->fields = xmalloc(sizeof(DBFField) * (size_t)dbf->field_count);
+    memcpy(rd->fields, dbf->fields, sizeof(DBFField) * (size_t)dbf->field_count);
+    rd->header_size = dbf->header.header_size;
+    rd->record_size = dbf->header.record_size;
+    rd->record_count = dbf->header.record_count;
+
+    rd->window_capacity = (uint32_t)(DBF_READAHEAD_BYTES / rd->record_size);
+    if (rd->window_capacity == 0) rd->window_capacity = 1;
+    rd->window = xmalloc((size_t)rd->window_capacity * rd->record_size);
+
+    rd->bof = true;
+    rd->eof = rd->record_count == 0;
+    return rd;
+}
+
+void dbf_reader_close(DBFReader *rd) {
+    if (!rd) return;
+    close(rd->fd);
+    xfree(rd->window);
+    xfree(rd->fields);
+    xfree(rd);
+}
+
+/* Load the block of records around 'recno', extending in the direction of
+ * travel, with one pread */
+static bool reader_load(DBFReader *rd, uint32_t recno, bool forward) {
+    uint32_t first = recno;
+    if (!forward) {
+        first = recno > rd->window_capacity ? recno - rd->window_capacity + 1 : 1;
+    }
+    uint32_t n = rd->record_count - first + 1;
+    if (n > rd->window_capacity) n = rd->window_capacity;
+
+    size_t bytes = (size_t)n * rd->record_size;
+    off_t offset = (off_t)rd->header_size + (off_t)(first - 1) * rd->record_size;
+    size_t done = 0;
+
+    while (done < bytes) {
+        ssize_t got = pread(rd->fd, rd->window + done, bytes - done, offset + (off_t)done);
+        if (got <= 0) {
+            rd->window_first = 0;
+            error_set(ERR_FILE_READ, "Cannot read record %u of %s", first, rd->filename);
+            return false;
+        }
+        done += (size_t)got;
+    }
+
+    rd->window_first = first;
+    rd->window_count = n;
+    return true;
+}
+
+/* Point the cursor at a record, reading its block if needed */
+static bool reader_seek(DBFReader *rd, uint32_t recno, bool forward) {
+    if (recno == 0) {
+        rd->current_record = 0;
+        rd->record = NULL;
+        rd->bof = true;
+        rd->eof = rd->record_count == 0;
+        return true;
+    }
+    if (recno > rd->record_count) {
+        rd->current_record = rd->record_count + 1;
+        rd->record = NULL;
+        rd->bof = false;
+        rd->eof = true;
+        return true;
+    }
+
+    if (rd->window_first == 0 || recno < rd->window_first ||
+        recno >= rd->window_first + rd->window_count) {
+        if (!reader_load(rd, recno, forward)) return false;
+    }
+
+    rd->current_record = recno;
+    rd->record = rd->window + (size_t)(recno - rd->window_first) * rd->record_size;
+    rd->bof = false;
+    rd->eof = false;
+    return true;
+}
+
+/* Under SET DELETED ON, move off deleted records in the direction of travel */
+static bool reader_settle(DBFReader *rd, bool forward) {
+    while (g_skip_deleted && rd->record && rd->record[0] == DBF_RECORD_DELETED) {
+        uint32_t recno = forward ? rd->current_record + 1 : rd->current_record - 1;
+        if (!reader_seek(rd, recno, forward)) return false;
+    }
+    return true;
+}
+
+bool dbf_reader_goto(DBFReader *rd, uint32_t recno) {
+    return rd && reader_seek(rd, recno, true);
+}
+
+bool dbf_reader_go_top(DBFReader *rd) {
+    if (!rd) return false;
+    if (rd->record_count == 0) return reader_seek(rd, 0, true);
+    return reader_seek(rd, 1, true) && reader_settle(rd, true);
+}
+
+bool dbf_reader_skip(DBFReader *rd, int count) {
+    if (!rd) return false;
+
+    for (; count > 0 && !rd->eof; count--) {
+        if (!reader_seek(rd, rd->current_record + 1, true) || !reader_settle(rd, true)) {
+            return false;
+        }
+    }
+    for (; count < 0 && rd->current_record > 0; count++) {
+        if (!reader_seek(rd, rd->current_record - 1, false) || !reader_settle(rd, false)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool dbf_reader_eof(DBFReader *rd) {
+    return rd ? rd->eof : true;
+}
+
+bool dbf_reader_bof(DBFReader *rd) {
+    return rd ? rd->bof : true;
+}
+
+uint32_t dbf_reader_recno(DBFReader *rd) {
+    return rd ? rd->current_record : 0;
+}
+
+uint32_t dbf_reader_reccount(DBFReader *rd) {
+    return rd ? rd->record_count : 0;
+}
+
+bool dbf_reader_deleted(DBFReader *rd) {
+    return rd && rd->record && rd->record[0] == DBF_RECORD_DELETED;
+}
+
+int dbf_reader_field_count(DBFReader *rd) {
+    return rd ? rd->field_count : 0;
+}
+
+const DBFField *dbf_reader_field_info(DBFReader *rd, int index) {
+    if (!rd || index < 0 || index >= rd->field_count) return NULL;
+    return &rd->fields[index];
+}
+
+/* View of a field of the current record; valid until the cursor moves */
+bool dbf_reader_field_view(DBFReader *rd, int field_index, const uint8_t **ptr, size_t *len) {
+    if (!rd || !rd->record || !ptr || !len) return false;
+    if (field_index < 0 || field_index >= rd->field_count) return false;
+
+    *ptr = rd->record + rd->fields[field_index].offset;
+    *len = rd->fields[field_index].length;
+    return true;
+}
+
+bool dbf_reader_get_string(DBFReader *rd, int field_index, char *buffer, size_t bufsize) {
+    const uint8_t *ptr;
+    size_t len;
+
+    if (!buffer || bufsize == 0) return false;
+    if (!dbf_reader_field_view(rd, field_index, &ptr, &len)) return false;
+
+    if (len > bufsize - 1) len = bufsize - 1;
+    memcpy(buffer, ptr, len);
+    buffer[len] = '\0';
+    return true;
+}
+
+bool dbf_reader_get_double(DBFReader *rd, int field_index, double *value) {
+    const uint8_t *ptr;
+    size_t len;
+
+    if (!value || !dbf_reader_field_view(rd, field_index, &ptr, &len)) return false;
+    if (rd->fields[field_index].type != FIELD_TYPE_NUMERIC) {
+        error_set(ERR_TYPE_MISMATCH, "Field is not numeric");
+        return false;
+    }
+
+    return dbf_decode_numeric(ptr, len, value);
+}
+
+/*
+ * Asynchronous scans
+ */
+
+struct DBFScan {
+    DBF *dbf;                  /* Table being scanned */
+    AIO *aio;                  /* NULL when the scan uses ordinary navigation */
+    uint8_t *skip;             /* One byte per zone block, set for blocks passed over
+                                * (NULL when every block is scanned) */
+    uint32_t skipped;          /* Records in blocks passed over */
+    uint8_t *blocks;           /* DBF_SCAN_DEPTH blocks of records */
+    uint32_t block_records;    /* Records per block */
+    uint32_t record_count;     /* Records when the scan began */
+    uint32_t next_recno;       /* First record not yet submitted */
+    uint32_t submitted;        /* Reads submitted */
+    uint32_t current;          /* Read holding the cursor */
+    uint32_t first[DBF_SCAN_DEPTH]; /* First record and record count per slot */
+    uint32_t count[DBF_SCAN_DEPTH];
+    bool ready[DBF_SCAN_DEPTH]; /* Slot holds its records */
+    uint32_t recno;            /* Cursor */
+};
+
+void dbf_set_scan_mode(DBFScanMode mode) {
+    g_scan_mode = mode;
+}
+
+DBFScanMode dbf_get_scan_mode(void) {
+    return g_scan_mode;
+}
+
+static bool scan_skips(const DBFScan *scan, uint32_t recno) {
+    return scan->skip && recno <= scan->record_count &&
+           scan->skip[(recno - 1) / DBF_ZONE_RECORDS];
+}
+
+/* First record at or after 'recno' outside the blocks passed over */
+static uint32_t scan_skip_to(const DBFScan *scan, uint32_t recno) {
+    while (scan_skips(scan, recno)) {
+        recno = ((recno - 1) / DBF_ZONE_RECORDS + 1) * DBF_ZONE_RECORDS + 1;
+    }
+    return recno;
+}
+
+/* Mark the zone blocks in which no record can pass every test: by the
+ * zone maps for comparisons and by the Bloom filters for matches */
+static void scan_zones(DBFScan *scan, const DBFZoneTest *tests, int count) {
+    DBF *dbf = scan->dbf;
+    uint32_t records = dbf->header.record_count;
+    uint32_t blocks = zone_blocks(records);
+    bool ranged = false;
+    bool bloomed = false;
+
+    if (count == 0 || records == 0) return;
+    for (int i = 0; i < count; i++) {
+        if (tests[i].field < 0 || tests[i].field >= dbf->field_count) return;
+        if (tests[i].op != DBF_ZONE_MATCH) {
+            ranged = true;
+        } else if (bloom_slot(dbf->blooms, tests[i].field) >= 0) {
+            bloomed = true;
+        }
+    }
+
+    if (ranged && (!zones_ready(dbf) || dbf->zones->blocks < blocks)) ranged = false;
+    if (bloomed && (!blooms_ready(dbf) || dbf->blooms->blocks < blocks)) bloomed = false;
+    if (!ranged && !bloomed) return;
+
+    /* Each match probes the same bits in every block */
+    int *slots = xmalloc(sizeof(int) * (size_t)count);
+    uint64_t *hashes = xmalloc(sizeof(uint64_t) * (size_t)count);
+    for (int i = 0; i < count; i++) {
+        slots[i] = -1;
+        if (bloomed && tests[i].op == DBF_ZONE_MATCH && tests[i].text) {
+            slots[i] = bloom_slot(dbf->blooms, tests[i].field);
+            hashes[i] = bloom_hash((const uint8_t *)tests[i].text, strlen(tests[i].text));
+        }
+    }
+
+    scan->skip = xcalloc(blocks, 1);
+    for (uint32_t b = 0; b < blocks; b++) {
+        for (int i = 0; i < count && !scan->skip[b]; i++) {
+            if (tests[i].op == DBF_ZONE_MATCH) {
+                if (slots[i] >= 0 && !bloom_test(bloom_filter(dbf->blooms, b, slots[i]), hashes[i])) {
+                    scan->skip[b] = 1;
+                }
+            } else if (ranged) {
+                DBFZones *zones = dbf->zones;
+                int slot = zones->slot[tests[i].field];
+                if (slot >= 0 && zone_excludes(&zones->ranges[(size_t)b * zones->width + slot], &tests[i])) {
+                    scan->skip[b] = 1;
+                }
+            }
+        }
+        if (scan->skip[b]) {
+            uint32_t last = (b + 1) * DBF_ZONE_RECORDS;
+            scan->skipped += (last < records ? last : records) - b * DBF_ZONE_RECORDS;
+        }
+    }
+    xfree(slots);
+    xfree(hashes);
+
+    if (scan->skipped == 0) {
+        xfree(scan->skip);
+        scan->skip = NULL;
+    }
+}
+
+/* Queue the read of the next run of records, up to a block, into the slot
+ * it cycles through. Runs stop short of blocks passed over. */
+static bool scan_submit(DBFScan *scan) {
+    uint32_t first = scan_skip_to(scan, scan->next_recno);
+    if (first > scan->record_count) return true;
+
+    uint32_t n = scan->record_count - first + 1;
+    if (n > scan->block_records) n = scan->block_records;
+    for (uint32_t zone = (first - 1) / DBF_ZONE_RECORDS + 1;
+         scan->skip && (uint64_t)zone * DBF_ZONE_RECORDS < (uint64_t)first - 1 + n; zone++) {
+        if (scan->skip[zone]) {
+            n = zone * DBF_ZONE_RECORDS + 1 - first;
+            break;
+        }
+    }
+
+    uint32_t slot = scan->submitted++ % DBF_SCAN_DEPTH;
+    scan->first[slot] = first;
+    scan->count[slot] = n;
+    scan->ready[slot] = false;
+    scan->next_recno = first + n;
+
+    DBF *dbf = scan->dbf;
+    return aio_read(scan->aio, slot,
+                    scan->blocks + (size_t)slot * scan->block_records * dbf->header.record_size,
+                    (size_t)n * dbf->header.record_size,
+                    dbf->header.header_size + record_offset(dbf, first));
+}
+
+/* Record at or after the cursor from the read queue, waiting for its read
+ * if needed; moves the cursor past runs that were not read. Sets 'record'
+ * to NULL past the last run. */
+static bool scan_record(DBFScan *scan, const uint8_t **record) {
+    for (;;) {
+        if (scan->current == scan->submitted) {
+            *record = NULL;
+            return true;
+        }
+
+        uint32_t slot = scan->current % DBF_SCAN_DEPTH;
+        while (!scan->ready[slot]) {
+            uint32_t done;
+            size_t bytes;
+            if (!aio_wait(scan->aio, &done, &bytes)) return false;
+            scan->ready[done] = true;
+        }
+
+        if (scan->recno < scan->first[slot]) scan->recno = scan->first[slot];
+        if (scan->recno < scan->first[slot] + scan->count[slot]) {
+            *record = scan->blocks + ((size_t)slot * scan->block_records +
+                                      (scan->recno - scan->first[slot])) *
+                                     scan->dbf->header.record_size;
+            return true;
+        }
+
+        /* Done with this run; reuse its slot */
+        scan->current++;
+        if (!scan_submit(scan)) return false;
+    }
+}
+
+/* Move the table's cursor to the scan's next qualifying record */
+static bool scan_settle(DBFScan *scan) {
+    DBF *dbf = scan->dbf;
+
+    for (;; scan->recno++) {
+        const uint8_t *record;
+        if (!scan_record(scan, &record)) {
+            dbf_goto(dbf, dbf->header.record_count + 1);
+            return false;
+        }
+        if (!record) break;
+        if (g_skip_deleted && record[0] == DBF_RECORD_DELETED) continue;
+
+        memcpy(dbf->record_buffer, record, dbf->header.record_size);
+        dbf->current_record = scan->recno;
+        dbf->bof = false;
+        dbf->eof = false;
+        dbf->deleted = (record[0] == DBF_RECORD_DELETED);
+        dbf->modified = false;
+        dbf->loaded = true;
+        return true;
+    }
+
+    return dbf_goto(dbf, dbf->header.record_count + 1);
+}
+
+/* Ordinary navigation: step off records in blocks passed over */
+static bool scan_leap(DBFScan *scan) {
+    DBF *dbf = scan->dbf;
+
+    while (!dbf->eof && scan_skips(scan, dbf->current_record)) {
+        uint32_t recno = scan_skip_to(scan, dbf->current_record);
+        if (recno > scan->record_count) return dbf_goto(dbf, dbf->header.record_count + 1);
+        if (!dbf_goto(dbf, recno)) return false;
+        if (g_skip_deleted && dbf->deleted && !dbf_skip(dbf, 1)) return false;
+    }
+    return true;
+}
+
+/* Start a forward scan of the whole table, positioned on its first record */
+DBFScan *dbf_scan_open(DBF *dbf) {
+    return dbf_scan_open_where(dbf, 1, NULL, 0);
+}
+
+DBFScan *dbf_scan_open_where(DBF *dbf, uint32_t first, const DBFZoneTest *tests, int count) {
+    if (!dbf) return NULL;
+
+    DBFScan *scan = xcalloc(1, sizeof(DBFScan));
+    scan->dbf = dbf;
+    scan->record_count = dbf->header.record_count;
+
+    uint64_t bytes = (uint64_t)dbf->header.record_count * dbf->header.record_size;
+    bool async = !dbf->xcol &&
+                 (g_scan_mode == DBF_SCAN_THREADS || g_scan_mode == DBF_SCAN_URING ||
+                  (g_scan_mode == DBF_SCAN_AUTO && !dbf->map && !dbf->columns &&
+                   bytes >= DBF_SCAN_MIN_BYTES));
+
+    /* Pending writes go to the file (the async reads bypass the pool) and
+     * into the zone maps first */
+    if ((async || count > 0) && dbf->modified) write_record(dbf);
+    if (async && dbf->pool && !bufpool_flush(dbf->pool)) async = false;
+
+    scan_zones(scan, tests, count);
+
+    if (async) {
+        AIOBackend backend = g_scan_mode == DBF_SCAN_THREADS ? AIO_THREADS :
+                             g_scan_mode == DBF_SCAN_URING ? AIO_URING : AIO_AUTO;
+        fflush(dbf->fp);
+        scan->aio = aio_open(fileno(dbf->fp), DBF_SCAN_DEPTH, backend);
+    }
+
+    if (first == 0) first = 1;
+    if (!scan->aio) {
+        bool ok;
+        if (first == 1) {
+            ok = dbf_go_top(dbf);
+        } else if (first > scan->record_count) {
+            ok = dbf_goto(dbf, dbf->header.record_count + 1);
+        } else {
+            ok = dbf_goto(dbf, first);
+            if (ok && g_skip_deleted && dbf->deleted) ok = dbf_skip(dbf, 1);
+        }
+        if (ok) scan_leap(scan);
+        return scan;
+    }
+
+    scan->block_records = (uint32_t)(DBF_SCAN_BLOCK_BYTES / dbf->header.record_size);
+    if (scan->block_records == 0) scan->block_records = 1;
+    scan->blocks = xmalloc((size_t)DBF_SCAN_DEPTH * scan->block_records * dbf->header.record_size);
+    scan->next_recno = first;
+    scan->recno = first;
+
+    for (uint32_t i = 0; i < DBF_SCAN_DEPTH; i++) {
+        if (!scan_submit(scan)) {
+            dbf_scan_close(scan);
+            return NULL;
+        }
+    }
+
+    if (!scan_settle(scan)) {
+        dbf_scan_close(scan);
+        return NULL;
+    }
+    return scan;
+}
+
+/* Advance to the next record (honouring SET DELETED); EOF past the last */
+bool dbf_scan_next(DBFScan *scan) {
+    if (!scan) return false;
+    if (!scan->aio) return dbf_skip(scan->dbf, 1) && scan_leap(scan);
+
+    scan->recno++;
+    return scan_settle(scan);
 }
 
-int dbf_field_count(DBF *dbf) {
-    return dbf ? dbf->field_count : 0;
+uint32_t dbf_scan_skipped(DBFScan *scan) {
+    return scan ? scan->skipped : 0;
 }
 
-/* Get field value as string */
-bool dbf_get_string(DBF *dbf, int field_index, char *buffer, size_t bufsize) {
-    if (!dbf || !buffer || bufsize == 0) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+const char *dbf_scan_backend(DBFScan *scan) {
+    if (!scan) return NULL;
+    return scan->aio ? aio_backend_name(scan->aio) : "sync";
+}
 
-    const DBFField *field = &dbf->fields[field_index];
-    size_t len = field->length < bufsize - 1 ? field->length : bufsize - 1;
+/* End a scan; the table stays on the record it reached */
+void dbf_scan_close(DBFScan *scan) {
+    if (!scan) return;
+    aio_close(scan->aio);
+    xfree(scan->skip);
+    xfree(scan->blocks);
+    xfree(scan);
+}
 
-    memcpy(buffer, &dbf->record_buffer[field->offset], len);
-    buffer[len] = '\0';
+/* Compact a mapped table in place, one run of live records at a time */
+static uint32_t pack_mapped(DBF *dbf, uint32_t first, uint64_t *moved) {
+    uint8_t *base = dbf->map + dbf->header.header_size;
+    uint32_t write_recno = first;
+    uint32_t recno = first;
 
-    return true;
-}
+    while ((recno = next_active(dbf, recno)) != 0) {
+        uint32_t end = next_deleted(dbf, recno);
+        if (end == 0) end = dbf->header.record_count + 1;
 
-/* Get field value as double */
-bool dbf_get_double(DBF *dbf, int field_index, double *value) {
-    if (!dbf || !value) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+        size_t bytes = (size_t)(end - recno) * dbf->header.record_size;
+        memmove(base + record_offset(dbf, write_recno), base + record_offset(dbf, recno), bytes);
+        *moved += bytes;
 
-    const DBFField *field = &dbf->fields[field_index];
-    if (field->type != FIELD_TYPE_NUMERIC) {
-        error_set(ERR_TYPE_MISMATCH, "Field is not numeric");
-        return false;
+        write_recno += end - recno;
+        recno = end;
     }
 
-    char buf[32];
-    size_t len = field->length < 31 ? field->length : 31;
-    memcpy(buf, &dbf->record_buffer[field->offset], len);
-    buf[len] = '\0';
-
-    return str_to_num(buf, value);
+    return write_recno - 1;
 }
 
-/* Get field value as logical */
-bool dbf_get_logical(DBF *dbf, int field_index, bool *value) {
-    if (!dbf || !value) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+/* Stream the records from 'first' on through a large buffer, dropping
+ * deleted ones and writing the survivors back sequentially. Writes trail
+ * reads, so each chunk is read before its range can be overwritten. */
+static bool pack_stream(DBF *dbf, uint32_t first, uint32_t *kept, uint64_t *moved) {
+    int fd = fileno(dbf->fp);
+    uint16_t size = dbf->header.record_size;
+    uint32_t chunk = (uint32_t)(DBF_PACK_CHUNK_BYTES / size) + 1;
+    uint8_t *buffer = xmalloc((size_t)chunk * size);
+    off_t base = (off_t)dbf->header.header_size;
+    uint32_t write_recno = first;
+
+    for (uint32_t recno = first; recno <= dbf->header.record_count; recno += chunk) {
+        uint32_t n = dbf->header.record_count - recno + 1;
+        if (n > chunk) n = chunk;
+
+        size_t bytes = (size_t)n * size;
+        if (pread(fd, buffer, bytes, base + (off_t)record_offset(dbf, recno)) != (ssize_t)bytes) {
+            error_set(ERR_FILE_READ, "Cannot read %s", dbf->filename);
+            xfree(buffer);
+            return false;
+        }
 
-    const DBFField *field = &dbf->fields[field_index];
-    if (field->type != FIELD_TYPE_LOGICAL) {
-        error_set(ERR_TYPE_MISMATCH, "Field is not logical");
-        return false;
-    }
+        /* Compact the chunk in place */
+        size_t out = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            const uint8_t *rec = buffer + (size_t)i * size;
+            if (rec[0] == DBF_RECORD_DELETED) continue;
+            if (out != (size_t)i * size) memmove(buffer + out, rec, size);
+            out += size;
+        }
 
-    char c = dbf->record_buffer[field->offset];
-    *value = (c == 'T' || c == 't' || c == 'Y' || c == 'y');
+        if (out > 0 &&
+            pwrite(fd, buffer, out, base + (off_t)record_offset(dbf, write_recno)) != (ssize_t)out) {
+            error_set(ERR_FILE_WRITE, "Cannot write %s", dbf->filename);
+            xfree(buffer);
+            return false;
+        }
+
+        write_recno += (uint32_t)(out / size);
+        *moved += out;
+    }
 
+    xfree(buffer);
+    *kept = write_recno - 1;
     return true;
 }
 
-/* Get field value as date (YYYYMMDD) */
-bool dbf_get_date(DBF *dbf, int field_index, char *buffer) {
-    if (!dbf || !buffer) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+/* Pack database (remove deleted records) */
+bool dbf_pack(DBF *dbf) {
+    return dbf_pack_stats(dbf, NULL);
+}
 
-    const DBFField *field = &dbf->fields[field_index];
-    if (field->type != FIELD_TYPE_DATE) {
-        error_set(ERR_TYPE_MISMATCH, "Field is not date");
+/* Pack and report the work done. Records before the first deleted one
+ * stay where they are; the rest are compacted with large sequential I/O
+ * and the file is truncated after the new EOF marker. */
+bool dbf_pack_stats(DBF *dbf, DBFPackStats *stats) {
+    if (!dbf || dbf->readonly) {
+        error_set(ERR_FILE_WRITE, "Cannot pack read-only database");
         return false;
     }
 
-    memcpy(buffer, &dbf->record_buffer[field->offset], 8);
-    buffer[8] = '\0';
+    uint64_t start = monotonic_us();
+    pack_abandon(dbf);
 
-    return true;
-}
+    /* Flush any pending changes */
+    if (dbf->modified) {
+        write_record(dbf);
+    }
 
-/* Set field value as string */
-bool dbf_put_string(DBF *dbf, int field_index, const char *value) {
-    if (!dbf || dbf->readonly) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+    if (!delmap_ready(dbf)) return false;
+    delmap_unseal(dbf);
+    zones_unseal(dbf);
+    blooms_unseal(dbf);
 
-    const DBFField *field = &dbf->fields[field_index];
+    uint32_t count = dbf->header.record_count;
+    uint32_t first = dbf->deleted_count ? next_deleted(dbf, 1) : 0;
+    uint32_t kept = count;
+    uint64_t moved = 0;
 
-    /* Clear field with spaces */
-    memset(&dbf->record_buffer[field->offset], ' ', field->length);
+    if (dbf->map) {
+        if (first) kept = pack_mapped(dbf, first, &moved);
+    } else {
+        /* Bypass the pool while records move underneath it; pages that
+         * cannot be written back stay cached and the table is left as is */
+        if (!bufpool_detach(dbf->pool)) return false;
+        dbf->pool = NULL;
+
+        bool ok = !first || pack_stream(dbf, first, &kept, &moved);
+        if (ok) {
+            dbf->header.record_count = kept;
+            ok = ftruncate(fileno(dbf->fp), (off_t)(dbf->header.header_size +
+                           record_offset(dbf, kept + 1))) == 0;
+            if (!ok) error_set(ERR_FILE_WRITE, "Cannot truncate %s", dbf->filename);
+        }
 
-    if (value) {
-        size_t len = strlen(value);
-        if (len > field->length) len = field->length;
-        memcpy(&dbf->record_buffer[field->offset], value, len);
+        pool_attach(dbf);
+        if (!ok) {
+            /* Nothing was removed from the bitmap; rescan what is on disk */
+            dbf->header.record_count = count;
+            xfree(dbf->delmap);
+            dbf->delmap = NULL;
+            dbf->delmap_capacity = 0;
+            return false;
+        }
     }
 
-    dbf->modified = true;
-    return true;
-}
-
-/* Set field value as double */
-bool dbf_put_double(DBF *dbf, int field_index, double value) {
-    if (!dbf || dbf->readonly) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
-
-    const DBFField *field = &dbf->fields[field_index];
-    if (field->type != FIELD_TYPE_NUMERIC) {
-        error_set(ERR_TYPE_MISMATCH, "Field is not numeric");
-        return false;
-    }
+    /* Update record count */
+    dbf->header.record_count = kept;
+    dbf->last_read = 0;
+    dbf->readahead_end = 0;
 
-    char buf[64];
-    num_to_str(value, buf, field->length, field->decimals);
+    /* Every remaining record is active */
+    delmap_clear(dbf, kept);
 
-    /* Right-align in field */
-    memset(&dbf->record_buffer[field->offset], ' ', field->length);
-    size_t len = strlen(buf);
-    if (len > field->length) len = field->length;
-    size_t offset = field->length - len;
-    memcpy(&dbf->record_buffer[field->offset + offset], buf, len);
+    /* Write EOF marker */
+    if (!write_eof_marker(dbf)) return false;
+    if (dbf->pool && !bufpool_flush(dbf->pool)) return false;
 
-    dbf->modified = true;
-    return true;
-}
+    /* Update header */
+    if (!write_header(dbf)) return false;
 
-/* Set field value as logical */
-bool dbf_put_logical(DBF *dbf, int field_index, bool value) {
-    if (!dbf || dbf->readonly) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
+    fflush(dbf->fp);
+    dbf->pending = true;
 
-    const DBFField *field = &dbf->fields[field_index];
-    if (field->type != FIELD_TYPE_LOGICAL) {
-        error_set(ERR_TYPE_MISMATCH, "Field is not logical");
+    /* Drop whatever followed the old last record */
+    if (dbf->map && ftruncate(fileno(dbf->fp), (off_t)(dbf->header.header_size +
+                              record_offset(dbf, kept + 1) + 1)) != 0) {
+        error_set(ERR_FILE_WRITE, "Cannot truncate %s", dbf->filename);
         return false;
     }
 
-    dbf->record_buffer[field->offset] = value ? 'T' : 'F';
-    dbf->modified = true;
+    if (stats) {
+        stats->scanned = count;
+        stats->kept = kept;
+        stats->bytes_moved = moved;
+        stats->elapsed_us = monotonic_us() - start;
+    }
+
+    /* Decode the compacted table again; if that fails it is read as usual */
+    if (dbf->columns) columns_build(dbf);
+    if (dbf->zones) zones_build(dbf);
+    if (dbf->blooms) blooms_build(dbf);
+
+    /* Reposition to first record */
+    dbf_go_top(dbf);
 
     return true;
 }
 
-/* Set field value as date (YYYYMMDD) */
-bool dbf_put_date(DBF *dbf, int field_index, const char *value) {
-    if (!dbf || dbf->readonly) return false;
-    if (field_index < 0 || field_index >= dbf->field_count) return false;
-    if (dbf->current_record == 0 || dbf->eof) return false;
-
-    const DBFField *field = &dbf->fields[field_index];
-    if (field->type != FIELD_TYPE_DATE) {
-        error_set(ERR_TYPE_MISMATCH, "Field is not date");
-        return false;
-    }
+/*
+ * Online PACK
+ */
 
-    /* Clear field with spaces */
-    memset(&dbf->record_buffer[field->offset], ' ', 8);
+/* Copy 'n' records starting at 'recno' out of the table */
+static bool read_raw(DBF *dbf, uint32_t recno, uint32_t n, uint8_t *dst) {
+    size_t bytes = (size_t)n * dbf->header.record_size;
 
-    if (value && strlen(value) == 8) {
-        memcpy(&dbf->record_buffer[field->offset], value, 8);
+    if (dbf->map) {
+        memcpy(dst, dbf->map + dbf->header.header_size + record_offset(dbf, recno), bytes);
+        return true;
     }
 
-    dbf->modified = true;
-    return true;
+    return bufpool_read(dbf->pool, record_offset(dbf, recno), dst, bytes);
 }
 
-/* Pack database (remove deleted records) */
-bool dbf_pack(DBF *dbf) {
+/* Snapshot the table and create the shadow file */
+DBFPack *dbf_pack_begin(DBF *dbf) {
     if (!dbf || dbf->readonly) {
         error_set(ERR_FILE_WRITE, "Cannot pack read-only database");
-        return false;
+        return NULL;
+    }
+    if (dbf->packer) {
+        error_set(ERR_FILE_WRITE, "PACK already in progress on %s", dbf->filename);
+        return NULL;
     }
 
-    /* Flush any pending changes */
-    if (dbf->modified) {
-        write_record(dbf);
+    /* The copy reads the file directly, so it must be current */
+    if (dbf->modified && !write_record(dbf)) return NULL;
+    if (dbf->pool && !bufpool_flush(dbf->pool)) return NULL;
+    if (!delmap_ready(dbf)) return NULL;
+
+    DBFPack *pack = xcalloc(1, sizeof(DBFPack));
+    pack->dbf = dbf;
+    pack->snapshot = dbf->header.record_count;
+    pack->header_size = dbf->header.header_size;
+    pack->record_size = dbf->header.record_size;
+    pack->start_us = monotonic_us();
+
+    size_t bytes = delmap_bytes(pack->snapshot);
+    pack->dropped = xcalloc(bytes + 1, 1);
+    pack->dirty = xcalloc(bytes + 1, 1);
+    memcpy(pack->dropped, dbf->delmap, bytes);
+    pack->map = xcalloc((size_t)pack->snapshot + 1, sizeof(uint32_t));
+    pack->map_count = pack->snapshot;
+
+    strncpy(pack->shadow, dbf->filename, MAX_PATH_LEN - 5);
+    file_change_ext(pack->shadow, ".pak");
+
+    /* The shadow starts with the table's header and field descriptors */
+    uint8_t *header = xmalloc(dbf->header.header_size);
+    pack->src_fd = dup(fileno(dbf->fp));
+    pack->dst_fd = open(pack->shadow, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    bool ok = pack->src_fd >= 0 && pack->dst_fd >= 0 &&
+              pread(pack->src_fd, header, dbf->header.header_size, 0) == (ssize_t)dbf->header.header_size &&
+              pwrite(pack->dst_fd, header, dbf->header.header_size, 0) == (ssize_t)dbf->header.header_size;
+    xfree(header);
+
+    if (!ok) {
+        error_set(ERR_FILE_CREATE, "%s", pack->shadow);
+        dbf_pack_free(pack);
+        return NULL;
     }
 
-    uint8_t *buffer = xmalloc(dbf->header.record_size);
-    uint32_t write_recno = 0;
+    dbf->packer = pack;
+    return pack;
+}
 
-    for (uint32_t read_recno = 1; read_recno <= dbf->header.record_count; read_recno++) {
-        /* Read record */
-        long read_offset = dbf->header.header_size +
-                          (long)(read_recno - 1) * dbf->header.record_size;
-        if (fseek(dbf->fp, read_offset, SEEK_SET) != 0) {
+/* Copy the records that were live at the snapshot into the shadow file.
+ * Runs without the table lock: records changed meanwhile are marked dirty
+ * and copied again by dbf_pack_finish(). */
+bool dbf_pack_copy(DBFPack *pack) {
+    if (!pack) return false;
+
+    uint16_t size = pack->record_size;
+    uint16_t header_size = pack->header_size;
+    uint32_t chunk = (uint32_t)(DBF_PACK_CHUNK_BYTES / size) + 1;
+    uint8_t *buffer = xmalloc((size_t)chunk * size);
+
+    for (uint32_t recno = 1; recno <= pack->snapshot; recno += chunk) {
+        uint32_t n = pack->snapshot - recno + 1;
+        if (n > chunk) n = chunk;
+
+        size_t bytes = (size_t)n * size;
+        off_t from = (off_t)header_size + (off_t)(recno - 1) * size;
+        if (pread(pack->src_fd, buffer, bytes, from) != (ssize_t)bytes) {
+            error_set(ERR_FILE_READ, "Cannot read table for PACK");
             xfree(buffer);
             return false;
         }
-        if (fread(buffer, 1, dbf->header.record_size, dbf->fp) != dbf->header.record_size) {
+
+        size_t out = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t bit = recno + i - 1;
+            if ((pack->dropped[bit >> 3] >> (bit & 7)) & 1) continue;
+
+            pack->map[recno + i] = ++pack->kept;
+            if (out != (size_t)i * size) memmove(buffer + out, buffer + (size_t)i * size, size);
+            out += size;
+        }
+
+        off_t to = (off_t)header_size + (off_t)(pack->kept - out / size) * size;
+        if (out > 0 && pwrite(pack->dst_fd, buffer, out, to) != (ssize_t)out) {
+            error_set(ERR_FILE_WRITE, "%s", pack->shadow);
             xfree(buffer);
             return false;
         }
+        pack->moved += out;
+    }
 
-        /* Skip deleted records */
-        if (buffer[0] == DBF_RECORD_DELETED) continue;
+    xfree(buffer);
+    return true;
+}
 
-        write_recno++;
+/* Catch up on records written during the copy, then switch the table over
+ * to the shadow file */
+bool dbf_pack_finish(DBFPack *pack, DBFPackStats *stats) {
+    if (!pack || pack->done) return false;
 
-        /* Write record at new position if needed */
-        if (write_recno != read_recno) {
-            long write_offset = dbf->header.header_size +
-                               (long)(write_recno - 1) * dbf->header.record_size;
-            if (fseek(dbf->fp, write_offset, SEEK_SET) != 0) {
-                xfree(buffer);
-                return false;
-            }
-            if (fwrite(buffer, 1, dbf->header.record_size, dbf->fp) != dbf->header.record_size) {
-                xfree(buffer);
-                return false;
+    DBF *dbf = pack->dbf;
+    if (!dbf) {
+        error_set(ERR_FILE_WRITE, "PACK abandoned: the table was closed or rewritten");
+        return false;
+    }
+
+    if (dbf->modified && !write_record(dbf)) return false;
+
+    uint32_t count = dbf->header.record_count;
+    uint16_t size = dbf->header.record_size;
+    off_t base = (off_t)dbf->header.header_size;
+    uint8_t *record = xmalloc(size);
+
+    /* A record recalled during the copy was left out of the shadow and
+     * cannot be put back in order; pack offline instead */
+    for (uint32_t recno = 1; recno <= pack->snapshot; recno++) {
+        uint32_t bit = recno - 1;
+        if (((pack->dirty[bit >> 3] >> (bit & 7)) & 1) &&
+            pack->map[recno] == 0 && !delmap_test(dbf, recno)) {
+            xfree(record);
+            dbf->packer = NULL;
+            pack->dbf = NULL;
+
+            /* The offline PACK keeps order, so the map follows the bitmap */
+            pack->map = xrealloc(pack->map, ((size_t)count + 1) * sizeof(uint32_t));
+            pack->map_count = count;
+            uint32_t kept = 0;
+            for (uint32_t r = 1; r <= count; r++) {
+                pack->map[r] = delmap_test(dbf, r) ? 0 : ++kept;
             }
+            if (!dbf_pack_stats(dbf, stats)) return false;
+            pack->done = true;
+            return true;
         }
     }
 
-    xfree(buffer);
-
-    /* Update record count */
-    dbf->header.record_count = write_recno;
+    /* Rewrite kept records changed during the copy at their new place,
+     * noting the ones deleted meanwhile for the new bitmap */
+    uint8_t *marks = xcalloc(delmap_bytes(count) + 1, 1);
+    bool ok = true;
+    for (uint32_t recno = 1; ok && recno <= pack->snapshot; recno++) {
+        uint32_t bit = recno - 1;
+        if ((bit & 7) == 0 && pack->dirty[bit >> 3] == 0) {
+            recno += 7;
+            continue;
+        }
+        if (!((pack->dirty[bit >> 3] >> (bit & 7)) & 1) || pack->map[recno] == 0) continue;
+
+        ok = read_raw(dbf, recno, 1, record) &&
+             pwrite(pack->dst_fd, record, size,
+                    base + (off_t)(pack->map[recno] - 1) * size) == (ssize_t)size;
+        if (record[0] == DBF_RECORD_DELETED) {
+            uint32_t to = pack->map[recno] - 1;
+            marks[to >> 3] |= (uint8_t)(1u << (to & 7));
+        }
+    }
 
-    /* Truncate file */
-    long new_size = dbf->header.header_size +
-                   (long)dbf->header.record_count * dbf->header.record_size + 1;
+    /* Append the live records added during the copy */
+    pack->map = xrealloc(pack->map, ((size_t)count + 1) * sizeof(uint32_t));
+    pack->map_count = count;
+    for (uint32_t recno = pack->snapshot + 1; ok && recno <= count; recno++) {
+        pack->map[recno] = 0;
+        if (delmap_test(dbf, recno)) continue;
+
+        pack->map[recno] = ++pack->kept;
+        ok = read_raw(dbf, recno, 1, record) &&
+             pwrite(pack->dst_fd, record, size,
+                    base + (off_t)(pack->kept - 1) * size) == (ssize_t)size;
+        pack->moved += size;
+    }
+    xfree(record);
 
-    /* Write EOF marker */
-    if (fseek(dbf->fp, new_size - 1, SEEK_SET) != 0) return false;
+    /* Header, EOF marker and exact length, then make the shadow durable
+     * before it replaces the table */
+    uint8_t header[32];
     uint8_t eof = DBF_EOF_MARKER;
-    if (fwrite(&eof, 1, 1, dbf->fp) != 1) return false;
+    uint32_t old_count = dbf->header.record_count;
+    off_t end = base + (off_t)pack->kept * size;
+
+    dbf->header.record_count = pack->kept;
+    encode_header(dbf, header);
+    dbf->header.record_count = old_count;
+
+    ok = ok && pwrite(pack->dst_fd, header, 32, 0) == 32 &&
+         pwrite(pack->dst_fd, &eof, 1, end) == 1 &&
+         ftruncate(pack->dst_fd, end + 1) == 0 &&
+         fdatasync(pack->dst_fd) == 0;
+    if (!ok) {
+        error_set(ERR_FILE_WRITE, "%s", pack->shadow);
+        xfree(marks);
+        return false;
+    }
 
-    /* Update header */
-    if (!write_header(dbf)) return false;
+    if (rename(pack->shadow, dbf->filename) != 0) {
+        error_set(ERR_FILE_WRITE, "Cannot replace %s", dbf->filename);
+        xfree(marks);
+        return false;
+    }
+    pack->installed = true;
+    pack->done = true;
+    dbf->packer = NULL;
+
+    /* Reopen the table on the compacted file; nothing of the old file
+     * needs writing back */
+    bool mapped = dbf->map != NULL;
+    unmap_file(dbf);
+    if (dbf->pool) {
+        bufpool_truncate(dbf->pool, 0);
+        bufpool_detach(dbf->pool);
+        dbf->pool = NULL;
+    }
+    fclose(dbf->fp);
 
-    fflush(dbf->fp);
+    dbf->fp = fopen(dbf->filename, "r+b");
+    if (!dbf->fp || !read_header(dbf)) {
+        error_set(ERR_FILE_READ, "Cannot reopen %s", dbf->filename);
+        xfree(marks);
+        return false;
+    }
+    pool_attach(dbf);
+    if (mapped && map_file(dbf)) {
+        bufpool_detach(dbf->pool);
+        dbf->pool = NULL;
+    }
 
-    /* Reposition to first record */
-    dbf_go_top(dbf);
+    dbf->header_dirty = false;
+    dbf->pending = true;
+    dbf->last_read = 0;
+    dbf->readahead_end = 0;
+    dbf->sequential = false;
+
+    /* Records deleted during the copy were kept, still marked */
+    delmap_unseal(dbf);
+    zones_unseal(dbf);
+    blooms_unseal(dbf);
+    delmap_clear(dbf, pack->kept);
+    for (uint32_t recno = 1; recno <= pack->kept; recno++) {
+        uint32_t bit = recno - 1;
+        if ((marks[bit >> 3] >> (bit & 7)) & 1) delmap_set(dbf, recno, true);
+    }
+    xfree(marks);
+
+    if (stats) {
+        stats->scanned = count;
+        stats->kept = pack->kept;
+        stats->bytes_moved = pack->moved;
+        stats->elapsed_us = monotonic_us() - pack->start_us;
+    }
+
+    if (dbf->columns) columns_build(dbf);
+    if (dbf->zones) zones_build(dbf);
+    if (dbf->blooms) blooms_build(dbf);
+
+    /* Follow the current record to its new number */
+    uint32_t current = dbf->current_record;
+    dbf->modified = false;
+    if (current >= 1 && current <= count && pack->map[current]) {
+        dbf_goto(dbf, pack->map[current]);
+    } else {
+        dbf_go_top(dbf);
+    }
 
     return true;
 }
 
+const uint32_t *dbf_pack_map(DBFPack *pack, uint32_t *count) {
+    if (!pack || !pack->done) return NULL;
+    if (count) *count = pack->map_count;
+    return pack->map;
+}
+
+/* Release an online PACK, removing the shadow unless it was installed */
+void dbf_pack_free(DBFPack *pack) {
+    if (!pack) return;
+
+    if (pack->dbf && pack->dbf->packer == pack) {
+        pack->dbf->packer = NULL;
+    }
+    if (pack->src_fd >= 0) close(pack->src_fd);
+    if (pack->dst_fd >= 0) close(pack->dst_fd);
+    if (!pack->installed && pack->dst_fd >= 0) unlink(pack->shadow);
+
+    xfree(pack->dropped);
+    xfree(pack->dirty);
+    xfree(pack->map);
+    xfree(pack);
+}
+
+/* Copy the table file as committed, header and records unchanged, in
+ * blocks of DBF_COPY_CHUNK_BYTES */
+bool dbf_copy_file(DBF *dbf, const char *filename) {
+    if (!dbf || !dbf->fp) {
+        error_set(ERR_NOT_IMPLEMENTED, "Only DBF files can be copied whole");
+        return false;
+    }
+    if (!dbf_commit(dbf)) return false;
+
+    int dst = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0) {
+        error_set(ERR_FILE_CREATE, "%s", filename);
+        return false;
+    }
+
+    int src = fileno(dbf->fp);
+    uint64_t total = (uint64_t)dbf->header.header_size +
+                     (uint64_t)dbf->header.record_count * dbf->header.record_size;
+    uint8_t *buffer = xmalloc(DBF_COPY_CHUNK_BYTES);
+    bool ok = true;
+    posix_fadvise(src, 0, (off_t)total, POSIX_FADV_SEQUENTIAL);
+
+    for (uint64_t pos = 0; ok && pos < total; ) {
+        size_t n = total - pos < DBF_COPY_CHUNK_BYTES ? (size_t)(total - pos) : DBF_COPY_CHUNK_BYTES;
+        if (pread(src, buffer, n, (off_t)pos) != (ssize_t)n) {
+            error_set(ERR_FILE_READ, "%s", dbf->filename);
+            ok = false;
+        } else if (write(dst, buffer, n) != (ssize_t)n) {
+            error_set(ERR_FILE_WRITE, "%s", filename);
+            ok = false;
+        }
+        pos += n;
+    }
+
+    uint8_t eof = DBF_EOF_MARKER;
+    if (ok && write(dst, &eof, 1) != 1) {
+        error_set(ERR_FILE_WRITE, "%s", filename);
+        ok = false;
+    }
+    if (close(dst) != 0 && ok) {
+        error_set(ERR_FILE_WRITE, "%s", filename);
+        ok = false;
+    }
+
+    xfree(buffer);
+    if (!ok) unlink(filename);
+    return ok;
+}
+
 /* Zap database (remove all records) */
 bool dbf_zap(DBF *dbf) {
     if (!dbf || dbf->readonly) {
@@ -795,17 +3900,25 @@ bool dbf_zap(DBF *dbf) {
     }
 
     /* Update record count */
+    pack_abandon(dbf);
+    delmap_unseal(dbf);
+    zones_unseal(dbf);
+    blooms_unseal(dbf);
     dbf->header.record_count = 0;
+    dbf->last_read = 0;
+    delmap_clear(dbf, 0);
+    if (dbf->zones) zones_clear(dbf);
+    if (dbf->blooms) blooms_clear(dbf);
 
     /* Write EOF marker after header */
-    if (fseek(dbf->fp, dbf->header.header_size, SEEK_SET) != 0) return false;
-    uint8_t eof = DBF_EOF_MARKER;
-    if (fwrite(&eof, 1, 1, dbf->fp) != 1) return false;
+    if (!write_eof_marker(dbf)) return false;
+    if (dbf->pool && !bufpool_flush(dbf->pool)) return false;
 
     /* Update header */
     if (!write_header(dbf)) return false;
 
     fflush(dbf->fp);
+    dbf->pending = true;
 
     /* Reset position */
     dbf->current_record = 0;
@@ -816,10 +3929,116 @@ bool dbf_zap(DBF *dbf) {
 
     memset(dbf->record_buffer, ' ', dbf->header.record_size);
     dbf->record_buffer[0] = DBF_RECORD_ACTIVE;
+    dbf->loaded = true;
+    if (dbf->columns) dbf->columns->count = 0;
+
+    return true;
+}
+
+/*
+ * Durability
+ */
+
+/* Write records, then the header that counts them; optionally sync */
+static bool commit(DBF *dbf, bool sync) {
+    if (dbf->modified && !write_record(dbf)) return false;
+
+    if (dbf->pool && !bufpool_flush(dbf->pool)) return false;
+    if (dbf->header_dirty && !write_header(dbf)) return false;
 
+    if (fflush(dbf->fp) != 0) {
+        error_set(ERR_FILE_WRITE, "Cannot write %s", dbf->filename);
+        return false;
+    }
+
+    if (sync) {
+        if (dbf->map) msync(dbf->map, dbf->map_size, MS_SYNC);
+        if (fdatasync(fileno(dbf->fp)) != 0) {
+            error_set(ERR_FILE_WRITE, "Cannot sync %s", dbf->filename);
+            return false;
+        }
+        g_syncs++;
+    }
+
+    /* The sidecars are stamped against the table as just written */
+    delmap_save(dbf);
+    zones_save(dbf);
+    blooms_save(dbf);
+
+    dbf->pending = false;
+    dbf->commit_ms = commit_clock();
+    return true;
+}
+
+void dbf_set_durability(DBFDurability mode) {
+    g_durability = mode;
+}
+
+DBFDurability dbf_get_durability(void) {
+    return g_durability;
+}
+
+const char *dbf_durability_name(DBFDurability mode) {
+    switch (mode) {
+        case DBF_DURABILITY_NONE:  return "NONE";
+        case DBF_DURABILITY_BATCH: return "BATCH";
+        case DBF_DURABILITY_FULL:  return "FULL";
+    }
+    return "?";
+}
+
+/* Commit pending changes now, syncing unless durability is NONE */
+bool dbf_commit(DBF *dbf) {
+    if (!dbf) return false;
+    if (dbf->readonly || (!dbf->pending && !dbf->modified)) return true;
+    return commit(dbf, g_durability != DBF_DURABILITY_NONE);
+}
+
+/* Statement boundary: apply the durability mode to pending changes */
+bool dbf_end_statement(DBF *dbf) {
+    if (!dbf || dbf->readonly) return true;
+    if (!dbf->pending && !dbf->modified) return true;
+
+    switch (g_durability) {
+        case DBF_DURABILITY_NONE:
+            return commit(dbf, false);
+        case DBF_DURABILITY_BATCH:
+            return dbf_commit_due(dbf);
+        case DBF_DURABILITY_FULL:
+            return commit(dbf, true);
+    }
     return true;
 }
 
+/* Group commit: sync pending changes once the commit interval has passed */
+bool dbf_commit_due(DBF *dbf) {
+    if (!dbf || dbf->readonly) return true;
+    if (!dbf->pending && !dbf->modified) return true;
+    if (commit_clock() - dbf->commit_ms < DBF_GROUP_COMMIT_MS) return true;
+
+    return commit(dbf, g_durability != DBF_DURABILITY_NONE);
+}
+
+/* Group commit across every open table; the caller keeps the tables
+ * from being used or closed meanwhile */
+bool dbf_commit_all_due(void) {
+    bool ok = true;
+    pthread_mutex_lock(&g_open_lock);
+    for (int i = 0; i < g_open_count; i++) {
+        if (!dbf_commit_due(g_open_tables[i])) ok = false;
+    }
+    pthread_mutex_unlock(&g_open_lock);
+    return ok;
+}
+
+uint64_t dbf_sync_count(void) {
+    return g_syncs;
+}
+
+void dbf_set_commit_clock(uint64_t (*clock)(void)) {
+    g_commit_clock = clock;
+}
+
 /* Set/get alias */
 void dbf_set_alias(DBF *dbf, const char *alias) {
     if (!dbf || !alias) return;
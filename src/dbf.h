@@ -7,6 +7,7 @@
 #define XBASE3_DBF_H
 
 #include "util.h"
+#include "bufpool.h"
 #include <stdio.h>
 
 /* DBF version byte */
@@ -47,6 +48,21 @@ typedef struct {
     uint16_t offset;           /* Offset within record (calculated) */
 } DBFField;
 
+/* Online PACK in progress (see dbf_pack_begin) */
+typedef struct DBFPack DBFPack;
+
+/* Decoded columns of an in-memory table (see dbf_open_inmemory) */
+typedef struct DBFColumns DBFColumns;
+
+/* Per-block value ranges of a table (zone maps) */
+typedef struct DBFZones DBFZones;
+
+/* Per-block Bloom filters of chosen character fields */
+typedef struct DBFBlooms DBFBlooms;
+
+/* Columnar snapshot file (see xcol.h) */
+typedef struct XCol XCol;
+
 /* DBF file handle */
 typedef struct {
     FILE *fp;                  /* File pointer */
@@ -63,12 +79,122 @@ typedef struct {
     bool deleted;              /* Current record deleted flag */
     bool exclusive;            /* Exclusive access */
     bool readonly;             /* Read-only mode */
+    uint8_t *map;              /* Memory-mapped file (NULL unless MMAP mode) */
+    size_t map_size;           /* Length of the mapping in bytes */
+    BufFile *pool;             /* Record area in the buffer pool (unmapped) */
+    uint64_t readahead_end;    /* End of the current read-ahead window */
+    uint32_t last_read;        /* Last record read, for scan detection */
+    bool sequential;           /* Sequential access detected and advised */
+    bool header_dirty;         /* In-memory header ahead of the file */
+    bool pending;              /* Changes not yet committed */
+    uint64_t commit_ms;        /* Time of the last commit (monotonic ms) */
+    uint8_t *delmap;           /* Deleted bitmap, one bit per record (NULL until built) */
+    uint32_t delmap_capacity;  /* Records the bitmap has room for */
+    uint32_t deleted_count;    /* Set bits in the bitmap */
+    uint32_t delmap_lo;        /* Dirty byte range of the bitmap */
+    uint32_t delmap_hi;
+    bool delmap_dirty;         /* Sidecar behind the in-memory bitmap */
+    bool delmap_sealed;        /* Sidecar on disk is marked current */
+    int delmap_fd;             /* Sidecar file descriptor (-1 if not open) */
+    DBFPack *packer;           /* Online PACK tracking changes (NULL if none) */
+    DBFColumns *columns;       /* Decoded fields (NULL unless INMEMORY) */
+    bool loaded;               /* In-memory table: record buffer holds the current record */
+    DBFZones *zones;           /* Zone maps (NULL until built) */
+    DBFBlooms *blooms;         /* Bloom filters (NULL if no field has one) */
+    XCol *xcol;                /* Snapshot the table is read from (NULL for a DBF file) */
 } DBF;
 
+/* Durability modes (SET DURABILITY TO NONE|BATCH|FULL) */
+typedef enum {
+    DBF_DURABILITY_NONE,       /* Written to the OS at statement end, never synced */
+    DBF_DURABILITY_BATCH,      /* Group commit with one fdatasync per interval */
+    DBF_DURABILITY_FULL        /* Written and synced at the end of every statement */
+} DBFDurability;
+
+/* Deleted bitmap sidecar (.xdm): a 32-byte header followed by one bit per
+ * record. The header is sealed only while the sidecar matches the table,
+ * and stamps the size and modification time of the table, so that a sidecar
+ * left behind by a crash or changed by another program is rebuilt. */
+#define XDM_MAGIC       "XDM1"
+#define XDM_HEADER_SIZE 32
+#define XDM_SEALED      1
+
+/* Zone map sidecar (.xzm): for every DBF_ZONE_RECORDS records, the lowest
+ * and highest value of each N and D field. Sealed and stamped like the
+ * .xdm header. Writes only widen a range; PACK recomputes them. */
+#define XZM_MAGIC        "XZM1"
+#define XZM_HEADER_SIZE  32
+#define DBF_ZONE_RECORDS 4096
+
+/* Bloom filter sidecar (.xbl): the names of the character fields chosen
+ * with SET BLOOM ON, then for every DBF_ZONE_RECORDS records a filter per
+ * field holding its values, trimmed and in upper case. Sealed and stamped
+ * like the .xdm header; when stale, the field list is kept and the filters
+ * are rebuilt. Values written over stay in the filters until PACK. */
+#define XBL_MAGIC        "XBL1"
+#define XBL_HEADER_SIZE  32
+#define XBL_NAME_SIZE    16
+#define DBF_BLOOM_BYTES  8192
+#define DBF_BLOOM_HASHES 7
+#define DBF_BLOOM_FIELDS 8
+
+/* Interval between group commits in BATCH mode */
+#define DBF_GROUP_COMMIT_MS 50
+
+/* Work done by a PACK */
+typedef struct {
+    uint32_t scanned;          /* Records before the pack */
+    uint32_t kept;             /* Records after the pack */
+    uint64_t bytes_moved;      /* Record bytes rewritten */
+    uint64_t elapsed_us;       /* Wall time of the pack */
+} DBFPackStats;
+
+/* Buffered appender: stages records in memory and writes them in batches */
+typedef struct DBFAppender DBFAppender;
+
+/* Reader handle: a private descriptor, cursor and record block, read with
+ * pread, so that several threads can scan one table at the same time */
+typedef struct DBFReader DBFReader;
+
+/* Forward scan that keeps block reads in flight ahead of the cursor */
+typedef struct DBFScan DBFScan;
+
+/* I/O for full-table scans (AUTO: asynchronous for large unmapped tables,
+ * through io_uring where available and a pread thread pool otherwise) */
+typedef enum {
+    DBF_SCAN_AUTO,
+    DBF_SCAN_SYNC,             /* Ordinary navigation through the pool */
+    DBF_SCAN_THREADS,          /* Thread pool of preads */
+    DBF_SCAN_URING             /* io_uring, falling back to threads */
+} DBFScanMode;
+
+/* Comparison of a field with a constant, which a scan can use to skip
+ * blocks: N fields compare by value and D fields by julian day number,
+ * as expressions compare them */
+typedef enum {
+    DBF_ZONE_EQ,
+    DBF_ZONE_NE,
+    DBF_ZONE_LT,
+    DBF_ZONE_LE,
+    DBF_ZONE_GT,
+    DBF_ZONE_GE,
+    DBF_ZONE_MATCH             /* C field equals text, trimmed and ignoring case */
+} DBFZoneOp;
+
+typedef struct {
+    int field;                 /* N or D field (C for DBF_ZONE_MATCH) */
+    DBFZoneOp op;              /* field <op> value */
+    double value;
+    const char *text;          /* DBF_ZONE_MATCH: value looked for */
+} DBFZoneTest;
+
 /* Open/close operations */
 DBF *dbf_open(const char *filename, bool readonly);
+DBF *dbf_open_mmap(const char *filename, bool readonly);
+DBF *dbf_open_inmemory(const char *filename, bool readonly);
+DBF *dbf_open_xcol(const char *filename);
 DBF *dbf_create(const char *filename, const DBFField *fields, int field_count);
-void dbf_close(DBF *dbf);
+bool dbf_close(DBF *dbf);
 
 /* Navigation */
 bool dbf_goto(DBF *dbf, uint32_t recno);
@@ -82,9 +208,22 @@ bool dbf_bof(DBF *dbf);
 uint32_t dbf_recno(DBF *dbf);
 uint32_t dbf_reccount(DBF *dbf);
 bool dbf_deleted(DBF *dbf);
+bool dbf_is_mapped(DBF *dbf);
+bool dbf_is_inmemory(DBF *dbf);
+bool dbf_is_snapshot(DBF *dbf);
+
+/* Deleted bitmap: counts and flags without reading records */
+uint32_t dbf_deleted_count(DBF *dbf);
+uint32_t dbf_active_count(DBF *dbf);
+bool dbf_record_deleted(DBF *dbf, uint32_t recno);
+
+/* SET DELETED ON: GO TOP/BOTTOM and SKIP step over deleted records */
+void dbf_set_skip_deleted(bool on);
+bool dbf_get_skip_deleted(void);
 
 /* Record operations */
 bool dbf_append_blank(DBF *dbf);
+bool dbf_append_batch(DBF *dbf, const uint8_t *records, uint32_t n);
 bool dbf_delete(DBF *dbf);
 bool dbf_recall(DBF *dbf);
 bool dbf_flush(DBF *dbf);
@@ -94,6 +233,29 @@ int dbf_field_index(DBF *dbf, const char *name);
 const DBFField *dbf_field_info(DBF *dbf, int index);
 int dbf_field_count(DBF *dbf);
 
+/* Fixed-width numeric (N) field codec */
+bool dbf_decode_numeric(const uint8_t *ptr, size_t len, double *value);
+void dbf_encode_numeric(double value, uint8_t *ptr, size_t width, int decimals);
+
+/* Zero-copy field access: the view points into the current record (or the
+ * mapping) and stays valid until the record pointer moves or the field is
+ * written. Views are not NUL-terminated. */
+bool dbf_field_view(DBF *dbf, int field_index, const uint8_t **ptr, size_t *len);
+size_t dbf_view_trim_right(const uint8_t *ptr, size_t len);
+size_t dbf_view_trim(const uint8_t **ptr, size_t len);
+
+/* In-memory tables keep every field decoded: N as doubles, D as julian
+ * day numbers, L as bits and C as trimmed strings in an arena. dbf_get_*
+ * and navigation use the columns, and dbf_put_* keeps them current; the
+ * raw record is read only when its bytes are asked for. This view of a
+ * character field has its trailing blanks removed.
+ *
+ * A columnar snapshot (.xcol) opens as a read-only in-memory table whose
+ * columns are decoded from the file the first time a field is used;
+ * records are put together from the columns when their bytes are asked
+ * for. */
+bool dbf_column_view(DBF *dbf, int field_index, const uint8_t **ptr, size_t *len);
+
 /* Field value get/set */
 bool dbf_get_string(DBF *dbf, int field_index, char *buffer, size_t bufsize);
 bool dbf_get_double(DBF *dbf, int field_index, double *value);
@@ -105,10 +267,90 @@ bool dbf_put_double(DBF *dbf, int field_index, double value);
 bool dbf_put_logical(DBF *dbf, int field_index, bool value);
 bool dbf_put_date(DBF *dbf, int field_index, const char *value); /* YYYYMMDD */
 
+/* Buffered appends; the header is rewritten once per batch */
+DBFAppender *dbf_appender_open(DBF *dbf, uint32_t batch_records);
+uint8_t *dbf_appender_add(DBFAppender *ap);
+bool dbf_appender_put_string(DBFAppender *ap, int field_index, const char *value);
+bool dbf_appender_put_double(DBFAppender *ap, int field_index, double value);
+bool dbf_appender_put_logical(DBFAppender *ap, int field_index, bool value);
+bool dbf_appender_put_date(DBFAppender *ap, int field_index, const char *value);
+bool dbf_appender_flush(DBFAppender *ap);
+uint32_t dbf_appender_count(DBFAppender *ap);
+bool dbf_appender_close(DBFAppender *ap);
+
+/* Reader handles: open with the table's lock held (pending writes are
+ * flushed so the reader sees them); afterwards the reader needs no lock.
+ * The record count is fixed when the reader is opened. */
+DBFReader *dbf_reader_open(DBF *dbf);
+void dbf_reader_close(DBFReader *rd);
+bool dbf_reader_goto(DBFReader *rd, uint32_t recno);
+bool dbf_reader_go_top(DBFReader *rd);
+bool dbf_reader_skip(DBFReader *rd, int count);
+bool dbf_reader_eof(DBFReader *rd);
+bool dbf_reader_bof(DBFReader *rd);
+uint32_t dbf_reader_recno(DBFReader *rd);
+uint32_t dbf_reader_reccount(DBFReader *rd);
+bool dbf_reader_deleted(DBFReader *rd);
+int dbf_reader_field_count(DBFReader *rd);
+const DBFField *dbf_reader_field_info(DBFReader *rd, int index);
+bool dbf_reader_field_view(DBFReader *rd, int field_index, const uint8_t **ptr, size_t *len);
+bool dbf_reader_get_string(DBFReader *rd, int field_index, char *buffer, size_t bufsize);
+bool dbf_reader_get_double(DBFReader *rd, int field_index, double *value);
+
+/* Scans: open positions the table on its first record (as GO TOP does)
+ * and next moves it forward, so expressions see each record as usual.
+ * The table must not be written while a scan is open. */
+void dbf_set_scan_mode(DBFScanMode mode);
+DBFScanMode dbf_get_scan_mode(void);
+DBFScan *dbf_scan_open(DBF *dbf);
+bool dbf_scan_next(DBFScan *scan);
+
+/* Scan from record 'first' on, only through the blocks whose zone maps
+ * and Bloom filters allow a record to pass every test; the caller still
+ * evaluates its full condition on the records visited */
+DBFScan *dbf_scan_open_where(DBF *dbf, uint32_t first, const DBFZoneTest *tests, int count);
+bool dbf_test_record(DBF *dbf, const DBFZoneTest *tests, int count); /* Current record passes all */
+uint32_t dbf_scan_skipped(DBFScan *scan); /* Records in blocks passed over */
+const char *dbf_scan_backend(DBFScan *scan); /* "io_uring", "threads" or "sync" */
+void dbf_scan_close(DBFScan *scan);
+
+/* Bloom filters on character fields (SET BLOOM ON|OFF <field>); scans use
+ * them for DBF_ZONE_MATCH tests. Dropping field -1 drops them all. */
+bool dbf_bloom_add(DBF *dbf, int field_index);
+bool dbf_bloom_drop(DBF *dbf, int field_index);
+
 /* Bulk operations */
 bool dbf_pack(DBF *dbf);
+bool dbf_pack_stats(DBF *dbf, DBFPackStats *stats);
+bool dbf_copy_file(DBF *dbf, const char *filename); /* COPY TO of the whole file */
+
+/* Online PACK: begin and finish run with the table locked, the copy runs
+ * without the lock while other requests keep using the table. Finish
+ * catches up on records written during the copy and renames the compacted
+ * shadow file over the table. Closing, packing or zapping the table while
+ * the copy runs abandons the online PACK. */
+DBFPack *dbf_pack_begin(DBF *dbf);
+bool dbf_pack_copy(DBFPack *pack);
+bool dbf_pack_finish(DBFPack *pack, DBFPackStats *stats);
+const uint32_t *dbf_pack_map(DBFPack *pack, uint32_t *count); /* old recno -> new, 0 = removed */
+void dbf_pack_free(DBFPack *pack);
 bool dbf_zap(DBF *dbf);
 
+/* Durability: operations leave their changes pending and a statement
+ * boundary decides, per mode, when they are written and synced. The mode
+ * is global: it applies to every table open in the process, whichever
+ * session opened it. In BATCH mode dbf_commit_all_due() is called
+ * periodically to sync the tables whose interval has passed. */
+void dbf_set_durability(DBFDurability mode);
+DBFDurability dbf_get_durability(void);
+const char *dbf_durability_name(DBFDurability mode);
+bool dbf_commit(DBF *dbf);
+bool dbf_end_statement(DBF *dbf);
+bool dbf_commit_due(DBF *dbf);
+bool dbf_commit_all_due(void);
+uint64_t dbf_sync_count(void);
+void dbf_set_commit_clock(uint64_t (*clock)(void)); /* ms; NULL for the real clock (tests) */
+
 /* Utility */
 void dbf_set_alias(DBF *dbf, const char *alias);
 const char *dbf_get_alias(DBF *dbf);
@@ -32,6 +32,15 @@ Value value_string(const char *s) {
     return v;
 }
 
+Value value_string_len(const char *s, size_t len) {
+    Value v = {0};
+    v.type = VAL_STRING;
+    v.data.string = xmalloc(len + 1);
+    memcpy(v.data.string, s, len);
+    v.data.string[len] = '\0';
+    return v;
+}
+
 Value value_date(const char *d) {
     Value v = {0};
     v.type = VAL_DATE;
@@ -320,6 +329,75 @@ static Value eval_unary(TokenType op, Value *operand) {
     }
 }
 
+/* Value of a field of an in-memory table, read from its decoded column */
+static Value column_value(DBF *dbf, int idx, const DBFField *field) {
+    switch (field->type) {
+        case FIELD_TYPE_NUMERIC: {
+            double val = 0;
+            dbf_get_double(dbf, idx, &val);
+            return value_number(val);
+        }
+        case FIELD_TYPE_DATE: {
+            Value v = value_date(NULL);
+            dbf_get_date(dbf, idx, v.data.date);
+            return v;
+        }
+        case FIELD_TYPE_LOGICAL: {
+            bool val = false;
+            dbf_get_logical(dbf, idx, &val);
+            return value_logical(val);
+        }
+        case FIELD_TYPE_CHAR: {
+            /* The column holds the value trimmed; the field is padded */
+            const uint8_t *ptr;
+            size_t len;
+            if (!dbf_column_view(dbf, idx, &ptr, &len)) return value_string("");
+            Value v = {0};
+            v.type = VAL_STRING;
+            v.data.string = xmalloc((size_t)field->length + 1);
+            memcpy(v.data.string, ptr, len);
+            memset(v.data.string + len, ' ', field->length - len);
+            v.data.string[field->length] = '\0';
+            return v;
+        }
+        default:
+            return value_nil();
+    }
+}
+
+/* Value of a field of the current record, read through a field view of
+ * the table or, in a parallel scan, of the worker's reader */
+static Value field_value(EvalContext *ctx, int idx) {
+    DBF *dbf = ctx->current_dbf;
+    const DBFField *field = dbf_field_info(dbf, idx);
+    if (!ctx->reader && dbf_is_inmemory(dbf)) return column_value(dbf, idx, field);
+
+    const uint8_t *ptr = NULL;
+    size_t len = 0;
+    bool have = ctx->reader ? dbf_reader_field_view(ctx->reader, idx, &ptr, &len) :
+                              dbf_field_view(dbf, idx, &ptr, &len);
+
+    switch (field->type) {
+        case FIELD_TYPE_CHAR:
+            return have ? value_string_len((const char *)ptr, len) : value_string("");
+        case FIELD_TYPE_NUMERIC: {
+            double val = 0;
+            if (have) dbf_decode_numeric(ptr, len, &val);
+            return value_number(val);
+        }
+        case FIELD_TYPE_DATE: {
+            Value v = value_date(NULL);
+            if (have) memcpy(v.data.date, ptr, 8);
+            return v;
+        }
+        case FIELD_TYPE_LOGICAL:
+            return value_logical(have && (ptr[0] == 'T' || ptr[0] == 't' ||
+                                          ptr[0] == 'Y' || ptr[0] == 'y'));
+        default:
+            return value_nil();
+    }
+}
+
 /* Main expression evaluator */
 Value expr_eval(ASTExpr *expr, EvalContext *ctx) {
     if (!expr) return value_nil();
@@ -360,29 +438,7 @@ Value expr_eval(ASTExpr *expr, EvalContext *ctx) {
             if (ctx->current_dbf) {
                 int idx = dbf_field_index(ctx->current_dbf, expr->data.ident);
                 if (idx >= 0) {
-                    const DBFField *field = dbf_field_info(ctx->current_dbf, idx);
-                    char buf[MAX_FIELD_LEN + 1];
-
-                    switch (field->type) {
-                        case FIELD_TYPE_CHAR:
-                            dbf_get_string(ctx->current_dbf, idx, buf, sizeof(buf));
-                            return value_string(buf);
-                        case FIELD_TYPE_NUMERIC: {
-                            double val;
-                            dbf_get_double(ctx->current_dbf, idx, &val);
-                            return value_number(val);
-                        }
-                        case FIELD_TYPE_DATE:
-                            dbf_get_date(ctx->current_dbf, idx, buf);
-                            return value_date(buf);
-                        case FIELD_TYPE_LOGICAL: {
-                            bool val;
-                            dbf_get_logical(ctx->current_dbf, idx, &val);
-                            return value_logical(val);
-                        }
-                        default:
-                            return value_nil();
-                    }
+                    return field_value(ctx, idx);
                 }
             }
 
@@ -402,21 +458,7 @@ Value expr_eval(ASTExpr *expr, EvalContext *ctx) {
             if (ctx->current_dbf) {
                 int idx = dbf_field_index(ctx->current_dbf, expr->data.field_ref.field);
                 if (idx >= 0) {
-                    const DBFField *field = dbf_field_info(ctx->current_dbf, idx);
-                    char buf[MAX_FIELD_LEN + 1];
-
-                    switch (field->type) {
-                        case FIELD_TYPE_CHAR:
-                            dbf_get_string(ctx->current_dbf, idx, buf, sizeof(buf));
-                            return value_string(buf);
-                        case FIELD_TYPE_NUMERIC: {
-                            double val;
-                            dbf_get_double(ctx->current_dbf, idx, &val);
-                            return value_number(val);
-                        }
-                        default:
-                            return value_nil();
-                    }
+                    return field_value(ctx, idx);
                 }
             }
             return value_nil();
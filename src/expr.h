@@ -37,6 +37,8 @@ typedef struct Value {
 /* Evaluation context */
 typedef struct {
     DBF *current_dbf;       /* Current database */
+    DBFReader *reader;      /* Record source of a parallel scan worker; fields
+                             * of current_dbf are read through it when set */
     /* Add more context as needed: work areas, etc. */
 } EvalContext;
 
@@ -44,6 +46,7 @@ typedef struct {
 Value value_nil(void);
 Value value_number(double n);
 Value value_string(const char *s);
+Value value_string_len(const char *s, size_t len);
 Value value_date(const char *d);
 Value value_logical(bool b);
 
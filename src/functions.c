@@ -491,30 +491,35 @@ static Value fn_islower(Value *args, int arg_count, EvalContext *ctx) {
 static Value fn_recno(Value *args, int arg_count, EvalContext *ctx) {
     (void)args; (void)arg_count;
     if (!ctx->current_dbf) return value_number(0);
+    if (ctx->reader) return value_number((double)dbf_reader_recno(ctx->reader));
     return value_number((double)dbf_recno(ctx->current_dbf));
 }
 
 static Value fn_reccount(Value *args, int arg_count, EvalContext *ctx) {
     (void)args; (void)arg_count;
     if (!ctx->current_dbf) return value_number(0);
+    if (ctx->reader) return value_number((double)dbf_reader_reccount(ctx->reader));
     return value_number((double)dbf_reccount(ctx->current_dbf));
 }
 
 static Value fn_eof(Value *args, int arg_count, EvalContext *ctx) {
     (void)args; (void)arg_count;
     if (!ctx->current_dbf) return value_logical(true);
+    if (ctx->reader) return value_logical(dbf_reader_eof(ctx->reader));
     return value_logical(dbf_eof(ctx->current_dbf));
 }
 
 static Value fn_bof(Value *args, int arg_count, EvalContext *ctx) {
     (void)args; (void)arg_count;
     if (!ctx->current_dbf) return value_logical(true);
+    if (ctx->reader) return value_logical(dbf_reader_bof(ctx->reader));
     return value_logical(dbf_bof(ctx->current_dbf));
 }
 
 static Value fn_deleted(Value *args, int arg_count, EvalContext *ctx) {
     (void)args; (void)arg_count;
     if (!ctx->current_dbf) return value_logical(false);
+    if (ctx->reader) return value_logical(dbf_reader_deleted(ctx->reader));
     return value_logical(dbf_deleted(ctx->current_dbf));
 }
 
@@ -46,6 +46,22 @@ static bool check_database(HttpResponse *resp, CommandContext *ctx) {
     return true;
 }
 
+/* Helper: field value (an untrimmed view) to JSON */
+static JsonValue *value_to_json(const DBFField *field, const uint8_t *value, size_t len) {
+    switch (field->type) {
+        case FIELD_TYPE_NUMERIC: {
+            double num;
+            if (dbf_decode_numeric(value, len, &num)) return json_number(num);
+            return json_null();
+        }
+        case FIELD_TYPE_LOGICAL:
+            return json_bool(value[0] == 'T' || value[0] == 'Y' ||
+                             value[0] == 't' || value[0] == 'y');
+        default:
+            return json_string_len((const char *)value, dbf_view_trim_right(value, len));
+    }
+}
+
 /* Helper: record to JSON object */
 static JsonValue *record_to_json(DBF *dbf) {
     JsonValue *record = json_object();
@@ -57,34 +73,37 @@ static JsonValue *record_to_json(DBF *dbf) {
     int fc = dbf_field_count(dbf);
     for (int i = 0; i < fc; i++) {
         const DBFField *field = dbf_field_info(dbf, i);
-        char value[MAX_FIELD_LEN + 1];
-        dbf_get_string(dbf, i, value, sizeof(value));
-
-        /* Trim trailing spaces */
-        size_t len = strlen(value);
-        while (len > 0 && value[len - 1] == ' ') {
-            value[--len] = '\0';
+        const uint8_t *value;
+        size_t len;
+        if (!dbf_field_view(dbf, i, &value, &len)) {
+            json_object_set(fields, field->name, json_null());
+            continue;
         }
+        json_object_set(fields, field->name, value_to_json(field, value, len));
+    }
+    json_object_set(record, "fields", fields);
 
-        switch (field->type) {
-            case FIELD_TYPE_NUMERIC: {
-                double num;
-                if (str_to_num(value, &num)) {
-                    json_object_set(fields, field->name, json_number(num));
-                } else {
-                    json_object_set(fields, field->name, json_null());
-                }
-                break;
-            }
-            case FIELD_TYPE_LOGICAL:
-                json_object_set(fields, field->name,
-                    json_bool(value[0] == 'T' || value[0] == 'Y' ||
-                              value[0] == 't' || value[0] == 'y'));
-                break;
-            default:
-                json_object_set(fields, field->name, json_string(value));
-                break;
+    return record;
+}
+
+/* Helper: reader's current record to JSON object */
+static JsonValue *reader_record_to_json(DBFReader *rd) {
+    JsonValue *record = json_object();
+
+    json_object_set(record, "recno", json_number((double)dbf_reader_recno(rd)));
+    json_object_set(record, "deleted", json_bool(dbf_reader_deleted(rd)));
+
+    JsonValue *fields = json_object();
+    int fc = dbf_reader_field_count(rd);
+    for (int i = 0; i < fc; i++) {
+        const DBFField *field = dbf_reader_field_info(rd, i);
+        const uint8_t *value;
+        size_t len;
+        if (!dbf_reader_field_view(rd, i, &value, &len)) {
+            json_object_set(fields, field->name, json_null());
+            continue;
         }
+        json_object_set(fields, field->name, value_to_json(field, value, len));
     }
     json_object_set(record, "fields", fields);
 
@@ -134,8 +153,11 @@ void handle_database_open(HttpRequest *req, HttpResponse *resp, CommandContext *
         strcat(path, ".dbf");
     }
 
-    /* Open database */
-    DBF *dbf = dbf_open(path, false);
+    /* Open database, optionally with memory-mapped reads */
+    bool use_mmap = false;
+    json_get_bool(json_object_get(body, "mmap"), &use_mmap);
+
+    DBF *dbf = use_mmap ? dbf_open_mmap(path, false) : dbf_open(path, false);
     if (!dbf) {
         http_response_error(resp, 400, "ERR_OPEN_FAILED", error_string(g_last_error));
         json_free(body);
@@ -149,6 +171,7 @@ void handle_database_open(HttpRequest *req, HttpResponse *resp, CommandContext *
     json_object_set(data, "filename", json_string(path));
     json_object_set(data, "records", json_number((double)dbf_reccount(dbf)));
     json_object_set(data, "fields", json_number((double)dbf_field_count(dbf)));
+    json_object_set(data, "mmap", json_bool(dbf_is_mapped(dbf)));
 
     JsonValue *response = json_response_ok(data);
     http_response_json(resp, response);
@@ -160,8 +183,12 @@ void handle_database_close(HttpRequest *req, HttpResponse *resp, CommandContext
     (void)req;
 
     if (cmd_get_current_dbf(ctx)) {
-        dbf_close(cmd_get_current_dbf(ctx));
+        bool ok = dbf_close(cmd_get_current_dbf(ctx));
         cmd_set_current_dbf(ctx, NULL);
+        if (!ok) {
+            http_response_error(resp, 500, "ERR_CLOSE_FAILED", error_string(g_last_error));
+            return;
+        }
     }
 
     JsonValue *response = json_response_ok(json_bool(true));
@@ -406,21 +433,42 @@ void handle_records_list(HttpRequest *req, HttpResponse *resp, CommandContext *c
     if (offset_str) offset = atoi(offset_str);
     if (offset < 0) offset = 0;
 
-    JsonValue *records = json_array();
+    /* Scan through a reader handle, without the lock, so that listings
+     * run alongside each other and leave the record pointer alone. The
+     * reader keeps a PACK or ZAP from rewriting the file meanwhile. */
+    DBFReader *rd = dbf_reader_open(dbf);
+    if (!rd) {
+        http_response_error(resp, 500, "ERR_READ_FAILED", error_string(g_last_error));
+        return;
+    }
+
+    bool unlocked = ctx->lock_held;
+    if (unlocked) {
+        cmd_reader_begin(ctx);
+        cmd_unlock(ctx);
+    }
 
-    dbf_goto(dbf, (uint32_t)(offset + 1));
+    JsonValue *records = json_array();
     int count = 0;
 
-    while (!dbf_eof(dbf) && count < limit) {
-        json_array_push(records, record_to_json(dbf));
+    dbf_reader_goto(rd, (uint32_t)(offset + 1));
+    while (!dbf_reader_eof(rd) && count < limit) {
+        json_array_push(records, reader_record_to_json(rd));
         count++;
-        dbf_skip(dbf, 1);
+        if (!dbf_reader_skip(rd, 1)) break;
+    }
+
+    uint32_t total = dbf_reader_reccount(rd);
+    dbf_reader_close(rd);
+    if (unlocked) {
+        cmd_lock(ctx);
+        cmd_reader_end(ctx);
     }
 
     JsonValue *data = json_object();
     json_object_set(data, "records", records);
     json_object_set(data, "count", json_number((double)count));
-    json_object_set(data, "total", json_number((double)dbf_reccount(dbf)));
+    json_object_set(data, "total", json_number((double)total));
     json_object_set(data, "offset", json_number((double)offset));
     json_object_set(data, "limit", json_number((double)limit));
 
@@ -454,45 +502,120 @@ void handle_records_get(HttpRequest *req, HttpResponse *resp, CommandContext *ct
     json_free(response);
 }
 
+/* Helper: stage one JSON object as a new record of an appender */
+static bool stage_json_record(DBFAppender *ap, DBF *dbf, JsonValue *obj) {
+    if (!dbf_appender_add(ap)) return false;
+
+    JsonPair *p = json_object_pairs(obj);
+    while (p) {
+        int idx = dbf_field_index(dbf, p->key);
+        if (idx >= 0) {
+            const DBFField *field = dbf_field_info(dbf, idx);
+            if (json_is_string(p->value)) {
+                dbf_appender_put_string(ap, idx, json_get_string(p->value));
+            } else if (json_is_number(p->value)) {
+                double n;
+                json_get_number(p->value, &n);
+                if (field->type == FIELD_TYPE_NUMERIC) {
+                    dbf_appender_put_double(ap, idx, n);
+                }
+            } else if (json_is_bool(p->value)) {
+                bool b;
+                json_get_bool(p->value, &b);
+                if (field->type == FIELD_TYPE_LOGICAL) {
+                    dbf_appender_put_logical(ap, idx, b);
+                }
+            }
+        }
+        p = p->next;
+    }
+    return true;
+}
+
+/* Helper: append an array of record objects in batches */
+static void append_records_bulk(HttpResponse *resp, DBF *dbf, JsonValue *records) {
+    size_t count = json_array_length(records);
+    for (size_t i = 0; i < count; i++) {
+        if (!json_is_object(json_array_get(records, i))) {
+            http_response_error(resp, 400, "ERR_INVALID_RECORD", "Records must be JSON objects");
+            return;
+        }
+    }
+
+    uint32_t first = dbf_reccount(dbf) + 1;
+    DBFAppender *ap = dbf_appender_open(dbf, 0);
+    bool ok = ap != NULL;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = stage_json_record(ap, dbf, json_array_get(records, i));
+    }
+    if (ap && !dbf_appender_close(ap)) ok = false;
+
+    if (!ok) {
+        http_response_error(resp, 500, "ERR_APPEND_FAILED", "Failed to append records");
+        return;
+    }
+
+    JsonValue *data = json_object();
+    json_object_set(data, "appended", json_number((double)count));
+    json_object_set(data, "first", json_number(count ? (double)first : 0));
+    json_object_set(data, "last", json_number(count ? (double)dbf_reccount(dbf) : 0));
+    json_object_set(data, "total", json_number((double)dbf_reccount(dbf)));
+
+    JsonValue *response = json_response_ok(data);
+    http_response_json(resp, response);
+    json_free(response);
+}
+
 void handle_records_append(HttpRequest *req, HttpResponse *resp, CommandContext *ctx) {
     if (!check_database(resp, ctx)) return;
     DBF *dbf = cmd_get_current_dbf(ctx);
 
+    /* If body provided, parse it before touching the table */
+    JsonValue *body = NULL;
+    if (req->body && req->body_len > 0) {
+        body = get_json_body(req, resp);
+        if (!body) return;
+    }
+
+    /* An array of records is appended in batches */
+    if (body && json_is_array(body)) {
+        append_records_bulk(resp, dbf, body);
+        json_free(body);
+        return;
+    }
+
     if (!dbf_append_blank(dbf)) {
+        json_free(body);
         http_response_error(resp, 500, "ERR_APPEND_FAILED", "Failed to append record");
         return;
     }
 
-    /* If body provided, set field values */
-    JsonValue *body = NULL;
-    if (req->body && req->body_len > 0) {
-        body = get_json_body(req, resp);
-        if (body) {
-            JsonPair *p = json_object_pairs(body);
-            while (p) {
-                int idx = dbf_field_index(dbf, p->key);
-                if (idx >= 0) {
-                    const DBFField *field = dbf_field_info(dbf, idx);
-                    if (json_is_string(p->value)) {
-                        dbf_put_string(dbf, idx, json_get_string(p->value));
-                    } else if (json_is_number(p->value)) {
-                        double n;
-                        json_get_number(p->value, &n);
-                        if (field->type == FIELD_TYPE_NUMERIC) {
-                            dbf_put_double(dbf, idx, n);
-                        }
-                    } else if (json_is_bool(p->value)) {
-                        bool b;
-                        json_get_bool(p->value, &b);
-                        if (field->type == FIELD_TYPE_LOGICAL) {
-                            dbf_put_logical(dbf, idx, b);
-                        }
+    /* Set field values from the body */
+    if (body) {
+        JsonPair *p = json_object_pairs(body);
+        while (p) {
+            int idx = dbf_field_index(dbf, p->key);
+            if (idx >= 0) {
+                const DBFField *field = dbf_field_info(dbf, idx);
+                if (json_is_string(p->value)) {
+                    dbf_put_string(dbf, idx, json_get_string(p->value));
+                } else if (json_is_number(p->value)) {
+                    double n;
+                    json_get_number(p->value, &n);
+                    if (field->type == FIELD_TYPE_NUMERIC) {
+                        dbf_put_double(dbf, idx, n);
+                    }
+                } else if (json_is_bool(p->value)) {
+                    bool b;
+                    json_get_bool(p->value, &b);
+                    if (field->type == FIELD_TYPE_LOGICAL) {
+                        dbf_put_logical(dbf, idx, b);
                     }
                 }
-                p = p->next;
             }
-            json_free(body);
+            p = p->next;
         }
+        json_free(body);
     }
 
     dbf_flush(dbf);
@@ -655,14 +778,24 @@ void handle_query_locate(HttpRequest *req, HttpResponse *resp, CommandContext *c
         snprintf(search_val, sizeof(search_val), "%g", n);
     }
 
-    /* Search */
-    dbf_go_top(dbf);
+    /* Search, passing over blocks whose Bloom filter rules the value out */
+    size_t search_len = strlen(search_val);
+    DBFZoneTest test = {field_idx, DBF_ZONE_MATCH, 0, search_val};
+    DBFScan *scan = dbf_scan_open_where(dbf, 1, &test, 1);
+    if (!scan) {
+        http_response_error(resp, 500, "ERR_READ_FAILED", error_string(g_last_error));
+        json_free(body);
+        return;
+    }
     while (!dbf_eof(dbf)) {
-        char field_val[MAX_FIELD_LEN + 1];
-        dbf_get_string(dbf, field_idx, field_val, sizeof(field_val));
-        str_trim(field_val);
-
-        if (str_casecmp(field_val, search_val) == 0) {
+        const uint8_t *field_val;
+        size_t len;
+        dbf_field_view(dbf, field_idx, &field_val, &len);
+        len = dbf_view_trim(&field_val, len);
+
+        if (len == search_len &&
+            strncasecmp((const char *)field_val, search_val, len) == 0) {
+            dbf_scan_close(scan);
             JsonValue *data = record_to_json(dbf);
             json_object_set(data, "found", json_bool(true));
 
@@ -673,8 +806,9 @@ void handle_query_locate(HttpRequest *req, HttpResponse *resp, CommandContext *c
             return;
         }
 
-        dbf_skip(dbf, 1);
+        if (!dbf_scan_next(scan)) break;
     }
+    dbf_scan_close(scan);
 
     JsonValue *data = json_object();
     json_object_set(data, "found", json_bool(false));
@@ -690,15 +824,9 @@ void handle_query_count(HttpRequest *req, HttpResponse *resp, CommandContext *ct
     if (!check_database(resp, ctx)) return;
     DBF *dbf = cmd_get_current_dbf(ctx);
 
-    /* Count non-deleted records */
+    /* Counts come from the deleted bitmap; no records are read */
     uint32_t total = dbf_reccount(dbf);
-    uint32_t active = 0;
-
-    dbf_go_top(dbf);
-    while (!dbf_eof(dbf)) {
-        if (!dbf_deleted(dbf)) active++;
-        dbf_skip(dbf, 1);
-    }
+    uint32_t active = dbf_active_count(dbf);
 
     JsonValue *data = json_object();
     json_object_set(data, "total", json_number((double)total));
@@ -722,30 +850,22 @@ void handle_query_seek(HttpRequest *req, HttpResponse *resp, CommandContext *ctx
     JsonValue *body = get_json_body(req, resp);
     if (!body) return;
 
-    const char *key = json_get_string(json_object_get(body, "key"));
-    if (!key) {
-        double n;
-        if (json_get_number(json_object_get(body, "key"), &n)) {
-            char buf[64];
-            snprintf(buf, sizeof(buf), "%g", n);
-            key = buf;
-        }
-    }
+    XDX *xdx = ctx->indexes[ctx->current_order - 1];
+    uint8_t *key_buffer = xcalloc(1, xdx_key_length(xdx));
 
-    if (!key) {
+    const char *key = json_get_string(json_object_get(body, "key"));
+    double n;
+    if (key) {
+        xdx_key_text(xdx, key, key_buffer);
+    } else if (json_get_number(json_object_get(body, "key"), &n)) {
+        xdx_key_number(xdx, n, key_buffer);
+    } else {
+        free(key_buffer);
         http_response_error(resp, 400, "ERR_MISSING_PARAM", "key is required");
         json_free(body);
         return;
     }
 
-    XDX *xdx = ctx->indexes[ctx->current_order - 1];
-    uint16_t key_len = xdx_key_length(xdx);
-    uint8_t *key_buffer = xcalloc(1, key_len);
-    memset(key_buffer, ' ', key_len);
-    size_t len = strlen(key);
-    if (len > key_len) len = key_len;
-    memcpy(key_buffer, key, len);
-
     bool found = xdx_seek(xdx, key_buffer);
     uint32_t recno = xdx_recno(xdx);
     free(key_buffer);
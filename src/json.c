@@ -3,6 +3,8 @@
  * json.c - Lightweight JSON parser and builder
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "json.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,8 +13,8 @@
 #include <math.h>
 
 /* Parser state */
-static const char *g_parse_ptr = NULL;
-static char g_parse_error[256] = {0};
+static _Thread_local const char *g_parse_ptr = NULL;
+static _Thread_local char g_parse_error[256] = {0};
 
 /* String buffer for building output */
 typedef struct {
@@ -87,6 +89,15 @@ JsonValue *json_string(const char *val) {
     return v;
 }
 
+JsonValue *json_string_len(const char *val, size_t len) {
+    JsonValue *v = calloc(1, sizeof(JsonValue));
+    v->type = JSON_STRING;
+    v->data.string_val = malloc(len + 1);
+    memcpy(v->data.string_val, val, len);
+    v->data.string_val[len] = '\0';
+    return v;
+}
+
 JsonValue *json_array(void) {
     JsonValue *v = calloc(1, sizeof(JsonValue));
     v->type = JSON_ARRAY;
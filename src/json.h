@@ -58,6 +58,7 @@ JsonValue *json_null(void);
 JsonValue *json_bool(bool val);
 JsonValue *json_number(double val);
 JsonValue *json_string(const char *val);
+JsonValue *json_string_len(const char *val, size_t len);
 JsonValue *json_array(void);
 JsonValue *json_object(void);
 
@@ -313,6 +313,7 @@ static void scan_dot_keyword(Lexer *lex, Token *tok) {
     advance(lex);  /* Skip first . */
 
     const char *start = lex->current;
+    int column = lex->column;
     size_t len = 0;
 
     while (isalpha((unsigned char)peek_char(lex))) {
@@ -348,9 +349,9 @@ static void scan_dot_keyword(Lexer *lex, Token *tok) {
         strcpy(tok->text, ".F.");
     } else {
         /* Not a recognized dot keyword - could be field separator */
-        /* Back up and return DOT */
-        lex->current = start - 1;
-        lex->column -= (int)len + 1;
+        /* Back up to just after the dot and return DOT */
+        lex->current = start;
+        lex->column = column;
         tok->type = TOK_DOT;
         strcpy(tok->text, ".");
     }
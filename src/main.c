@@ -28,6 +28,7 @@
 /* Global context */
 static CommandContext g_ctx;
 static volatile bool g_interrupted = false;
+static bool g_executing = false;    /* Context locked around cmd_execute */
 
 /* Signal handler for Ctrl+C */
 static void signal_handler(int sig) {
@@ -114,6 +115,10 @@ static bool execute_line(const char *line) {
     /* Set up error recovery */
     if (setjmp(g_error_jmp) != 0) {
         /* Error occurred */
+        if (g_executing) {
+            g_executing = false;
+            cmd_unlock(&g_ctx);
+        }
         error_print();
         error_clear();
         return true;  /* Continue REPL */
@@ -133,7 +138,11 @@ static bool execute_line(const char *line) {
     }
 
     if (node) {
+        cmd_lock(&g_ctx);
+        g_executing = true;
         cmd_execute(node, &g_ctx);
+        g_executing = false;
+        cmd_unlock(&g_ctx);
         ast_node_free(node);
 
         if (g_ctx.quit_requested) {
@@ -272,6 +281,9 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    /* Group commits run beside every mode */
+    cmd_start_committer(&g_ctx);
+
     /* Execute based on mode */
     if (server_mode) {
         /* HTTP server mode */
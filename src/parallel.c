@@ -0,0 +1,164 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * parallel.c - Parallel scans over morsels of a table
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+static int g_threads = 1;
+
+void parallel_set_threads(int threads) {
+    if (threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n < 1 ? 1 : (int)n;
+    }
+    g_threads = threads > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : threads;
+}
+
+int parallel_get_threads(void) {
+    return g_threads;
+}
+
+/* State shared by the workers of one scan */
+typedef struct {
+    const ParallelTask *task;
+    ASTExpr *cond;
+    DBF *dbf;
+    uint32_t last;
+    bool skip_deleted;
+    bool failed;               /* A worker could not read its morsel */
+    pthread_mutex_t lock;
+    uint32_t next;             /* First record of the next morsel */
+    uint32_t found;            /* Earliest match so far (first_only) */
+} ScanShared;
+
+typedef struct {
+    ScanShared *shared;
+    DBFReader *reader;
+    void *partial;
+} ScanWorker;
+
+/* Claim the next morsel; false when none is left worth scanning */
+static bool claim(ScanShared *sh, uint32_t *from, uint32_t *to) {
+    pthread_mutex_lock(&sh->lock);
+    bool ok = sh->next <= sh->last && (sh->found == 0 || sh->next < sh->found);
+    if (ok) {
+        *from = sh->next;
+        *to = sh->last - sh->next < PARALLEL_MORSEL_RECORDS ? sh->last :
+              sh->next + PARALLEL_MORSEL_RECORDS - 1;
+        sh->next = *to + 1;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return ok;
+}
+
+static void *scan_worker(void *arg) {
+    ScanWorker *w = arg;
+    ScanShared *sh = w->shared;
+    EvalContext ctx;
+    eval_context_init(&ctx);
+    ctx.current_dbf = sh->dbf;
+    ctx.reader = w->reader;
+
+    uint32_t from, to;
+    while (claim(sh, &from, &to)) {
+        for (uint32_t recno = from; recno <= to; recno++) {
+            if (!dbf_reader_goto(w->reader, recno)) {
+                pthread_mutex_lock(&sh->lock);
+                sh->failed = true;
+                sh->next = sh->last + 1;
+                pthread_mutex_unlock(&sh->lock);
+                return NULL;
+            }
+            if (sh->skip_deleted && dbf_reader_deleted(w->reader)) continue;
+
+            if (sh->cond) {
+                Value v = expr_eval(sh->cond, &ctx);
+                bool pass = value_to_logical(&v);
+                value_free(&v);
+                if (!pass) continue;
+            }
+
+            if (sh->task->visit) sh->task->visit(&ctx, w->partial, sh->task->arg);
+
+            if (sh->task->first_only) {
+                pthread_mutex_lock(&sh->lock);
+                if (sh->found == 0 || recno < sh->found) sh->found = recno;
+                pthread_mutex_unlock(&sh->lock);
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool parallel_scan(DBF *dbf, uint32_t first, ASTExpr *cond, const ParallelTask *task,
+                   void **partials, int *workers, uint32_t *found) {
+    uint32_t last = dbf_reccount(dbf);
+    uint32_t records = first <= last ? last - first + 1 : 0;
+
+    /* No more workers than morsels */
+    int n = g_threads;
+    uint32_t morsels = (records + PARALLEL_MORSEL_RECORDS - 1) / PARALLEL_MORSEL_RECORDS;
+    if ((uint32_t)n > morsels) n = morsels > 0 ? (int)morsels : 1;
+
+    /* Readers are opened here, where the table may still be written */
+    ScanWorker w[PARALLEL_MAX_THREADS];
+    for (int i = 0; i < n; i++) {
+        w[i].reader = dbf_reader_open(dbf);
+        if (!w[i].reader) {
+            while (i-- > 0) dbf_reader_close(w[i].reader);
+            return false;
+        }
+    }
+
+    ScanShared sh;
+    sh.task = task;
+    sh.cond = cond;
+    sh.dbf = dbf;
+    sh.last = last;
+    sh.skip_deleted = dbf_get_skip_deleted();
+    sh.failed = false;
+    pthread_mutex_init(&sh.lock, NULL);
+    sh.next = first;
+    sh.found = 0;
+
+    uint8_t *results = xcalloc((size_t)n, task->partial_size ? task->partial_size : 1);
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    bool started[PARALLEL_MAX_THREADS];
+    for (int i = 0; i < n; i++) {
+        w[i].shared = &sh;
+        w[i].partial = results + (size_t)i * task->partial_size;
+    }
+
+    /* The calling thread is worker 0; morsels of a thread that could not
+     * be started go to the others */
+    for (int i = 1; i < n; i++) {
+        started[i] = pthread_create(&threads[i], NULL, scan_worker, &w[i]) == 0;
+    }
+    scan_worker(&w[0]);
+    for (int i = 1; i < n; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < n; i++) {
+        dbf_reader_close(w[i].reader);
+    }
+    pthread_mutex_destroy(&sh.lock);
+
+    if (sh.failed) {
+        xfree(results);
+        return false;
+    }
+
+    *partials = results;
+    *workers = n;
+    if (found) *found = sh.found;
+    return true;
+}
@@ -0,0 +1,47 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * parallel.h - Parallel scans over morsels of a table
+ */
+
+#ifndef XBASE3_PARALLEL_H
+#define XBASE3_PARALLEL_H
+
+#include "util.h"
+#include "dbf.h"
+#include "expr.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Records a worker claims at a time */
+#define PARALLEL_MORSEL_RECORDS 8192
+
+/* Most worker threads in one scan */
+#define PARALLEL_MAX_THREADS    32
+
+/* Worker threads a scan may use (SET PARALLEL TO <n>); 1, the default,
+ * scans on the calling thread only */
+void parallel_set_threads(int threads);
+int parallel_get_threads(void);
+
+/* What a scan does with each record that passes its condition */
+typedef struct {
+    size_t partial_size;       /* Bytes of each worker's result, zeroed at start */
+    void (*visit)(EvalContext *ctx, void *partial, void *arg);
+    void *arg;
+    bool first_only;           /* Only the earliest passing record is wanted */
+} ParallelTask;
+
+/* Visit the records from 'first' on that pass 'cond' (all of them when
+ * NULL), leaving out deleted records under SET DELETED ON. Morsels of
+ * the table are handed out in order to worker threads, each evaluating
+ * through its own reader handle, so expressions see the record through
+ * ctx->reader and the table itself does not move. '*partials' receives
+ * an array of '*workers' results for the caller to merge and free. A
+ * first_only task stops each worker at its first match and skips
+ * morsels after the earliest match so far; that record is '*found'
+ * (0 when none). Returns false, with nothing visited, when the table
+ * cannot be read this way. */
+bool parallel_scan(DBF *dbf, uint32_t first, ASTExpr *cond, const ParallelTask *task,
+                   void **partials, int *workers, uint32_t *found);
+
+#endif /* XBASE3_PARALLEL_H */
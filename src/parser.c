@@ -4,6 +4,7 @@
  */
 
 #include "parser.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -114,6 +115,35 @@ static void parse_ident_list(Parser *p, char ***list, int *count) {
     } while (match(p, TOK_COMMA));
 }
 
+/* Parse a file name: a string, or a name with an optional extension */
+static char *parse_filename(Parser *p) {
+    if (check(p, TOK_STRING)) {
+        return xstrdup(advance(p)->text);
+    }
+    if (!check(p, TOK_IDENT)) {
+        return NULL;
+    }
+
+    /* Token text does not outlive the next token */
+    char *name = xstrdup(advance(p)->text);
+    if (match(p, TOK_DOT)) {
+        const char *ext = check(p, TOK_IDENT) ? advance(p)->text : "";
+        size_t len = strlen(name);
+        name = xrealloc(name, len + strlen(ext) + 2);
+        name[len] = '.';
+        strcpy(name + len + 1, ext);
+    }
+
+    if (strlen(name) >= MAX_PATH_LEN) {
+        error_set(ERR_SYNTAX, "File name too long (%zu characters, at most %d)",
+                  strlen(name), MAX_PATH_LEN - 1);
+        p->had_error = true;
+        xfree(name);
+        return NULL;
+    }
+    return name;
+}
+
 /* Parse scope clause (ALL, NEXT n, RECORD n, REST) */
 static void parse_scope(Parser *p, Scope *scope) {
     scope->type = SCOPE_ALL;
@@ -407,10 +437,7 @@ static ASTNode *parse_use(Parser *p) {
     }
 
     /* Filename */
-    if (check(p, TOK_IDENT) || check(p, TOK_STRING)) {
-        Token *tok = advance(p);
-        node->data.use.filename = xstrdup(tok->text);
-    }
+    node->data.use.filename = parse_filename(p);
 
     /* Options */
     while (!check(p, TOK_EOF) && !check(p, TOK_NEWLINE)) {
@@ -423,6 +450,12 @@ static ASTNode *parse_use(Parser *p) {
             node->data.use.exclusive = true;
         } else if (match(p, TOK_SHARED)) {
             node->data.use.shared = true;
+        } else if (check(p, TOK_IDENT) && str_casecmp(peek(p)->text, "MMAP") == 0) {
+            advance(p);
+            node->data.use.mmap = true;
+        } else if (check(p, TOK_IDENT) && str_casecmp(peek(p)->text, "INMEMORY") == 0) {
+            advance(p);
+            node->data.use.inmemory = true;
         } else {
             break;
         }
@@ -509,9 +542,114 @@ static ASTNode *parse_append(Parser *p) {
     if (match(p, TOK_BLANK)) {
         /* APPEND BLANK */
     } else if (match(p, TOK_FROM)) {
-        /* APPEND FROM file - not fully implemented */
-        if (check(p, TOK_IDENT) || check(p, TOK_STRING)) {
-            advance(p);
+        /* APPEND FROM file [TYPE type] [FOR cond] [WHILE cond] */
+        node->data.append.filename = parse_filename(p);
+        if (match(p, TOK_TYPE) && check(p, TOK_IDENT)) {
+            Token *tok = advance(p);
+            node->data.append.type = xstrdup(tok->text);
+        }
+        parse_conditions(p, node);
+    }
+
+    return node;
+}
+
+/* Parse COPY TO file [FIELDS list] [scope] [FOR cond] [WHILE cond] [TYPE type] */
+static ASTNode *parse_copy(Parser *p) {
+    ASTNode *node = ast_node_new(CMD_COPY);
+
+    if (!expect(p, TOK_TO, "Expected TO in COPY command")) {
+        return node;
+    }
+
+    node->data.copy.filename = parse_filename(p);
+
+    /* Clauses in any order */
+    while (!check(p, TOK_EOF) && !check(p, TOK_NEWLINE)) {
+        if (match(p, TOK_FIELDS)) {
+            parse_ident_list(p, &node->data.copy.fields, &node->data.copy.field_count);
+        } else if (match(p, TOK_TYPE)) {
+            if (check(p, TOK_IDENT)) {
+                Token *tok = advance(p);
+                xfree(node->data.copy.type);
+                node->data.copy.type = xstrdup(tok->text);
+            }
+        } else if (check(p, TOK_FOR) || check(p, TOK_WHILE)) {
+            parse_conditions(p, node);
+        } else if (check(p, TOK_ALL) || check(p, TOK_NEXT) ||
+                   check(p, TOK_RECORD) || check(p, TOK_REST)) {
+            parse_scope(p, &node->scope);
+        } else {
+            break;
+        }
+    }
+
+    return node;
+}
+
+/* Parse the field list of SORT ON: field [/A] [/C] [/D] [, ...] */
+static void parse_sort_fields(Parser *p, ASTNode *node) {
+    int capacity = 8;
+    node->data.copy.fields = ast_string_list_new(capacity);
+    node->data.copy.options = xcalloc((size_t)capacity, sizeof(int));
+    node->data.copy.field_count = 0;
+
+    do {
+        if (!check(p, TOK_IDENT)) {
+            error_set(ERR_SYNTAX, "Expected field name in SORT");
+            p->had_error = true;
+            return;
+        }
+        int n = node->data.copy.field_count;
+        int old_capacity = capacity;
+        ast_string_list_add(&node->data.copy.fields, &node->data.copy.field_count, &capacity,
+                            advance(p)->text);
+        if (capacity != old_capacity) {
+            node->data.copy.options = xrealloc(node->data.copy.options, sizeof(int) * (size_t)capacity);
+        }
+        node->data.copy.options[n] = SORT_ASCENDING;
+
+        /* Options may be written together (/DC) or apart (/D/C) */
+        while (match(p, TOK_SLASH)) {
+            const char *letters = check(p, TOK_IDENT) ? advance(p)->text : "";
+            if (!*letters) {
+                error_set(ERR_SYNTAX, "Expected A, C or D after / in SORT");
+                p->had_error = true;
+                return;
+            }
+            for (const char *c = letters; *c; c++) {
+                switch (toupper((unsigned char)*c)) {
+                    case 'A': node->data.copy.options[n] &= ~SORT_DESCENDING; break;
+                    case 'D': node->data.copy.options[n] |= SORT_DESCENDING; break;
+                    case 'C': node->data.copy.options[n] |= SORT_NOCASE; break;
+                    default:
+                        error_set(ERR_SYNTAX, "Unknown SORT option /%s", letters);
+                        p->had_error = true;
+                        return;
+                }
+            }
+        }
+    } while (match(p, TOK_COMMA));
+}
+
+/* Parse SORT TO file ON field [/A|/D] [/C] [, ...] [scope] [FOR cond] [WHILE cond];
+ * ON may also come first, as dBASE writes it */
+static ASTNode *parse_sort(Parser *p) {
+    ASTNode *node = ast_node_new(CMD_SORT);
+
+    while (!check(p, TOK_EOF) && !check(p, TOK_NEWLINE) && !p->had_error) {
+        if (match(p, TOK_TO)) {
+            xfree(node->data.copy.filename);
+            node->data.copy.filename = parse_filename(p);
+        } else if (!node->data.copy.fields && match(p, TOK_ON)) {
+            parse_sort_fields(p, node);
+        } else if (check(p, TOK_FOR) || check(p, TOK_WHILE)) {
+            parse_conditions(p, node);
+        } else if (check(p, TOK_ALL) || check(p, TOK_NEXT) ||
+                   check(p, TOK_RECORD) || check(p, TOK_REST)) {
+            parse_scope(p, &node->scope);
+        } else {
+            break;
         }
     }
 
@@ -637,6 +775,13 @@ static ASTNode *parse_set(Parser *p) {
     } else if (str_casecmp(peek(p)->text, "OFF") == 0) {
         advance(p);
         node->data.set.on = false;
+    } else {
+        return node;
+    }
+
+    /* SET option ON|OFF <name> (SET BLOOM ON <field>) */
+    if (check(p, TOK_IDENT) || token_is_keyword(peek(p)->type)) {
+        node->data.set.value = ast_expr_ident(advance(p)->text);
     }
 
     return node;
@@ -730,10 +875,7 @@ static ASTNode *parse_index(Parser *p) {
         return node;
     }
 
-    if (check(p, TOK_IDENT) || check(p, TOK_STRING)) {
-        Token *tok = advance(p);
-        node->data.index.filename = xstrdup(tok->text);
-    }
+    node->data.index.filename = parse_filename(p);
 
     /* Options */
     while (!check(p, TOK_EOF) && !check(p, TOK_NEWLINE)) {
@@ -775,10 +917,7 @@ static ASTNode *parse_close(Parser *p) {
 static ASTNode *parse_create(Parser *p) {
     ASTNode *node = ast_node_new(CMD_CREATE);
 
-    if (check(p, TOK_IDENT) || check(p, TOK_STRING)) {
-        Token *tok = advance(p);
-        node->data.create.filename = xstrdup(tok->text);
-    }
+    node->data.create.filename = parse_filename(p);
 
     return node;
 }
@@ -883,16 +1022,25 @@ static ASTNode *parse_count(Parser *p) {
 static ASTNode *parse_sum_avg(Parser *p, bool is_sum) {
     ASTNode *node = ast_node_new(is_sum ? CMD_SUM : CMD_AVERAGE);
 
-    parse_expr_list(p, &node->data.aggregate.exprs, &node->data.aggregate.count);
+    /* Without expressions every numeric field is totalled */
+    if (!check(p, TOK_EOF) && !check(p, TOK_NEWLINE) && !check(p, TOK_TO) &&
+        !check(p, TOK_ALL) && !check(p, TOK_NEXT) && !check(p, TOK_RECORD) &&
+        !check(p, TOK_REST) && !check(p, TOK_FOR) && !check(p, TOK_WHILE)) {
+        parse_expr_list(p, &node->data.aggregate.exprs, &node->data.aggregate.count);
+    }
 
+    /* TO may come before or, as in COUNT, after the scope and conditions */
     if (match(p, TOK_TO)) {
-        int var_count = 0;
-        parse_ident_list(p, &node->data.aggregate.vars, &var_count);
+        parse_ident_list(p, &node->data.aggregate.vars, &node->data.aggregate.var_count);
     }
 
     parse_scope(p, &node->scope);
     parse_conditions(p, node);
 
+    if (!node->data.aggregate.vars && match(p, TOK_TO)) {
+        parse_ident_list(p, &node->data.aggregate.vars, &node->data.aggregate.var_count);
+    }
+
     return node;
 }
 
@@ -987,6 +1135,16 @@ ASTNode *parser_parse_command(Parser *p) {
             node = parse_append(p);
             break;
 
+        case TOK_COPY:
+            advance(p);
+            node = parse_copy(p);
+            break;
+
+        case TOK_SORT:
+            advance(p);
+            node = parse_sort(p);
+            break;
+
         case TOK_DELETE:
             advance(p);
             node = parse_delete(p, false);
@@ -1000,6 +1158,10 @@ ASTNode *parser_parse_command(Parser *p) {
         case TOK_PACK:
             advance(p);
             node = ast_node_new(CMD_PACK);
+            if (check(p, TOK_IDENT) && str_casecmp(peek(p)->text, "ONLINE") == 0) {
+                advance(p);
+                node->data.pack.online = true;
+            }
             break;
 
         case TOK_ZAP:
@@ -3,6 +3,8 @@
  * server.c - Minimal HTTP server implementation
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "server.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +18,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <ctype.h>
+#include <time.h>
 
 /* Thread pool worker context */
 typedef struct {
@@ -390,6 +393,7 @@ static void handle_request(int client_fd, ServerConfig *cfg) {
     cmd_lock(cfg->cmd_ctx);
     error_enable_longjmp(false);  /* Disable longjmp in server mode */
     route->handler(&req, &resp, cfg->cmd_ctx);
+    dbf_end_statement(cmd_get_current_dbf(cfg->cmd_ctx));
     error_enable_longjmp(true);
     cmd_unlock(cfg->cmd_ctx);
 
@@ -0,0 +1,546 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * sort.c - External merge sort of records into a new table
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sort.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* Records staged in memory: a key followed by the record image */
+typedef struct {
+    uint64_t prefix;           /* First 8 key bytes, big-endian */
+    uint8_t *entry;
+} SortItem;
+
+/* Sorted run in a temporary file */
+typedef struct {
+    uint64_t offset;
+    uint32_t count;
+} SortRun;
+
+/* Cursor over a run while merging */
+typedef struct {
+    uint64_t offset;           /* Next entry not yet read */
+    uint32_t left;             /* Entries not yet read */
+    uint8_t *buffer;
+    uint32_t capacity;         /* Entries the buffer holds */
+    uint32_t pos;
+    uint32_t fill;
+} RunReader;
+
+struct Sorter {
+    char filename[MAX_PATH_LEN];
+    DBF *out;
+    DBFField *fields;
+    int field_count;
+    SortKey keys[SORT_MAX_KEYS];
+    int key_count;
+    uint16_t record_size;
+    size_t key_size;           /* Key bytes in front of each record */
+    size_t entry_size;
+
+    uint8_t *buffer;           /* Staged entries; run buffers while merging */
+    SortItem *items;
+    SortItem *scratch;
+    uint32_t capacity;         /* Entries the budget holds */
+    uint32_t staged;
+    uint32_t added;
+
+    int fd;                    /* Runs (-1 until the first is written) */
+    int spare;                 /* Runs of the next merge pass */
+    SortRun *runs;
+    uint32_t run_count;
+    uint32_t run_capacity;
+    uint32_t spilled;          /* Runs written from memory */
+    uint8_t *out_buffer;       /* Entries being written to a run */
+    uint32_t out_capacity;
+};
+
+static void write_u32_be(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void write_u64_be(uint8_t *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+static uint64_t read_u64_be(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+/* Bytes of key a field contributes */
+static size_t key_length(const DBFField *field) {
+    switch (field->type) {
+        case FIELD_TYPE_NUMERIC: return 8;
+        case FIELD_TYPE_LOGICAL: return 1;
+        default: return field->length;
+    }
+}
+
+Sorter *sorter_create(const char *filename, const DBFField *fields, int field_count,
+                      const SortKey *keys, int key_count, size_t memory) {
+    if (key_count <= 0 || key_count > SORT_MAX_KEYS) {
+        error_set(ERR_SYNTAX, "SORT takes 1 to %d key fields", SORT_MAX_KEYS);
+        return NULL;
+    }
+
+    DBF *out = dbf_create(filename, fields, field_count);
+    if (!out) return NULL;
+
+    Sorter *s = xcalloc(1, sizeof(Sorter));
+    strncpy(s->filename, filename, MAX_PATH_LEN - 1);
+    s->out = out;
+    s->fields = xmalloc(sizeof(DBFField) * (size_t)field_count);
+    memcpy(s->fields, fields, sizeof(DBFField) * (size_t)field_count);
+    s->field_count = field_count;
+    memcpy(s->keys, keys, sizeof(SortKey) * (size_t)key_count);
+    s->key_count = key_count;
+    s->fd = -1;
+    s->spare = -1;
+
+    s->record_size = 1;
+    for (int f = 0; f < field_count; f++) {
+        s->record_size = (uint16_t)(s->record_size + fields[f].length);
+    }
+    for (int k = 0; k < key_count; k++) {
+        s->key_size += key_length(&fields[keys[k].field]);
+    }
+    s->key_size += sizeof(uint32_t);  /* Input position */
+    s->entry_size = s->key_size + s->record_size;
+
+    if (memory == 0) memory = SORT_MEMORY_BYTES;
+    size_t capacity = memory / (s->entry_size + 2 * sizeof(SortItem));
+    s->capacity = capacity < 64 ? 64 : capacity > UINT32_MAX ? UINT32_MAX : (uint32_t)capacity;
+    s->buffer = xmalloc((size_t)s->capacity * s->entry_size);
+    s->items = xmalloc(sizeof(SortItem) * s->capacity);
+    return s;
+}
+
+/* Build the key of a record in front of its copy */
+static void encode_key(Sorter *s, uint8_t *entry, const uint8_t *record) {
+    uint8_t *p = entry;
+
+    for (int k = 0; k < s->key_count; k++) {
+        const SortKey *key = &s->keys[k];
+        const DBFField *field = &s->fields[key->field];
+        const uint8_t *value = &record[field->offset];
+        uint8_t *start = p;
+
+        switch (field->type) {
+            case FIELD_TYPE_NUMERIC: {
+                double number;
+                if (!dbf_decode_numeric(value, field->length, &number) || number == 0) number = 0;
+                uint64_t bits;
+                memcpy(&bits, &number, sizeof(bits));
+                bits = bits >> 63 ? ~bits : bits | ((uint64_t)1 << 63);
+                write_u64_be(p, bits);
+                p += 8;
+                break;
+            }
+            case FIELD_TYPE_LOGICAL:
+                switch (*value) {
+                    case 'T': case 't': case 'Y': case 'y': *p = 2; break;
+                    case 'F': case 'f': case 'N': case 'n': *p = 1; break;
+                    default: *p = 0; break;
+                }
+                p++;
+                break;
+            case FIELD_TYPE_CHAR:
+                if (key->nocase) {
+                    for (uint16_t i = 0; i < field->length; i++) {
+                        *p++ = (uint8_t)toupper(value[i]);
+                    }
+                    break;
+                }
+                /* fall through */
+            default:
+                memcpy(p, value, field->length);
+                p += field->length;
+                break;
+        }
+
+        if (key->descending) {
+            for (uint8_t *q = start; q < p; q++) *q = (uint8_t)~*q;
+        }
+    }
+
+    write_u32_be(p, s->added);
+}
+
+static int item_compare(const SortItem *a, const SortItem *b, size_t key_size) {
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
+    return key_size > 8 ? memcmp(a->entry + 8, b->entry + 8, key_size - 8) : 0;
+}
+
+/* Bottom-up merge sort of the staged items */
+static void sort_items(Sorter *s) {
+    if (!s->scratch) s->scratch = xmalloc(sizeof(SortItem) * s->capacity);
+    SortItem *src = s->items, *dst = s->scratch;
+    uint32_t count = s->staged;
+
+    for (uint32_t width = 1; width < count; width *= 2) {
+        for (uint32_t lo = 0; lo < count; lo += 2 * width) {
+            uint32_t mid = lo + width < count ? lo + width : count;
+            uint32_t hi = mid + width < count ? mid + width : count;
+            uint32_t i = lo, j = mid, k = lo;
+
+            while (i < mid && j < hi) {
+                dst[k++] = item_compare(&src[j], &src[i], s->key_size) < 0 ? src[j++] : src[i++];
+            }
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi) dst[k++] = src[j++];
+        }
+        SortItem *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != s->items) {
+        s->scratch = s->items;
+        s->items = src;
+    }
+}
+
+static bool write_at(Sorter *s, int fd, const uint8_t *data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error_set(ERR_FILE_WRITE, "Sort work file for %s: %s", s->filename, strerror(errno));
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+static bool read_at(Sorter *s, int fd, uint8_t *data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, data, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error_set(ERR_FILE_READ, "Sort work file for %s", s->filename);
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+/* Anonymous work file beside the output */
+static int work_file(Sorter *s) {
+    char name[MAX_PATH_LEN + 16];
+    snprintf(name, sizeof(name), "%s.XXXXXX", s->filename);
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        error_set(ERR_FILE_CREATE, "Sort work file for %s", s->filename);
+        return -1;
+    }
+    unlink(name);
+    return fd;
+}
+
+/* Output of a merge: the next run, or the table when 'run' is NULL */
+typedef struct {
+    int fd;
+    SortRun *run;
+    uint32_t used;             /* Entries in out_buffer */
+    DBFAppender *appender;
+} MergeSink;
+
+static bool sink_flush(Sorter *s, MergeSink *sink) {
+    uint64_t offset = sink->run->offset + (uint64_t)(sink->run->count - sink->used) * s->entry_size;
+    bool ok = write_at(s, sink->fd, s->out_buffer, (size_t)sink->used * s->entry_size, offset);
+    sink->used = 0;
+    return ok;
+}
+
+static bool sink_put(Sorter *s, MergeSink *sink, const uint8_t *entry) {
+    if (!sink->run) {
+        uint8_t *record = dbf_appender_add(sink->appender);
+        if (!record) return false;
+        memcpy(record, entry + s->key_size, s->record_size);
+        return true;
+    }
+    memcpy(s->out_buffer + (size_t)sink->used * s->entry_size, entry, s->entry_size);
+    sink->used++;
+    sink->run->count++;
+    return sink->used < s->out_capacity || sink_flush(s, sink);
+}
+
+static void add_run(Sorter *s, uint64_t offset) {
+    if (s->run_count == s->run_capacity) {
+        s->run_capacity = s->run_capacity ? s->run_capacity * 2 : 16;
+        s->runs = xrealloc(s->runs, sizeof(SortRun) * s->run_capacity);
+    }
+    s->runs[s->run_count].offset = offset;
+    s->runs[s->run_count].count = 0;
+    s->run_count++;
+}
+
+/* Sort the staged records and write them out as one more run */
+static bool spill(Sorter *s) {
+    if (s->fd < 0) {
+        s->fd = work_file(s);
+        if (s->fd < 0) return false;
+        size_t n = SORT_READ_BYTES / s->entry_size;
+        s->out_capacity = n ? (uint32_t)n : 1;
+        s->out_buffer = xmalloc((size_t)s->out_capacity * s->entry_size);
+    }
+    sort_items(s);
+
+    uint64_t offset = 0;
+    if (s->run_count > 0) {
+        SortRun *last = &s->runs[s->run_count - 1];
+        offset = last->offset + (uint64_t)last->count * s->entry_size;
+    }
+    add_run(s, offset);
+
+    MergeSink sink = {s->fd, &s->runs[s->run_count - 1], 0, NULL};
+    for (uint32_t i = 0; i < s->staged; i++) {
+        if (!sink_put(s, &sink, s->items[i].entry)) return false;
+    }
+    if (sink.used > 0 && !sink_flush(s, &sink)) return false;
+
+    s->staged = 0;
+    s->spilled++;
+    return true;
+}
+
+bool sorter_add(Sorter *s, const uint8_t *record) {
+    if (!s) return false;
+    if (s->added == UINT32_MAX) {
+        error_set(ERR_INVALID_RECORD, "Too many records to sort");
+        return false;
+    }
+    if (s->staged == s->capacity && !spill(s)) return false;
+
+    uint8_t *entry = s->buffer + (size_t)s->staged * s->entry_size;
+    encode_key(s, entry, record);
+    memcpy(entry + s->key_size, record, s->record_size);
+
+    uint8_t prefix[8] = {0};
+    memcpy(prefix, entry, s->key_size < 8 ? s->key_size : 8);
+    s->items[s->staged].prefix = read_u64_be(prefix);
+    s->items[s->staged].entry = entry;
+    s->staged++;
+    s->added++;
+    return true;
+}
+
+/*
+ * Merging
+ */
+
+static bool reader_fill(Sorter *s, int fd, RunReader *r) {
+    uint32_t n = r->left < r->capacity ? r->left : r->capacity;
+    if (!read_at(s, fd, r->buffer, (size_t)n * s->entry_size, r->offset)) return false;
+    r->offset += (uint64_t)n * s->entry_size;
+    r->left -= n;
+    r->pos = 0;
+    r->fill = n;
+    return true;
+}
+
+static const uint8_t *reader_entry(Sorter *s, const RunReader *r) {
+    return r->pos < r->fill ? r->buffer + (size_t)r->pos * s->entry_size : NULL;
+}
+
+/* Whether run 'a' holds the smaller current entry; exhausted runs lose */
+static bool beats(Sorter *s, RunReader *readers, int a, int b) {
+    const uint8_t *ea = reader_entry(s, &readers[a]);
+    const uint8_t *eb = reader_entry(s, &readers[b]);
+    if (!ea) return false;
+    if (!eb) return true;
+    return memcmp(ea, eb, s->key_size) < 0;
+}
+
+/* Build the loser tree over players [0, k) at leaves k..2k-1, leaving
+ * the loser of each match at its node; returns the overall winner */
+static int tree_build(Sorter *s, RunReader *readers, int *tree, int k, int node) {
+    if (node >= k) return node - k;
+
+    int a = tree_build(s, readers, tree, k, 2 * node);
+    int b = tree_build(s, readers, tree, k, 2 * node + 1);
+    if (beats(s, readers, b, a)) {
+        tree[node] = a;
+        return b;
+    }
+    tree[node] = b;
+    return a;
+}
+
+/* Merge runs [first, first + k) of the work file into 'sink' */
+static bool merge_runs(Sorter *s, uint32_t first, int k, MergeSink *sink) {
+    RunReader *readers = xcalloc((size_t)k, sizeof(RunReader));
+    int *tree = xmalloc(sizeof(int) * (size_t)(k + 1));
+    uint32_t per_run = s->capacity / (uint32_t)k;
+    bool ok = true;
+
+    for (int i = 0; i < k && ok; i++) {
+        RunReader *r = &readers[i];
+        r->offset = s->runs[first + (uint32_t)i].offset;
+        r->left = s->runs[first + (uint32_t)i].count;
+        r->buffer = s->buffer + (size_t)i * per_run * s->entry_size;
+        r->capacity = per_run;
+        ok = reader_fill(s, s->fd, r);
+    }
+
+    if (ok) tree[0] = tree_build(s, readers, tree, k, 1);
+
+    while (ok) {
+        int winner = tree[0];
+        RunReader *r = &readers[winner];
+        const uint8_t *entry = reader_entry(s, r);
+        if (!entry) break;  /* Every run is exhausted */
+
+        if (!sink_put(s, sink, entry)) {
+            ok = false;
+            break;
+        }
+        if (++r->pos == r->fill && r->left > 0 && !reader_fill(s, s->fd, r)) {
+            ok = false;
+            break;
+        }
+
+        /* Replay the winner's path to the root */
+        for (int t = (winner + k) / 2; t > 0; t /= 2) {
+            if (beats(s, readers, tree[t], winner)) {
+                int loser = winner;
+                winner = tree[t];
+                tree[t] = loser;
+            }
+        }
+        tree[0] = winner;
+    }
+
+    xfree(tree);
+    xfree(readers);
+    return ok;
+}
+
+/* Runs merged at once: as many as get SORT_READ_BYTES of the budget */
+static int fan_in(Sorter *s) {
+    size_t per_run = SORT_READ_BYTES > s->entry_size ? SORT_READ_BYTES : s->entry_size;
+    size_t n = (size_t)s->capacity * s->entry_size / per_run;
+    return n < 2 ? 2 : n > 4096 ? 4096 : (int)n;
+}
+
+/* Merge groups of runs into fewer, longer runs until one pass remains */
+static bool merge_pass(Sorter *s) {
+    int width = fan_in(s);
+    if (s->spare < 0) {
+        s->spare = work_file(s);
+        if (s->spare < 0) return false;
+    }
+
+    SortRun *merged = xmalloc(sizeof(SortRun) * ((s->run_count + (uint32_t)width - 1) / (uint32_t)width));
+    uint32_t count = 0;
+    uint64_t offset = 0;
+    bool ok = true;
+
+    for (uint32_t first = 0; ok && first < s->run_count; first += (uint32_t)width) {
+        uint32_t k = s->run_count - first < (uint32_t)width ? s->run_count - first : (uint32_t)width;
+        merged[count].offset = offset;
+        merged[count].count = 0;
+        MergeSink sink = {s->spare, &merged[count], 0, NULL};
+        ok = merge_runs(s, first, (int)k, &sink) && (sink.used == 0 || sink_flush(s, &sink));
+        offset += (uint64_t)merged[count].count * s->entry_size;
+        count++;
+    }
+
+    if (ok) {
+        /* The merged runs become the input of the next pass, and the
+         * space of the old ones is given back */
+        int swap = s->fd;
+        s->fd = s->spare;
+        s->spare = swap;
+        if (ftruncate(s->spare, 0) != 0) {
+            error_set(ERR_FILE_WRITE, "Sort work file for %s: %s", s->filename, strerror(errno));
+            ok = false;
+        }
+        xfree(s->runs);
+        s->runs = merged;
+        s->run_count = count;
+        s->run_capacity = count;
+    } else {
+        xfree(merged);
+    }
+    return ok;
+}
+
+static void sorter_free(Sorter *s) {
+    if (s->fd >= 0) close(s->fd);
+    if (s->spare >= 0) close(s->spare);
+    xfree(s->fields);
+    xfree(s->buffer);
+    xfree(s->items);
+    xfree(s->scratch);
+    xfree(s->runs);
+    xfree(s->out_buffer);
+    xfree(s);
+}
+
+bool sorter_finish(Sorter *s) {
+    if (!s) return false;
+
+    uint32_t batch = (uint32_t)(SORT_READ_BYTES * 8 / s->record_size);
+    DBFAppender *appender = dbf_appender_open(s->out, batch);
+    bool ok = appender != NULL;
+
+    if (ok && s->run_count == 0) {
+        /* Everything fit in memory */
+        sort_items(s);
+        MergeSink sink = {-1, NULL, 0, appender};
+        for (uint32_t i = 0; ok && i < s->staged; i++) {
+            ok = sink_put(s, &sink, s->items[i].entry);
+        }
+    } else if (ok) {
+        if (s->staged > 0) ok = spill(s);
+        while (ok && s->run_count > (uint32_t)fan_in(s)) {
+            ok = merge_pass(s);
+        }
+        MergeSink sink = {-1, NULL, 0, appender};
+        if (ok) ok = merge_runs(s, 0, (int)s->run_count, &sink);
+    }
+
+    if (appender && !dbf_appender_close(appender)) ok = false;
+    if (!dbf_close(s->out)) ok = false;
+    if (!ok) remove(s->filename);
+    sorter_free(s);
+    return ok;
+}
+
+void sorter_discard(Sorter *s) {
+    if (!s) return;
+    dbf_close(s->out);
+    remove(s->filename);
+    sorter_free(s);
+}
+
+uint32_t sorter_count(Sorter *s) {
+    return s ? s->added : 0;
+}
+
+uint32_t sorter_runs(Sorter *s) {
+    return s ? s->spilled : 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * sort.h - External merge sort of records into a new table
+ */
+
+#ifndef XBASE3_SORT_H
+#define XBASE3_SORT_H
+
+#include "util.h"
+#include "dbf.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Records are sorted in runs that fit a memory budget. Each record is
+ * stored behind a binary key built from its key fields, so that runs are
+ * ordered by comparing keys byte for byte:
+ *   C  the field text (in upper case for a case-blind key)
+ *   N  the value as a sign-adjusted big-endian double; blank is 0
+ *   D  the YYYYMMDD text; blank dates sort first
+ *   L  blank, then .F., then .T.
+ * A descending key has its bytes inverted, and the key ends with the
+ * record's position in the input, which keeps equal keys in input order.
+ * When the records do not fit in memory, full runs are written to a
+ * temporary file beside the output and merged through a loser tree,
+ * in as many passes as reading every run at once with buffers of
+ * SORT_READ_BYTES would take more than the budget.
+ */
+
+/* Memory for records being sorted when no budget is given */
+#define SORT_MEMORY_BYTES   ((size_t)64 << 20)
+
+/* Bytes read from each run at a time while merging */
+#define SORT_READ_BYTES     ((size_t)1 << 20)
+
+/* Most key fields */
+#define SORT_MAX_KEYS       16
+
+typedef struct {
+    int field;                 /* Index into the record layout */
+    bool descending;
+    bool nocase;               /* C fields compare ignoring case */
+} SortKey;
+
+/* Sort in progress */
+typedef struct Sorter Sorter;
+
+/* Start sorting records laid out as 'fields' describes into a new table
+ * 'filename' with the same fields. 'memory' of 0 is SORT_MEMORY_BYTES. */
+Sorter *sorter_create(const char *filename, const DBFField *fields, int field_count,
+                      const SortKey *keys, int key_count, size_t memory);
+
+/* Add one raw record image (deletion flag first) */
+bool sorter_add(Sorter *s, const uint8_t *record);
+
+/* Merge the runs and write the table, then close it; the table is
+ * removed if this fails */
+bool sorter_finish(Sorter *s);
+
+/* Give up on a sort and remove the table */
+void sorter_discard(Sorter *s);
+
+/* Records added so far */
+uint32_t sorter_count(Sorter *s);
+
+/* Runs written to the temporary file so far (0 while all fit in memory) */
+uint32_t sorter_runs(Sorter *s);
+
+#endif /* XBASE3_SORT_H */
@@ -0,0 +1,661 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * textio.c - Delimited and NDJSON text files
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "textio.h"
+#include "json.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool text_format_from_name(const char *name, TextFormat *format) {
+    if (!name) return false;
+
+    if (str_casecmp(name, "DELIMITED") == 0) {
+        *format = TEXT_DELIMITED;
+    } else if (str_casecmp(name, "NDJSON") == 0) {
+        *format = TEXT_NDJSON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Import
+ */
+
+/* A slice of the file, parsed by one thread into record images */
+typedef struct {
+    DBF *dbf;                  /* Field layout only; never modified */
+    TextFormat format;
+    const char *begin;         /* Whole lines */
+    const char *end;
+    uint8_t *records;          /* Images of the lines parsed so far */
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t lines;            /* Lines read, including a bad one */
+    bool failed;               /* Stopped at line 'lines' */
+    char message[128];
+    char *scratch;             /* NUL-terminated copy of an NDJSON line */
+    size_t scratch_size;
+} TextChunk;
+
+static bool chunk_fail(TextChunk *c, const char *fmt, const char *field) {
+    snprintf(c->message, sizeof(c->message), fmt, field);
+    c->failed = true;
+    return false;
+}
+
+/* Store text into a field of a record image */
+static bool store_text(TextChunk *c, const DBFField *field, uint8_t *record,
+                       const char *text, size_t len) {
+    uint8_t *dst = &record[field->offset];
+
+    if (field->type == FIELD_TYPE_CHAR) {
+        if (len > field->length) len = field->length;
+        memcpy(dst, text, len);
+        return true;
+    }
+
+    /* Other types ignore surrounding blanks */
+    while (len > 0 && isspace((unsigned char)*text)) {
+        text++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)text[len - 1])) len--;
+    if (len == 0) return true;
+
+    switch (field->type) {
+        case FIELD_TYPE_NUMERIC: {
+            char buf[64];
+            char *end;
+            if (len >= sizeof(buf)) return chunk_fail(c, "Invalid number for %s", field->name);
+            memcpy(buf, text, len);
+            buf[len] = '\0';
+            double value = strtod(buf, &end);
+            if (*end != '\0') return chunk_fail(c, "Invalid number for %s", field->name);
+            dbf_encode_numeric(value, dst, field->length, field->decimals);
+            return true;
+        }
+
+        case FIELD_TYPE_DATE:
+            if (len == 8) {
+                memcpy(dst, text, 8);
+            } else if (len == 10 && text[4] == '-' && text[7] == '-') {
+                memcpy(dst, text, 4);
+                memcpy(dst + 4, text + 5, 2);
+                memcpy(dst + 6, text + 8, 2);
+            } else {
+                return chunk_fail(c, "Invalid date for %s", field->name);
+            }
+            for (int i = 0; i < 8; i++) {
+                if (!isdigit(dst[i])) return chunk_fail(c, "Invalid date for %s", field->name);
+            }
+            return true;
+
+        case FIELD_TYPE_LOGICAL: {
+            char ch = (char)toupper((unsigned char)(len == 3 && text[0] == '.' ? text[1] : text[0]));
+            if (ch == 'T' || ch == 'Y') {
+                *dst = 'T';
+            } else if (ch == 'F' || ch == 'N') {
+                *dst = 'F';
+            } else {
+                return chunk_fail(c, "Invalid logical for %s", field->name);
+            }
+            return true;
+        }
+
+        default:
+            /* Memo contents are not imported */
+            return true;
+    }
+}
+
+/* DELIMITED: values in field order; quoted values may hold commas */
+static bool parse_delimited(TextChunk *c, const char *p, const char *end, uint8_t *record) {
+    char buf[MAX_FIELD_LEN + 2];
+    int field_count = dbf_field_count(c->dbf);
+
+    for (int f = 0; f < field_count; f++) {
+        const DBFField *field = dbf_field_info(c->dbf, f);
+        size_t len = 0;
+
+        if (p < end && *p == '"') {
+            for (p++; p < end; p++) {
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        p++;
+                    } else {
+                        break;
+                    }
+                }
+                if (len < sizeof(buf) - 1) buf[len++] = *p;
+            }
+            if (p == end) return chunk_fail(c, "Unterminated quote for %s", field->name);
+            p++;
+            while (p < end && *p != ',') p++;
+            if (!store_text(c, field, record, buf, len)) return false;
+        } else {
+            const char *comma = memchr(p, ',', (size_t)(end - p));
+            const char *stop = comma ? comma : end;
+            if (!store_text(c, field, record, p, (size_t)(stop - p))) return false;
+            p = stop;
+        }
+        if (p >= end) break;
+        p++;  /* Past the comma */
+    }
+    return true;
+}
+
+/* Store one NDJSON value */
+static bool store_json(TextChunk *c, const DBFField *field, uint8_t *record, JsonValue *value) {
+    char buf[64];
+
+    switch (value->type) {
+        case JSON_NULL:
+            return true;
+        case JSON_BOOL:
+            return store_text(c, field, record, value->data.bool_val ? "T" : "F", 1);
+        case JSON_NUMBER:
+            if (field->type == FIELD_TYPE_NUMERIC) {
+                dbf_encode_numeric(value->data.number_val, &record[field->offset],
+                                   field->length, field->decimals);
+                return true;
+            }
+            snprintf(buf, sizeof(buf), "%.15g", value->data.number_val);
+            return store_text(c, field, record, buf, strlen(buf));
+        case JSON_STRING:
+            return store_text(c, field, record, value->data.string_val, strlen(value->data.string_val));
+        default:
+            return chunk_fail(c, "Nested value for %s", field->name);
+    }
+}
+
+/* NDJSON: one object per line */
+static bool parse_ndjson(TextChunk *c, const char *p, const char *end, uint8_t *record) {
+    size_t len = (size_t)(end - p);
+    if (len + 1 > c->scratch_size) {
+        c->scratch_size = len + 1 > 256 ? len + 1 : 256;
+        c->scratch = xrealloc(c->scratch, c->scratch_size);
+    }
+    memcpy(c->scratch, p, len);
+    c->scratch[len] = '\0';
+
+    JsonValue *obj = json_parse(c->scratch);
+    if (!obj || obj->type != JSON_OBJECT) {
+        json_free(obj);
+        return chunk_fail(c, "%s", "Expected a JSON object");
+    }
+
+    bool ok = true;
+    int field_count = dbf_field_count(c->dbf);
+    for (JsonPair *pair = obj->data.object_val; ok && pair; pair = pair->next) {
+        for (int f = 0; f < field_count; f++) {
+            const DBFField *field = dbf_field_info(c->dbf, f);
+            if (str_casecmp(pair->key, field->name) == 0) {
+                ok = store_json(c, field, record, pair->value);
+                break;
+            }
+        }
+    }
+
+    json_free(obj);
+    return ok;
+}
+
+/* End of the DELIMITED record starting at 'p': the first newline outside
+ * a quoted value. '*lines' counts the newlines inside quotes. */
+static const char *delimited_eol(const char *p, const char *end, uint32_t *lines) {
+    bool quoted = false;
+    bool start = true;              /* At the start of a value */
+
+    for (; p < end; p++) {
+        char ch = *p;
+        if (quoted) {
+            if (ch == '"') {
+                if (p + 1 < end && p[1] == '"') {
+                    p++;
+                } else {
+                    quoted = false;
+                }
+            } else if (ch == '\n') {
+                (*lines)++;
+            }
+            continue;
+        }
+        if (ch == '\n') return p;
+        if (ch == '"' && start) quoted = true;
+        start = ch == ',';
+    }
+    return NULL;
+}
+
+/* Convert every record of a chunk, stopping at the first bad one */
+static void *chunk_parse(void *arg) {
+    TextChunk *c = arg;
+    uint16_t record_size = c->dbf->header.record_size;
+
+    for (const char *p = c->begin; p < c->end; ) {
+        c->lines++;
+        const char *nl = c->format == TEXT_DELIMITED ? delimited_eol(p, c->end, &c->lines) :
+                         memchr(p, '\n', (size_t)(c->end - p));
+        const char *eol = nl ? nl : c->end;
+        const char *next = nl ? nl + 1 : c->end;
+        if (eol > p && eol[-1] == '\r') eol--;
+
+        const char *q = p;
+        while (q < eol && isspace((unsigned char)*q)) q++;
+        if (q == eol) {
+            p = next;
+            continue;
+        }
+
+        if (c->count == c->capacity) {
+            c->capacity = c->capacity ? c->capacity * 2 : 1024;
+            c->records = xrealloc(c->records, (size_t)c->capacity * record_size);
+        }
+        uint8_t *record = c->records + (size_t)c->count * record_size;
+        memset(record, ' ', record_size);
+        record[0] = DBF_RECORD_ACTIVE;
+
+        bool ok = c->format == TEXT_NDJSON ? parse_ndjson(c, p, eol, record) :
+                                             parse_delimited(c, p, eol, record);
+        if (!ok) break;
+        c->count++;
+        p = next;
+    }
+    return NULL;
+}
+
+/* Threads to parse with (SET PARALLEL) */
+static int text_threads(void) {
+    int n = parallel_get_threads();
+    if (n < 1) n = 1;
+    return n > TEXT_MAX_THREADS ? TEXT_MAX_THREADS : n;
+}
+
+/* Newline that ends the chunk: the first one from 'from' on that is
+ * outside quotes, judged by the parity of the quotes since 'begin' */
+static const char *chunk_eol(TextFormat format, const char *begin, const char *from,
+                             const char *end) {
+    const char *nl = memchr(from, '\n', (size_t)(end - from));
+    if (format != TEXT_DELIMITED) return nl;
+
+    size_t quotes = 0;
+    for (const char *p = begin; p < (nl ? nl : end); p++) quotes += *p == '"';
+    while (nl && (quotes & 1)) {
+        const char *next = memchr(nl + 1, '\n', (size_t)(end - nl - 1));
+        for (const char *p = nl; p < (next ? next : end); p++) quotes += *p == '"';
+        nl = next;
+    }
+    return nl;
+}
+
+bool text_import(DBF *dbf, const char *filename, TextFormat format, uint32_t *appended) {
+    *appended = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        error_set(ERR_FILE_NOT_FOUND, "%s", filename);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        error_set(ERR_FILE_READ, "%s", filename);
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error_set(ERR_FILE_READ, "%s: %s", filename, strerror(errno));
+        return false;
+    }
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+
+    int threads = text_threads();
+    TextChunk chunks[TEXT_MAX_THREADS];
+    pthread_t workers[TEXT_MAX_THREADS];
+    bool started[TEXT_MAX_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    for (int t = 0; t < threads; t++) {
+        chunks[t].dbf = dbf;
+        chunks[t].format = format;
+    }
+
+    const char *pos = data;
+    const char *end = data + size;
+    if (size >= 3 && memcmp(pos, "\xEF\xBB\xBF", 3) == 0) pos += 3;  /* UTF-8 mark */
+
+    uint32_t line = 0;
+    bool ok = true;
+
+    /* Parse up to 'threads' chunks at once, then append them in order */
+    while (ok && pos < end) {
+        int used = 0;
+        while (used < threads && pos < end) {
+            const char *stop = (size_t)(end - pos) > TEXT_CHUNK_BYTES ? pos + TEXT_CHUNK_BYTES : end;
+            if (stop < end) {
+                const char *nl = chunk_eol(format, pos, stop, end);
+                stop = nl ? nl + 1 : end;
+            }
+            TextChunk *c = &chunks[used++];
+            c->begin = pos;
+            c->end = stop;
+            c->count = 0;
+            c->lines = 0;
+            c->failed = false;
+            pos = stop;
+        }
+
+        for (int t = 1; t < used; t++) {
+            started[t] = pthread_create(&workers[t], NULL, chunk_parse, &chunks[t]) == 0;
+        }
+        chunk_parse(&chunks[0]);
+        for (int t = 1; t < used; t++) {
+            if (started[t]) {
+                pthread_join(workers[t], NULL);
+            } else {
+                chunk_parse(&chunks[t]);
+            }
+        }
+
+        for (int t = 0; ok && t < used; t++) {
+            TextChunk *c = &chunks[t];
+            if (c->count > 0 && !dbf_append_batch(dbf, c->records, c->count)) {
+                ok = false;
+                break;
+            }
+            *appended += c->count;
+            if (c->failed) {
+                error_set(ERR_SYNTAX, "%s line %u: %s", filename, line + c->lines, c->message);
+                ok = false;
+            }
+            line += c->lines;
+        }
+    }
+
+    for (int t = 0; t < threads; t++) {
+        xfree(chunks[t].records);
+        xfree(chunks[t].scratch);
+    }
+    munmap(data, size);
+    return ok;
+}
+
+/*
+ * Export
+ */
+
+struct TextWriter {
+    int fd;
+    char filename[MAX_PATH_LEN];
+    TextFormat format;
+    DBFField *fields;
+    int field_count;
+    char *buffer;              /* TEXT_WRITE_BYTES, written when nearly full */
+    size_t used;
+    size_t line_max;           /* Longest line a record can produce */
+    uint32_t records;
+    bool failed;
+};
+
+TextWriter *text_writer_create(const char *filename, TextFormat format,
+                               const DBFField *fields, int field_count) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error_set(ERR_FILE_CREATE, "%s", filename);
+        return NULL;
+    }
+
+    TextWriter *w = xcalloc(1, sizeof(TextWriter));
+    w->fd = fd;
+    strncpy(w->filename, filename, MAX_PATH_LEN - 1);
+    w->format = format;
+    w->fields = xmalloc(sizeof(DBFField) * (size_t)field_count);
+    memcpy(w->fields, fields, sizeof(DBFField) * (size_t)field_count);
+    w->field_count = field_count;
+
+    /* A JSON escape takes six bytes a character at most; a reformatted
+     * number fewer than 64. Add quotes, separators and the field name. */
+    w->line_max = 2;
+    for (int f = 0; f < field_count; f++) {
+        w->line_max += (size_t)fields[f].length * 6 + 64 + MAX_FIELD_NAME * 6 + 8;
+    }
+    w->buffer = xmalloc(TEXT_WRITE_BYTES);
+    return w;
+}
+
+static bool writer_drain(TextWriter *w) {
+    for (size_t done = 0; done < w->used; ) {
+        ssize_t n = write(w->fd, w->buffer + done, w->used - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error_set(ERR_FILE_WRITE, "%s: %s", w->filename, strerror(errno));
+            w->failed = true;
+            return false;
+        }
+        done += (size_t)n;
+    }
+    w->used = 0;
+    return true;
+}
+
+/* Value with the blanks around it dropped */
+static const uint8_t *value_span(const uint8_t *value, size_t *len) {
+    size_t n = *len;
+    while (n > 0 && value[0] == ' ') {
+        value++;
+        n--;
+    }
+    while (n > 0 && value[n - 1] == ' ') n--;
+    *len = n;
+    return value;
+}
+
+/* Whether the text of a numeric field is also a JSON number */
+static bool numeric_is_json(const uint8_t *p, size_t len) {
+    size_t i = 0;
+    if (i < len && p[i] == '-') i++;
+    size_t digits = i;
+    while (i < len && isdigit(p[i])) i++;
+    if (i == digits) return false;
+    if (i < len && p[i] == '.') {
+        size_t frac = ++i;
+        while (i < len && isdigit(p[i])) i++;
+        if (i == frac) return false;
+    }
+    return i == len;
+}
+
+static char *put_delimited(TextWriter *w, const uint8_t *record, char *out) {
+    for (int f = 0; f < w->field_count; f++) {
+        const DBFField *field = &w->fields[f];
+        const uint8_t *value = &record[field->offset];
+        size_t len = field->length;
+
+        if (f > 0) *out++ = ',';
+        switch (field->type) {
+            case FIELD_TYPE_CHAR:
+                while (len > 0 && value[len - 1] == ' ') len--;
+                *out++ = '"';
+                for (size_t i = 0; i < len; i++) {
+                    if (value[i] == '"') *out++ = '"';
+                    *out++ = (char)value[i];
+                }
+                *out++ = '"';
+                break;
+            case FIELD_TYPE_LOGICAL:
+                if (*value == 'T' || *value == 't' || *value == 'Y' || *value == 'y') {
+                    *out++ = 'T';
+                } else if (*value != ' ' && *value != '?') {
+                    *out++ = 'F';
+                }
+                break;
+            case FIELD_TYPE_NUMERIC:
+            case FIELD_TYPE_DATE:
+                value = value_span(value, &len);
+                memcpy(out, value, len);
+                out += len;
+                break;
+            default:
+                /* Memo contents are not exported */
+                break;
+        }
+    }
+    return out;
+}
+
+static char *put_json_string(char *out, const uint8_t *value, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    *out++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        uint8_t ch = value[i];
+        if (ch == '"' || ch == '\\') {
+            *out++ = '\\';
+            *out++ = (char)ch;
+        } else if (ch < 0x20) {
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[ch >> 4];
+            out[5] = hex[ch & 15];
+            out += 6;
+        } else {
+            *out++ = (char)ch;
+        }
+    }
+    *out++ = '"';
+    return out;
+}
+
+static char *put_ndjson(TextWriter *w, const uint8_t *record, char *out) {
+    *out++ = '{';
+    for (int f = 0; f < w->field_count; f++) {
+        const DBFField *field = &w->fields[f];
+        const uint8_t *value = &record[field->offset];
+        size_t len = field->length;
+
+        if (f > 0) *out++ = ',';
+        out = put_json_string(out, (const uint8_t *)field->name, strlen(field->name));
+        *out++ = ':';
+
+        switch (field->type) {
+            case FIELD_TYPE_CHAR:
+                while (len > 0 && value[len - 1] == ' ') len--;
+                out = put_json_string(out, value, len);
+                continue;
+            case FIELD_TYPE_LOGICAL:
+                if (*value == 'T' || *value == 't' || *value == 'Y' || *value == 'y') {
+                    memcpy(out, "true", 4);
+                    out += 4;
+                    continue;
+                }
+                if (*value != ' ' && *value != '?') {
+                    memcpy(out, "false", 5);
+                    out += 5;
+                    continue;
+                }
+                break;
+            case FIELD_TYPE_NUMERIC: {
+                value = value_span(value, &len);
+                if (len == 0) break;
+                if (numeric_is_json(value, len)) {
+                    memcpy(out, value, len);
+                    out += len;
+                    continue;
+                }
+                /* Forms such as ".5" or "5." */
+                char buf[64];
+                char *end;
+                if (len >= sizeof(buf)) break;
+                memcpy(buf, value, len);
+                buf[len] = '\0';
+                double number = strtod(buf, &end);
+                if (*end != '\0' || number != number) break;
+                int n = snprintf(buf, sizeof(buf), "%.*f", field->decimals, number);
+                if (n <= 0 || (size_t)n >= sizeof(buf)) break;
+                memcpy(out, buf, (size_t)n);
+                out += n;
+                continue;
+            }
+            case FIELD_TYPE_DATE:
+                value = value_span(value, &len);
+                if (len != 8) break;
+                *out++ = '"';
+                memcpy(out, value, 4);
+                out[4] = '-';
+                memcpy(out + 5, value + 4, 2);
+                out[7] = '-';
+                memcpy(out + 8, value + 6, 2);
+                out += 10;
+                *out++ = '"';
+                continue;
+            default:
+                break;
+        }
+        memcpy(out, "null", 4);
+        out += 4;
+    }
+    *out++ = '}';
+    return out;
+}
+
+bool text_writer_add(TextWriter *w, const uint8_t *record) {
+    if (!w || w->failed) return false;
+    if (w->used + w->line_max > TEXT_WRITE_BYTES && !writer_drain(w)) return false;
+
+    char *out = w->buffer + w->used;
+    out = w->format == TEXT_NDJSON ? put_ndjson(w, record, out) : put_delimited(w, record, out);
+    *out++ = '\n';
+    w->used = (size_t)(out - w->buffer);
+    w->records++;
+    return true;
+}
+
+static void writer_free(TextWriter *w) {
+    xfree(w->fields);
+    xfree(w->buffer);
+    xfree(w);
+}
+
+bool text_writer_finish(TextWriter *w) {
+    if (!w) return false;
+
+    bool ok = !w->failed && writer_drain(w);
+    if (close(w->fd) != 0 && ok) {
+        error_set(ERR_FILE_WRITE, "%s: %s", w->filename, strerror(errno));
+        ok = false;
+    }
+    if (!ok) unlink(w->filename);
+    writer_free(w);
+    return ok;
+}
+
+void text_writer_discard(TextWriter *w) {
+    if (!w) return;
+    close(w->fd);
+    unlink(w->filename);
+    writer_free(w);
+}
+
+uint32_t text_writer_written(TextWriter *w) {
+    return w ? w->records : 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * textio.h - Delimited and NDJSON text files
+ */
+
+#ifndef XBASE3_TEXTIO_H
+#define XBASE3_TEXTIO_H
+
+#include "util.h"
+#include "dbf.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * One record per line, in either format:
+ *   DELIMITED  values in field order separated by commas; character values
+ *              in double quotes ("" for a quote, and may span lines),
+ *              dates as YYYYMMDD, logicals as T or F
+ *   NDJSON     one JSON object per line, keys matching field names in any
+ *              case; missing keys and nulls leave the field blank
+ * Dates are also read as YYYY-MM-DD and logicals as Y/N or .T./.F.
+ */
+typedef enum {
+    TEXT_DELIMITED,
+    TEXT_NDJSON
+} TextFormat;
+
+/* Bytes of the file each loader thread parses at a time */
+#define TEXT_CHUNK_BYTES    (4u * 1024 * 1024)
+
+/* Most threads parsing one file */
+#define TEXT_MAX_THREADS    8
+
+/* Format named by a TYPE clause */
+bool text_format_from_name(const char *name, TextFormat *format);
+
+/* Append every record of a text file to 'dbf'. Chunks of the file are
+ * converted to record images on several threads and appended in file
+ * order. A bad line stops the load with the records before it appended;
+ * '*appended' counts those either way. */
+bool text_import(DBF *dbf, const char *filename, TextFormat format, uint32_t *appended);
+
+/* Bytes of output gathered before each write */
+#define TEXT_WRITE_BYTES    (8u * 1024 * 1024)
+
+/* Text file being written */
+typedef struct TextWriter TextWriter;
+
+/* Create a text file for records laid out as 'fields' describes. Values
+ * are written as text_import reads them back; NDJSON writes blank
+ * numbers, dates and logicals as null. */
+TextWriter *text_writer_create(const char *filename, TextFormat format,
+                               const DBFField *fields, int field_count);
+
+/* Add one raw record image (deletion flag first) as a line */
+bool text_writer_add(TextWriter *w, const uint8_t *record);
+
+/* Write what is buffered and close; the file is removed if this fails */
+bool text_writer_finish(TextWriter *w);
+
+/* Give up on a file and remove it */
+void text_writer_discard(TextWriter *w);
+
+uint32_t text_writer_written(TextWriter *w);
+
+#endif /* XBASE3_TEXTIO_H */
@@ -0,0 +1,889 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * xcol.c - Columnar snapshot files
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "xcol.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Largest scale (10^decimals) at which numbers are stored as integers */
+#define XCOL_MAX_SCALE_DECIMALS 15
+
+/* Magnitude below which a double holds every integer exactly */
+#define XCOL_EXACT_LIMIT 9007199254740992.0
+
+static void write_u64_le(uint8_t *buf, uint64_t val) {
+    write_u32_le(buf, (uint32_t)val);
+    write_u32_le(buf + 4, (uint32_t)(val >> 32));
+}
+
+static uint64_t read_u64_le(const uint8_t *buf) {
+    return (uint64_t)read_u32_le(buf) | ((uint64_t)read_u32_le(buf + 4) << 32);
+}
+
+static void write_double_le(uint8_t *buf, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    write_u64_le(buf, bits);
+}
+
+static double read_double_le(const uint8_t *buf) {
+    uint64_t bits = read_u64_le(buf);
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+/* Bits needed to hold 'range' (0 when every value is the same) */
+static int bit_width(uint64_t range) {
+    int width = 0;
+    while (range) {
+        width++;
+        range >>= 1;
+    }
+    return width;
+}
+
+static size_t packed_bytes(uint32_t count, int width) {
+    return ((size_t)count * (size_t)width + 7) / 8;
+}
+
+/* Pack 'count' values of 'width' bits, lowest bit first; 'out' is zeroed */
+static void pack_bits(uint8_t *out, const uint64_t *values, uint32_t count, int width) {
+    for (uint32_t i = 0; i < count; i++) {
+        size_t bit = (size_t)i * (size_t)width;
+        for (int b = 0; b < width;) {
+            int room = 8 - (int)(bit & 7);
+            int take = width - b < room ? width - b : room;
+            out[bit >> 3] |= (uint8_t)(((values[i] >> b) & ((1u << take) - 1)) << (bit & 7));
+            bit += (size_t)take;
+            b += take;
+        }
+    }
+}
+
+static uint64_t unpack_bits(const uint8_t *in, uint32_t index, int width) {
+    size_t bit = (size_t)index * (size_t)width;
+    uint64_t value = 0;
+    for (int b = 0; b < width;) {
+        int room = 8 - (int)(bit & 7);
+        int take = width - b < room ? width - b : room;
+        value |= (uint64_t)((in[bit >> 3] >> (bit & 7)) & ((1u << take) - 1)) << b;
+        bit += (size_t)take;
+        b += take;
+    }
+    return value;
+}
+
+static double decimal_scale(int decimals) {
+    double scale = 1;
+    for (int i = 0; i < decimals; i++) scale *= 10;
+    return scale;
+}
+
+/*
+ * Writer
+ */
+
+/* Values of one field in the chunk being filled */
+typedef struct {
+    double *num;               /* N: values */
+    int64_t *ints;             /* D, L, deletion flags; N once scaled */
+    uint8_t *length;           /* C, M: value lengths */
+    char *text;                /* C, M: values, one after the other */
+    size_t text_used;
+    size_t text_capacity;
+} XColBuffer;
+
+struct XColWriter {
+    FILE *fp;
+    char filename[MAX_PATH_LEN];
+    DBFField *fields;
+    int field_count;
+    uint16_t record_size;
+    XColBuffer *cols;          /* One per field, then the deletion flags */
+    uint64_t *scratch;         /* Values being packed */
+    uint32_t rows;             /* Records in the current chunk */
+    uint32_t records;          /* Records written */
+    uint64_t offset;           /* End of the data written so far */
+    uint8_t *out;              /* Encoded chunk of one field */
+    size_t out_capacity;
+    uint8_t *directory;        /* Entries of the chunks written */
+    size_t directory_used;
+    size_t directory_capacity;
+};
+
+static uint8_t *writer_out(XColWriter *w, size_t bytes) {
+    if (bytes > w->out_capacity) {
+        w->out_capacity = bytes;
+        w->out = xrealloc(w->out, bytes);
+    }
+    memset(w->out, 0, bytes);
+    return w->out;
+}
+
+XColWriter *xcol_create(const char *filename, const DBFField *fields, int field_count) {
+    if (field_count <= 0 || field_count > MAX_FIELDS) {
+        error_set(ERR_INVALID_FIELD, "Invalid field count");
+        return NULL;
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        error_set(ERR_FILE_CREATE, "Cannot create %s", filename);
+        return NULL;
+    }
+
+    XColWriter *w = xcalloc(1, sizeof(XColWriter));
+    w->fp = fp;
+    strncpy(w->filename, filename, MAX_PATH_LEN - 1);
+    w->field_count = field_count;
+    w->fields = xmalloc(sizeof(DBFField) * (size_t)field_count);
+    memcpy(w->fields, fields, sizeof(DBFField) * (size_t)field_count);
+    w->record_size = 1;
+    w->cols = xcalloc((size_t)field_count + 1, sizeof(XColBuffer));
+    w->scratch = xmalloc(sizeof(uint64_t) * XCOL_CHUNK_RECORDS);
+
+    for (int f = 0; f <= field_count; f++) {
+        XColBuffer *col = &w->cols[f];
+        char type = f < field_count ? fields[f].type : FIELD_TYPE_LOGICAL;
+
+        if (f < field_count) w->record_size = (uint16_t)(w->record_size + fields[f].length);
+        switch (type) {
+            case FIELD_TYPE_NUMERIC:
+                col->num = xmalloc(sizeof(double) * XCOL_CHUNK_RECORDS);
+                col->ints = xmalloc(sizeof(int64_t) * XCOL_CHUNK_RECORDS);
+                break;
+            case FIELD_TYPE_DATE:
+            case FIELD_TYPE_LOGICAL:
+                col->ints = xmalloc(sizeof(int64_t) * XCOL_CHUNK_RECORDS);
+                break;
+            default:
+                col->length = xmalloc(XCOL_CHUNK_RECORDS);
+                break;
+        }
+    }
+
+    /* Header and field descriptors; the header is completed by finish */
+    uint8_t header[XCOL_HEADER_SIZE] = {0};
+    bool ok = fwrite(header, XCOL_HEADER_SIZE, 1, fp) == 1;
+    for (int f = 0; f < field_count && ok; f++) {
+        uint8_t desc[XCOL_FIELD_SIZE] = {0};
+        memcpy(desc, fields[f].name, strnlen(fields[f].name, MAX_FIELD_NAME - 1));
+        desc[11] = (uint8_t)fields[f].type;
+        write_u16_le(&desc[12], fields[f].length);
+        desc[14] = fields[f].decimals;
+        ok = fwrite(desc, XCOL_FIELD_SIZE, 1, fp) == 1;
+    }
+    w->offset = XCOL_HEADER_SIZE + (uint64_t)field_count * XCOL_FIELD_SIZE;
+
+    if (!ok) {
+        xcol_discard(w);
+        error_set(ERR_FILE_WRITE, "Cannot write %s", filename);
+        return NULL;
+    }
+    return w;
+}
+
+static void writer_free(XColWriter *w) {
+    for (int f = 0; f <= w->field_count; f++) {
+        xfree(w->cols[f].num);
+        xfree(w->cols[f].ints);
+        xfree(w->cols[f].length);
+        xfree(w->cols[f].text);
+    }
+    xfree(w->cols);
+    xfree(w->fields);
+    xfree(w->scratch);
+    xfree(w->out);
+    xfree(w->directory);
+    xfree(w);
+}
+
+void xcol_discard(XColWriter *w) {
+    if (!w) return;
+    fclose(w->fp);
+    remove(w->filename);
+    writer_free(w);
+}
+
+uint32_t xcol_written(XColWriter *w) {
+    return w ? w->records : 0;
+}
+
+/* Encode integers as runs or against a frame of reference, whichever is
+ * smaller */
+static size_t encode_ints(XColWriter *w, const int64_t *values, uint32_t n, uint8_t *encoding) {
+    int64_t lo = values[0], hi = values[0];
+    uint32_t runs = 1;
+    for (uint32_t i = 1; i < n; i++) {
+        if (values[i] < lo) lo = values[i];
+        if (values[i] > hi) hi = values[i];
+        if (values[i] != values[i - 1]) runs++;
+    }
+
+    int width = bit_width((uint64_t)hi - (uint64_t)lo);
+    size_t for_size = 9 + packed_bytes(n, width);
+    size_t rle_size = 4 + (size_t)runs * 12;
+
+    if (rle_size < for_size) {
+        uint8_t *out = writer_out(w, rle_size);
+        uint8_t *p = out + 4;
+        uint32_t start = 0;
+        write_u32_le(out, runs);
+        for (uint32_t i = 1; i <= n; i++) {
+            if (i == n || values[i] != values[start]) {
+                write_u64_le(p, (uint64_t)values[start]);
+                write_u32_le(p + 8, i - start);
+                p += 12;
+                start = i;
+            }
+        }
+        *encoding = XCOL_RLE;
+        return rle_size;
+    }
+
+    uint8_t *out = writer_out(w, for_size);
+    write_u64_le(out, (uint64_t)lo);
+    out[8] = (uint8_t)width;
+    for (uint32_t i = 0; i < n; i++) {
+        w->scratch[i] = (uint64_t)values[i] - (uint64_t)lo;
+    }
+    pack_bits(out + 9, w->scratch, n, width);
+    *encoding = XCOL_FOR;
+    return for_size;
+}
+
+/* Encode numbers as scaled integers when they all are, else as doubles */
+static size_t encode_numbers(XColWriter *w, const DBFField *field, XColBuffer *col,
+                             uint32_t n, uint8_t *encoding) {
+    bool whole = field->decimals <= XCOL_MAX_SCALE_DECIMALS;
+    double scale = decimal_scale(field->decimals);
+
+    for (uint32_t i = 0; i < n && whole; i++) {
+        double scaled = col->num[i] * scale;
+        if (!(fabs(scaled) < XCOL_EXACT_LIMIT)) {
+            whole = false;
+            break;
+        }
+        int64_t v = (int64_t)llround(scaled);
+        if ((double)v / scale != col->num[i]) whole = false;
+        col->ints[i] = v;
+    }
+    if (whole) return encode_ints(w, col->ints, n, encoding);
+
+    size_t size = (size_t)n * 8;
+    uint8_t *out = writer_out(w, size);
+    for (uint32_t i = 0; i < n; i++) {
+        write_double_le(out + (size_t)i * 8, col->num[i]);
+    }
+    *encoding = XCOL_PLAIN;
+    return size;
+}
+
+/* Encode character values with a dictionary when they repeat enough */
+static size_t encode_strings(XColWriter *w, XColBuffer *col, uint32_t n, uint8_t *encoding) {
+    /* Open-addressed table of distinct values: entry number + 1 per slot */
+    uint32_t slots = 1;
+    while (slots < 2 * n) slots <<= 1;
+    uint32_t *table = xcalloc(slots, sizeof(uint32_t));
+    uint32_t *first = xmalloc(sizeof(uint32_t) * n);   /* Entry -> first row */
+    size_t *start = xmalloc(sizeof(size_t) * (n + 1)); /* Row -> text offset */
+    uint32_t entries = 0;
+    size_t dict_bytes = 0;
+
+    start[0] = 0;
+    for (uint32_t i = 0; i < n; i++) start[i + 1] = start[i] + col->length[i];
+
+    for (uint32_t i = 0; i < n; i++) {
+        const char *s = col->text + start[i];
+        uint32_t h = 2166136261u;
+        for (uint8_t k = 0; k < col->length[i]; k++) {
+            h = (h ^ (uint8_t)s[k]) * 16777619u;
+        }
+
+        uint32_t slot = h & (slots - 1);
+        while (table[slot]) {
+            uint32_t row = first[table[slot] - 1];
+            if (col->length[row] == col->length[i] &&
+                memcmp(col->text + start[row], s, col->length[i]) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (slots - 1);
+        }
+        if (!table[slot]) {
+            first[entries] = i;
+            table[slot] = ++entries;
+            dict_bytes += 1 + (size_t)col->length[i];
+        }
+        w->scratch[i] = table[slot] - 1;
+    }
+
+    int width = bit_width(entries - 1);
+    size_t dict_size = 4 + dict_bytes + 1 + packed_bytes(n, width);
+    size_t plain_size = (size_t)n + col->text_used;
+    size_t size;
+
+    if (dict_size < plain_size) {
+        uint8_t *out = writer_out(w, dict_size);
+        uint8_t *p = out + 4;
+        write_u32_le(out, entries);
+        for (uint32_t e = 0; e < entries; e++) {
+            uint32_t row = first[e];
+            *p++ = col->length[row];
+            memcpy(p, col->text + start[row], col->length[row]);
+            p += col->length[row];
+        }
+        *p++ = (uint8_t)width;
+        pack_bits(p, w->scratch, n, width);
+        *encoding = XCOL_DICT;
+        size = dict_size;
+    } else {
+        uint8_t *out = writer_out(w, plain_size);
+        memcpy(out, col->length, n);
+        if (col->text_used) memcpy(out + n, col->text, col->text_used);
+        *encoding = XCOL_PLAIN;
+        size = plain_size;
+    }
+
+    xfree(table);
+    xfree(first);
+    xfree(start);
+    return size;
+}
+
+/* Encode and write every field of the current chunk */
+static bool flush_chunk(XColWriter *w) {
+    uint32_t n = w->rows;
+    if (n == 0) return true;
+
+    size_t need = w->directory_used + (size_t)(w->field_count + 1) * XCOL_ENTRY_SIZE;
+    if (need > w->directory_capacity) {
+        size_t capacity = w->directory_capacity ? w->directory_capacity * 2 : 4096;
+        while (capacity < need) capacity *= 2;
+        w->directory = xrealloc(w->directory, capacity);
+        w->directory_capacity = capacity;
+    }
+
+    for (int f = 0; f <= w->field_count; f++) {
+        XColBuffer *col = &w->cols[f];
+        char type = f < w->field_count ? w->fields[f].type : FIELD_TYPE_LOGICAL;
+        uint8_t encoding;
+        double min = 0, max = 0;
+        size_t size;
+
+        switch (type) {
+            case FIELD_TYPE_NUMERIC:
+                min = max = col->num[0];
+                for (uint32_t i = 1; i < n; i++) {
+                    if (col->num[i] < min) min = col->num[i];
+                    if (col->num[i] > max) max = col->num[i];
+                }
+                size = encode_numbers(w, &w->fields[f], col, n, &encoding);
+                break;
+            case FIELD_TYPE_DATE:
+                min = max = (double)col->ints[0];
+                for (uint32_t i = 1; i < n; i++) {
+                    if (col->ints[i] < min) min = (double)col->ints[i];
+                    if (col->ints[i] > max) max = (double)col->ints[i];
+                }
+                size = encode_ints(w, col->ints, n, &encoding);
+                break;
+            case FIELD_TYPE_LOGICAL:
+                size = encode_ints(w, col->ints, n, &encoding);
+                break;
+            default:
+                size = encode_strings(w, col, n, &encoding);
+                col->text_used = 0;
+                break;
+        }
+
+        if (size && fwrite(w->out, size, 1, w->fp) != 1) {
+            error_set(ERR_FILE_WRITE, "Cannot write %s", w->filename);
+            return false;
+        }
+
+        uint8_t *entry = w->directory + w->directory_used;
+        memset(entry, 0, XCOL_ENTRY_SIZE);
+        write_u64_le(entry, w->offset);
+        write_u32_le(entry + 8, (uint32_t)size);
+        entry[12] = encoding;
+        write_double_le(entry + 16, min);
+        write_double_le(entry + 24, max);
+        w->directory_used += XCOL_ENTRY_SIZE;
+        w->offset += size;
+    }
+
+    w->rows = 0;
+    return true;
+}
+
+bool xcol_write(XColWriter *w, const uint8_t *record) {
+    if (!w || !record) return false;
+
+    uint32_t row = w->rows;
+    for (int f = 0; f < w->field_count; f++) {
+        const DBFField *field = &w->fields[f];
+        const uint8_t *p = record + field->offset;
+        XColBuffer *col = &w->cols[f];
+
+        switch (field->type) {
+            case FIELD_TYPE_NUMERIC:
+                if (!dbf_decode_numeric(p, field->length, &col->num[row])) col->num[row] = 0;
+                break;
+            case FIELD_TYPE_DATE: {
+                char date[9];
+                memcpy(date, p, 8);
+                date[8] = '\0';
+                col->ints[row] = date_to_julian(date);
+                break;
+            }
+            case FIELD_TYPE_LOGICAL:
+                col->ints[row] = p[0] == 'T' || p[0] == 't' || p[0] == 'Y' || p[0] == 'y';
+                break;
+            default: {
+                size_t len = dbf_view_trim_right(p, field->length);
+                if (col->text_used + len > col->text_capacity) {
+                    size_t capacity = col->text_capacity ? col->text_capacity : 65536;
+                    while (capacity < col->text_used + len) capacity *= 2;
+                    col->text = xrealloc(col->text, capacity);
+                    col->text_capacity = capacity;
+                }
+                if (len) memcpy(col->text + col->text_used, p, len);
+                col->text_used += len;
+                col->length[row] = (uint8_t)len;
+                break;
+            }
+        }
+    }
+    w->cols[w->field_count].ints[row] = record[0] == DBF_RECORD_DELETED;
+
+    w->records++;
+    if (++w->rows == XCOL_CHUNK_RECORDS) return flush_chunk(w);
+    return true;
+}
+
+bool xcol_finish(XColWriter *w) {
+    if (!w) return false;
+
+    bool ok = flush_chunk(w);
+
+    if (ok && w->directory_used &&
+        fwrite(w->directory, w->directory_used, 1, w->fp) != 1) {
+        ok = false;
+    }
+
+    uint8_t header[XCOL_HEADER_SIZE] = {0};
+    memcpy(header, XCOL_MAGIC, 4);
+    write_u32_le(&header[4], w->records);
+    write_u16_le(&header[8], (uint16_t)w->field_count);
+    write_u16_le(&header[10], w->record_size);
+    write_u32_le(&header[12], XCOL_CHUNK_RECORDS);
+    write_u64_le(&header[16], w->offset);
+
+    if (ok && (fseek(w->fp, 0, SEEK_SET) != 0 ||
+               fwrite(header, XCOL_HEADER_SIZE, 1, w->fp) != 1)) {
+        ok = false;
+    }
+    if (fclose(w->fp) != 0) ok = false;
+
+    if (!ok) {
+        remove(w->filename);
+        error_set(ERR_FILE_WRITE, "Cannot write %s", w->filename);
+    }
+    writer_free(w);
+    return ok;
+}
+
+/*
+ * Reader
+ */
+
+struct XCol {
+    int fd;
+    char filename[MAX_PATH_LEN];
+    uint32_t record_count;
+    int field_count;
+    uint16_t record_size;
+    uint32_t chunk_records;
+    uint32_t chunks;
+    uint64_t data_end;         /* Start of the directory */
+    DBFField *fields;
+    uint8_t *directory;
+};
+
+static bool xcol_invalid(XCol *x) {
+    error_set(ERR_INVALID_DBF, "Invalid snapshot %s", x->filename);
+    return false;
+}
+
+XCol *xcol_open(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        error_set(ERR_FILE_NOT_FOUND, "%s", filename);
+        return NULL;
+    }
+
+    XCol *x = xcalloc(1, sizeof(XCol));
+    x->fd = fd;
+    strncpy(x->filename, filename, MAX_PATH_LEN - 1);
+
+    struct stat st;
+    uint8_t header[XCOL_HEADER_SIZE];
+    if (fstat(fd, &st) != 0 ||
+        pread(fd, header, XCOL_HEADER_SIZE, 0) != XCOL_HEADER_SIZE ||
+        memcmp(header, XCOL_MAGIC, 4) != 0) {
+        xcol_invalid(x);
+        goto fail;
+    }
+
+    x->record_count = read_u32_le(&header[4]);
+    x->field_count = read_u16_le(&header[8]);
+    x->record_size = read_u16_le(&header[10]);
+    x->chunk_records = read_u32_le(&header[12]);
+    x->data_end = read_u64_le(&header[16]);
+    if (x->field_count <= 0 || x->field_count > MAX_FIELDS || x->chunk_records == 0) {
+        xcol_invalid(x);
+        goto fail;
+    }
+    x->chunks = (uint32_t)(((uint64_t)x->record_count + x->chunk_records - 1) / x->chunk_records);
+
+    size_t desc_bytes = (size_t)x->field_count * XCOL_FIELD_SIZE;
+    size_t dir_bytes = (size_t)x->chunks * (size_t)(x->field_count + 1) * XCOL_ENTRY_SIZE;
+    if (x->data_end < XCOL_HEADER_SIZE + desc_bytes ||
+        x->data_end + dir_bytes != (uint64_t)st.st_size) {
+        xcol_invalid(x);
+        goto fail;
+    }
+
+    uint8_t *desc = xmalloc(desc_bytes);
+    if (pread(fd, desc, desc_bytes, XCOL_HEADER_SIZE) != (ssize_t)desc_bytes) {
+        xfree(desc);
+        xcol_invalid(x);
+        goto fail;
+    }
+
+    x->fields = xcalloc((size_t)x->field_count, sizeof(DBFField));
+    uint16_t offset = 1;
+    for (int f = 0; f < x->field_count; f++) {
+        const uint8_t *d = desc + (size_t)f * XCOL_FIELD_SIZE;
+        DBFField *field = &x->fields[f];
+        memcpy(field->name, d, MAX_FIELD_NAME - 1);
+        field->type = (char)d[11];
+        field->length = read_u16_le(&d[12]);
+        field->decimals = d[14];
+        field->offset = offset;
+        offset = (uint16_t)(offset + field->length);
+        if (field->length == 0 || field->length > MAX_FIELD_LEN ||
+            (field->type == FIELD_TYPE_DATE && field->length != 8)) {
+            xfree(desc);
+            xcol_invalid(x);
+            goto fail;
+        }
+    }
+    xfree(desc);
+    if (offset != x->record_size) {
+        xcol_invalid(x);
+        goto fail;
+    }
+
+    x->directory = xmalloc(dir_bytes ? dir_bytes : 1);
+    if (dir_bytes && pread(fd, x->directory, dir_bytes, (off_t)x->data_end) != (ssize_t)dir_bytes) {
+        xcol_invalid(x);
+        goto fail;
+    }
+    for (size_t e = 0; e < dir_bytes; e += XCOL_ENTRY_SIZE) {
+        const uint8_t *entry = x->directory + e;
+        if (read_u64_le(entry) + read_u32_le(entry + 8) > x->data_end || entry[12] > XCOL_DICT) {
+            xcol_invalid(x);
+            goto fail;
+        }
+    }
+    return x;
+
+fail:
+    xcol_close(x);
+    return NULL;
+}
+
+void xcol_close(XCol *x) {
+    if (!x) return;
+    close(x->fd);
+    xfree(x->fields);
+    xfree(x->directory);
+    xfree(x);
+}
+
+uint32_t xcol_record_count(XCol *x) {
+    return x ? x->record_count : 0;
+}
+
+int xcol_field_count(XCol *x) {
+    return x ? x->field_count : 0;
+}
+
+const DBFField *xcol_fields(XCol *x) {
+    return x ? x->fields : NULL;
+}
+
+uint16_t xcol_record_size(XCol *x) {
+    return x ? x->record_size : 0;
+}
+
+static const uint8_t *chunk_entry(XCol *x, uint32_t chunk, int column) {
+    return x->directory + ((size_t)chunk * (size_t)(x->field_count + 1) + (size_t)column) * XCOL_ENTRY_SIZE;
+}
+
+static uint32_t chunk_rows(XCol *x, uint32_t chunk) {
+    uint32_t first = chunk * x->chunk_records;
+    return x->record_count - first < x->chunk_records ? x->record_count - first : x->chunk_records;
+}
+
+bool xcol_chunk_range(XCol *x, uint32_t chunk, int field, double *min, double *max) {
+    if (!x || chunk >= x->chunks || field < 0 || field >= x->field_count) return false;
+    const uint8_t *entry = chunk_entry(x, chunk, field);
+    *min = read_double_le(entry + 16);
+    *max = read_double_le(entry + 24);
+    return true;
+}
+
+/* Read the encoded values of one field of one chunk */
+static uint8_t *read_chunk(XCol *x, uint32_t chunk, int column, size_t *size, int *encoding) {
+    const uint8_t *entry = chunk_entry(x, chunk, column);
+    *size = read_u32_le(entry + 8);
+    *encoding = entry[12];
+
+    uint8_t *data = xmalloc(*size ? *size : 1);
+    if (*size && pread(x->fd, data, *size, (off_t)read_u64_le(entry)) != (ssize_t)*size) {
+        xfree(data);
+        error_set(ERR_FILE_READ, "Cannot read %s", x->filename);
+        return NULL;
+    }
+    return data;
+}
+
+/* Decode 'n' integers stored as runs or against a frame of reference */
+static bool decode_ints(const uint8_t *data, size_t size, int encoding, uint32_t n, int64_t *out) {
+    if (encoding == XCOL_RLE) {
+        if (size < 4) return false;
+        uint32_t runs = read_u32_le(data);
+        if (size < 4 + (size_t)runs * 12) return false;
+
+        uint32_t i = 0;
+        for (uint32_t r = 0; r < runs; r++) {
+            const uint8_t *run = data + 4 + (size_t)r * 12;
+            int64_t value = (int64_t)read_u64_le(run);
+            uint32_t len = read_u32_le(run + 8);
+            if (len > n - i) return false;
+            for (uint32_t k = 0; k < len; k++) out[i++] = value;
+        }
+        return i == n;
+    }
+
+    if (encoding == XCOL_FOR) {
+        if (size < 9 || data[8] > 64 || size < 9 + packed_bytes(n, data[8])) return false;
+        uint64_t base = read_u64_le(data);
+        int width = data[8];
+        for (uint32_t i = 0; i < n; i++) {
+            out[i] = (int64_t)(base + unpack_bits(data + 9, i, width));
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/* Decode the integers of one field of one chunk */
+static bool chunk_ints(XCol *x, uint32_t chunk, int column, int64_t *values) {
+    size_t size;
+    int encoding;
+    uint8_t *data = read_chunk(x, chunk, column, &size, &encoding);
+    if (!data) return false;
+
+    bool ok = decode_ints(data, size, encoding, chunk_rows(x, chunk), values);
+    xfree(data);
+    return ok || xcol_invalid(x);
+}
+
+static bool field_is(XCol *x, int field, char type) {
+    if (!x || field < 0 || field >= x->field_count || x->fields[field].type != type) {
+        error_set(ERR_TYPE_MISMATCH, "Field type mismatch in snapshot");
+        return false;
+    }
+    return true;
+}
+
+bool xcol_read_numbers(XCol *x, int field, double *values) {
+    if (!field_is(x, field, FIELD_TYPE_NUMERIC)) return false;
+    double scale = decimal_scale(x->fields[field].decimals);
+    int64_t *ints = xmalloc(sizeof(int64_t) * x->chunk_records);
+    bool ok = true;
+
+    for (uint32_t c = 0; c < x->chunks && ok; c++) {
+        uint32_t n = chunk_rows(x, c);
+        double *out = values + (size_t)c * x->chunk_records;
+        size_t size;
+        int encoding;
+        uint8_t *data = read_chunk(x, c, field, &size, &encoding);
+        if (!data) {
+            xfree(ints);
+            return false;
+        }
+
+        if (encoding == XCOL_PLAIN) {
+            ok = size >= (size_t)n * 8;
+            for (uint32_t i = 0; ok && i < n; i++) out[i] = read_double_le(data + (size_t)i * 8);
+        } else {
+            ok = decode_ints(data, size, encoding, n, ints);
+            for (uint32_t i = 0; ok && i < n; i++) out[i] = (double)ints[i] / scale;
+        }
+        xfree(data);
+    }
+
+    xfree(ints);
+    return ok || xcol_invalid(x);
+}
+
+bool xcol_read_dates(XCol *x, int field, int32_t *jdn) {
+    if (!field_is(x, field, FIELD_TYPE_DATE)) return false;
+    int64_t *values = xmalloc(sizeof(int64_t) * x->chunk_records);
+
+    for (uint32_t c = 0; c < x->chunks; c++) {
+        if (!chunk_ints(x, c, field, values)) {
+            xfree(values);
+            return false;
+        }
+        int32_t *out = jdn + (size_t)c * x->chunk_records;
+        for (uint32_t i = 0; i < chunk_rows(x, c); i++) out[i] = (int32_t)values[i];
+    }
+    xfree(values);
+    return true;
+}
+
+bool xcol_read_bits(XCol *x, int field, uint8_t *bits) {
+    if (!x || (field >= 0 && !field_is(x, field, FIELD_TYPE_LOGICAL))) return false;
+    int column = field < 0 ? x->field_count : field;
+    int64_t *values = xmalloc(sizeof(int64_t) * x->chunk_records);
+
+    for (uint32_t c = 0; c < x->chunks; c++) {
+        if (!chunk_ints(x, c, column, values)) {
+            xfree(values);
+            return false;
+        }
+        uint32_t first = c * x->chunk_records;
+        for (uint32_t i = 0; i < chunk_rows(x, c); i++) {
+            uint32_t bit = first + i;
+            if (values[i]) {
+                bits[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+            } else {
+                bits[bit >> 3] &= (uint8_t)~(1u << (bit & 7));
+            }
+        }
+    }
+    xfree(values);
+    return true;
+}
+
+/* Append a value to a growing arena */
+static size_t arena_add(char **arena, size_t *used, size_t *capacity, const uint8_t *p, size_t len) {
+    if (*used + len > *capacity) {
+        size_t grown = *capacity ? *capacity : 4096;
+        while (grown < *used + len) grown *= 2;
+        *arena = xrealloc(*arena, grown);
+        *capacity = grown;
+    }
+    size_t at = *used;
+    if (len) memcpy(*arena + at, p, len);
+    *used += len;
+    return at;
+}
+
+bool xcol_read_strings(XCol *x, int field, size_t *offset, uint8_t *length,
+                       char **arena, size_t *arena_used) {
+    if (!x || field < 0 || field >= x->field_count) return false;
+    char type = x->fields[field].type;
+    if (type == FIELD_TYPE_NUMERIC || type == FIELD_TYPE_DATE || type == FIELD_TYPE_LOGICAL) {
+        return field_is(x, field, FIELD_TYPE_CHAR);
+    }
+
+    size_t capacity = 0;
+    uint16_t limit = x->fields[field].length;
+    *arena = NULL;
+    *arena_used = 0;
+
+    for (uint32_t c = 0; c < x->chunks; c++) {
+        uint32_t n = chunk_rows(x, c);
+        uint32_t first = c * x->chunk_records;
+        size_t size;
+        int encoding;
+        uint8_t *data = read_chunk(x, c, field, &size, &encoding);
+        if (!data) goto fail;
+
+        bool ok = true;
+        if (encoding == XCOL_PLAIN) {
+            size_t pos = n;
+            ok = size >= n;
+            for (uint32_t i = 0; ok && i < n; i++) {
+                uint8_t len = data[i];
+                ok = len <= limit && pos + len <= size;
+                if (ok) {
+                    offset[first + i] = arena_add(arena, arena_used, &capacity, data + pos, len);
+                    length[first + i] = len;
+                    pos += len;
+                }
+            }
+        } else if (encoding == XCOL_DICT && size >= 4) {
+            /* Each entry goes into the arena once; rows point at it */
+            uint32_t entries = read_u32_le(data);
+            size_t *at = xmalloc(sizeof(size_t) * (entries ? entries : 1));
+            uint8_t *len = xmalloc(entries ? entries : 1);
+            size_t pos = 4;
+
+            ok = entries > 0 && entries <= n;
+            for (uint32_t e = 0; ok && e < entries; e++) {
+                ok = pos < size && data[pos] <= limit && pos + 1 + data[pos] <= size;
+                if (ok) {
+                    len[e] = data[pos];
+                    at[e] = arena_add(arena, arena_used, &capacity, data + pos + 1, len[e]);
+                    pos += 1 + (size_t)len[e];
+                }
+            }
+
+            int width = ok && pos < size ? data[pos] : 0;
+            ok = ok && pos < size && width <= 32 && pos + 1 + packed_bytes(n, width) <= size;
+            for (uint32_t i = 0; ok && i < n; i++) {
+                uint64_t code = unpack_bits(data + pos + 1, i, width);
+                ok = code < entries;
+                if (ok) {
+                    offset[first + i] = at[code];
+                    length[first + i] = len[code];
+                }
+            }
+            xfree(at);
+            xfree(len);
+        } else {
+            ok = false;
+        }
+        xfree(data);
+
+        if (!ok) {
+            xcol_invalid(x);
+            goto fail;
+        }
+    }
+    return true;
+
+fail:
+    xfree(*arena);
+    *arena = NULL;
+    *arena_used = 0;
+    return false;
+}
@@ -0,0 +1,99 @@
+/*
+ * xBase3 - dBASE III+ Compatible Database System
+ * xcol.h - Columnar snapshot files
+ */
+
+#ifndef XBASE3_XCOL_H
+#define XBASE3_XCOL_H
+
+#include "util.h"
+#include "dbf.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A snapshot (.xcol, written by COPY TO ... TYPE XCOL) stores a table
+ * column by column, in chunks of XCOL_CHUNK_RECORDS records, so that a
+ * query reads only the fields it uses. Values are kept decoded: numbers
+ * as doubles or scaled integers, dates as julian day numbers, logicals
+ * and deletion flags as 0/1, characters without trailing blanks.
+ *
+ * Bytes 0-31:    Header
+ *   0-3    Magic "XCL1"
+ *   4-7    Record count
+ *   8-9    Field count
+ *   10-11  Record size of the table the snapshot was taken from
+ *   12-15  Records per chunk
+ *   16-23  Offset of the chunk directory
+ * Then 16 bytes per field: name (11), type, length (2), decimals, reserved.
+ * Then the chunks, and at the end the directory: for every chunk, one
+ * 32-byte entry per field and one for the deletion flags:
+ *   0-7    Offset of the encoded values
+ *   8-11   Encoded size
+ *   12     Encoding (XColEncoding)
+ *   16-23  Lowest value (N and D fields, as zone maps compare them)
+ *   24-31  Highest value
+ *
+ * Encodings:
+ *   PLAIN  doubles (N); lengths, then the bytes of every value (C)
+ *   RLE    run count (4), then per run an 8-byte value and a 4-byte length
+ *   FOR    frame of reference: 8-byte base, bit width (1), then each value
+ *          minus the base packed in that many bits
+ *   DICT   entry count (4), each entry as a length byte and its bytes,
+ *          bit width (1), then each value's entry number bit-packed
+ * Integers are little endian; N fields whose values are whole numbers
+ * once scaled by their decimals are stored as scaled integers.
+ */
+#define XCOL_MAGIC          "XCL1"
+#define XCOL_HEADER_SIZE    32
+#define XCOL_FIELD_SIZE     16
+#define XCOL_ENTRY_SIZE     32
+#define XCOL_CHUNK_RECORDS  (16 * DBF_ZONE_RECORDS)
+
+typedef enum {
+    XCOL_PLAIN,
+    XCOL_RLE,
+    XCOL_FOR,
+    XCOL_DICT
+} XColEncoding;
+
+/* Snapshot being written */
+typedef struct XColWriter XColWriter;
+
+/* Create a snapshot of records laid out as 'fields' describes */
+XColWriter *xcol_create(const char *filename, const DBFField *fields, int field_count);
+
+/* Add one raw record image (deletion flag first) */
+bool xcol_write(XColWriter *w, const uint8_t *record);
+
+/* Write the last chunk and the directory, then close; the file is
+ * removed if this fails */
+bool xcol_finish(XColWriter *w);
+
+/* Give up on a snapshot and remove the file */
+void xcol_discard(XColWriter *w);
+
+uint32_t xcol_written(XColWriter *w);
+
+/* Snapshots being read: the directory is read at open, the values of a
+ * field only when asked for */
+XCol *xcol_open(const char *filename);
+void xcol_close(XCol *x);
+
+uint32_t xcol_record_count(XCol *x);
+int xcol_field_count(XCol *x);
+const DBFField *xcol_fields(XCol *x); /* Offsets as in the source record */
+uint16_t xcol_record_size(XCol *x);
+
+/* Range of an N or D field over chunk 'chunk' */
+bool xcol_chunk_range(XCol *x, uint32_t chunk, int field, double *min, double *max);
+
+/* Decode every value of a field; arrays have room for every record.
+ * Field -1 reads the deletion flags as bits. */
+bool xcol_read_numbers(XCol *x, int field, double *values);
+bool xcol_read_dates(XCol *x, int field, int32_t *jdn);
+bool xcol_read_bits(XCol *x, int field, uint8_t *bits);
+bool xcol_read_strings(XCol *x, int field, size_t *offset, uint8_t *length,
+                       char **arena, size_t *arena_used);
+
+#endif /* XBASE3_XCOL_H */
@@ -3,12 +3,17 @@
  * xdx.c - XDX B-tree index engine implementation
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "xdx.h"
 #include "dbf.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 /* Internal structures for navigation stack */
 typedef struct {
@@ -22,180 +27,365 @@ typedef struct {
     int capacity;
 } NavStack;
 
-/* Calculate node size in bytes */
-static size_t node_size(XDX *xdx) {
-    /* Header + (order * (key + recno + child)) + right_child */
-    size_t entry_size = xdx->header.key_length + sizeof(uint32_t);
-    if (xdx->header.order > 0) {
-        /* Internal nodes have child pointers */
-        entry_size += sizeof(uint32_t);
-    }
-    return sizeof(XDXNodeHeader) +
-           (xdx->header.order * entry_size) +
-           sizeof(uint32_t);  /* right child */
+/* Bytes a node takes on disk */
+static size_t node_size(XDX *xdx, bool is_leaf) {
+    if (xdx->header.version >= 2) return XDX_PAGE_SIZE;
+
+    /* Version 1: header, 'order' entries of key + recno (+ child), then
+     * the right-most child of an internal node */
+    size_t entry_size = xdx->header.key_length + sizeof(uint32_t) +
+                        (is_leaf ? 0 : sizeof(uint32_t));
+    return sizeof(XDXNodeHeader) + xdx->header.order * entry_size +
+           (is_leaf ? 0 : sizeof(uint32_t));
 }
 
-/* Calculate leaf node size (no child pointers) */
-static size_t leaf_node_size(XDX *xdx) {
-    size_t entry_size = xdx->header.key_length + sizeof(uint32_t);
+/* Keys that fit in a version 2 page */
+static uint16_t page_order(uint16_t key_length) {
+    return (uint16_t)((XDX_PAGE_SIZE - sizeof(XDXNodeHeader) - sizeof(uint32_t)) /
+                      (key_length + 2 * sizeof(uint32_t)));
+}
+
+/* Bytes of a node's page image in memory: the version 2 layout, sized
+ * for the index's order (a whole page from version 2) */
+static size_t image_size(XDX *xdx) {
+    if (xdx->header.version >= 2) return XDX_PAGE_SIZE;
     return sizeof(XDXNodeHeader) +
-           (xdx->header.order * entry_size);
+           (size_t)xdx->header.order * (xdx->header.key_length + 2 * sizeof(uint32_t)) +
+           sizeof(uint32_t);
 }
 
-/* Allocate a new node in memory */
-static XDXNode *node_alloc(XDX *xdx) {
-    XDXNode *node = xcalloc(1, sizeof(XDXNode));
-    node->entries = xcalloc(xdx->header.order, sizeof(XDXKeyEntry));
+/* Slots of the page image arrays */
+static uint8_t *key_at(XDX *xdx, XDXNode *node, int i) {
+    return node->data + sizeof(XDXNodeHeader) + (size_t)i * xdx->header.key_length;
+}
+
+static uint8_t *recno_at(XDX *xdx, XDXNode *node, int i) {
+    return node->data + sizeof(XDXNodeHeader) +
+           (size_t)xdx->header.order * xdx->header.key_length +
+           (size_t)i * sizeof(uint32_t);
+}
+
+static uint8_t *child_at(XDX *xdx, XDXNode *node, int i) {
+    return node->data + sizeof(XDXNodeHeader) +
+           (size_t)xdx->header.order * (xdx->header.key_length + sizeof(uint32_t)) +
+           (size_t)i * sizeof(uint32_t);
+}
 
-    for (int i = 0; i < xdx->header.order; i++) {
-        node->entries[i].key = xcalloc(1, xdx->header.key_length);
+static uint32_t node_recno(XDX *xdx, XDXNode *node, int i) {
+    uint32_t v;
+    memcpy(&v, recno_at(xdx, node, i), sizeof(v));
+    return v;
+}
+
+/* Child left of key i; child key_count is the right-most one */
+static uint32_t node_child(XDX *xdx, XDXNode *node, int i) {
+    uint32_t v;
+    memcpy(&v, child_at(xdx, node, i), sizeof(v));
+    return v;
+}
+
+static void set_recno(XDX *xdx, XDXNode *node, int i, uint32_t recno) {
+    memcpy(recno_at(xdx, node, i), &recno, sizeof(recno));
+}
+
+static void set_child(XDX *xdx, XDXNode *node, int i, uint32_t offset) {
+    memcpy(child_at(xdx, node, i), &offset, sizeof(offset));
+}
+
+/* Open a gap of one entry at 'pos' (internal nodes: with the child right
+ * of it), or close the gap at 'pos' when 'grow' is false */
+static void node_shift(XDX *xdx, XDXNode *node, int pos, bool grow) {
+    int from = grow ? pos : pos + 1;
+    int to = grow ? pos + 1 : pos;
+    int n = node->header.key_count - from;
+    size_t klen = xdx->header.key_length;
+
+    memmove(key_at(xdx, node, to), key_at(xdx, node, from), (size_t)n * klen);
+    memmove(recno_at(xdx, node, to), recno_at(xdx, node, from), (size_t)n * sizeof(uint32_t));
+    if (!node->header.is_leaf) {
+        memmove(child_at(xdx, node, to + 1), child_at(xdx, node, from + 1),
+                (size_t)n * sizeof(uint32_t));
     }
+}
 
+/* Allocate a new node in memory */
+static XDXNode *node_alloc(XDX *xdx) {
+    XDXNode *node = xcalloc(1, sizeof(XDXNode));
+    node->data = xcalloc(1, image_size(xdx));
     return node;
 }
 
 /* Free a node */
-static void node_free(XDXNode *node, int order) {
+static void node_free(XDXNode *node) {
     if (!node) return;
-
-    if (node->entries) {
-        for (int i = 0; i < order; i++) {
-            free(node->entries[i].key);
-        }
-        free(node->entries);
-    }
+    free(node->data);
     free(node);
 }
 
-/* Read a node from file */
-static XDXNode *node_read(XDX *xdx, uint32_t offset) {
-    if (offset == 0) return NULL;
+/* Offset of a node within the node area (after the header) */
+static uint64_t node_pos(uint32_t offset) {
+    return (uint64_t)offset - XDX_HEADER_SIZE;
+}
 
-    XDXNode *node = node_alloc(xdx);
-    node->file_offset = offset;
+/* Decode a version 1 node, whose entries interleave key, recno and child */
+static void node_decode_v1(XDX *xdx, XDXNode *node, const uint8_t *src) {
+    src += sizeof(XDXNodeHeader);
 
-    if (fseek(xdx->fp, (long)offset, SEEK_SET) != 0) {
-        node_free(node, xdx->header.order);
-        return NULL;
+    for (int i = 0; i < node->header.key_count; i++) {
+        memcpy(key_at(xdx, node, i), src, xdx->header.key_length);
+        src += xdx->header.key_length;
+        memcpy(recno_at(xdx, node, i), src, sizeof(uint32_t));
+        src += sizeof(uint32_t);
+        if (!node->header.is_leaf) {
+            memcpy(child_at(xdx, node, i), src, sizeof(uint32_t));
+            src += sizeof(uint32_t);
+        }
     }
 
-    /* Read header */
-    if (fread(&node->header, sizeof(XDXNodeHeader), 1, xdx->fp) != 1) {
-        node_free(node, xdx->header.order);
-        return NULL;
+    if (!node->header.is_leaf) {
+        memcpy(child_at(xdx, node, node->header.key_count), src, sizeof(uint32_t));
     }
+}
 
-    /* Read key entries */
-    for (int i = 0; i < node->header.key_count; i++) {
-        /* Read key */
-        if (fread(node->entries[i].key, xdx->header.key_length, 1, xdx->fp) != 1) {
-            node_free(node, xdx->header.order);
-            return NULL;
-        }
+/* Serialize a node in the version 1 layout into the staging buffer,
+ * returning its length */
+static size_t node_encode_v1(XDX *xdx, XDXNode *node) {
+    uint8_t *dst = xdx->node_buffer;
 
-        /* Read record number */
-        if (fread(&node->entries[i].recno, sizeof(uint32_t), 1, xdx->fp) != 1) {
-            node_free(node, xdx->header.order);
-            return NULL;
-        }
+    memcpy(dst, &node->header, sizeof(XDXNodeHeader));
+    dst += sizeof(XDXNodeHeader);
 
-        /* Read child pointer for internal nodes */
+    for (int i = 0; i < node->header.key_count; i++) {
+        memcpy(dst, key_at(xdx, node, i), xdx->header.key_length);
+        dst += xdx->header.key_length;
+        memcpy(dst, recno_at(xdx, node, i), sizeof(uint32_t));
+        dst += sizeof(uint32_t);
         if (!node->header.is_leaf) {
-            if (fread(&node->entries[i].child_offset, sizeof(uint32_t), 1, xdx->fp) != 1) {
-                node_free(node, xdx->header.order);
-                return NULL;
-            }
+            memcpy(dst, child_at(xdx, node, i), sizeof(uint32_t));
+            dst += sizeof(uint32_t);
         }
     }
 
-    /* Read right child for internal nodes */
     if (!node->header.is_leaf) {
-        if (fread(&node->right_child, sizeof(uint32_t), 1, xdx->fp) != 1) {
-            node_free(node, xdx->header.order);
-            return NULL;
+        memcpy(dst, child_at(xdx, node, node->header.key_count), sizeof(uint32_t));
+        dst += sizeof(uint32_t);
+    }
+
+    return (size_t)(dst - xdx->node_buffer);
+}
+
+/* Read a node from file: a version 2 page is its own image and is read
+ * with one copy; a version 1 node is converted */
+static XDXNode *node_read(XDX *xdx, uint32_t offset) {
+    if (offset < XDX_HEADER_SIZE) return NULL;
+
+    XDXNode *node = node_alloc(xdx);
+    node->file_offset = offset;
+
+    uint64_t pos = node_pos(offset);
+    bool ok;
+
+    if (xdx->header.version >= 2) {
+        ok = bufpool_read(xdx->pool, pos, node->data, XDX_PAGE_SIZE);
+        if (ok) memcpy(&node->header, node->data, sizeof(XDXNodeHeader));
+    } else {
+        /* Read the header, then exactly the used entries */
+        ok = bufpool_read(xdx->pool, pos, &node->header, sizeof(XDXNodeHeader));
+        if (ok && node->header.key_count <= xdx->header.order) {
+            size_t entry = xdx->header.key_length + sizeof(uint32_t) +
+                           (node->header.is_leaf ? 0 : sizeof(uint32_t));
+            size_t len = sizeof(XDXNodeHeader) + (size_t)node->header.key_count * entry +
+                         (node->header.is_leaf ? 0 : sizeof(uint32_t));
+            ok = bufpool_read(xdx->pool, pos, xdx->node_buffer, len);
+            if (ok) node_decode_v1(xdx, node, xdx->node_buffer);
         }
     }
 
+    if (ok && node->header.key_count > xdx->header.order) {
+        error_set(ERR_INVALID_INDEX, "Corrupt index node");
+        ok = false;
+    }
+
+    if (!ok) {
+        node_free(node);
+        return NULL;
+    }
+
     return node;
 }
 
-/* Write a node to file */
+/* Write a node to file with a single write */
 static bool node_write(XDX *xdx, XDXNode *node) {
     if (!node) return false;
 
-    if (fseek(xdx->fp, (long)node->file_offset, SEEK_SET) != 0) {
-        return false;
+    bool ok;
+    if (xdx->header.version >= 2) {
+        memcpy(node->data, &node->header, sizeof(XDXNodeHeader));
+        ok = bufpool_write(xdx->pool, node_pos(node->file_offset), node->data, XDX_PAGE_SIZE);
+    } else {
+        size_t len = node_encode_v1(xdx, node);
+        ok = bufpool_write(xdx->pool, node_pos(node->file_offset), xdx->node_buffer, len);
     }
+    if (!ok) return false;
 
-    /* Write header */
-    if (fwrite(&node->header, sizeof(XDXNodeHeader), 1, xdx->fp) != 1) {
-        return false;
-    }
+    node->dirty = false;
+    return true;
+}
 
-    /* Write key entries */
-    for (int i = 0; i < node->header.key_count; i++) {
-        /* Write key */
-        if (fwrite(node->entries[i].key, xdx->header.key_length, 1, xdx->fp) != 1) {
-            return false;
-        }
+/*
+ * Node cache
+ */
 
-        /* Write record number */
-        if (fwrite(&node->entries[i].recno, sizeof(uint32_t), 1, xdx->fp) != 1) {
-            return false;
-        }
+static unsigned cache_slot(XDX *xdx, uint32_t offset) {
+    uint64_t h = (uint64_t)offset * 0x9E3779B97F4A7C15ULL;
+    return (unsigned)(h >> 32) & (xdx->bucket_count - 1);
+}
 
-        /* Write child pointer for internal nodes */
-        if (!node->header.is_leaf) {
-            if (fwrite(&node->entries[i].child_offset, sizeof(uint32_t), 1, xdx->fp) != 1) {
-                return false;
-            }
+static XDXNode *cache_find(XDX *xdx, uint32_t offset) {
+    if (xdx->bucket_count == 0) return NULL;
+
+    XDXNode *n = xdx->buckets[cache_slot(xdx, offset)];
+    while (n && n->file_offset != offset) n = n->hash_next;
+    return n;
+}
+
+/* Grow the bucket array so chains stay short */
+static void cache_reserve(XDX *xdx, uint32_t nodes) {
+    if (xdx->bucket_count >= nodes && xdx->bucket_count > 0) return;
+
+    uint32_t count = xdx->bucket_count ? xdx->bucket_count : 64;
+    while (count < nodes) count *= 2;
+
+    XDXNode **old = xdx->buckets;
+    uint32_t old_count = xdx->bucket_count;
+    xdx->buckets = xcalloc(count, sizeof(XDXNode *));
+    xdx->bucket_count = count;
+
+    for (uint32_t i = 0; i < old_count; i++) {
+        XDXNode *n = old[i];
+        while (n) {
+            XDXNode *next = n->hash_next;
+            unsigned slot = cache_slot(xdx, n->file_offset);
+            n->hash_next = xdx->buckets[slot];
+            xdx->buckets[slot] = n;
+            n = next;
         }
     }
+    free(old);
+}
 
-    /* Write right child for internal nodes */
-    if (!node->header.is_leaf) {
-        if (fwrite(&node->right_child, sizeof(uint32_t), 1, xdx->fp) != 1) {
-            return false;
+static void cache_remove(XDX *xdx, XDXNode *node) {
+    XDXNode **link = &xdx->buckets[cache_slot(xdx, node->file_offset)];
+    while (*link != node) link = &(*link)->hash_next;
+    *link = node->hash_next;
+    xdx->cached--;
+
+    if (node->header.is_leaf) {
+        if (node->lru_prev) node->lru_prev->lru_next = node->lru_next;
+        else xdx->lru_head = node->lru_next;
+        if (node->lru_next) node->lru_next->lru_prev = node->lru_prev;
+        else xdx->lru_tail = node->lru_prev;
+        xdx->leaf_count--;
+    }
+}
+
+/* Move a leaf to the front of the LRU list */
+static void lru_touch(XDX *xdx, XDXNode *node) {
+    if (xdx->lru_head == node) return;
+
+    if (node->lru_prev) node->lru_prev->lru_next = node->lru_next;
+    if (node->lru_next) node->lru_next->lru_prev = node->lru_prev;
+    else if (xdx->lru_tail == node) xdx->lru_tail = node->lru_prev;
+
+    node->lru_prev = NULL;
+    node->lru_next = xdx->lru_head;
+    if (xdx->lru_head) xdx->lru_head->lru_prev = node;
+    xdx->lru_head = node;
+    if (!xdx->lru_tail) xdx->lru_tail = node;
+}
+
+/* Drop unpinned leaves, oldest first, until the cache is within bounds */
+static void cache_evict(XDX *xdx) {
+    XDXNode *n = xdx->lru_tail;
+    while (n && xdx->leaf_count > XDX_CACHE_LEAVES) {
+        XDXNode *prev = n->lru_prev;
+        if (n->pins == 0) {
+            cache_remove(xdx, n);
+            node_free(n);
         }
+        n = prev;
     }
+}
 
-    node->dirty = false;
-    return true;
+/* Get a node through the cache, pinning it until node_release() */
+static XDXNode *node_get(XDX *xdx, uint32_t offset) {
+    XDXNode *node = cache_find(xdx, offset);
+    if (node) {
+        xdx->cache_hits++;
+    } else {
+        xdx->cache_misses++;
+        node = node_read(xdx, offset);
+        if (!node) return NULL;
+
+        cache_reserve(xdx, xdx->cached + 1);
+        unsigned slot = cache_slot(xdx, offset);
+        node->hash_next = xdx->buckets[slot];
+        xdx->buckets[slot] = node;
+        xdx->cached++;
+        if (node->header.is_leaf) xdx->leaf_count++;
+    }
+
+    node->pins++;
+    if (node->header.is_leaf) {
+        lru_touch(xdx, node);
+        cache_evict(xdx);
+    }
+    return node;
+}
+
+static void node_release(XDXNode *node) {
+    if (node) node->pins--;
 }
 
-/* Allocate a new node in the file */
+/* Free every cached node */
+static void cache_clear(XDX *xdx) {
+    for (uint32_t i = 0; i < xdx->bucket_count; i++) {
+        XDXNode *n = xdx->buckets[i];
+        while (n) {
+            XDXNode *next = n->hash_next;
+            node_free(n);
+            n = next;
+        }
+        xdx->buckets[i] = NULL;
+    }
+    xdx->cached = 0;
+    xdx->leaf_count = 0;
+    xdx->lru_head = NULL;
+    xdx->lru_tail = NULL;
+}
+
+/* Allocate a new node at the end of the file */
 static uint32_t node_create(XDX *xdx, bool is_leaf) {
-    /* Seek to end of file */
-    if (fseek(xdx->fp, 0, SEEK_END) != 0) {
+    uint64_t end = XDX_HEADER_SIZE + bufpool_size(xdx->pool);
+    if (end > UINT32_MAX) {
+        error_set(ERR_FILE_WRITE, "Index file too large");
         return 0;
     }
 
-    uint32_t offset = (uint32_t)ftell(xdx->fp);
+    uint32_t offset = (uint32_t)end;
 
-    /* Create empty node */
-    XDXNode *node = node_alloc(xdx);
-    node->file_offset = offset;
-    node->header.key_count = 0;
-    node->header.is_leaf = is_leaf ? 1 : 0;
-    node->header.parent_offset = 0;
-    node->dirty = true;
+    /* Zero-filled node of full size, so later growth stays in place */
+    size_t size = node_size(xdx, is_leaf);
+    XDXNodeHeader hdr = {0};
+    hdr.is_leaf = is_leaf ? 1 : 0;
 
-    /* Write to file */
-    if (!node_write(xdx, node)) {
-        node_free(node, xdx->header.order);
-        return 0;
-    }
+    memset(xdx->node_buffer, 0, size);
+    memcpy(xdx->node_buffer, &hdr, sizeof(hdr));
 
-    /* Pad to proper size */
-    size_t size = is_leaf ? leaf_node_size(xdx) : node_size(xdx);
-    size_t written = sizeof(XDXNodeHeader);
-    uint8_t zero = 0;
-    while (written < size) {
-        fwrite(&zero, 1, 1, xdx->fp);
-        written++;
+    if (!bufpool_write(xdx->pool, node_pos(offset), xdx->node_buffer, size)) {
+        return 0;
     }
 
-    node_free(node, xdx->header.order);
     xdx->header.node_count++;
 
     return offset;
@@ -203,6 +393,11 @@ static uint32_t node_create(XDX *xdx, bool is_leaf) {
 
 /* Compare two keys */
 int xdx_key_compare(XDX *xdx, const void *key1, const void *key2) {
+    /* Binary keys are stored in order, descending ones included */
+    if (xdx->header.flags & XDX_FLAG_BINARY) {
+        return memcmp(key1, key2, xdx->header.key_length);
+    }
+
     int result;
 
     switch (xdx->header.key_type) {
@@ -241,6 +436,58 @@ int xdx_key_compare(XDX *xdx, const void *key1, const void *key2) {
     return result;
 }
 
+static void write_be(uint8_t *p, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        p[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+/* Invert a binary key of a descending index */
+static void key_order(XDX *xdx, uint8_t *key) {
+    if ((xdx->header.flags & (XDX_FLAG_BINARY | XDX_FLAG_DESCENDING)) !=
+        (XDX_FLAG_BINARY | XDX_FLAG_DESCENDING)) return;
+    for (uint16_t i = 0; i < xdx->header.key_length; i++) key[i] = (uint8_t)~key[i];
+}
+
+void xdx_key_number(XDX *xdx, double value, void *key) {
+    bool binary = (xdx->header.flags & XDX_FLAG_BINARY) != 0;
+    if (binary && xdx->header.key_type == XDX_KEY_NUMERIC) {
+        if (value == 0 || value != value) value = 0;  /* -0 and NaN sort as 0 */
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits = bits >> 63 ? ~bits : bits | ((uint64_t)1 << 63);
+        write_be(key, bits, XDX_NUMBER_KEY_LEN);
+        key_order(xdx, key);
+    } else if (binary && xdx->header.key_type == XDX_KEY_DATE) {
+        write_be(key, (uint32_t)(int32_t)value ^ 0x80000000u, XDX_DATE_KEY_LEN);
+        key_order(xdx, key);
+    } else {
+        char text[32];
+        snprintf(text, sizeof(text), "%g", value);
+        xdx_key_text(xdx, text, key);
+    }
+}
+
+void xdx_key_text(XDX *xdx, const char *text, void *key) {
+    if (xdx->header.flags & XDX_FLAG_BINARY) {
+        switch (xdx->header.key_type) {
+            case XDX_KEY_NUMERIC:
+                xdx_key_number(xdx, strtod(text, NULL), key);
+                return;
+            case XDX_KEY_DATE:
+                xdx_key_number(xdx, (double)date_to_julian(text), key);
+                return;
+        }
+    }
+
+    size_t len = strlen(text);
+    if (len > xdx->header.key_length) len = xdx->header.key_length;
+    memset(key, ' ', xdx->header.key_length);
+    memcpy(key, text, len);
+    key_order(xdx, key);
+}
+
 /* Find position for key in node (binary search) */
 static int find_key_pos(XDX *xdx, XDXNode *node, const void *key) {
     int left = 0;
@@ -248,7 +495,7 @@ static int find_key_pos(XDX *xdx, XDXNode *node, const void *key) {
 
     while (left <= right) {
         int mid = (left + right) / 2;
-        int cmp = xdx_key_compare(xdx, key, node->entries[mid].key);
+        int cmp = xdx_key_compare(xdx, key, key_at(xdx, node, mid));
 
         if (cmp == 0) {
             return mid;  /* Exact match */
@@ -265,39 +512,35 @@ static int find_key_pos(XDX *xdx, XDXNode *node, const void *key) {
 /* Split a full node */
 static bool split_node(XDX *xdx, XDXNode *node, XDXNode *parent, int parent_idx) {
     int mid = node->header.key_count / 2;
+    size_t klen = xdx->header.key_length;
 
     /* Create new right sibling */
     uint32_t new_offset = node_create(xdx, node->header.is_leaf);
     if (new_offset == 0) return false;
 
-    XDXNode *sibling = node_read(xdx, new_offset);
+    XDXNode *sibling = node_get(xdx, new_offset);
     if (!sibling) return false;
 
-    /* Copy right half of keys to sibling */
-    sibling->header.key_count = node->header.key_count - mid - 1;
+    /* Copy right half of keys (and the children around them) to sibling */
+    int moved = node->header.key_count - mid - 1;
+    sibling->header.key_count = (uint16_t)moved;
     sibling->header.is_leaf = node->header.is_leaf;
 
-    for (int i = 0; i < sibling->header.key_count; i++) {
-        memcpy(sibling->entries[i].key, node->entries[mid + 1 + i].key,
-               xdx->header.key_length);
-        sibling->entries[i].recno = node->entries[mid + 1 + i].recno;
-        sibling->entries[i].child_offset = node->entries[mid + 1 + i].child_offset;
-    }
-
+    memcpy(key_at(xdx, sibling, 0), key_at(xdx, node, mid + 1), (size_t)moved * klen);
+    memcpy(recno_at(xdx, sibling, 0), recno_at(xdx, node, mid + 1),
+           (size_t)moved * sizeof(uint32_t));
     if (!node->header.is_leaf) {
-        sibling->right_child = node->right_child;
+        memcpy(child_at(xdx, sibling, 0), child_at(xdx, node, mid + 1),
+               (size_t)(moved + 1) * sizeof(uint32_t));
     }
 
     /* Middle key goes up to parent */
-    uint8_t *mid_key = xmalloc(xdx->header.key_length);
-    memcpy(mid_key, node->entries[mid].key, xdx->header.key_length);
-    uint32_t mid_recno = node->entries[mid].recno;
+    uint8_t mid_key[XDX_MAX_KEY_LEN];
+    memcpy(mid_key, key_at(xdx, node, mid), klen);
+    uint32_t mid_recno = node_recno(xdx, node, mid);
 
-    /* Shrink original node */
-    node->header.key_count = mid;
-    if (!node->header.is_leaf) {
-        node->right_child = node->entries[mid].child_offset;
-    }
+    /* Shrink original node; the middle key's child becomes its right-most */
+    node->header.key_count = (uint16_t)mid;
 
     /* Write both nodes */
     node->dirty = true;
@@ -309,13 +552,13 @@ static bool split_node(XDX *xdx, XDXNode *node, XDXNode *parent, int parent_idx)
     if (parent == NULL) {
         /* Create new root */
         uint32_t new_root_offset = node_create(xdx, false);
-        XDXNode *new_root = node_read(xdx, new_root_offset);
+        XDXNode *new_root = node_get(xdx, new_root_offset);
 
         new_root->header.key_count = 1;
-        memcpy(new_root->entries[0].key, mid_key, xdx->header.key_length);
-        new_root->entries[0].recno = mid_recno;
-        new_root->entries[0].child_offset = node->file_offset;
-        new_root->right_child = sibling->file_offset;
+        memcpy(key_at(xdx, new_root, 0), mid_key, klen);
+        set_recno(xdx, new_root, 0, mid_recno);
+        set_child(xdx, new_root, 0, node->file_offset);
+        set_child(xdx, new_root, 1, sibling->file_offset);
 
         node_write(xdx, new_root);
 
@@ -325,36 +568,24 @@ static bool split_node(XDX *xdx, XDXNode *node, XDXNode *parent, int parent_idx)
 
         /* Update cached root */
         if (xdx->root) {
-            node_free(xdx->root, xdx->header.order);
+            node_release(xdx->root);
         }
         xdx->root = new_root;
     } else {
-        /* Insert into parent - shift keys right */
-        for (int i = parent->header.key_count; i > parent_idx; i--) {
-            memcpy(parent->entries[i].key, parent->entries[i-1].key,
-                   xdx->header.key_length);
-            parent->entries[i].recno = parent->entries[i-1].recno;
-            parent->entries[i].child_offset = parent->entries[i-1].child_offset;
-        }
-
-        memcpy(parent->entries[parent_idx].key, mid_key, xdx->header.key_length);
-        parent->entries[parent_idx].recno = mid_recno;
-        parent->entries[parent_idx].child_offset = node->file_offset;
-
-        /* Update right child pointer */
-        if (parent_idx == parent->header.key_count) {
-            parent->right_child = sibling->file_offset;
-        } else {
-            parent->entries[parent_idx + 1].child_offset = sibling->file_offset;
-        }
+        /* Insert into parent: the split node stays left of the middle key,
+         * the sibling goes right of it */
+        node_shift(xdx, parent, parent_idx, true);
+        memcpy(key_at(xdx, parent, parent_idx), mid_key, klen);
+        set_recno(xdx, parent, parent_idx, mid_recno);
+        set_child(xdx, parent, parent_idx, node->file_offset);
+        set_child(xdx, parent, parent_idx + 1, sibling->file_offset);
 
         parent->header.key_count++;
         parent->dirty = true;
         node_write(xdx, parent);
     }
 
-    free(mid_key);
-    node_free(sibling, xdx->header.order);
+    node_release(sibling);
 
     return true;
 }
@@ -400,6 +631,13 @@ XDX *xdx_create(const char *filename, const char *key_expr,
                 char key_type, uint16_t key_length,
                 bool unique, bool descending) {
 
+    if (key_type == XDX_KEY_NUMERIC) key_length = XDX_NUMBER_KEY_LEN;
+    if (key_type == XDX_KEY_DATE) key_length = XDX_DATE_KEY_LEN;
+    if (key_length == 0 || key_length > XDX_MAX_KEY_LEN) {
+        error_set(ERR_INVALID_INDEX, "Index key length must be 1 to %d", XDX_MAX_KEY_LEN);
+        return NULL;
+    }
+
     XDX *xdx = xcalloc(1, sizeof(XDX));
     strncpy(xdx->filename, filename, MAX_PATH_LEN - 1);
 
@@ -417,8 +655,8 @@ XDX *xdx_create(const char *filename, const char *key_expr,
     xdx->header.version = XDX_VERSION;
     xdx->header.key_type = key_type;
     xdx->header.key_length = key_length;
-    xdx->header.order = XDX_DEFAULT_ORDER;
-    xdx->header.flags = 0;
+    xdx->header.order = page_order(key_length);
+    xdx->header.flags = XDX_FLAG_BINARY;
 
     if (unique) xdx->header.flags |= XDX_FLAG_UNIQUE;
     if (descending) xdx->header.flags |= XDX_FLAG_DESCENDING;
@@ -438,12 +676,19 @@ XDX *xdx_create(const char *filename, const char *key_expr,
     for (size_t i = sizeof(XDXHeader); i < XDX_HEADER_SIZE; i++) {
         fwrite(&zero, 1, 1, xdx->fp);
     }
+    fflush(xdx->fp);
+
+    /* Nodes live in the buffer pool */
+    xdx->pool = bufpool_attach(fileno(xdx->fp), XDX_HEADER_SIZE, 0);
+    xdx->node_buffer = xcalloc(1, node_size(xdx, false));
 
     /* Create empty root node (leaf) */
     uint32_t root_offset = node_create(xdx, true);
     if (root_offset == 0) {
         error_set(ERR_FILE_WRITE, "Cannot create root node");
+        bufpool_detach(xdx->pool);
         fclose(xdx->fp);
+        free(xdx->node_buffer);
         free(xdx);
         return NULL;
     }
@@ -458,7 +703,7 @@ XDX *xdx_create(const char *filename, const char *key_expr,
     xdx->key_buffer = xcalloc(1, key_length);
 
     /* Load root */
-    xdx->root = node_read(xdx, root_offset);
+    xdx->root = node_get(xdx, root_offset);
 
     fflush(xdx->fp);
     return xdx;
@@ -492,8 +737,13 @@ XDX *xdx_open(const char *filename) {
         return NULL;
     }
 
-    /* Validate version */
-    if (xdx->header.version != XDX_VERSION) {
+    /* Validate version; version 1 files are read and updated in their
+     * own layout until rebuilt */
+    bool paged = xdx->header.version == XDX_VERSION;
+    if ((!paged && xdx->header.version != XDX_VERSION_1) ||
+        xdx->header.key_length == 0 || xdx->header.key_length > XDX_MAX_KEY_LEN ||
+        xdx->header.order < 3 ||
+        (paged && xdx->header.order != page_order(xdx->header.key_length))) {
         error_set(ERR_INVALID_INDEX, "Unsupported index version");
         fclose(xdx->fp);
         free(xdx);
@@ -503,28 +753,45 @@ XDX *xdx_open(const char *filename) {
     /* Allocate key buffer */
     xdx->key_buffer = xcalloc(1, xdx->header.key_length);
 
+    /* Nodes live in the buffer pool */
+    struct stat st;
+    uint64_t size = 0;
+    if (fstat(fileno(xdx->fp), &st) == 0 && st.st_size > XDX_HEADER_SIZE) {
+        size = (uint64_t)st.st_size - XDX_HEADER_SIZE;
+    }
+    xdx->pool = bufpool_attach(fileno(xdx->fp), XDX_HEADER_SIZE, size);
+    xdx->node_buffer = xcalloc(1, node_size(xdx, false));
+
     /* Load root */
-    xdx->root = node_read(xdx, xdx->header.root_offset);
+    xdx->root = node_get(xdx, xdx->header.root_offset);
 
     return xdx;
 }
 
-void xdx_close(XDX *xdx) {
-    if (!xdx) return;
+bool xdx_close(XDX *xdx) {
+    if (!xdx) return true;
 
-    xdx_flush(xdx);
+    bool ok = xdx_flush(xdx);
 
-    if (xdx->root) {
-        node_free(xdx->root, xdx->header.order);
-    }
+    cache_clear(xdx);
+    free(xdx->buckets);
 
     free(xdx->key_buffer);
+    free(xdx->node_buffer);
+
+    if (!bufpool_detach(xdx->pool)) {
+        error_set(ERR_FILE_WRITE, "Cannot write back %s", xdx->filename);
+        bufpool_truncate(xdx->pool, 0);
+        bufpool_detach(xdx->pool);
+        ok = false;
+    }
 
     if (xdx->fp) {
         fclose(xdx->fp);
     }
 
     free(xdx);
+    return ok;
 }
 
 bool xdx_flush(XDX *xdx) {
@@ -543,120 +810,133 @@ bool xdx_flush(XDX *xdx) {
         node_write(xdx, xdx->root);
     }
 
+    if (!bufpool_flush(xdx->pool)) return false;
+
     fflush(xdx->fp);
     return true;
 }
 
+/* Check whether a node has no room for another key */
+static bool node_full(XDX *xdx, XDXNode *node) {
+    return node->header.key_count >= xdx->header.order - 1;
+}
+
 bool xdx_insert(XDX *xdx, const void *key, uint32_t recno) {
-    if (!xdx || !key) return false;
+    if (!xdx || !key || !xdx->root) return false;
+
+    /* Full nodes are split on the way down, so a parent always has room
+       for the key pushed up by a child split */
+    if (node_full(xdx, xdx->root)) {
+        if (!split_node(xdx, xdx->root, NULL, 0)) return false;
+    }
 
-    /* Start at root */
     XDXNode *node = xdx->root;
-    XDXNode *parent = NULL;
-    int parent_idx = 0;
+    bool unique = (xdx->header.flags & XDX_FLAG_UNIQUE) != 0;
 
-    /* Traverse to leaf */
     while (!node->header.is_leaf) {
         int pos = find_key_pos(xdx, node, key);
 
         /* Check for duplicate in unique index */
-        if ((xdx->header.flags & XDX_FLAG_UNIQUE) &&
-            pos < node->header.key_count &&
-            xdx_key_compare(xdx, key, node->entries[pos].key) == 0) {
+        if (unique && pos < node->header.key_count &&
+            xdx_key_compare(xdx, key, key_at(xdx, node, pos)) == 0) {
             error_set(ERR_DUPLICATE_KEY, "Duplicate key in unique index");
-            if (parent && parent != xdx->root) node_free(parent, xdx->header.order);
-            if (node != xdx->root) node_free(node, xdx->header.order);
+            if (node != xdx->root) node_release(node);
             return false;
         }
 
-        uint32_t child_offset;
-        if (pos < node->header.key_count) {
-            child_offset = node->entries[pos].child_offset;
-        } else {
-            child_offset = node->right_child;
-        }
+        uint32_t child_offset = node_child(xdx, node, pos);
 
-        if (parent && parent != xdx->root) {
-            node_free(parent, xdx->header.order);
+        XDXNode *child = node_get(xdx, child_offset);
+        if (!child) {
+            if (node != xdx->root) node_release(node);
+            return false;
         }
-        parent = node;
-        parent_idx = pos;
 
-        node = node_read(xdx, child_offset);
-        if (!node) {
-            if (parent != xdx->root) node_free(parent, xdx->header.order);
-            return false;
+        if (node_full(xdx, child)) {
+            /* Split pushes a key into this node; search it again */
+            bool ok = split_node(xdx, child, node, pos);
+            node_release(child);
+            if (!ok) {
+                if (node != xdx->root) node_release(node);
+                return false;
+            }
+            continue;
         }
+
+        if (node != xdx->root) node_release(node);
+        node = child;
     }
 
     /* Check for duplicate in leaf */
-    if (xdx->header.flags & XDX_FLAG_UNIQUE) {
+    if (unique) {
         for (int i = 0; i < node->header.key_count; i++) {
-            if (xdx_key_compare(xdx, key, node->entries[i].key) == 0) {
+            if (xdx_key_compare(xdx, key, key_at(xdx, node, i)) == 0) {
                 error_set(ERR_DUPLICATE_KEY, "Duplicate key in unique index");
-                if (parent && parent != xdx->root) node_free(parent, xdx->header.order);
-                if (node != xdx->root) node_free(node, xdx->header.order);
+                if (node != xdx->root) node_release(node);
                 return false;
             }
         }
     }
 
-    /* Find insert position */
-    int pos = find_key_pos(xdx, node, key);
-
-    /* Check if node is full */
-    if (node->header.key_count >= xdx->header.order - 1) {
-        /* Split the node */
-        if (!split_node(xdx, node, parent, parent_idx)) {
-            if (parent && parent != xdx->root) node_free(parent, xdx->header.order);
-            if (node != xdx->root) node_free(node, xdx->header.order);
-            return false;
-        }
-
-        /* Re-find the correct node after split */
-        /* Reload root if it changed */
-        if (xdx->root->file_offset != xdx->header.root_offset) {
-            node_free(xdx->root, xdx->header.order);
-            xdx->root = node_read(xdx, xdx->header.root_offset);
-        }
-
-        /* Start over from root */
-        if (parent && parent != xdx->root) node_free(parent, xdx->header.order);
-        if (node != xdx->root) node_free(node, xdx->header.order);
-
-        return xdx_insert(xdx, key, recno);  /* Retry */
-    }
-
     /* Insert key at position */
-    for (int i = node->header.key_count; i > pos; i--) {
-        memcpy(node->entries[i].key, node->entries[i-1].key,
-               xdx->header.key_length);
-        node->entries[i].recno = node->entries[i-1].recno;
-    }
+    int pos = find_key_pos(xdx, node, key);
 
-    memcpy(node->entries[pos].key, key, xdx->header.key_length);
-    node->entries[pos].recno = recno;
+    node_shift(xdx, node, pos, true);
+    memcpy(key_at(xdx, node, pos), key, xdx->header.key_length);
+    set_recno(xdx, node, pos, recno);
     node->header.key_count++;
     node->dirty = true;
 
     /* Write node */
     bool result = node_write(xdx, node);
 
-    /* Update root cache if needed */
-    if (node->file_offset == xdx->header.root_offset) {
-        if (xdx->root && xdx->root != node) {
-            node_free(xdx->root, xdx->header.order);
-        }
-        xdx->root = node;
-    } else {
-        node_free(node, xdx->header.order);
+    if (node != xdx->root) {
+        node_release(node);
     }
 
-    if (parent && parent != xdx->root) {
-        node_free(parent, xdx->header.order);
+    return result;
+}
+
+/* Order batch entries by key, then record number */
+static int entry_compare(XDX *xdx, const uint8_t *a, const uint8_t *b) {
+    int cmp = xdx_key_compare(xdx, a, b);
+    if (cmp != 0) return cmp;
+
+    uint32_t ra, rb;
+    memcpy(&ra, a + xdx->header.key_length, sizeof(uint32_t));
+    memcpy(&rb, b + xdx->header.key_length, sizeof(uint32_t));
+    return ra < rb ? -1 : ra > rb;
+}
+
+/* Bottom-up merge sort of 'count' entries of 'size' bytes */
+static void sort_entries(XDX *xdx, uint8_t *entries, uint32_t count, size_t size) {
+    uint8_t *tmp = xmalloc((size_t)count * size);
+    uint8_t *src = entries, *dst = tmp;
+
+    for (uint32_t width = 1; width < count; width *= 2) {
+        for (uint32_t lo = 0; lo < count; lo += 2 * width) {
+            uint32_t mid = lo + width < count ? lo + width : count;
+            uint32_t hi = mid + width < count ? mid + width : count;
+            uint32_t i = lo, j = mid, k = lo;
+
+            while (i < mid && j < hi) {
+                if (entry_compare(xdx, src + j * size, src + i * size) < 0) {
+                    memcpy(dst + k++ * size, src + j++ * size, size);
+                } else {
+                    memcpy(dst + k++ * size, src + i++ * size, size);
+                }
+            }
+            memcpy(dst + k * size, src + i * size, (mid - i) * size);
+            k += mid - i;
+            memcpy(dst + k * size, src + j * size, (hi - j) * size);
+        }
+        uint8_t *swap = src;
+        src = dst;
+        dst = swap;
     }
 
-    return result;
+    if (src != entries) memcpy(entries, src, (size_t)count * size);
+    free(tmp);
 }
 
 bool xdx_delete(XDX *xdx, const void *key, uint32_t recno) {
@@ -671,18 +951,13 @@ bool xdx_delete(XDX *xdx, const void *key, uint32_t recno) {
         int pos = find_key_pos(xdx, node, key);
         stack_push(&stack, node->file_offset, pos);
 
-        uint32_t child_offset;
-        if (pos < node->header.key_count) {
-            child_offset = node->entries[pos].child_offset;
-        } else {
-            child_offset = node->right_child;
-        }
+        uint32_t child_offset = node_child(xdx, node, pos);
 
         if (node != xdx->root) {
-            node_free(node, xdx->header.order);
+            node_release(node);
         }
 
-        node = node_read(xdx, child_offset);
+        node = node_get(xdx, child_offset);
         if (!node) {
             stack_free(&stack);
             return false;
@@ -694,8 +969,8 @@ bool xdx_delete(XDX *xdx, const void *key, uint32_t recno) {
     int del_pos = -1;
 
     for (int i = 0; i < node->header.key_count; i++) {
-        if (xdx_key_compare(xdx, key, node->entries[i].key) == 0 &&
-            node->entries[i].recno == recno) {
+        if (xdx_key_compare(xdx, key, key_at(xdx, node, i)) == 0 &&
+            node_recno(xdx, node, i) == recno) {
             found = true;
             del_pos = i;
             break;
@@ -703,17 +978,13 @@ bool xdx_delete(XDX *xdx, const void *key, uint32_t recno) {
     }
 
     if (!found) {
-        if (node != xdx->root) node_free(node, xdx->header.order);
+        if (node != xdx->root) node_release(node);
         stack_free(&stack);
         return false;  /* Key not found */
     }
 
     /* Remove key by shifting */
-    for (int i = del_pos; i < node->header.key_count - 1; i++) {
-        memcpy(node->entries[i].key, node->entries[i+1].key,
-               xdx->header.key_length);
-        node->entries[i].recno = node->entries[i+1].recno;
-    }
+    node_shift(xdx, node, del_pos, false);
     node->header.key_count--;
     node->dirty = true;
 
@@ -726,7 +997,7 @@ bool xdx_delete(XDX *xdx, const void *key, uint32_t recno) {
        REINDEX can be used to rebuild a balanced tree. */
 
     if (node != xdx->root) {
-        node_free(node, xdx->header.order);
+        node_release(node);
     }
 
     stack_free(&stack);
@@ -747,13 +1018,13 @@ bool xdx_seek(XDX *xdx, const void *key) {
         if (node->header.is_leaf) {
             /* Check for exact match */
             if (pos < node->header.key_count) {
-                int cmp = xdx_key_compare(xdx, key, node->entries[pos].key);
+                int cmp = xdx_key_compare(xdx, key, key_at(xdx, node, pos));
                 if (cmp == 0) {
                     xdx->found = true;
-                    xdx->current_recno = node->entries[pos].recno;
+                    xdx->current_recno = node_recno(xdx, node, pos);
                 } else if (cmp < 0) {
                     /* Key would be before this position */
-                    xdx->current_recno = node->entries[pos].recno;
+                    xdx->current_recno = node_recno(xdx, node, pos);
                 } else {
                     /* Key would be after all keys */
                     xdx->current_recno = 0;  /* EOF */
@@ -763,33 +1034,26 @@ bool xdx_seek(XDX *xdx, const void *key) {
             }
 
             if (node != xdx->root) {
-                node_free(node, xdx->header.order);
+                node_release(node);
             }
             break;
         }
 
         /* Descend to child */
-        uint32_t child_offset;
         if (pos < node->header.key_count &&
-            xdx_key_compare(xdx, key, node->entries[pos].key) == 0) {
+            xdx_key_compare(xdx, key, key_at(xdx, node, pos)) == 0) {
             /* Exact match at internal node */
             xdx->found = true;
-            xdx->current_recno = node->entries[pos].recno;
+            xdx->current_recno = node_recno(xdx, node, pos);
             if (node != xdx->root) {
-                node_free(node, xdx->header.order);
+                node_release(node);
             }
             break;
         }
 
-        if (pos < node->header.key_count) {
-            child_offset = node->entries[pos].child_offset;
-        } else {
-            child_offset = node->right_child;
-        }
-
-        XDXNode *child = node_read(xdx, child_offset);
+        XDXNode *child = node_get(xdx, node_child(xdx, node, pos));
         if (node != xdx->root) {
-            node_free(node, xdx->header.order);
+            node_release(node);
         }
         node = child;
     }
@@ -812,19 +1076,19 @@ bool xdx_go_top(XDX *xdx) {
 
     /* Go to leftmost leaf */
     while (node && !node->header.is_leaf) {
-        uint32_t child_offset = node->entries[0].child_offset;
-        XDXNode *child = node_read(xdx, child_offset);
+        uint32_t child_offset = node_child(xdx, node, 0);
+        XDXNode *child = node_get(xdx, child_offset);
         if (node != xdx->root) {
-            node_free(node, xdx->header.order);
+            node_release(node);
         }
         node = child;
     }
 
     if (node && node->header.key_count > 0) {
-        xdx->current_recno = node->entries[0].recno;
+        xdx->current_recno = node_recno(xdx, node, 0);
         xdx->found = true;
         if (node != xdx->root) {
-            node_free(node, xdx->header.order);
+            node_release(node);
         }
         return true;
     }
@@ -841,19 +1105,19 @@ bool xdx_go_bottom(XDX *xdx) {
 
     /* Go to rightmost leaf */
     while (node && !node->header.is_leaf) {
-        uint32_t child_offset = node->right_child;
-        XDXNode *child = node_read(xdx, child_offset);
+        uint32_t child_offset = node_child(xdx, node, node->header.key_count);
+        XDXNode *child = node_get(xdx, child_offset);
         if (node != xdx->root) {
-            node_free(node, xdx->header.order);
+            node_release(node);
         }
         node = child;
     }
 
     if (node && node->header.key_count > 0) {
-        xdx->current_recno = node->entries[node->header.key_count - 1].recno;
+        xdx->current_recno = node_recno(xdx, node, node->header.key_count - 1);
         xdx->found = true;
         if (node != xdx->root) {
-            node_free(node, xdx->header.order);
+            node_release(node);
         }
         return true;
     }
@@ -881,36 +1145,714 @@ bool xdx_bof(XDX *xdx) {
     return !xdx || xdx->current_recno == 0;
 }
 
-bool xdx_reindex(XDX *xdx, DBF *dbf,
-                 bool (*eval_key)(DBF *dbf, void *key, void *ctx),
-                 void *ctx) {
-    if (!xdx || !dbf || !eval_key) return false;
-
-    /* Clear the index by creating new root */
-    /* Truncate file after header */
-    if (fseek(xdx->fp, XDX_HEADER_SIZE, SEEK_SET) != 0) {
+/* Drop every node and truncate the file after the header; the index has
+ * no root until one is written */
+static bool truncate_tree(XDX *xdx) {
+    cache_clear(xdx);
+    xdx->root = NULL;
+    bufpool_truncate(xdx->pool, 0);
+    fflush(xdx->fp);
+    if (ftruncate(fileno(xdx->fp), XDX_HEADER_SIZE) != 0) {
+        error_set(ERR_FILE_WRITE, "Cannot truncate index file");
         return false;
     }
 
-    /* Note: ftruncate would be ideal here but isn't portable */
-    /* Instead we just overwrite with new nodes */
-
     xdx->header.node_count = 0;
+    xdx->modified = true;
+
+    /* A rebuilt version 1 index is upgraded to the page format */
+    if (xdx->header.version != XDX_VERSION) {
+        xdx->header.version = XDX_VERSION;
+        xdx->header.order = page_order(xdx->header.key_length);
+        free(xdx->node_buffer);
+        xdx->node_buffer = xcalloc(1, node_size(xdx, false));
+    }
+    return true;
+}
+
+/* Drop every node and start over with an empty root */
+static bool clear_tree(XDX *xdx) {
+    if (!truncate_tree(xdx)) return false;
 
     /* Create new empty root */
     uint32_t new_root = node_create(xdx, true);
     if (new_root == 0) return false;
 
     xdx->header.root_offset = new_root;
-    xdx->modified = true;
 
     /* Reload root */
-    if (xdx->root) {
-        node_free(xdx->root, xdx->header.order);
+    xdx->root = node_get(xdx, new_root);
+    return xdx->root != NULL;
+}
+
+/*
+ * Bulk build
+ */
+
+#define BUILD_MAX_LEVELS 32
+
+/* Keys from one producer; full buffers are sorted and written as runs */
+struct XDXBuildPart {
+    XDXBuild *build;
+    uint8_t *entries;           /* Keys added since the last run */
+    uint32_t used;
+};
+
+struct XDXBuild {
+    XDX *xdx;
+    size_t entry_size;          /* Key, then record number */
+    size_t memory;
+    int threads;
+    uint32_t capacity;          /* Entries each part holds */
+    XDXBuildPart **parts;       /* parts[0] takes xdx_build_add */
+    int part_count;
+    pthread_mutex_t lock;       /* Guards parts and runs */
+    int fd;                     /* Work file of sorted runs; -1 until needed */
+    uint64_t *runs;             /* Start of each run, then the end of the last */
+    int run_count;
+    bool failed;
+};
+
+/* Writes the tree bottom-up: each level fills one node at a time, and a
+ * key arriving at a full node goes up a level instead, between the full
+ * node and the next one. Finished pages are appended to the file. */
+typedef struct {
+    XDX *xdx;
+    XDXNode *level[BUILD_MAX_LEVELS];   /* Node being filled, per level */
+    int depth;
+    int sep_level;              /* Level of the most recent key above the leaves */
+    uint16_t fill;              /* Keys per node */
+    XDXNode *last_leaf;         /* Copy of the last finished leaf */
+    uint64_t last_leaf_pos;
+    uint64_t next;              /* Node area offset of the next page */
+    uint8_t *out;               /* Pages not yet written */
+    uint64_t out_pos;
+    size_t out_used;
+    uint32_t keys;
+    bool ok;
+} TreeWriter;
+
+static bool tree_flush(TreeWriter *tw) {
+    if (tw->out_used == 0) return true;
+    if (!bufpool_write_direct(tw->xdx->pool, tw->out_pos, tw->out, tw->out_used)) return false;
+    tw->out_pos += tw->out_used;
+    tw->out_used = 0;
+    return true;
+}
+
+/* Store a page at node area offset 'pos': appended to the write buffer,
+ * or rewritten where it already is */
+static bool tree_store(TreeWriter *tw, uint64_t pos, const uint8_t *page) {
+    if (pos >= tw->out_pos && pos < tw->out_pos + tw->out_used) {
+        memcpy(tw->out + (pos - tw->out_pos), page, XDX_PAGE_SIZE);
+        return true;
+    }
+    if (pos < tw->out_pos) return bufpool_write_direct(tw->xdx->pool, pos, page, XDX_PAGE_SIZE);
+
+    if (tw->out_used + XDX_PAGE_SIZE > XDX_BUILD_WRITE_BYTES && !tree_flush(tw)) return false;
+    memcpy(tw->out + tw->out_used, page, XDX_PAGE_SIZE);
+    tw->out_used += XDX_PAGE_SIZE;
+    return true;
+}
+
+/* Write a finished node as the next page, returning its file offset */
+static uint32_t tree_page(TreeWriter *tw, XDXNode *node) {
+    uint64_t pos = tw->next;
+    if (XDX_HEADER_SIZE + pos + XDX_PAGE_SIZE > UINT32_MAX) {
+        error_set(ERR_FILE_WRITE, "Index file too large");
+        tw->ok = false;
+        return 0;
+    }
+
+    memcpy(node->data, &node->header, sizeof(XDXNodeHeader));
+    if (!tree_store(tw, pos, node->data)) {
+        tw->ok = false;
+        return 0;
+    }
+    tw->next += XDX_PAGE_SIZE;
+    tw->xdx->header.node_count++;
+
+    if (node->header.is_leaf) {
+        memcpy(tw->last_leaf->data, node->data, XDX_PAGE_SIZE);
+        tw->last_leaf->header = node->header;
+        tw->last_leaf_pos = pos;
+    }
+    return (uint32_t)(XDX_HEADER_SIZE + pos);
+}
+
+/* Add the next key in order at 'level'; 'left' is the node before it */
+static void tree_add(TreeWriter *tw, int level, const uint8_t *entry, uint32_t left) {
+    XDX *xdx = tw->xdx;
+    if (level == tw->depth) {
+        if (level == BUILD_MAX_LEVELS) {
+            error_set(ERR_INVALID_INDEX, "Index too deep");
+            tw->ok = false;
+            return;
+        }
+        tw->level[level] = node_alloc(xdx);
+        tw->level[level]->header.is_leaf = level == 0;
+        tw->depth++;
+    }
+
+    XDXNode *node = tw->level[level];
+    if (level > 0) set_child(xdx, node, node->header.key_count, left);
+
+    if (node->header.key_count < tw->fill) {
+        int i = node->header.key_count++;
+        memcpy(key_at(xdx, node, i), entry, xdx->header.key_length);
+        memcpy(recno_at(xdx, node, i), entry + xdx->header.key_length, sizeof(uint32_t));
+        if (level > 0) tw->sep_level = level;
+        return;
+    }
+
+    /* Full: the node is done and the key separates it from the next one */
+    uint32_t offset = tree_page(tw, node);
+    if (!tw->ok) return;
+    memset(node->data, 0, XDX_PAGE_SIZE);
+    node->header.key_count = 0;
+    tree_add(tw, level + 1, entry, offset);
+}
+
+/* Write the nodes still being filled, bottom-up, and make the top one the
+ * root */
+static bool tree_finish(TreeWriter *tw) {
+    XDX *xdx = tw->xdx;
+    if (tw->depth == 0) {
+        /* No keys: the root is an empty leaf */
+        tw->level[0] = node_alloc(xdx);
+        tw->level[0]->header.is_leaf = 1;
+        tw->depth = 1;
+    }
+
+    /* The last key went up, leaving the last leaf empty: bring it down and
+     * send the previous leaf's last key up in its place */
+    XDXNode *leaf = tw->level[0];
+    if (tw->ok && leaf->header.key_count == 0 && tw->depth > 1) {
+        XDXNode *sep = tw->level[tw->sep_level];
+        XDXNode *prev = tw->last_leaf;
+        int s = sep->header.key_count - 1;
+        int p = prev->header.key_count - 1;
+        size_t klen = xdx->header.key_length;
+
+        memcpy(key_at(xdx, leaf, 0), key_at(xdx, sep, s), klen);
+        set_recno(xdx, leaf, 0, node_recno(xdx, sep, s));
+        leaf->header.key_count = 1;
+        memcpy(key_at(xdx, sep, s), key_at(xdx, prev, p), klen);
+        set_recno(xdx, sep, s, node_recno(xdx, prev, p));
+        prev->header.key_count--;
+
+        memcpy(prev->data, &prev->header, sizeof(XDXNodeHeader));
+        memset(key_at(xdx, prev, p), 0, klen);
+        set_recno(xdx, prev, p, 0);
+        if (!tree_store(tw, tw->last_leaf_pos, prev->data)) tw->ok = false;
+    }
+
+    uint32_t child = 0;
+    for (int level = 0; tw->ok && level < tw->depth; level++) {
+        XDXNode *node = tw->level[level];
+        if (level > 0) set_child(xdx, node, node->header.key_count, child);
+        child = tree_page(tw, node);
+    }
+
+    if (!tw->ok || !tree_flush(tw)) return false;
+    xdx->header.root_offset = child;
+    return true;
+}
+
+/* Switch an index with text keys to binary ones, taking the fixed key
+ * lengths of numbers and dates */
+static void binary_keys(XDX *xdx) {
+    if (xdx->header.flags & XDX_FLAG_BINARY) return;
+    xdx->header.flags |= XDX_FLAG_BINARY;
+
+    if (xdx->header.key_type == XDX_KEY_NUMERIC) xdx->header.key_length = XDX_NUMBER_KEY_LEN;
+    if (xdx->header.key_type == XDX_KEY_DATE) xdx->header.key_length = XDX_DATE_KEY_LEN;
+    xdx->header.order = page_order(xdx->header.key_length);
+    free(xdx->key_buffer);
+    xdx->key_buffer = xcalloc(1, xdx->header.key_length);
+}
+
+/* Start a build; 'rekey' when the keys are made afresh, in the current
+ * encoding, rather than carried over from the old tree */
+static XDXBuild *build_start(XDX *xdx, size_t memory, int threads, bool rekey) {
+    if (!xdx || !truncate_tree(xdx)) return NULL;
+    if (rekey) binary_keys(xdx);
+
+    XDXBuild *b = xcalloc(1, sizeof(XDXBuild));
+    b->xdx = xdx;
+    b->entry_size = xdx->header.key_length + sizeof(uint32_t);
+    b->memory = memory ? memory : XDX_BUILD_MEMORY;
+    b->threads = threads < 1 ? 1 : threads;
+
+    /* Each producer gets a share; half of it holds keys, half is the
+     * sort's scratch space */
+    size_t capacity = b->memory / (2 * b->entry_size * (size_t)b->threads);
+    if (capacity < 1024) capacity = 1024;
+    if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+    b->capacity = (uint32_t)capacity;
+
+    pthread_mutex_init(&b->lock, NULL);
+    b->fd = -1;
+    xdx_build_part(b);
+    return b;
+}
+
+XDXBuild *xdx_build_begin(XDX *xdx, size_t memory, int threads) {
+    return build_start(xdx, memory, threads, true);
+}
+
+XDXBuildPart *xdx_build_part(XDXBuild *b) {
+    XDXBuildPart *part = xcalloc(1, sizeof(XDXBuildPart));
+    part->build = b;
+
+    pthread_mutex_lock(&b->lock);
+    b->parts = xrealloc(b->parts, (size_t)(b->part_count + 1) * sizeof(XDXBuildPart *));
+    b->parts[b->part_count++] = part;
+    pthread_mutex_unlock(&b->lock);
+    return part;
+}
+
+/* Write a part's keys, already in order, to the work file as one run */
+static bool build_write_run(XDXBuildPart *part) {
+    XDXBuild *b = part->build;
+
+    /* Claim space for the run; the write itself runs unlocked */
+    size_t size = (size_t)part->used * b->entry_size;
+    pthread_mutex_lock(&b->lock);
+    if (b->fd < 0 && !b->failed) {
+        char name[MAX_PATH_LEN + 16];
+        snprintf(name, sizeof(name), "%s.XXXXXX", b->xdx->filename);
+        b->fd = mkstemp(name);
+        if (b->fd >= 0) {
+            unlink(name);
+            b->runs = xmalloc(sizeof(uint64_t));
+            b->runs[0] = 0;
+        } else {
+            error_set(ERR_FILE_CREATE, "Index work file for %s", b->xdx->filename);
+            b->failed = true;
+        }
+    }
+    bool ok = !b->failed;
+    uint64_t offset = 0;
+    if (ok) {
+        offset = b->runs[b->run_count];
+        b->run_count++;
+        b->runs = xrealloc(b->runs, (size_t)(b->run_count + 1) * sizeof(uint64_t));
+        b->runs[b->run_count] = offset + size;
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    const uint8_t *data = part->entries;
+    while (ok && size > 0) {
+        ssize_t n = pwrite(b->fd, data, size, (off_t)offset);
+        if (n <= 0) {
+            pthread_mutex_lock(&b->lock);
+            error_set(ERR_FILE_WRITE, "Index work file for %s", b->xdx->filename);
+            b->failed = true;
+            pthread_mutex_unlock(&b->lock);
+            ok = false;
+            break;
+        }
+        data += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+
+    part->used = 0;
+    return ok;
+}
+
+/* Sort a full part and write it out as a run */
+static bool build_spill(XDXBuildPart *part) {
+    XDXBuild *b = part->build;
+    sort_entries(b->xdx, part->entries, part->used, b->entry_size);
+    return build_write_run(part);
+}
+
+bool xdx_build_part_add(XDXBuildPart *part, const void *key, uint32_t recno) {
+    XDXBuild *b = part->build;
+    if (!part->entries) part->entries = xmalloc((size_t)b->capacity * b->entry_size);
+    if (part->used == b->capacity && !build_spill(part)) return false;
+
+    uint8_t *entry = part->entries + (size_t)part->used++ * b->entry_size;
+    memcpy(entry, key, b->xdx->header.key_length);
+    memcpy(entry + b->xdx->header.key_length, &recno, sizeof(uint32_t));
+    return true;
+}
+
+bool xdx_build_add(XDXBuild *b, const void *key, uint32_t recno) {
+    return xdx_build_part_add(b->parts[0], key, recno);
+}
+
+/* Pass one key in order to the tree, leaving out repeats in a unique index */
+static void build_emit(TreeWriter *tw, const uint8_t *entry, uint32_t *duplicates) {
+    XDX *xdx = tw->xdx;
+    if (xdx->header.flags & XDX_FLAG_UNIQUE) {
+        if (tw->keys > 0 && xdx_key_compare(xdx, xdx->key_buffer, entry) == 0) {
+            (*duplicates)++;
+            return;
+        }
+        memcpy(xdx->key_buffer, entry, xdx->header.key_length);
+    }
+    tree_add(tw, 0, entry, 0);
+    tw->keys++;
+}
+
+/* Sorted run being merged, read from the work file or already in memory */
+typedef struct {
+    uint64_t pos;               /* Next byte of the run to read */
+    uint64_t end;
+    uint8_t *buf;
+    size_t len;                 /* Bytes in buf */
+    size_t at;                  /* Current entry in buf */
+} BuildRun;
+
+/* K-way merge through a heap of runs */
+typedef struct {
+    XDXBuild *build;
+    BuildRun *runs;
+    int *heap;
+    int n;                      /* Runs not yet done */
+    size_t size;                /* Bytes read from a run at a time */
+    bool ok;
+} BuildMerge;
+
+static bool run_fill(XDXBuild *b, BuildRun *r, size_t size) {
+    size_t want = r->end - r->pos < size ? (size_t)(r->end - r->pos) : size;
+    r->len = 0;
+    r->at = 0;
+    while (r->len < want) {
+        ssize_t n = pread(b->fd, r->buf + r->len, want - r->len, (off_t)(r->pos + r->len));
+        if (n <= 0) {
+            error_set(ERR_FILE_READ, "Index work file for %s", b->xdx->filename);
+            return false;
+        }
+        r->len += (size_t)n;
+    }
+    r->pos += r->len;
+    return true;
+}
+
+static bool run_less(BuildMerge *m, int x, int y) {
+    BuildRun *a = &m->runs[x], *b = &m->runs[y];
+    return entry_compare(m->build->xdx, a->buf + a->at, b->buf + b->at) < 0;
+}
+
+static void heap_down(BuildMerge *m, int i) {
+    for (;;) {
+        int least = i, l = 2 * i + 1, r = l + 1;
+        if (l < m->n && run_less(m, m->heap[l], m->heap[least])) least = l;
+        if (r < m->n && run_less(m, m->heap[r], m->heap[least])) least = r;
+        if (least == i) return;
+        int t = m->heap[i];
+        m->heap[i] = m->heap[least];
+        m->heap[least] = t;
+        i = least;
+    }
+}
+
+/* Start merging 'k' runs whose buffers hold their first entries */
+static void merge_init(BuildMerge *m, XDXBuild *b, BuildRun *runs, int k, size_t size) {
+    m->build = b;
+    m->runs = runs;
+    m->heap = xmalloc((size_t)(k > 0 ? k : 1) * sizeof(int));
+    m->n = 0;
+    m->size = size;
+    m->ok = true;
+    for (int i = 0; i < k; i++) {
+        if (runs[i].len > 0) m->heap[m->n++] = i;
+    }
+    for (int i = m->n / 2 - 1; i >= 0; i--) heap_down(m, i);
+}
+
+/* Copy the least entry to 'out'; false when every run is done */
+static bool merge_next(BuildMerge *m, uint8_t *out) {
+    if (m->n == 0 || !m->ok) return false;
+
+    size_t es = m->build->entry_size;
+    BuildRun *r = &m->runs[m->heap[0]];
+    memcpy(out, r->buf + r->at, es);
+
+    r->at += es;
+    if (r->at == r->len) {
+        if (r->pos < r->end) {
+            if (!run_fill(m->build, r, m->size)) m->ok = false;
+        } else {
+            r->len = 0;
+        }
+        if (r->len == 0) m->heap[0] = m->heap[--m->n];
+    }
+    heap_down(m, 0);
+    return true;
+}
+
+/* Merge every run in the work file into the tree in one pass */
+static bool build_merge_runs(XDXBuild *b, TreeWriter *tw, uint32_t *duplicates) {
+    int k = b->run_count;
+    size_t size = b->memory / (size_t)k;
+    if (size > XDX_BUILD_READ_BYTES) size = XDX_BUILD_READ_BYTES;
+    size -= size % b->entry_size;
+    if (size < 64 * b->entry_size) size = 64 * b->entry_size;
+
+    BuildRun *runs = xcalloc((size_t)k, sizeof(BuildRun));
+    bool ok = true;
+    for (int i = 0; i < k; i++) {
+        runs[i].pos = b->runs[i];
+        runs[i].end = b->runs[i + 1];
+        runs[i].buf = xmalloc(size);
+        if (ok && !run_fill(b, &runs[i], size)) ok = false;
+    }
+
+    BuildMerge m;
+    merge_init(&m, b, runs, k, size);
+    m.ok = ok;
+    uint8_t *entry = xmalloc(b->entry_size);
+    while (tw->ok && merge_next(&m, entry)) {
+        build_emit(tw, entry, duplicates);
+    }
+    ok = m.ok && tw->ok;
+
+    free(entry);
+    for (int i = 0; i < k; i++) free(runs[i].buf);
+    free(runs);
+    free(m.heap);
+    return ok;
+}
+
+/* Lowest position in 'entries' whose entry is not before 'key' */
+static uint32_t lower_bound(XDXBuild *b, const uint8_t *entries, uint32_t count,
+                            const uint8_t *key) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entry_compare(b->xdx, entries + (size_t)mid * b->entry_size, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* One thread's share of a parallel job: sorting whole parts, or merging
+ * one key range of every part into its place in the output */
+typedef struct {
+    XDXBuild *build;
+    int index;
+    int threads;
+    uint32_t *cuts;             /* Per range, the start of it in each part */
+    uint8_t *out;
+} BuildJob;
+
+static void *sort_job(void *arg) {
+    BuildJob *job = arg;
+    XDXBuild *b = job->build;
+    for (int i = job->index; i < b->part_count; i += job->threads) {
+        XDXBuildPart *part = b->parts[i];
+        sort_entries(b->xdx, part->entries, part->used, b->entry_size);
+    }
+    return NULL;
+}
+
+static void *merge_job(void *arg) {
+    BuildJob *job = arg;
+    XDXBuild *b = job->build;
+    int k = b->part_count;
+    const uint32_t *from = job->cuts + (size_t)job->index * k;
+    const uint32_t *to = from + k;
+
+    /* The range starts after the entries of every earlier range */
+    uint8_t *out = job->out;
+    BuildRun *runs = xcalloc((size_t)k, sizeof(BuildRun));
+    for (int i = 0; i < k; i++) {
+        out += (size_t)from[i] * b->entry_size;
+        runs[i].buf = b->parts[i]->entries + (size_t)from[i] * b->entry_size;
+        runs[i].len = (size_t)(to[i] - from[i]) * b->entry_size;
+    }
+
+    BuildMerge m;
+    merge_init(&m, b, runs, k, 0);
+    while (merge_next(&m, out)) out += b->entry_size;
+
+    free(m.heap);
+    free(runs);
+    return NULL;
+}
+
+/* Run 'fn' on 'n' threads, the calling thread being the first; the share
+ * of a thread that cannot be started is done here afterwards */
+static void run_jobs(int n, void *(*fn)(void *), BuildJob *jobs) {
+    pthread_t threads[XDX_BUILD_MAX_THREADS];
+    bool started[XDX_BUILD_MAX_THREADS];
+    for (int i = 1; i < n; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fn, &jobs[i]) == 0;
+    }
+    fn(&jobs[0]);
+    for (int i = 1; i < n; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            fn(&jobs[i]);
+        }
+    }
+}
+
+/* Merge the sorted parts in memory into one array, each thread taking a
+ * range of keys bounded by keys sampled from the largest part */
+static uint8_t *build_merge_parts(XDXBuild *b, int threads, uint32_t *total) {
+    int k = b->part_count;
+    int largest = 0;
+    uint32_t count = 0;
+    for (int i = 0; i < k; i++) {
+        count += b->parts[i]->used;
+        if (b->parts[i]->used > b->parts[largest]->used) largest = i;
+    }
+
+    /* cuts[r * k + i]: where range r starts in part i */
+    uint32_t *cuts = xmalloc((size_t)(threads + 1) * k * sizeof(uint32_t));
+    const XDXBuildPart *sample = b->parts[largest];
+    for (int r = 0; r <= threads; r++) {
+        for (int i = 0; i < k; i++) {
+            XDXBuildPart *part = b->parts[i];
+            uint32_t *cut = &cuts[(size_t)r * k + i];
+            if (r == 0) {
+                *cut = 0;
+            } else if (r == threads) {
+                *cut = part->used;
+            } else {
+                const uint8_t *key = sample->entries +
+                    (size_t)((uint64_t)sample->used * r / threads) * b->entry_size;
+                *cut = lower_bound(b, part->entries, part->used, key);
+            }
+        }
+    }
+
+    uint8_t *out = xmalloc((size_t)(count ? count : 1) * b->entry_size);
+    BuildJob jobs[XDX_BUILD_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        jobs[i] = (BuildJob){b, i, threads, cuts, out};
+    }
+    run_jobs(threads, merge_job, jobs);
+
+    free(cuts);
+    *total = count;
+    return out;
+}
+
+static void build_free(XDXBuild *b) {
+    if (b->fd >= 0) close(b->fd);
+    for (int i = 0; i < b->part_count; i++) {
+        free(b->parts[i]->entries);
+        free(b->parts[i]);
+    }
+    free(b->parts);
+    free(b->runs);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
+
+/* Sort the keys and pass them to the tree in order */
+static bool build_sorted(XDXBuild *b, TreeWriter *tw, uint32_t *duplicates) {
+    if (b->failed) return false;
+
+    int threads = b->threads < b->part_count ? b->threads : b->part_count;
+    if (threads > XDX_BUILD_MAX_THREADS) threads = XDX_BUILD_MAX_THREADS;
+
+    /* Parts still holding keys are sorted side by side */
+    BuildJob jobs[XDX_BUILD_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        jobs[i] = (BuildJob){b, i, threads, NULL, NULL};
     }
-    xdx->root = node_read(xdx, new_root);
+    run_jobs(threads, sort_job, jobs);
+
+    /* Runs on disk: add the sorted parts as runs and merge them all */
+    if (b->fd >= 0) {
+        for (int i = 0; i < b->part_count; i++) {
+            if (b->parts[i]->used > 0 && !build_write_run(b->parts[i])) return false;
+        }
+        return build_merge_runs(b, tw, duplicates);
+    }
+
+    /* All in memory: one part is already in order; more are merged */
+    int filled = 0, last = 0;
+    for (int i = 0; i < b->part_count; i++) {
+        if (b->parts[i]->used > 0) {
+            filled++;
+            last = i;
+        }
+    }
+    const uint8_t *entries = b->parts[last]->entries;
+    uint32_t count = b->parts[last]->used;
+    uint8_t *merged = NULL;
+    if (filled > 1) {
+        merged = build_merge_parts(b, threads, &count);
+        entries = merged;
+    }
+
+    for (uint32_t i = 0; tw->ok && i < count; i++) {
+        build_emit(tw, entries + (size_t)i * b->entry_size, duplicates);
+    }
+    free(merged);
+    return tw->ok;
+}
+
+static void tree_begin(TreeWriter *tw, XDX *xdx) {
+    memset(tw, 0, sizeof(*tw));
+    tw->xdx = xdx;
+    tw->fill = (uint16_t)(xdx->header.order - 1);
+    tw->last_leaf = node_alloc(xdx);
+    tw->out = xmalloc(XDX_BUILD_WRITE_BYTES);
+    tw->ok = true;
+}
+
+/* Finish the tree and release the writer; if anything failed the index
+ * is left empty */
+static bool tree_end(TreeWriter *tw, bool ok) {
+    XDX *xdx = tw->xdx;
+    ok = ok && tree_finish(tw);
+
+    for (int i = 0; i < tw->depth; i++) node_free(tw->level[i]);
+    node_free(tw->last_leaf);
+    free(tw->out);
+
+    if (!ok) {
+        clear_tree(xdx);
+        return false;
+    }
+
+    xdx->root = node_get(xdx, xdx->header.root_offset);
+    return xdx->root != NULL && xdx_flush(xdx);
+}
+
+bool xdx_build_finish(XDXBuild *b, uint32_t *keys, uint32_t *duplicates) {
+    uint32_t dup = 0;
+    TreeWriter tw;
+    tree_begin(&tw, b->xdx);
+
+    bool ok = build_sorted(b, &tw, &dup);
+    build_free(b);
+
+    if (keys) *keys = tw.keys;
+    if (duplicates) *duplicates = dup;
+    return tree_end(&tw, ok);
+}
+
+void xdx_build_discard(XDXBuild *b) {
+    if (!b) return;
+    XDX *xdx = b->xdx;
+    build_free(b);
+    clear_tree(xdx);
+}
+
+bool xdx_reindex(XDX *xdx, DBF *dbf,
+                 bool (*eval_key)(DBF *dbf, void *key, void *ctx),
+                 void *ctx) {
+    if (!xdx || !dbf || !eval_key) return false;
 
-    /* Iterate through all records and insert keys */
+    XDXBuild *build = xdx_build_begin(xdx, 0, 1);
+    if (!build) return false;
+
+    /* Iterate through all records and collect keys */
     uint32_t reccount = dbf_reccount(dbf);
     uint8_t *key = xcalloc(1, xdx->header.key_length);
 
@@ -922,14 +1864,175 @@ bool xdx_reindex(XDX *xdx, DBF *dbf,
         memset(key, ' ', xdx->header.key_length);
         if (!eval_key(dbf, key, ctx)) continue;
 
-        /* Insert into index */
-        xdx_insert(xdx, key, recno);
+        if (!xdx_build_add(build, key, recno)) {
+            free(key);
+            xdx_build_discard(build);
+            return false;
+        }
     }
 
     free(key);
-    xdx_flush(xdx);
+    return xdx_build_finish(build, NULL, NULL);
+}
 
-    return true;
+/* Remapping state shared by the tree walk */
+typedef struct {
+    const uint32_t *map;
+    uint32_t count;
+    int mode;                   /* REMAP_COUNT, REMAP_REWRITE or REMAP_COLLECT */
+    uint32_t dropped;           /* Entries whose record is gone */
+    uint8_t *entries;           /* Collected key + recno pairs, in key order */
+    size_t used;
+    size_t capacity;
+} RemapState;
+
+enum { REMAP_COUNT, REMAP_REWRITE, REMAP_COLLECT };
+
+static uint32_t remap_recno(RemapState *rs, uint32_t recno) {
+    return recno >= 1 && recno <= rs->count ? rs->map[recno] : recno;
+}
+
+static void remap_collect(XDX *xdx, RemapState *rs, const uint8_t *key, uint32_t recno) {
+    size_t size = xdx->header.key_length + sizeof(uint32_t);
+    if (rs->used + size > rs->capacity) {
+        rs->capacity = rs->capacity ? rs->capacity * 2 : size * 1024;
+        rs->entries = xrealloc(rs->entries, rs->capacity);
+    }
+    memcpy(rs->entries + rs->used, key, xdx->header.key_length);
+    memcpy(rs->entries + rs->used + xdx->header.key_length, &recno, sizeof(uint32_t));
+    rs->used += size;
+}
+
+/* Visit the subtree at 'offset' in key order */
+static bool remap_walk(XDX *xdx, uint32_t offset, RemapState *rs) {
+    XDXNode *node = offset == xdx->root->file_offset ? xdx->root : node_get(xdx, offset);
+    if (!node) return false;
+
+    bool ok = true;
+    bool changed = false;
+
+    for (int i = 0; ok && i < node->header.key_count; i++) {
+        if (!node->header.is_leaf) ok = remap_walk(xdx, node_child(xdx, node, i), rs);
+
+        uint32_t old = node_recno(xdx, node, i);
+        uint32_t recno = remap_recno(rs, old);
+        if (recno == 0) {
+            rs->dropped++;
+        } else if (rs->mode == REMAP_REWRITE && recno != old) {
+            set_recno(xdx, node, i, recno);
+            changed = true;
+        } else if (rs->mode == REMAP_COLLECT) {
+            remap_collect(xdx, rs, key_at(xdx, node, i), recno);
+        }
+    }
+
+    if (ok && !node->header.is_leaf) {
+        ok = remap_walk(xdx, node_child(xdx, node, node->header.key_count), rs);
+    }
+    if (ok && changed) ok = node_write(xdx, node);
+
+    if (node != xdx->root) node_release(node);
+    return ok;
+}
+
+/* Renumber the records an index points at after its table was packed.
+ * Entries of removed records are dropped, which rebuilds the tree from
+ * its own keys; otherwise record numbers are rewritten in place. */
+bool xdx_remap(XDX *xdx, const uint32_t *map, uint32_t count) {
+    if (!xdx || !xdx->root || !map) return false;
+
+    RemapState rs = {map, count, REMAP_COUNT, 0, NULL, 0, 0};
+    if (!remap_walk(xdx, xdx->root->file_offset, &rs)) return false;
+
+    if (rs.dropped == 0) {
+        rs.mode = REMAP_REWRITE;
+        if (!remap_walk(xdx, xdx->root->file_offset, &rs)) return false;
+        return xdx_flush(xdx);
+    }
+
+    rs.mode = REMAP_COLLECT;
+    bool ok = remap_walk(xdx, xdx->root->file_offset, &rs);
+    XDXBuild *build = ok ? build_start(xdx, 0, 1, false) : NULL;
+    ok = build != NULL;
+
+    size_t size = xdx->header.key_length + sizeof(uint32_t);
+    for (size_t pos = 0; ok && pos < rs.used; pos += size) {
+        uint32_t recno;
+        memcpy(&recno, rs.entries + pos + xdx->header.key_length, sizeof(uint32_t));
+        ok = xdx_build_add(build, rs.entries + pos, recno);
+    }
+
+    free(rs.entries);
+    if (!build) return false;
+    if (!ok) {
+        xdx_build_discard(build);
+        return false;
+    }
+    return xdx_build_finish(build, NULL, NULL);
+}
+
+/* Write the tree afresh from its own keys merged with a sorted batch.
+ * Of equal keys, the ones already in the index come first. */
+static bool merge_batch(XDX *xdx, const uint8_t *entries, uint32_t count, uint32_t *duplicates) {
+    RemapState rs = {NULL, 0, REMAP_COLLECT, 0, NULL, 0, 0};
+    if (!remap_walk(xdx, xdx->root->file_offset, &rs) || !truncate_tree(xdx)) {
+        free(rs.entries);
+        return false;
+    }
+
+    TreeWriter tw;
+    tree_begin(&tw, xdx);
+
+    size_t size = xdx->header.key_length + sizeof(uint32_t);
+    const uint8_t *old = rs.entries, *old_end = rs.entries + rs.used;
+    const uint8_t *add = entries, *add_end = entries + (size_t)count * size;
+    while (tw.ok && (old < old_end || add < add_end)) {
+        if (add == add_end || (old < old_end && xdx_key_compare(xdx, old, add) <= 0)) {
+            build_emit(&tw, old, duplicates);
+            old += size;
+        } else {
+            build_emit(&tw, add, duplicates);
+            add += size;
+        }
+    }
+
+    free(rs.entries);
+    return tree_end(&tw, tw.ok);
+}
+
+bool xdx_insert_batch(XDX *xdx, uint8_t *entries, uint32_t count, uint32_t *duplicates) {
+    if (duplicates) *duplicates = 0;
+    if (!xdx || !xdx->root) return false;
+    if (count == 0) return true;
+
+    size_t size = xdx->header.key_length + sizeof(uint32_t);
+    sort_entries(xdx, entries, count, size);
+
+    uint32_t dup = 0;
+    bool ok = true;
+    uint64_t slots = (uint64_t)xdx->header.node_count * (uint64_t)(xdx->header.order - 1);
+    if ((uint64_t)count * XDX_MERGE_RATIO >= slots) {
+        ok = merge_batch(xdx, entries, count, &dup);
+    } else {
+        for (uint32_t i = 0; ok && i < count; i++) {
+            uint8_t *entry = entries + i * size;
+            uint32_t recno;
+            memcpy(&recno, entry + xdx->header.key_length, sizeof(uint32_t));
+
+            if (!xdx_insert(xdx, entry, recno)) {
+                if (g_last_error != ERR_DUPLICATE_KEY) {
+                    ok = false;
+                } else {
+                    error_clear();
+                    dup++;
+                }
+            }
+        }
+        ok = ok && xdx_flush(xdx);
+    }
+
+    if (duplicates) *duplicates = dup;
+    return ok;
 }
 
 const char *xdx_key_expr(XDX *xdx) {
@@ -951,3 +2054,13 @@ bool xdx_is_unique(XDX *xdx) {
 bool xdx_is_descending(XDX *xdx) {
     return xdx && (xdx->header.flags & XDX_FLAG_DESCENDING);
 }
+
+void xdx_get_cache_stats(XDX *xdx, XDXCacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!xdx) return;
+
+    stats->hits = xdx->cache_hits;
+    stats->misses = xdx->cache_misses;
+    stats->leaves = xdx->leaf_count;
+    stats->internal = xdx->cached - xdx->leaf_count;
+}
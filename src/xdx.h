@@ -8,17 +8,30 @@
 
 #include "util.h"
 #include "dbf.h"
+#include "bufpool.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 /* XDX file format constants */
 #define XDX_MAGIC           "XDX"
-#define XDX_VERSION         1
+#define XDX_VERSION         2       /* Nodes are fixed-size pages */
+#define XDX_VERSION_1       1       /* Nodes sized by order, still readable */
 #define XDX_HEADER_SIZE     512
+#define XDX_PAGE_SIZE       4096    /* Node size from version 2 */
 #define XDX_MAX_KEY_LEN     256
 #define XDX_MAX_EXPR_LEN    256
-#define XDX_DEFAULT_ORDER   50      /* Max keys per node */
+#define XDX_CACHE_LEAVES    256     /* Leaf nodes kept decoded per index */
+
+/* Bulk builds: memory for keys being sorted when no budget is given, and
+ * the bytes read from each sorted run / written to the index at a time */
+#define XDX_BUILD_MEMORY        ((size_t)64 << 20)
+#define XDX_BUILD_READ_BYTES    ((size_t)1 << 20)
+#define XDX_BUILD_WRITE_BYTES   ((size_t)1 << 20)
+#define XDX_BUILD_MAX_THREADS   32
+
+/* Batch inserts of at least 1/XDX_MERGE_RATIO of an index rewrite it */
+#define XDX_MERGE_RATIO         16
 
 /* Key types */
 #define XDX_KEY_CHAR        'C'
@@ -28,12 +41,17 @@
 /* Flags */
 #define XDX_FLAG_UNIQUE     0x01
 #define XDX_FLAG_DESCENDING 0x02
+#define XDX_FLAG_BINARY     0x04    /* Keys compare byte for byte (xdx_key_text) */
+
+/* Lengths of binary numeric and date keys */
+#define XDX_NUMBER_KEY_LEN  8
+#define XDX_DATE_KEY_LEN    4
 
 /*
  * XDX Header Structure (512 bytes)
  *
  * Bytes 0-3:     Magic "XDX\0"
- * Byte 4:        Version (1)
+ * Byte 4:        Version (2, or 1 for files not yet rebuilt)
  * Byte 5:        Key type (C/N/D)
  * Bytes 6-7:     Key length
  * Bytes 8-11:    Root node offset
@@ -57,47 +75,63 @@ typedef struct {
 } XDXHeader;
 
 /*
- * B-tree Node Structure (variable size)
+ * B-tree Node Page (version 2, XDX_PAGE_SIZE bytes)
  *
  * Bytes 0-1:     Key count in this node
  * Byte 2:        Leaf flag (1=leaf, 0=internal)
  * Byte 3:        Reserved
- * Bytes 4-7:     Parent node offset (0 for root)
+ * Bytes 4-7:     Parent node offset (unused, 0)
+ * Keys:          'order' slots of key_length bytes
+ * Record numbers: 'order' slots of 4 bytes
+ * Children:      'order' + 1 slots of 4 bytes (internal nodes only); the
+ *                child before key i, then the right-most child
  *
- * For each key (up to 'order' keys):
- *   Key value (key_length bytes)
- *   Record number (4 bytes)
- *   Child node offset (4 bytes, internal nodes only)
+ * 'order' is as many keys as fit in a page. Nodes start on page
+ * boundaries of the node area, so a node is read or written with one
+ * buffer pool call, and the cached node is a copy of the page: keys are
+ * compared and shifted in place, without a buffer per key.
  *
- * Right-most child offset (4 bytes, internal nodes only)
+ * Version 1 nodes instead hold header, then for each key the key value,
+ * record number and (internal nodes) child offset, then the right-most
+ * child, sized for an order of 50. They are converted to the page image
+ * when read and back when written; REINDEX rewrites the file as version 2.
  */
 typedef struct {
     uint16_t key_count;         /* Number of keys in this node */
     uint8_t is_leaf;            /* 1 if leaf node, 0 if internal */
     uint8_t reserved;
     uint32_t parent_offset;     /* Parent node offset (0 = root) */
-    /* Followed by key data - allocated dynamically */
 } XDXNodeHeader;
 
-/* Key entry in a node */
-typedef struct {
-    uint8_t *key;               /* Key value (key_length bytes) */
-    uint32_t recno;             /* Record number in DBF */
-    uint32_t child_offset;      /* Child node offset (internal nodes) */
-} XDXKeyEntry;
-
-/* In-memory node representation */
-typedef struct {
-    XDXNodeHeader header;
+/* In-memory node, owned by the index's node cache */
+typedef struct XDXNode {
+    XDXNodeHeader header;       /* Copied to the page image when written */
     uint32_t file_offset;       /* This node's offset in file */
-    XDXKeyEntry *entries;       /* Array of key entries */
-    uint32_t right_child;       /* Right-most child (internal nodes) */
+    uint8_t *data;              /* Page image */
     bool dirty;                 /* Node modified flag */
+    int pins;                   /* Users of the node; pinned nodes stay cached */
+    struct XDXNode *hash_next;  /* Next node in hash chain */
+    struct XDXNode *lru_prev;   /* Leaf LRU links, most recent first */
+    struct XDXNode *lru_next;
 } XDXNode;
 
+/*
+ * Decoded nodes are cached per index by file offset. Internal nodes stay
+ * cached while the index is open; leaves beyond XDX_CACHE_LEAVES are
+ * evicted least recently used first. Nodes are written through to the
+ * buffer pool when modified, so eviction never writes.
+ */
+typedef struct {
+    uint64_t hits;              /* Node lookups served from the cache */
+    uint64_t misses;            /* Node lookups decoded from the file */
+    uint32_t internal;          /* Internal nodes cached */
+    uint32_t leaves;            /* Leaf nodes cached */
+} XDXCacheStats;
+
 /* XDX index handle */
 typedef struct {
-    FILE *fp;                   /* File pointer */
+    FILE *fp;                   /* File pointer (header I/O) */
+    BufFile *pool;              /* Node area in the buffer pool */
     char filename[MAX_PATH_LEN]; /* Index file path */
     XDXHeader header;           /* Index header */
     XDXNode *root;              /* Cached root node */
@@ -105,8 +139,19 @@ typedef struct {
     bool found;                 /* Last seek found exact match */
     bool modified;              /* Index modified flag */
 
+    /* Node cache */
+    XDXNode **buckets;          /* Hash table by file offset */
+    uint32_t bucket_count;      /* Power of two */
+    uint32_t cached;            /* Nodes in the hash table */
+    uint32_t leaf_count;        /* Of which leaves, all on the LRU list */
+    XDXNode *lru_head;
+    XDXNode *lru_tail;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
     /* Key buffer for comparisons */
     uint8_t *key_buffer;        /* Temporary key storage */
+    uint8_t *node_buffer;       /* Serialized node staging area */
 } XDX;
 
 
@@ -114,7 +159,8 @@ typedef struct {
  * Index file operations
  */
 
-/* Create a new index file */
+/* Create a new index file; numeric and date keys take their binary
+ * lengths whatever 'key_length' says */
 XDX *xdx_create(const char *filename, const char *key_expr,
                 char key_type, uint16_t key_length,
                 bool unique, bool descending);
@@ -123,7 +169,7 @@ XDX *xdx_create(const char *filename, const char *key_expr,
 XDX *xdx_open(const char *filename);
 
 /* Close index file */
-void xdx_close(XDX *xdx);
+bool xdx_close(XDX *xdx);
 
 /* Flush changes to disk */
 bool xdx_flush(XDX *xdx);
@@ -135,6 +181,50 @@ bool xdx_flush(XDX *xdx);
 /* Insert a key into the index */
 bool xdx_insert(XDX *xdx, const void *key, uint32_t recno);
 
+/* Insert many keys at once. 'entries' holds 'count' pairs of a key and a
+ * record number (key_length + 4 bytes each) and is sorted here. A batch
+ * of at least 1/XDX_MERGE_RATIO of the index is merged with the existing
+ * keys in one pass that writes the tree afresh; a smaller one is inserted
+ * key by key, in key order. Keys already in a unique index are left out
+ * and counted in 'duplicates'. */
+bool xdx_insert_batch(XDX *xdx, uint8_t *entries, uint32_t count, uint32_t *duplicates);
+
+/*
+ * Bulk build: replace the whole tree with keys given in any order. The
+ * keys are sorted in memory, or in runs written to a temporary file
+ * beside the index and merged when they exceed the budget, then the tree
+ * is written bottom-up with full nodes, one page after another. In a
+ * unique index every key after the first of equal keys (in record
+ * order) is left out.
+ *
+ * Several threads may add keys at once, each through its own part. Each
+ * part sorts and writes its own runs; at the end the parts are sorted
+ * side by side and, when all fit in memory, merged by key range on as
+ * many threads.
+ */
+typedef struct XDXBuild XDXBuild;
+typedef struct XDXBuildPart XDXBuildPart;
+
+/* Start a build, emptying the index. 'memory' of 0 is XDX_BUILD_MEMORY,
+ * shared between 'threads' parts; 'threads' also bounds the threads used
+ * to sort and merge. */
+XDXBuild *xdx_build_begin(XDX *xdx, size_t memory, int threads);
+
+/* Add one key and its record number */
+bool xdx_build_add(XDXBuild *build, const void *key, uint32_t recno);
+
+/* A new part for one thread to add keys through */
+XDXBuildPart *xdx_build_part(XDXBuild *build);
+bool xdx_build_part_add(XDXBuildPart *part, const void *key, uint32_t recno);
+
+/* Sort and write the tree, once every thread is done adding; '*keys'
+ * receives the keys written and '*duplicates' those left out (either may
+ * be NULL). On failure the index is left empty. */
+bool xdx_build_finish(XDXBuild *build, uint32_t *keys, uint32_t *duplicates);
+
+/* Give up on a build, leaving the index empty */
+void xdx_build_discard(XDXBuild *build);
+
 /* Delete a key from the index */
 bool xdx_delete(XDX *xdx, const void *key, uint32_t recno);
 
@@ -166,11 +256,34 @@ bool xdx_bof(XDX *xdx);
  * Index maintenance
  */
 
-/* Rebuild index from DBF */
+/* Rebuild index from DBF; 'eval_key' stores the key of the current record
+ * in its stored form, over a blank-filled buffer */
 bool xdx_reindex(XDX *xdx, DBF *dbf,
                  bool (*eval_key)(DBF *dbf, void *key, void *ctx),
                  void *ctx);
 
+/* Renumber records after a PACK: map[old] is the new record number, 0 if
+ * the record was removed (count = number of old records) */
+bool xdx_remap(XDX *xdx, const uint32_t *map, uint32_t count);
+
+/*
+ * Keys in their stored form. New indexes have XDX_FLAG_BINARY, under
+ * which every key compares with memcmp: numbers are the 8 bytes of the
+ * double, big-endian, with the sign bit flipped (every bit for negative
+ * numbers); dates are the 4-byte big-endian julian day with the sign bit
+ * flipped, blank dates being day 0; text is blank padded. A descending
+ * index stores each key with every byte inverted. Indexes written before
+ * keep numbers as text compared with atof, and reverse comparisons when
+ * descending, until a rebuild switches them to binary keys.
+ */
+
+/* Store 'text' as a key: blank padded or cut to the key length, or the
+ * number or YYYYMMDD date it holds for binary numeric and date keys */
+void xdx_key_text(XDX *xdx, const char *text, void *key);
+
+/* Store a number as a key; for binary date keys it is the julian day */
+void xdx_key_number(XDX *xdx, double value, void *key);
+
 /* Get key expression */
 const char *xdx_key_expr(XDX *xdx);
 
@@ -186,6 +299,9 @@ bool xdx_is_unique(XDX *xdx);
 /* Check if index is descending */
 bool xdx_is_descending(XDX *xdx);
 
+/* Node cache statistics */
+void xdx_get_cache_stats(XDX *xdx, XDXCacheStats *stats);
+
 /*
  * Key comparison
  */
@@ -2,11 +2,21 @@
  * xBase3 - DBF Engine Tests
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "dbf.h"
+#include "xcol.h"
+#include "textio.h"
+#include "sort.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
 
 #define TEST(name) printf("Testing %s... ", name)
 #define PASS() printf("PASSED\n")
@@ -14,6 +24,84 @@
 
 static const char *test_file = "/tmp/test_xbase3.dbf";
 
+/* Reference encoder: printf formatting, right-aligned in the field */
+static void ref_encode(double value, uint8_t *out, int width, int decimals) {
+    char buf[64];
+    num_to_str(value, buf, width, decimals);
+    size_t len = strlen(buf);
+    memset(out, ' ', (size_t)width);
+    memcpy(out + (width - (int)len), buf, len);
+}
+
+/* Reference decoder: strtod on a NUL-terminated copy */
+static bool ref_decode(const uint8_t *field, size_t len, double *value) {
+    char buf[256];
+    memcpy(buf, field, len);
+    buf[len] = '\0';
+    return str_to_num(buf, value);
+}
+
+static bool same_double(double a, double b) {
+    if (isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+    return a == b && signbit(a) == signbit(b);
+}
+
+/* Encode and decode one value both ways; false on any difference */
+static bool check_codec(double value, int width, int decimals) {
+    uint8_t fast[32], ref[32];
+    dbf_encode_numeric(value, fast, (size_t)width, decimals);
+    ref_encode(value, ref, width, decimals);
+    if (memcmp(fast, ref, (size_t)width) != 0) {
+        printf("\n  encode %.17g (%d,%d): '%.*s' vs '%.*s'", value, width, decimals,
+               width, (char *)fast, width, (char *)ref);
+        return false;
+    }
+
+    double a = 0, b = 0;
+    bool ok_a = dbf_decode_numeric(fast, (size_t)width, &a);
+    bool ok_b = ref_decode(ref, (size_t)width, &b);
+    if (ok_a != ok_b || (ok_a && !same_double(a, b))) {
+        printf("\n  decode '%.*s': %.17g vs %.17g", width, (char *)fast, a, b);
+        return false;
+    }
+    return true;
+}
+
+/* Group commit clock the durability test moves by hand */
+static uint64_t test_ms;
+static uint64_t test_clock(void) {
+    return test_ms;
+}
+
+/* Record count as stored in the header on disk */
+static uint32_t read_disk_count(void) {
+    uint8_t buf[8] = {0};
+    FILE *fp = fopen(test_file, "rb");
+    if (fp) {
+        if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) memset(buf, 0, sizeof(buf));
+        fclose(fp);
+    }
+    return read_u32_le(&buf[4]);
+}
+
+/* Reader thread: sum the ID field over a whole scan */
+typedef struct {
+    DBFReader *rd;
+    double sum;
+    uint32_t rows;
+} ScanJob;
+
+static void *scan_thread(void *arg) {
+    ScanJob *job = arg;
+    double id;
+
+    for (dbf_reader_go_top(job->rd); !dbf_reader_eof(job->rd); dbf_reader_skip(job->rd, 1)) {
+        if (dbf_reader_get_double(job->rd, 0, &id)) job->sum += id;
+        job->rows++;
+    }
+    return NULL;
+}
+
 int main(void) {
     /* Test DBF creation */
     TEST("DBF create");
@@ -166,8 +254,1412 @@ int main(void) {
         PASS();
     }
 
+    /* Test memory-mapped access */
+    TEST("DBF mmap");
+    {
+        DBF *dbf = dbf_open_mmap(test_file, false);
+        if (!dbf) FAIL("Failed to open DBF with mmap");
+        if (!dbf_is_mapped(dbf)) FAIL("Should be mapped");
+
+        char name[21];
+        dbf_goto(dbf, 2);
+        dbf_get_string(dbf, 0, name, sizeof(name));
+        str_trim_right(name);
+        if (strcmp(name, "Bob Jones") != 0) FAIL("Mapped read mismatch");
+
+        /* Appends grow the mapping */
+        for (int i = 0; i < 100; i++) {
+            if (!dbf_append_blank(dbf)) FAIL("Mapped append failed");
+            dbf_put_double(dbf, 1, i);
+            dbf_flush(dbf);
+        }
+        if (dbf_reccount(dbf) != 102) FAIL("Should have 102 records");
+
+        double age;
+        dbf_goto(dbf, 52);
+        dbf_get_double(dbf, 1, &age);
+        if (age != 49) FAIL("Mapped read after append mismatch");
+
+        /* Pack through the mapping */
+        dbf_goto(dbf, 3);
+        dbf_delete(dbf);
+        if (!dbf_pack(dbf)) FAIL("Mapped pack failed");
+        if (dbf_reccount(dbf) != 101) FAIL("Should have 101 records after pack");
+        dbf_close(dbf);
+
+        /* The mapped pack truncates the file too */
+        FILE *fp = fopen(test_file, "rb");
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) != (long)(32 * 4 + 1) + 101L * 25 + 1) FAIL("Mapped pack did not truncate");
+        fclose(fp);
+
+        /* Changes are visible through regular file I/O */
+        dbf = dbf_open(test_file, true);
+        if (!dbf) FAIL("Failed to reopen DBF");
+        if (dbf_reccount(dbf) != 101) FAIL("Record count not persisted");
+        dbf_goto(dbf, 3);
+        dbf_get_double(dbf, 1, &age);
+        if (age != 1) FAIL("Packed record mismatch");
+        dbf_close(dbf);
+        PASS();
+    }
+
+    /* Test sequential read-ahead */
+    TEST("DBF read-ahead scan");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"PAD", 'C', 200, 0, 0}
+        };
+
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        for (int i = 1; i <= 2000; i++) {
+            dbf_append_blank(dbf);
+            dbf_put_double(dbf, 0, i);
+        }
+        dbf_close(dbf);
+
+        dbf = dbf_open(test_file, false);
+        if (!dbf) FAIL("Failed to open DBF");
+
+        /* Forward scan served from read-ahead blocks */
+        double id;
+        uint32_t seen = 0;
+        for (dbf_go_top(dbf); !dbf_eof(dbf); dbf_skip(dbf, 1)) {
+            dbf_get_double(dbf, 0, &id);
+            if ((uint32_t)id != dbf_recno(dbf)) FAIL("Scan value mismatch");
+            seen++;
+        }
+        if (seen != 2000) FAIL("Scan should visit 2000 records");
+
+        /* Writes during a scan are visible on re-read */
+        dbf_go_top(dbf);
+        dbf_skip(dbf, 1);
+        dbf_skip(dbf, 1);
+        dbf_put_double(dbf, 0, 9999);
+        dbf_skip(dbf, 1);
+        dbf_goto(dbf, 3);
+        dbf_get_double(dbf, 0, &id);
+        if (id != 9999) FAIL("Write not visible through read-ahead block");
+
+        /* Random access still works */
+        dbf_goto(dbf, 1500);
+        dbf_get_double(dbf, 0, &id);
+        if (id != 1500) FAIL("Random read mismatch");
+
+        dbf_close(dbf);
+        PASS();
+    }
+
+    /* Test buffer pool eviction and write-back */
+    TEST("Buffer pool");
+    {
+        bufpool_set_budget(0);  /* Clamped to the minimum page count */
+
+        DBF *dbf = dbf_open(test_file, false);
+        if (!dbf) FAIL("Failed to open DBF");
+
+        /* Rewrite every record; dirty pages are written back on eviction */
+        for (uint32_t r = 1; r <= dbf_reccount(dbf); r++) {
+            dbf_goto(dbf, r);
+            dbf_put_double(dbf, 0, r * 2);
+        }
+        dbf_close(dbf);
+
+        BufPoolStats stats;
+        bufpool_get_stats(&stats);
+        if (stats.evictions == 0) FAIL("Expected evictions under a small budget");
+        if (stats.dirty != 0) FAIL("Close should leave no dirty pages");
+
+        dbf = dbf_open(test_file, true);
+        if (!dbf) FAIL("Failed to reopen DBF");
+        double id;
+        for (uint32_t r = 1; r <= dbf_reccount(dbf); r++) {
+            dbf_goto(dbf, r);
+            dbf_get_double(dbf, 0, &id);
+            if ((uint32_t)id != r * 2) FAIL("Value lost through the buffer pool");
+        }
+        dbf_close(dbf);
+
+        /* Pinned pages survive pressure and keep their contents */
+        dbf = dbf_open(test_file, false);
+        BufPage *page = bufpool_pin(dbf->pool, 0);
+        if (!page) FAIL("Pin failed");
+        uint8_t first = bufpool_page_data(page)[0];
+        for (dbf_go_top(dbf); !dbf_eof(dbf); dbf_skip(dbf, 1)) {
+        }
+        if (bufpool_page_data(page)[0] != first) FAIL("Pinned page was reused");
+        bufpool_unpin(page, false);
+        dbf_close(dbf);
+
+        /* A page that cannot be written back keeps its region attached */
+        int fd = open(test_file, O_RDONLY);
+        BufFile *file = bufpool_attach(fd, 0, 0);
+        uint8_t byte = 'x';
+        if (!bufpool_write(file, 0, &byte, 1)) FAIL("Pool write failed");
+        if (bufpool_detach(file)) FAIL("Detach should fail when write-back fails");
+        bufpool_get_stats(&stats);
+        if (stats.dirty != 1) FAIL("Unwritten page was dropped");
+        bufpool_truncate(file, 0);
+        if (!bufpool_detach(file)) FAIL("Detach after discarding failed");
+        close(fd);
+        error_clear();
+
+        bufpool_set_budget((size_t)BUFPOOL_DEFAULT_MB * 1024 * 1024);
+        PASS();
+    }
+
+    /* Test batched appends */
+    TEST("DBF batch append");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"NAME", 'C', 10, 0, 0}
+        };
+
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+
+        /* Appender writes a batch every 100 records */
+        DBFAppender *ap = dbf_appender_open(dbf, 100);
+        if (!ap) FAIL("Failed to open appender");
+        for (int i = 1; i <= 1050; i++) {
+            if (!dbf_appender_add(ap)) FAIL("Appender add failed");
+            dbf_appender_put_double(ap, 0, i);
+            dbf_appender_put_string(ap, 1, "batch");
+        }
+        if (dbf_reccount(dbf) != 1000) FAIL("Full batches should be written");
+        if (dbf_appender_count(ap) != 1050) FAIL("Appender count mismatch");
+        if (!dbf_appender_close(ap)) FAIL("Appender close failed");
+        if (dbf_reccount(dbf) != 1050) FAIL("Should have 1050 records");
+        if (dbf_recno(dbf) != 1050) FAIL("Should be positioned at last record");
+
+        /* Raw records in one call */
+        uint16_t size = dbf->header.record_size;
+        uint8_t raw[3 * 19];
+        memset(raw, ' ', sizeof(raw));
+        for (int i = 0; i < 3; i++) {
+            memcpy(&raw[i * size + 1], "    9000", 8);
+            raw[i * size + 8] = (uint8_t)('1' + i);
+        }
+        if (size != 19) FAIL("Unexpected record size");
+        if (!dbf_append_batch(dbf, raw, 3)) FAIL("Batch append failed");
+        dbf_close(dbf);
+
+        dbf = dbf_open(test_file, true);
+        if (!dbf) FAIL("Failed to reopen DBF");
+        if (dbf_reccount(dbf) != 1053) FAIL("Record count not persisted");
+
+        double id;
+        char name[11];
+        dbf_goto(dbf, 777);
+        dbf_get_double(dbf, 0, &id);
+        dbf_get_string(dbf, 1, name, sizeof(name));
+        str_trim_right(name);
+        if (id != 777 || strcmp(name, "batch") != 0) FAIL("Staged record mismatch");
+        dbf_goto(dbf, 1053);
+        dbf_get_double(dbf, 0, &id);
+        if (id != 9003) FAIL("Raw record mismatch");
+        dbf_close(dbf);
+
+        /* Records are followed by a single EOF marker */
+        FILE *fp = fopen(test_file, "rb");
+        fseek(fp, 0, SEEK_END);
+        long expected = (long)(32 * 3 + 1) + 1053L * 19 + 1;
+        if (ftell(fp) != expected) FAIL("File size mismatch");
+        fseek(fp, -1, SEEK_END);
+        if (fgetc(fp) != DBF_EOF_MARKER) FAIL("Missing EOF marker");
+        fclose(fp);
+        PASS();
+    }
+
+    /* Test durability modes */
+    TEST("DBF durability");
+    {
+        DBF *dbf = dbf_open(test_file, false);
+        if (!dbf) FAIL("Failed to open DBF");
+        uint32_t count = dbf_reccount(dbf);
+
+        /* The header on disk trails appends until a statement ends */
+        dbf_set_durability(DBF_DURABILITY_NONE);
+        uint64_t syncs = dbf_sync_count();
+        dbf_append_blank(dbf);
+        if (read_disk_count() != count) FAIL("Header written before statement end");
+        if (!dbf_end_statement(dbf)) FAIL("Statement end failed");
+        if (read_disk_count() != count + 1) FAIL("Header not written at statement end");
+        if (dbf_sync_count() != syncs) FAIL("NONE should not sync");
+
+        /* Commits are timed by a clock that stands still until moved */
+        dbf_set_commit_clock(test_clock);
+        test_ms = 1000;
+
+        /* FULL syncs every statement that changed something */
+        dbf_set_durability(DBF_DURABILITY_FULL);
+        dbf_append_blank(dbf);
+        dbf_end_statement(dbf);
+        dbf_end_statement(dbf);
+        if (dbf_sync_count() != syncs + 1) FAIL("FULL should sync once per change");
+
+        /* BATCH coalesces statements within the commit interval */
+        dbf_set_durability(DBF_DURABILITY_BATCH);
+        syncs = dbf_sync_count();
+        for (int i = 0; i < 20; i++) {
+            dbf_append_blank(dbf);
+            dbf_put_double(dbf, 0, i);
+            dbf_end_statement(dbf);
+        }
+        if (dbf_sync_count() != syncs) FAIL("BATCH should group commits");
+        if (read_disk_count() == count + 22) FAIL("Group commit should still be pending");
+
+        test_ms += DBF_GROUP_COMMIT_MS - 1;
+        if (!dbf_commit_due(dbf)) FAIL("Group commit failed");
+        if (dbf_sync_count() != syncs) FAIL("Group commit before the interval");
+        test_ms++;
+        if (!dbf_commit_due(dbf)) FAIL("Group commit failed");
+        if (read_disk_count() != count + 22) FAIL("Group commit did not write header");
+        if (dbf_sync_count() != syncs + 1) FAIL("Group commit should sync once");
+
+        /* The periodic group commit covers every open table */
+        const char *other_file = "/tmp/test_durable.dbf";
+        DBFField fields[1] = {{"ID", 'N', 8, 0, 0}};
+        DBF *other = dbf_create(other_file, fields, 1);
+        if (!other) FAIL("Failed to create second DBF");
+        dbf_append_blank(other);
+        dbf_commit(other);
+        syncs = dbf_sync_count();
+        dbf_append_blank(dbf);
+        dbf_end_statement(dbf);
+        dbf_append_blank(other);
+        dbf_end_statement(other);
+        if (dbf_sync_count() != syncs) FAIL("Group commit should still be pending");
+        test_ms += DBF_GROUP_COMMIT_MS;
+        if (!dbf_commit_all_due()) FAIL("Group commit of all tables failed");
+        if (dbf_sync_count() != syncs + 2) FAIL("Group commit should sync each table");
+        dbf_close(other);
+        unlink(other_file);
+
+        dbf_set_commit_clock(NULL);
+        dbf_set_durability(DBF_DURABILITY_NONE);
+        dbf_close(dbf);
+        PASS();
+    }
+
+    /* Test zero-copy field views */
+    TEST("DBF field view");
+    {
+        DBF *dbf = dbf_open(test_file, false);
+        if (!dbf) FAIL("Failed to open DBF");
+
+        const uint8_t *ptr;
+        size_t len;
+        dbf_goto(dbf, 777);
+        if (!dbf_field_view(dbf, 1, &ptr, &len)) FAIL("View failed");
+        if (len != 10) FAIL("View length should be the field length");
+        if (ptr != dbf->record_buffer + dbf_field_info(dbf, 1)->offset) {
+            FAIL("View should point into the record buffer");
+        }
+        if (dbf_view_trim_right(ptr, len) != 5 || memcmp(ptr, "batch", 5) != 0) {
+            FAIL("Trimmed view mismatch");
+        }
+
+        /* Numeric fields are blank-padded on the left */
+        if (!dbf_field_view(dbf, 0, &ptr, &len)) FAIL("View failed");
+        len = dbf_view_trim(&ptr, len);
+        if (len != 3 || memcmp(ptr, "777", 3) != 0) FAIL("Trimmed numeric view mismatch");
+
+        /* Views follow pending writes */
+        dbf_put_string(dbf, 1, "changed");
+        dbf_field_view(dbf, 1, &ptr, &len);
+        if (memcmp(ptr, "changed", 7) != 0) FAIL("View should see the pending write");
+
+        /* No view without a current record */
+        dbf_go_bottom(dbf);
+        dbf_skip(dbf, 1);
+        if (dbf_field_view(dbf, 1, &ptr, &len)) FAIL("View at EOF should fail");
+        dbf_close(dbf);
+
+        /* Mapped tables are viewed in place */
+        dbf = dbf_open_mmap(test_file, true);
+        if (!dbf) FAIL("Failed to map DBF");
+        dbf_goto(dbf, 777);
+        dbf_field_view(dbf, 1, &ptr, &len);
+        if (ptr < dbf->map || ptr >= dbf->map + dbf->map_size) FAIL("View should point into the mapping");
+        if (dbf_view_trim_right(ptr, len) != 7) FAIL("Mapped view mismatch");
+        dbf_close(dbf);
+        PASS();
+    }
+
+    /* Test the deleted bitmap and its sidecar */
+    TEST("DBF deleted bitmap");
+    {
+        const char *sidecar = "/tmp/test_xbase3.xdm";
+        unlink(sidecar);
+
+        DBF *dbf = dbf_open(test_file, false);
+        if (!dbf) FAIL("Failed to open DBF");
+        uint32_t total = dbf_reccount(dbf);
+        uint32_t deleted = 0;
+        for (uint32_t r = 10; r <= total; r += 10) {
+            dbf_goto(dbf, r);
+            dbf_delete(dbf);
+            deleted++;
+        }
+        if (dbf_deleted_count(dbf) != deleted) FAIL("Deleted count mismatch");
+        if (dbf_active_count(dbf) != total - deleted) FAIL("Active count mismatch");
+        if (!dbf_record_deleted(dbf, 20) || dbf_record_deleted(dbf, 21)) FAIL("Record flag mismatch");
+
+        /* Deleted records appended in a batch are counted */
+        uint8_t raw[19];
+        memset(raw, ' ', sizeof(raw));
+        raw[0] = DBF_RECORD_DELETED;
+        dbf_append_batch(dbf, raw, 1);
+        total++;
+        deleted++;
+        if (dbf_deleted_count(dbf) != deleted) FAIL("Appended deletion not counted");
+        dbf_close(dbf);
+
+        FILE *fp = fopen(sidecar, "rb");
+        if (!fp) FAIL("Sidecar not written");
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) != XDM_HEADER_SIZE + (long)(total + 7) / 8) FAIL("Sidecar size mismatch");
+        fclose(fp);
+
+        /* A current sidecar is loaded instead of scanning */
+        dbf = dbf_open(test_file, true);
+        if (!dbf->delmap) FAIL("Sidecar should be loaded on open");
+        if (dbf_deleted_count(dbf) != deleted) FAIL("Loaded count mismatch");
+
+        /* SET DELETED ON steps over deleted records */
+        dbf_set_skip_deleted(true);
+        uint32_t visited = 0;
+        for (dbf_go_top(dbf); !dbf_eof(dbf); dbf_skip(dbf, 1)) {
+            if (dbf_deleted(dbf)) FAIL("Deleted record visited");
+            visited++;
+        }
+        if (visited != total - deleted) FAIL("Active records not all visited");
+        dbf_go_bottom(dbf);
+        if (dbf_recno(dbf) != total - 1) FAIL("GO BOTTOM should skip the deleted last record");
+        dbf_goto(dbf, 21);
+        dbf_skip(dbf, -1);
+        if (dbf_recno(dbf) != 19) FAIL("SKIP -1 should step over record 20");
+        dbf_skip(dbf, 2);
+        if (dbf_recno(dbf) != 22) FAIL("SKIP 2 should step over record 20");
+        dbf_set_skip_deleted(false);
+        dbf_close(dbf);
+
+        /* A table changed behind the sidecar's back is rescanned */
+        struct timespec ts = {0, 20000000};
+        nanosleep(&ts, NULL);
+        fp = fopen(test_file, "r+b");
+        uint8_t hdr[12];
+        if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) FAIL("Header read failed");
+        fseek(fp, read_u16_le(&hdr[8]), SEEK_SET);
+        fputc(DBF_RECORD_DELETED, fp);
+        fclose(fp);
+
+        dbf = dbf_open(test_file, false);
+        if (dbf->delmap) FAIL("Stale sidecar should not be loaded");
+        if (dbf_deleted_count(dbf) != deleted + 1) FAIL("Rebuilt count mismatch");
+
+        /* A crash after a change leaves the sidecar unsealed */
+        dbf_goto(dbf, 2);
+        dbf_delete(dbf);
+        if (!dbf_commit(dbf)) FAIL("Commit failed");
+        dbf_goto(dbf, 3);
+        dbf_delete(dbf);
+        dbf_flush(dbf);
+        fp = fopen(sidecar, "rb");
+        uint8_t xdm[XDM_HEADER_SIZE];
+        if (fread(xdm, 1, sizeof(xdm), fp) != sizeof(xdm)) FAIL("Sidecar read failed");
+        fclose(fp);
+        if (xdm[14] == XDM_SEALED) FAIL("Sidecar should be unsealed while changes are pending");
+        if (!dbf_commit(dbf)) FAIL("Commit failed");
+
+        /* PACK leaves no deleted records */
+        if (!dbf_pack(dbf)) FAIL("Pack failed");
+        if (dbf_reccount(dbf) != total - deleted - 3) FAIL("Pack count mismatch");
+        if (dbf_deleted_count(dbf) != 0) FAIL("Bitmap should be clear after pack");
+        dbf_close(dbf);
+
+        dbf = dbf_open(test_file, true);
+        if (!dbf->delmap || dbf_deleted_count(dbf) != 0) FAIL("Packed sidecar not current");
+        dbf_close(dbf);
+        PASS();
+    }
+
+    /* Test PACK across several I/O chunks */
+    TEST("DBF streaming pack");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"NAME", 'C', 10, 0, 0}
+        };
+
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        DBFAppender *ap = dbf_appender_open(dbf, 0);
+        for (int i = 1; i <= 150000; i++) {
+            dbf_appender_add(ap);
+            dbf_appender_put_double(ap, 0, i);
+            dbf_appender_put_string(ap, 1, "pack");
+        }
+        dbf_appender_close(ap);
+
+        /* A long live prefix, then every third record, then a dead tail */
+        uint32_t expected = 0;
+        for (uint32_t r = 1; r <= 150000; r++) {
+            if ((r > 40000 && r % 3 == 0) || r > 149000) {
+                dbf_goto(dbf, r);
+                dbf_delete(dbf);
+            } else {
+                expected++;
+            }
+        }
+
+        DBFPackStats stats;
+        if (!dbf_pack_stats(dbf, &stats)) FAIL("Pack failed");
+        if (stats.scanned != 150000 || stats.kept != expected) FAIL("Pack stats mismatch");
+        if (stats.bytes_moved >= (uint64_t)(150000 - 40000) * 19) FAIL("Live prefix should not move");
+        if (dbf_reccount(dbf) != expected) FAIL("Pack count mismatch");
+        dbf_close(dbf);
+
+        /* The file ends right after the EOF marker */
+        FILE *fp = fopen(test_file, "rb");
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) != (long)(32 * 3 + 1) + (long)expected * 19 + 1) FAIL("File not truncated");
+        fseek(fp, -1, SEEK_END);
+        if (fgetc(fp) != DBF_EOF_MARKER) FAIL("Missing EOF marker");
+        fclose(fp);
+
+        dbf = dbf_open(test_file, true);
+        uint32_t id = 0;
+        double value;
+        for (dbf_go_top(dbf); !dbf_eof(dbf); dbf_skip(dbf, 1)) {
+            do id++; while (id > 40000 && id % 3 == 0);
+            dbf_get_double(dbf, 0, &value);
+            if (value != id || dbf_deleted(dbf)) FAIL("Packed record mismatch");
+        }
+        dbf_close(dbf);
+        PASS();
+    }
+
+    /* Test online PACK with changes made during the copy */
+    TEST("DBF online pack");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"NAME", 'C', 10, 0, 0}
+        };
+
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        for (int i = 1; i <= 5000; i++) {
+            dbf_append_blank(dbf);
+            dbf_put_double(dbf, 0, i);
+            dbf_put_string(dbf, 1, "online");
+            if (i % 4 == 0) dbf_delete(dbf);
+        }
+        dbf_commit(dbf);
+
+        DBFPack *pack = dbf_pack_begin(dbf);
+        if (!pack) FAIL("Begin failed");
+        if (dbf_pack_begin(dbf)) FAIL("Second PACK should be refused");
+
+        /* Changes while the copy is under way */
+        dbf_goto(dbf, 10);
+        dbf_put_string(dbf, 1, "changed");
+        if (!dbf_pack_copy(pack)) FAIL("Copy failed");
+        dbf_goto(dbf, 11);
+        dbf_delete(dbf);
+        dbf_append_blank(dbf);
+        dbf_put_double(dbf, 0, 5001);
+        dbf_append_blank(dbf);
+        dbf_put_double(dbf, 0, 5002);
+        dbf_delete(dbf);
+        dbf_goto(dbf, 9);
+
+        DBFPackStats stats;
+        if (!dbf_pack_finish(pack, &stats)) FAIL("Finish failed");
+        uint32_t count;
+        const uint32_t *map = dbf_pack_map(pack, &count);
+        if (!map || count != 5002) FAIL("Map should cover every old record");
+        if (map[4] != 0 || map[5] != 4 || map[5001] != 3751 || map[5002] != 0) FAIL("Map mismatch");
+        if (stats.kept != 3751 || dbf_reccount(dbf) != 3751) FAIL("Record count mismatch");
+        if (dbf_recno(dbf) != map[9]) FAIL("Current record should follow the pack");
+        uint32_t changed = map[10], deleted = map[11];
+        dbf_pack_free(pack);
+        if (access("/tmp/test_xbase3.pak", F_OK) == 0) FAIL("Shadow file left behind");
+
+        char name[11];
+        double id;
+        dbf_goto(dbf, changed);
+        dbf_get_string(dbf, 1, name, sizeof(name));
+        if (strncmp(name, "changed", 7) != 0) FAIL("Change during copy lost");
+        dbf_goto(dbf, deleted);
+        dbf_get_double(dbf, 0, &id);
+        if (id != 11 || !dbf_deleted(dbf)) FAIL("Deletion during copy lost");
+        if (dbf_deleted_count(dbf) != 1) FAIL("Bitmap mismatch");
+        dbf_close(dbf);
+
+        FILE *fp = fopen(test_file, "rb");
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) != (long)(32 * 3 + 1) + 3751L * 19 + 1) FAIL("Shadow size mismatch");
+        fclose(fp);
+
+        /* A record recalled during the copy forces an offline pack */
+        dbf = dbf_open(test_file, false);
+        pack = dbf_pack_begin(dbf);
+        dbf_goto(dbf, deleted);
+        dbf_recall(dbf);
+        dbf_pack_copy(pack);
+        if (!dbf_pack_finish(pack, &stats)) FAIL("Fallback finish failed");
+        if (dbf_reccount(dbf) != 3751 || dbf_pack_map(pack, NULL) == NULL) FAIL("Fallback mismatch");
+        dbf_pack_free(pack);
+
+        /* Closing the table abandons the PACK */
+        dbf_goto(dbf, 1);
+        dbf_delete(dbf);
+        pack = dbf_pack_begin(dbf);
+        dbf_close(dbf);
+        if (!dbf_pack_copy(pack)) FAIL("Copy after close failed");
+        if (dbf_pack_finish(pack, &stats)) FAIL("Abandoned PACK should fail");
+        dbf_pack_free(pack);
+        if (access("/tmp/test_xbase3.pak", F_OK) == 0) FAIL("Abandoned shadow left behind");
+        PASS();
+    }
+
+    TEST("DBF reader handles");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"NAME", 'C', 10, 0, 0}
+        };
+
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        for (int i = 1; i <= 20000; i++) {
+            dbf_append_blank(dbf);
+            dbf_put_double(dbf, 0, i);
+            dbf_put_string(dbf, 1, "reader");
+            if (i % 10 == 0) dbf_delete(dbf);
+        }
+        /* Uncommitted, and still in the record buffer */
+        dbf_goto(dbf, 7);
+        dbf_put_string(dbf, 1, "fresh");
+
+        DBFReader *readers[4];
+        for (int i = 0; i < 4; i++) {
+            readers[i] = dbf_reader_open(dbf);
+            if (!readers[i]) FAIL("Reader open failed");
+        }
+        if (dbf_reader_reccount(readers[0]) != 20000) FAIL("Reader record count mismatch");
+
+        char name[11];
+        dbf_reader_goto(readers[0], 7);
+        dbf_reader_get_string(readers[0], 1, name, sizeof(name));
+        if (strncmp(name, "fresh", 5) != 0) FAIL("Reader missed a pending write");
+
+        /* The readers outlive the table */
+        dbf_close(dbf);
+
+        pthread_t threads[4];
+        ScanJob jobs[4];
+        for (int i = 0; i < 4; i++) {
+            jobs[i].rd = readers[i];
+            jobs[i].sum = 0;
+            jobs[i].rows = 0;
+            pthread_create(&threads[i], NULL, scan_thread, &jobs[i]);
+        }
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+            if (jobs[i].rows != 20000 || jobs[i].sum != 20000.0 * 20001 / 2) {
+                FAIL("Concurrent scan mismatch");
+            }
+        }
+
+        /* Backward steps cross block boundaries */
+        DBFReader *rd = readers[0];
+        double id;
+        dbf_reader_goto(rd, 20000);
+        dbf_reader_skip(rd, -5000);
+        dbf_reader_get_double(rd, 0, &id);
+        if (dbf_reader_recno(rd) != 15000 || id != 15000 || !dbf_reader_deleted(rd)) {
+            FAIL("Backward skip mismatch");
+        }
+        dbf_reader_skip(rd, -20000);
+        if (!dbf_reader_bof(rd) || dbf_reader_recno(rd) != 0) FAIL("Reader should stop at BOF");
+
+        /* SET DELETED ON is honoured */
+        dbf_set_skip_deleted(true);
+        dbf_reader_goto(rd, 9);
+        dbf_reader_skip(rd, 1);
+        if (dbf_reader_recno(rd) != 11) FAIL("Reader should skip deleted records");
+        dbf_set_skip_deleted(false);
+
+        for (int i = 0; i < 4; i++) dbf_reader_close(readers[i]);
+        PASS();
+    }
+
+    TEST("DBF async scan");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"NAME", 'C', 10, 0, 0}
+        };
+
+        /* 200000 records of 19 bytes span more blocks than the queue holds */
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        DBFAppender *ap = dbf_appender_open(dbf, 0);
+        for (int i = 1; i <= 200000; i++) {
+            uint8_t *record = dbf_appender_add(ap);
+            dbf_appender_put_double(ap, 0, i);
+            if (i % 7 == 0) record[0] = DBF_RECORD_DELETED;
+        }
+        dbf_appender_close(ap);
+        dbf_goto(dbf, 3);
+        dbf_put_string(dbf, 1, "pending");
+
+        DBFScanMode modes[3] = {DBF_SCAN_SYNC, DBF_SCAN_THREADS, DBF_SCAN_URING};
+        for (int m = 0; m < 3; m++) {
+            dbf_set_scan_mode(modes[m]);
+            for (int skip = 0; skip < 2; skip++) {
+                dbf_set_skip_deleted(skip);
+                DBFScan *scan = dbf_scan_open(dbf);
+                if (!scan) FAIL("Scan open failed");
+                if (m == 1 && strcmp(dbf_scan_backend(scan), "threads") != 0) FAIL("Wrong backend");
+
+                uint32_t rows = 0, expect = 1;
+                double sum = 0, id;
+                bool ordered = true;
+                for (; !dbf_eof(dbf); dbf_scan_next(scan)) {
+                    if (skip && expect % 7 == 0) expect++;
+                    if (dbf_recno(dbf) != expect++) ordered = false;
+                    dbf_get_double(dbf, 0, &id);
+                    sum += id;
+                    rows++;
+                }
+                dbf_scan_close(scan);
+
+                uint32_t want = skip ? 200000 - 200000 / 7 : 200000;
+                double want_sum = 200000.0 * 200001 / 2;
+                if (skip) want_sum -= 7.0 * (200000 / 7) * (200000 / 7 + 1) / 2;
+                if (!ordered || rows != want || sum != want_sum) FAIL("Scan mismatch");
+            }
+        }
+        dbf_set_skip_deleted(false);
+
+        /* The scan sees the pending write and leaves the cursor where it stopped */
+        dbf_set_scan_mode(DBF_SCAN_THREADS);
+        DBFScan *scan = dbf_scan_open(dbf);
+        char name[11];
+        for (int i = 0; i < 2; i++) dbf_scan_next(scan);
+        dbf_get_string(dbf, 1, name, sizeof(name));
+        if (strncmp(name, "pending", 7) != 0) FAIL("Scan missed a pending write");
+        for (int i = 0; i < 20003; i++) dbf_scan_next(scan);
+        dbf_scan_close(scan);
+        if (dbf_recno(dbf) != 20006 || !dbf_deleted(dbf)) FAIL("Cursor should stay on the last record");
+        dbf_set_scan_mode(DBF_SCAN_AUTO);
+        dbf_close(dbf);
+        PASS();
+    }
+
+    TEST("DBF in-memory columns");
+    {
+        DBFField fields[4] = {
+            {"AMOUNT", 'N', 10, 2, 0},
+            {"NAME", 'C', 12, 0, 0},
+            {"BORN", 'D', 8, 0, 0},
+            {"OK", 'L', 1, 0, 0}
+        };
+
+        DBF *dbf = dbf_create(test_file, fields, 4);
+        if (!dbf) FAIL("Failed to create DBF");
+        for (int i = 1; i <= 3000; i++) {
+            char name[16], date[9];
+            dbf_append_blank(dbf);
+            dbf_put_double(dbf, 0, i * 1.25);
+            snprintf(name, sizeof(name), "n%d", i);
+            if (i % 5) dbf_put_string(dbf, 1, name);
+            snprintf(date, sizeof(date), "%04d%02d%02d", 1900 + i % 200, 1 + i % 12, 1 + i % 28);
+            if (i % 9) dbf_put_date(dbf, 2, date);
+            dbf_put_logical(dbf, 3, i % 2 == 0);
+            if (i % 11 == 0) dbf_delete(dbf);
+        }
+        dbf_close(dbf);
+
+        DBF *plain = dbf_open(test_file, true);
+        dbf = dbf_open_inmemory(test_file, false);
+        if (!dbf || !dbf_is_inmemory(dbf) || dbf_is_inmemory(plain)) FAIL("In-memory open failed");
+
+        for (uint32_t recno = 1; recno <= 3000; recno++) {
+            double a, b;
+            bool la, lb;
+            char da[9], db[9];
+            const uint8_t *view, *trimmed;
+            size_t vlen, tlen;
+
+            dbf_goto(dbf, recno);
+            dbf_goto(plain, recno);
+            dbf_get_double(dbf, 0, &a);
+            dbf_get_double(plain, 0, &b);
+            dbf_get_logical(dbf, 3, &la);
+            dbf_get_logical(plain, 3, &lb);
+            dbf_get_date(dbf, 2, da);
+            dbf_get_date(plain, 2, db);
+            dbf_column_view(dbf, 1, &trimmed, &tlen);
+            dbf_field_view(plain, 1, &view, &vlen);
+            if (a != b || la != lb || strcmp(da, db) != 0 ||
+                tlen != dbf_view_trim_right(view, vlen) || memcmp(trimmed, view, tlen) != 0 ||
+                dbf_deleted(dbf) != dbf_deleted(plain)) {
+                FAIL("Column differs from the record");
+            }
+        }
+        dbf_close(plain);
+
+        /* Writes keep the columns current; raw bytes are fetched on demand */
+        const uint8_t *view;
+        size_t len;
+        double amount;
+        char date[9];
+        bool ok;
+        dbf_goto(dbf, 42);
+        dbf_put_string(dbf, 1, "a longer name");
+        dbf_put_double(dbf, 0, -3.5);
+        dbf_goto(dbf, 43);
+        dbf_put_string(dbf, 1, "x");
+        dbf_put_date(dbf, 2, "20240229");
+        dbf_put_logical(dbf, 3, true);
+        dbf_delete(dbf);
+        dbf_goto(dbf, 1);
+        dbf_goto(dbf, 42);
+        dbf_column_view(dbf, 1, &view, &len);
+        if (len != 12 || memcmp(view, "a longer nam", 12) != 0) FAIL("Grown string lost");
+        dbf_get_double(dbf, 0, &amount);
+        if (amount != -3.5) FAIL("Numeric write lost");
+        dbf_goto(dbf, 43);
+        dbf_column_view(dbf, 1, &view, &len);
+        dbf_get_date(dbf, 2, date);
+        dbf_get_logical(dbf, 3, &ok);
+        if (len != 1 || view[0] != 'x' || strcmp(date, "20240229") != 0 || !ok || !dbf_deleted(dbf)) {
+            FAIL("Column write lost");
+        }
+        dbf_field_view(dbf, 1, &view, &len);
+        if (len != 12 || memcmp(view, "x           ", 12) != 0) FAIL("Raw record mismatch");
+
+        dbf_append_blank(dbf);
+        dbf_put_string(dbf, 1, "appended");
+        dbf_goto(dbf, 3001);
+        dbf_column_view(dbf, 1, &view, &len);
+        if (len != 8 || dbf_reccount(dbf) != 3001) FAIL("Append not decoded");
+
+        /* PACK decodes the compacted table again */
+        dbf_pack(dbf);
+        if (dbf_reccount(dbf) != 3001 - 273) FAIL("Pack count mismatch");
+        dbf_go_bottom(dbf);
+        dbf_column_view(dbf, 1, &view, &len);
+        if (len != 8 || memcmp(view, "appended", 8) != 0) FAIL("Columns stale after pack");
+        dbf_close(dbf);
+
+        /* The lazily loaded records were written back intact (42 is now 39) */
+        dbf = dbf_open(test_file, true);
+        dbf_goto(dbf, 39);
+        dbf_get_double(dbf, 0, &amount);
+        dbf_get_date(dbf, 2, date);
+        if (amount != -3.5 || strcmp(date, "19420715") != 0) FAIL("Record damaged on disk");
+        dbf_close(dbf);
+        PASS();
+    }
+
+    TEST("DBF zone maps");
+    {
+        DBFField fields[2] = {
+            {"AMOUNT", 'N', 10, 2, 0},
+            {"DT", 'D', 8, 0, 0}
+        };
+        const char *sidecar = "/tmp/test_xbase3.xzm";
+        unlink(sidecar);
+
+        /* Amounts and dates rise with the record number */
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        DBFAppender *ap = dbf_appender_open(dbf, 0);
+        for (int i = 1; i <= 50000; i++) {
+            char date[9];
+            dbf_appender_add(ap);
+            dbf_appender_put_double(ap, 0, i);
+            date_from_julian(date, date_to_julian("20000101") + i / 100);
+            dbf_appender_put_date(ap, 1, date);
+        }
+        dbf_appender_close(ap);
+
+        DBFZoneTest over[1] = {{0, DBF_ZONE_GT, 45000, NULL}};
+        DBFZoneTest range[2] = {
+            {1, DBF_ZONE_GE, (double)date_to_julian("20000301"), NULL},
+            {1, DBF_ZONE_LT, (double)date_to_julian("20000401"), NULL}
+        };
+
+        DBFScanMode modes[2] = {DBF_SCAN_SYNC, DBF_SCAN_THREADS};
+        for (int m = 0; m < 2; m++) {
+            dbf_set_scan_mode(modes[m]);
+
+            /* Blocks 1-10 end at or below 45000 */
+            DBFScan *scan = dbf_scan_open_where(dbf, 1, over, 1);
+            if (!scan) FAIL("Scan open failed");
+            uint32_t rows = 0, first = dbf_recno(dbf);
+            double amount;
+            for (; !dbf_eof(dbf); dbf_scan_next(scan)) {
+                dbf_get_double(dbf, 0, &amount);
+                if (amount > 45000) rows++;
+            }
+            if (dbf_scan_skipped(scan) != 10 * 4096 || first != 40961 || rows != 5000) {
+                FAIL("Amount blocks not skipped");
+            }
+            dbf_scan_close(scan);
+
+            /* Records 6000-9099 fall in March 2000, within blocks 2 and 3 */
+            scan = dbf_scan_open_where(dbf, 1, range, 2);
+            rows = 0;
+            for (; !dbf_eof(dbf); dbf_scan_next(scan)) {
+                char date[9];
+                dbf_get_date(dbf, 1, date);
+                if (strncmp(date, "200003", 6) == 0) rows++;
+            }
+            if (dbf_scan_skipped(scan) != 50000 - 2 * 4096 || rows != 3100) FAIL("Date blocks not skipped");
+            dbf_scan_close(scan);
+        }
+
+        /* A write widens its block; the deleted record is passed over */
+        dbf_goto(dbf, 5);
+        dbf_put_double(dbf, 0, 99999);
+        dbf_goto(dbf, 45001);
+        dbf_delete(dbf);
+        dbf_set_skip_deleted(true);
+        DBFScan *scan = dbf_scan_open_where(dbf, 1, over, 1);
+        if (dbf_recno(dbf) != 1 || dbf_scan_skipped(scan) != 9 * 4096) FAIL("Write did not widen its block");
+        uint32_t rows = 0;
+        for (; !dbf_eof(dbf); dbf_scan_next(scan)) {
+            double amount;
+            dbf_get_double(dbf, 0, &amount);
+            if (amount > 45000) rows++;
+        }
+        if (rows != 5000) FAIL("Scan lost records");
+        dbf_scan_close(scan);
+        dbf_set_skip_deleted(false);
+        dbf_close(dbf);
+
+        /* The sidecar is sealed on close and reused on open */
+        FILE *fp = fopen(sidecar, "rb");
+        uint8_t xzm[XZM_HEADER_SIZE];
+        if (!fp || fread(xzm, 1, sizeof(xzm), fp) != sizeof(xzm)) FAIL("Sidecar missing");
+        fclose(fp);
+        if (memcmp(xzm, XZM_MAGIC, 4) != 0 || xzm[14] != XDM_SEALED) FAIL("Sidecar not sealed");
+
+        dbf = dbf_open(test_file, false);
+        if (!dbf->zones) FAIL("Sidecar not loaded");
+
+        /* PACK computes tight ranges again */
+        dbf_goto(dbf, 5);
+        dbf_delete(dbf);
+        dbf_pack(dbf);
+        scan = dbf_scan_open_where(dbf, 1, over, 1);
+        if (dbf_scan_skipped(scan) != 10 * 4096 || dbf_recno(dbf) != 40961) FAIL("Pack left wide ranges");
+        dbf_scan_close(scan);
+        dbf_set_scan_mode(DBF_SCAN_AUTO);
+        dbf_close(dbf);
+        unlink(sidecar);
+        PASS();
+    }
+
+    TEST("DBF Bloom filters");
+    {
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"NAME", 'C', 12, 0, 0}
+        };
+        const char *sidecar = "/tmp/test_xbase3.xbl";
+        unlink(sidecar);
+
+        DBF *dbf = dbf_create(test_file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+        DBFAppender *ap = dbf_appender_open(dbf, 0);
+        for (int i = 1; i <= 20000; i++) {
+            char name[16];
+            dbf_appender_add(ap);
+            dbf_appender_put_double(ap, 0, i);
+            snprintf(name, sizeof(name), "cust%05d", i);
+            dbf_appender_put_string(ap, 1, name);
+        }
+        dbf_appender_close(ap);
+        if (dbf_bloom_add(dbf, 0)) FAIL("Numeric field accepted");
+        if (!dbf_bloom_add(dbf, 1)) FAIL("Bloom add failed");
+
+        /* Only the block holding record 12345 can match, in any case */
+        DBFZoneTest match = {1, DBF_ZONE_MATCH, 0, " CUST12345"};
+        DBFScan *scan = dbf_scan_open_where(dbf, 1, &match, 1);
+        if (dbf_scan_skipped(scan) != 20000 - 4096 || dbf_recno(dbf) != 12289) FAIL("Blocks not skipped");
+        dbf_scan_close(scan);
+
+        /* Writes and appends add to the filters */
+        dbf_goto(dbf, 5);
+        dbf_put_string(dbf, 1, "newcomer");
+        dbf_append_blank(dbf);
+        dbf_put_string(dbf, 1, "newcomer");
+        match.text = "newcomer";
+        scan = dbf_scan_open_where(dbf, 1, &match, 1);
+        uint32_t found = 0;
+        for (; !dbf_eof(dbf); dbf_scan_next(scan)) {
+            char name[13];
+            dbf_get_string(dbf, 1, name, sizeof(name));
+            if (strncmp(name, "newcomer", 8) == 0) found++;
+        }
+        if (found != 2 || dbf_scan_skipped(scan) != 20001 - 4096 - (20001 - 16384)) FAIL("Write not filtered");
+        dbf_scan_close(scan);
+
+        /* Scans can start past a record, as CONTINUE does */
+        match.text = "cust12345";
+        scan = dbf_scan_open_where(dbf, 12346, &match, 1);
+        if (dbf_recno(dbf) != 12346) FAIL("Scan should start at its first record");
+        dbf_scan_close(scan);
+        scan = dbf_scan_open_where(dbf, 16385, &match, 1);
+        if (!dbf_eof(dbf)) FAIL("Scan should skip to the end");
+        dbf_scan_close(scan);
+        match.text = "newcomer";
+        dbf_close(dbf);
+
+        /* The field list and filters come back from the sidecar */
+        dbf = dbf_open(test_file, false);
+        scan = dbf_scan_open_where(dbf, 1, &match, 1);
+        if (dbf_scan_skipped(scan) != 20001 - 4096 - (20001 - 16384)) FAIL("Sidecar not loaded");
+        dbf_scan_close(scan);
+
+        /* PACK drops values that were written over */
+        match.text = "cust00005";
+        scan = dbf_scan_open_where(dbf, 1, &match, 1);
+        if (dbf_recno(dbf) != 1) FAIL("Old value should stay until PACK");
+        dbf_scan_close(scan);
+        dbf_goto(dbf, 20001);
+        dbf_delete(dbf);
+        dbf_pack(dbf);
+        scan = dbf_scan_open_where(dbf, 1, &match, 1);
+        if (!dbf_eof(dbf) || dbf_scan_skipped(scan) != 20000) FAIL("Pack left stale values");
+        dbf_scan_close(scan);
+
+        dbf_bloom_drop(dbf, -1);
+        if (access(sidecar, F_OK) == 0) FAIL("Sidecar not removed");
+        dbf_close(dbf);
+        PASS();
+    }
+
+    TEST("DBF columnar snapshots");
+    {
+        DBFField fields[5] = {
+            {"ID", 'N', 8, 0, 0},
+            {"PRICE", 'N', 10, 3, 0},
+            {"NAME", 'C', 12, 0, 0},
+            {"DT", 'D', 8, 0, 0},
+            {"OK", 'L', 1, 0, 0}
+        };
+        const char *snapshot = "/tmp/test_xbase3.xcol";
+        uint32_t total = XCOL_CHUNK_RECORDS + 5000;
+
+        /* Two chunks: runs, narrow integers, fractions and a few names */
+        DBF *dbf = dbf_create(test_file, fields, 5);
+        if (!dbf) FAIL("Failed to create DBF");
+        DBFAppender *ap = dbf_appender_open(dbf, 0);
+        for (uint32_t i = 1; i <= total; i++) {
+            char name[16], date[9];
+            dbf_appender_add(ap);
+            dbf_appender_put_double(ap, 0, i);
+            dbf_appender_put_double(ap, 1, i % 7 == 0 ? i / 3.0 : 2.5);
+            snprintf(name, sizeof(name), "group%d", i % 5);
+            dbf_appender_put_string(ap, 2, name);
+            date_from_julian(date, date_to_julian("20100101") + i / 1000);
+            dbf_appender_put_date(ap, 3, date);
+            dbf_appender_put_logical(ap, 4, i % 2 == 0);
+        }
+        dbf_appender_close(ap);
+        dbf_goto(dbf, 3);
+        dbf_delete(dbf);
+        dbf_goto(dbf, total);
+        dbf_delete(dbf);
+
+        XColWriter *w = xcol_create(snapshot, dbf->fields, 5);
+        if (!w) FAIL("Snapshot create failed");
+        for (dbf_goto(dbf, 1); !dbf_eof(dbf); dbf_skip(dbf, 1)) {
+            if (!xcol_write(w, dbf->record_buffer)) FAIL("Snapshot write failed");
+        }
+        if (xcol_written(w) != total || !xcol_finish(w)) FAIL("Snapshot finish failed");
+        dbf_close(dbf);
+
+        DBF *snap = dbf_open_xcol(snapshot);
+        if (!snap || !dbf_is_snapshot(snap)) FAIL("Snapshot open failed");
+        if (dbf_reccount(snap) != total || dbf_field_count(snap) != 5) FAIL("Wrong shape");
+
+        uint32_t probes[4] = {1, 7, XCOL_CHUNK_RECORDS + 1, total};
+        for (int p = 0; p < 4; p++) {
+            uint32_t i = probes[p];
+            double id, price;
+            char name[13], date[9], expect[16];
+            bool ok;
+            dbf_goto(snap, i);
+            dbf_get_double(snap, 0, &id);
+            dbf_get_double(snap, 1, &price);
+            dbf_get_string(snap, 2, name, sizeof(name));
+            dbf_get_date(snap, 3, date);
+            dbf_get_logical(snap, 4, &ok);
+            snprintf(expect, sizeof(expect), "group%d", i % 5);
+            if (id != i || fabs(price - (i % 7 == 0 ? i / 3.0 : 2.5)) > 0.0005 ||
+                strncmp(name, expect, strlen(expect)) != 0 ||
+                date_to_julian(date) != date_to_julian("20100101") + (int32_t)(i / 1000) ||
+                ok != (i % 2 == 0)) {
+                FAIL("Value lost in snapshot");
+            }
+        }
+        dbf_goto(snap, 3);
+        if (!dbf_deleted(snap)) FAIL("Deletion flag lost");
+        dbf_goto(snap, total);
+        if (!dbf_deleted(snap)) FAIL("Deletion flag lost in last chunk");
+        dbf_goto(snap, 4);
+        if (dbf_deleted(snap)) FAIL("Active record read as deleted");
+        if (dbf_put_double(snap, 0, 1)) FAIL("Snapshot should be read-only");
+
+        /* The chunk ranges serve as zone maps */
+        DBFZoneTest late = {0, DBF_ZONE_GT, XCOL_CHUNK_RECORDS, NULL};
+        DBFScan *scan = dbf_scan_open_where(snap, 1, &late, 1);
+        if (!scan || dbf_scan_skipped(scan) != XCOL_CHUNK_RECORDS ||
+            dbf_recno(snap) != XCOL_CHUNK_RECORDS + 1) {
+            FAIL("Chunk not skipped");
+        }
+        uint32_t rows = 0;
+        for (; !dbf_eof(snap); dbf_scan_next(scan)) rows++;
+        if (rows != 5000) FAIL("Scan lost records");
+        dbf_scan_close(scan);
+        dbf_close(snap);
+        unlink(snapshot);
+        PASS();
+    }
+
+    TEST("DBF text import");
+    {
+        DBFField fields[4] = {
+            {"NAME", 'C', 12, 0, 0},
+            {"QTY", 'N', 8, 2, 0},
+            {"DAY", 'D', 8, 0, 0},
+            {"OK", 'L', 1, 0, 0}
+        };
+        const char *text = "/tmp/test_xbase3.txt";
+
+        FILE *fp = fopen(text, "w");
+        if (!fp) FAIL("Cannot write text file");
+        fprintf(fp, "\"Smith, \"\"J\"\"\",12.5,20240131,T\r\n");
+        fprintf(fp, "\n");
+        fprintf(fp, "plain,-3,2024-02-29,.F.\n");
+        fprintf(fp, "short\n");
+        fprintf(fp, "bad,1,2024013,T\n");
+        fprintf(fp, "never,1,20240101,T\n");
+        fclose(fp);
+
+        DBF *dbf = dbf_create(test_file, fields, 4);
+        if (!dbf) FAIL("Failed to create DBF");
+        uint32_t appended;
+        if (text_import(dbf, text, TEXT_DELIMITED, &appended)) FAIL("Bad date accepted");
+        if (appended != 3 || dbf_reccount(dbf) != 3) FAIL("Records before the bad line not kept");
+        if (strstr(g_error_msg, "line 5") == NULL) FAIL("Wrong line reported");
+
+        char name[13], date[9];
+        double qty;
+        bool ok;
+        dbf_goto(dbf, 1);
+        dbf_get_string(dbf, 0, name, sizeof(name));
+        dbf_get_double(dbf, 1, &qty);
+        dbf_get_date(dbf, 2, date);
+        dbf_get_logical(dbf, 3, &ok);
+        if (strcmp(name, "Smith, \"J\"  ") != 0 || qty != 12.5 || strcmp(date, "20240131") != 0 || !ok) {
+            FAIL("Quoted line misread");
+        }
+        dbf_goto(dbf, 2);
+        dbf_get_double(dbf, 1, &qty);
+        dbf_get_date(dbf, 2, date);
+        dbf_get_logical(dbf, 3, &ok);
+        if (qty != -3 || strcmp(date, "20240229") != 0 || ok) FAIL("Plain line misread");
+        dbf_goto(dbf, 3);
+        dbf_get_date(dbf, 2, date);
+        if (strcmp(date, "        ") != 0) FAIL("Missing values should be blank");
+
+        /* NDJSON matches keys to fields in any case */
+        fp = fopen(text, "w");
+        fprintf(fp, "{\"name\": \"json\", \"Qty\": 7.25, \"day\": null, \"ok\": true, \"extra\": [1]}\n");
+        fprintf(fp, "{\"QTY\": \"8\"}");
+        fclose(fp);
+        if (!text_import(dbf, text, TEXT_NDJSON, &appended) || appended != 2) FAIL("NDJSON import failed");
+        dbf_goto(dbf, 4);
+        dbf_get_string(dbf, 0, name, sizeof(name));
+        dbf_get_double(dbf, 1, &qty);
+        dbf_get_logical(dbf, 3, &ok);
+        if (strncmp(name, "json", 4) != 0 || qty != 7.25 || !ok) FAIL("NDJSON line misread");
+        dbf_goto(dbf, 5);
+        dbf_get_double(dbf, 1, &qty);
+        if (qty != 8) FAIL("NDJSON string number misread");
+
+        dbf_close(dbf);
+        unlink(text);
+        PASS();
+    }
+
+    TEST("DBF copy");
+    {
+        DBFField fields[4] = {
+            {"NAME", 'C', 12, 0, 0},
+            {"QTY", 'N', 8, 2, 0},
+            {"DAY", 'D', 8, 0, 0},
+            {"OK", 'L', 1, 0, 0}
+        };
+        const char *copy = "/tmp/test_xbase3_copy.dbf";
+        const char *text = "/tmp/test_xbase3_copy.txt";
+
+        DBF *dbf = dbf_create(test_file, fields, 4);
+        if (!dbf) FAIL("Failed to create DBF");
+        for (int i = 0; i < 50; i++) {
+            dbf_append_blank(dbf);
+            char name[16];
+            if (i % 7 == 3) {
+                snprintf(name, sizeof(name), "row\n%d", i);
+            } else {
+                snprintf(name, sizeof(name), "row \"%d\"", i);
+            }
+            dbf_put_string(dbf, 0, name);
+            if (i % 5) dbf_put_double(dbf, 1, i * 1.5);
+            dbf_put_date(dbf, 2, i % 2 ? "20240315" : "20231231");
+            dbf_put_logical(dbf, 3, i % 3 == 0);
+        }
+
+        /* Whole-file copy keeps every byte of the table */
+        if (!dbf_copy_file(dbf, copy)) FAIL("Copy failed");
+        DBF *dup = dbf_open(copy, true);
+        if (!dup || dbf_reccount(dup) != 50) FAIL("Copy has wrong record count");
+        dbf_goto(dup, 50);
+        dbf_goto(dbf, 50);
+        const uint8_t *a, *b;
+        size_t alen, blen;
+        for (int f = 0; f < 4; f++) {
+            dbf_field_view(dbf, f, &a, &alen);
+            dbf_field_view(dup, f, &b, &blen);
+            if (alen != blen || memcmp(a, b, alen) != 0) FAIL("Copied record differs");
+        }
+        dbf_close(dup);
+
+        /* Compiled tests agree with the values they compare */
+        DBFZoneTest tests[2] = {
+            {1, DBF_ZONE_GT, 30, NULL},
+            {2, DBF_ZONE_GE, (double)date_to_julian("20240101"), NULL}
+        };
+        DBFZoneTest match = {0, DBF_ZONE_MATCH, 0, "ROW \"21\""};
+        uint32_t passed = 0;
+        for (uint32_t r = 1; r <= 50; r++) {
+            dbf_goto(dbf, r);
+            bool expect = (r - 1) % 5 != 0 && (r - 1) * 1.5 > 30 && (r - 1) % 2 == 1;
+            if (dbf_test_record(dbf, tests, 2) != expect) FAIL("Compiled test disagrees");
+            if (dbf_test_record(dbf, &match, 1)) passed++;
+        }
+        if (passed != 1) FAIL("Text match should pass one record");
+
+        /* Text written by COPY reads back to the same values */
+        uint16_t size = dbf->header.record_size;
+        DBFField layout[4];
+        for (int f = 0; f < 4; f++) layout[f] = *dbf_field_info(dbf, f);
+        for (int format = TEXT_DELIMITED; format <= TEXT_NDJSON; format++) {
+            TextWriter *w = text_writer_create(text, (TextFormat)format, layout, 4);
+            if (!w) FAIL("Cannot create text file");
+            for (uint32_t r = 1; r <= 50; r++) {
+                dbf_goto(dbf, r);
+                if (!text_writer_add(w, dbf->record_buffer)) FAIL("Text write failed");
+            }
+            if (text_writer_written(w) != 50 || !text_writer_finish(w)) FAIL("Text finish failed");
+
+            dup = dbf_create(copy, fields, 4);
+            uint32_t appended;
+            if (!dup || !text_import(dup, text, (TextFormat)format, &appended) || appended != 50) {
+                FAIL("Written text does not load");
+            }
+            for (uint32_t r = 1; r <= 50; r++) {
+                dbf_goto(dbf, r);
+                dbf_goto(dup, r);
+                dbf_field_view(dbf, 0, &a, &alen);
+                dbf_field_view(dup, 0, &b, &blen);
+                if (memcmp(a, b, size - 1) != 0) FAIL("Text round trip changed a record");
+            }
+            dbf_close(dup);
+        }
+
+        dbf_close(dbf);
+        unlink(copy);
+        unlink("/tmp/test_xbase3_copy.xdm");
+        unlink(text);
+        PASS();
+    }
+
+    TEST("DBF external sort");
+    {
+        DBFField fields[3] = {
+            {"NAME", 'C', 6, 0, 0},
+            {"QTY", 'N', 7, 1, 0},
+            {"OK", 'L', 1, 0, 0}
+        };
+        const char *sorted = "/tmp/test_xbase3_sorted.dbf";
+
+        DBF *dbf = dbf_create(test_file, fields, 3);
+        if (!dbf) FAIL("Failed to create DBF");
+        DBFField layout[3];
+        for (int f = 0; f < 3; f++) layout[f] = *dbf_field_info(dbf, f);
+
+        /* A budget of 64 records spills dozens of runs, merged two at a time */
+        SortKey keys[2] = {{1, true, false}, {0, false, true}};
+        Sorter *sorter = sorter_create(sorted, layout, 3, keys, 2, 1);
+        if (!sorter) FAIL("Cannot start sort");
+
+        uint8_t record[15];
+        uint32_t seed = 12345;
+        for (int i = 0; i < 5000; i++) {
+            seed = seed * 1103515245 + 12345;
+            char text[16];
+            memset(record, ' ', sizeof(record));
+            snprintf(text, sizeof(text), "%c%05d", i % 2 ? 'a' : 'A', i % 7);
+            memcpy(&record[1], text, 6);
+            if (i % 11) {
+                snprintf(text, sizeof(text), "%7.1f", (double)((seed >> 16) % 200) / 2.0 - 50);
+                memcpy(&record[7], text, 7);
+            }
+            record[14] = i % 3 ? 'T' : 'F';
+            if (!sorter_add(sorter, record)) FAIL("Sort add failed");
+        }
+        if (sorter_runs(sorter) < 50) FAIL("Small budget should spill runs");
+        if (!sorter_finish(sorter)) FAIL("Sort failed");
+
+        DBF *out = dbf_open(sorted, true);
+        if (!out || dbf_reccount(out) != 5000) FAIL("Sorted table has wrong record count");
+        double last_qty = INFINITY;
+        char last_name[8] = "";
+        int name_ties = 0;
+        for (uint32_t r = 1; r <= 5000; r++) {
+            double qty = 0;
+            char name[8];
+            dbf_goto(out, r);
+            dbf_get_double(out, 1, &qty);
+            dbf_get_string(out, 0, name, sizeof(name));
+            if (qty > last_qty) FAIL("Descending key out of order");
+            if (qty == last_qty) {
+                int cmp = str_casecmp(last_name, name);
+                if (cmp > 0) FAIL("Case-blind key out of order");
+                /* Names that differ only in case tie */
+                if (cmp == 0 && last_name[0] != name[0]) name_ties++;
+            }
+            last_qty = qty;
+            strcpy(last_name, name);
+        }
+        if (name_ties == 0) FAIL("Expected equal keys");
+        dbf_close(out);
+
+        /* Stability: equal keys stay in input order */
+        SortKey by_ok = {2, false, false};
+        sorter = sorter_create(sorted, layout, 3, &by_ok, 1, 1);
+        for (int i = 0; i < 500; i++) {
+            char text[8];
+            memset(record, ' ', sizeof(record));
+            snprintf(text, sizeof(text), "%06d", i);
+            memcpy(&record[1], text, 6);
+            record[14] = i % 2 ? 'T' : 'F';
+            sorter_add(sorter, record);
+        }
+        if (!sorter_finish(sorter)) FAIL("Sort failed");
+        out = dbf_open(sorted, true);
+        for (uint32_t r = 1; r <= 500; r++) {
+            char name[8];
+            bool ok;
+            dbf_goto(out, r);
+            dbf_get_string(out, 0, name, sizeof(name));
+            dbf_get_logical(out, 2, &ok);
+            int expect = r <= 250 ? (int)(r - 1) * 2 : (int)(r - 251) * 2 + 1;
+            if (atoi(name) != expect || ok != (r > 250)) FAIL("Equal keys reordered");
+        }
+        dbf_close(out);
+
+        dbf_close(dbf);
+        unlink(sorted);
+        unlink("/tmp/test_xbase3_sorted.xdm");
+        PASS();
+    }
+
+    /* Test the numeric field codec against printf/strtod */
+    TEST("Numeric codec round trip");
+    {
+        static const double edges[] = {
+            0.0, -0.0, 0.5, 1.5, 2.5, -0.5, -2.5, 0.125, 0.375, -0.125,
+            1.005, 2.675, 0.045, 1.0 / 3.0, -2.0 / 3.0, 99999.5, 999.995,
+            123456789.987654321, -999.999, 1e-10, -1e-10, 0.004, -0.004,
+            1e15, 1e16, -1e17, 1e19, 1e300, 4503599627370497.0,
+            9007199254740993.0, INFINITY, -INFINITY, NAN
+        };
+        int failures = 0;
+
+        for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++) {
+            for (int width = 1; width <= 20; width++) {
+                for (int dec = 0; dec < width && dec <= 15; dec++) {
+                    if (!check_codec(edges[e], width, dec)) failures++;
+                }
+            }
+        }
+
+        /* Pseudo-random values over a range of magnitudes */
+        uint64_t seed = 0x2545F4914F6CDD1DULL;
+        for (int i = 0; i < 200000 && failures < 10; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            int dec = (int)(seed % 6);
+            int width = dec + 2 + (int)((seed >> 8) % 14);
+            double magnitude = pow(10.0, (double)((seed >> 16) % 14) - 3);
+            double value = (double)(int64_t)(seed >> 20) / (double)(1ULL << 44) * magnitude;
+
+            if (!check_codec(value, width, dec)) failures++;
+
+            /* Values at exact decimal ties stress the rounding path */
+            double tie = floor(value * pow(10.0, dec)) + 0.5;
+            if (!check_codec(tie / pow(10.0, dec), width, dec)) failures++;
+        }
+
+        /* Text that is not produced by the encoder */
+        static const char *texts[] = {
+            "", "     ", "  -12.50", "+7", "1e3", "  12  ", "1 2", "-", ".",
+            "5.", ".5", "-.5", "*****", "0x1A", "12345678901234567890",
+            "9007199254740993", "\t5", "00012.3400", "--1", "1.2.3", "-0",
+            "0.00000000000000000000000001", "-.000000000000000000000000000000125"
+        };
+        for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); t++) {
+            const uint8_t *text = (const uint8_t *)texts[t];
+            size_t len = strlen(texts[t]);
+            double a = 0, b = 0;
+            bool ok_a = dbf_decode_numeric(text, len, &a);
+            bool ok_b = ref_decode(text, len, &b);
+            if (ok_a != ok_b || (ok_a && !same_double(a, b))) {
+                printf("\n  decode '%s': %d/%.17g vs %d/%.17g", texts[t], ok_a, a, ok_b, b);
+                failures++;
+            }
+        }
+
+        if (failures) {
+            printf("\n");
+            FAIL("Codec differs from printf/strtod");
+        }
+        PASS();
+    }
+
     /* Cleanup */
     unlink(test_file);
+    unlink("/tmp/test_xbase3.xdm");
+    unlink("/tmp/test_xbase3.xzm");
+    unlink("/tmp/test_xbase3.xbl");
 
     printf("\nAll DBF tests passed!\n");
     return 0;
@@ -5,9 +5,11 @@
 #include "parser.h"
 #include "expr.h"
 #include "variables.h"
+#include "parallel.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 
 #define TEST(name) printf("Testing %s... ", name)
 #define PASS() printf("PASSED\n")
@@ -24,6 +26,13 @@ static Value eval_string(const char *input, EvalContext *ctx) {
     return result;
 }
 
+/* Add an expression to a worker's total */
+static void sum_field(EvalContext *ctx, void *partial, void *arg) {
+    Value v = expr_eval(arg, ctx);
+    *(double *)partial += v.data.number;
+    value_free(&v);
+}
+
 int main(void) {
     EvalContext ctx;
     eval_context_init(&ctx);
@@ -232,6 +241,76 @@ int main(void) {
         PASS();
     }
 
+    /* Test expressions evaluated on parallel scan workers */
+    TEST("parallel scans");
+    {
+        const char *file = "/tmp/test_xbase3_parallel.dbf";
+        DBFField fields[2] = {
+            {"ID", 'N', 8, 0, 0},
+            {"KIND", 'C', 4, 0, 0}
+        };
+        DBF *dbf = dbf_create(file, fields, 2);
+        if (!dbf) FAIL("Failed to create DBF");
+
+        /* Several morsels, the last one partial */
+        uint32_t records = PARALLEL_MORSEL_RECORDS * 5 + 123;
+        for (uint32_t i = 1; i <= records; i++) {
+            dbf_append_blank(dbf);
+            dbf_put_double(dbf, 0, i);
+            dbf_put_string(dbf, 1, i % 3 ? "ODD" : "TRI");
+        }
+        dbf_goto(dbf, 6);
+        dbf_delete(dbf);
+        dbf_set_skip_deleted(true);
+        ctx.current_dbf = dbf;
+
+        Parser p;
+        parser_init(&p, "TRIM(KIND) = \"TRI\" .AND. RECNO() > 1");
+        ASTExpr *cond = parser_parse_expr(&p);
+        parser_init(&p, "ID");
+        ASTExpr *id = parser_parse_expr(&p);
+        if (!cond || !id) FAIL("Parse failed");
+
+        parallel_set_threads(4);
+        ParallelTask task = {sizeof(double), NULL, NULL, false};
+        void *partials;
+        int workers;
+        uint32_t found;
+
+        /* Every multiple of 3 but the deleted record 6 is summed */
+        task.visit = sum_field;
+        task.arg = id;
+        if (!parallel_scan(dbf, 1, cond, &task, &partials, &workers, NULL)) FAIL("Parallel scan failed");
+        if (workers != 4) FAIL("Expected four workers");
+        double sum = 0;
+        for (int w = 0; w < workers; w++) sum += ((double *)partials)[w];
+        xfree(partials);
+        double n = records / 3;
+        if (sum != 3 * n * (n + 1) / 2 - 6) FAIL("Parallel sum wrong");
+
+        /* The earliest match wins even when a later morsel matches first */
+        parser_init(&p, "MOD(ID, 8192) = 100");
+        ASTExpr *first = parser_parse_expr(&p);
+        task.visit = NULL;
+        task.first_only = true;
+        if (!parallel_scan(dbf, 200, first, &task, &partials, &workers, &found)) FAIL("Parallel locate failed");
+        xfree(partials);
+        if (found != 8292) FAIL("Parallel locate found the wrong record");
+        if (!parallel_scan(dbf, records - 5, first, &task, &partials, &workers, &found)) FAIL("Parallel locate failed");
+        xfree(partials);
+        if (found != 0) FAIL("Parallel locate should find nothing");
+
+        parallel_set_threads(1);
+        ast_expr_free(first);
+        ast_expr_free(cond);
+        ast_expr_free(id);
+        ctx.current_dbf = NULL;
+        dbf_set_skip_deleted(false);
+        dbf_close(dbf);
+        unlink(file);
+        PASS();
+    }
+
     var_cleanup();
     printf("\nAll expression tests passed!\n");
     return 0;
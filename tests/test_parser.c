@@ -25,6 +25,15 @@ int main(void) {
         if (strcmp(node->data.use.filename, "test") != 0) FAIL("Filename mismatch");
         if (!node->data.use.alias) FAIL("Alias is NULL");
         if (strcmp(node->data.use.alias, "t") != 0) FAIL("Alias mismatch");
+        ast_node_free(node);
+
+        /* A name too long for a path is an error, not cut short */
+        char line[400] = "USE ";
+        memset(line + 4, 'x', 300);
+        parser_init(&p, line);
+        node = parser_parse_command(&p);
+        if (!p.had_error) FAIL("Long file name accepted");
+        if (node && node->data.use.filename) FAIL("Long file name kept");
 
         ast_node_free(node);
         PASS();
@@ -110,6 +119,68 @@ int main(void) {
         PASS();
     }
 
+    /* Test COPY command */
+    TEST("COPY command");
+    {
+        Parser p;
+        parser_init(&p, "COPY TO sales.xcol FIELDS qty, day TYPE xcol FOR qty > 0");
+
+        ASTNode *node = parser_parse_command(&p);
+        if (!node) FAIL("Parse returned NULL");
+        if (node->type != CMD_COPY) FAIL("Expected CMD_COPY");
+        if (!node->data.copy.filename) FAIL("Filename is NULL");
+        if (strcmp(node->data.copy.filename, "sales.xcol") != 0) FAIL("Filename mismatch");
+        if (node->data.copy.field_count != 2) FAIL("Expected 2 fields");
+        if (!node->data.copy.type) FAIL("Type is NULL");
+        if (!node->condition) FAIL("FOR condition is NULL");
+
+        ast_node_free(node);
+        PASS();
+    }
+
+    /* Test SORT command */
+    TEST("SUM command");
+    {
+        Parser p;
+        parser_init(&p, "SUM qty, qty * price FOR qty > 0 TO q, v");
+
+        ASTNode *node = parser_parse_command(&p);
+        if (!node) FAIL("Parse returned NULL");
+        if (node->type != CMD_SUM) FAIL("Expected CMD_SUM");
+        if (node->data.aggregate.count != 2) FAIL("Expected 2 expressions");
+        if (node->data.aggregate.var_count != 2) FAIL("Expected 2 variables");
+        if (!node->condition) FAIL("FOR condition is NULL");
+        ast_node_free(node);
+
+        /* Without expressions every numeric field is totalled */
+        parser_init(&p, "AVERAGE FOR qty > 0");
+        node = parser_parse_command(&p);
+        if (!node || node->type != CMD_AVERAGE) FAIL("Expected CMD_AVERAGE");
+        if (node->data.aggregate.count != 0) FAIL("Expected no expressions");
+        if (!node->condition) FAIL("FOR condition is NULL");
+
+        ast_node_free(node);
+        PASS();
+    }
+
+    TEST("SORT command");
+    {
+        Parser p;
+        parser_init(&p, "SORT TO ordered ON qty /D, name/AC FOR qty > 0");
+
+        ASTNode *node = parser_parse_command(&p);
+        if (!node) FAIL("Parse returned NULL");
+        if (node->type != CMD_SORT) FAIL("Expected CMD_SORT");
+        if (strcmp(node->data.copy.filename, "ordered") != 0) FAIL("Filename mismatch");
+        if (node->data.copy.field_count != 2) FAIL("Expected 2 key fields");
+        if (node->data.copy.options[0] != SORT_DESCENDING) FAIL("Expected /D");
+        if (node->data.copy.options[1] != SORT_NOCASE) FAIL("Expected /AC");
+        if (!node->condition) FAIL("FOR condition is NULL");
+
+        ast_node_free(node);
+        PASS();
+    }
+
     /* Test ? command */
     TEST("? command");
     {
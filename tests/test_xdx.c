@@ -15,6 +15,15 @@
 static const char *test_dbf = "/tmp/test_xdx.dbf";
 static const char *test_xdx = "/tmp/test_xdx.xdx";
 
+/* Key of the current record: the first four letters of NAME */
+static bool name_key(DBF *dbf, void *key, void *ctx) {
+    (void)ctx;
+    char name[21];
+    if (!dbf_get_string(dbf, 0, name, sizeof(name))) return false;
+    memcpy(key, name, strlen(name) < 4 ? strlen(name) : 4);
+    return true;
+}
+
 int main(void) {
     /* Create test DBF */
     DBFField fields[2] = {
@@ -158,6 +167,378 @@ int main(void) {
         PASS();
     }
 
+    /* Test a multi-level tree under buffer pool pressure */
+    TEST("XDX buffer pool");
+    {
+        const char *big_xdx = "/tmp/test_big.xdx";
+        bufpool_set_budget(0);
+
+        XDX *xdx = xdx_create(big_xdx, "NAME", XDX_KEY_CHAR, 20, false, false);
+        if (!xdx) FAIL("Create failed");
+
+        char key[21];
+        for (int i = 0; i < 5000; i++) {
+            snprintf(key, sizeof(key), "K%019d", (i * 7919) % 5000);
+            if (!xdx_insert(xdx, key, (uint32_t)(i + 1))) FAIL("Insert failed");
+        }
+        xdx_close(xdx);
+
+        xdx = xdx_open(big_xdx);
+        if (!xdx) FAIL("Reopen failed");
+        for (int i = 0; i < 5000; i += 37) {
+            snprintf(key, sizeof(key), "K%019d", (i * 7919) % 5000);
+            if (!xdx_seek(xdx, key)) FAIL("Seek failed");
+            if (xdx_recno(xdx) != (uint32_t)(i + 1)) FAIL("Wrong record");
+        }
+        xdx_close(xdx);
+
+        bufpool_set_budget((size_t)BUFPOOL_DEFAULT_MB * 1024 * 1024);
+        unlink(big_xdx);
+        PASS();
+    }
+
+    /* Test renumbering records after a PACK */
+    TEST("XDX remap");
+    {
+        const char *map_xdx = "/tmp/test_map.xdx";
+        XDX *xdx = xdx_create(map_xdx, "NAME", XDX_KEY_CHAR, 20, false, false);
+        if (!xdx) FAIL("Create failed");
+
+        char key[21];
+        for (int i = 1; i <= 2000; i++) {
+            snprintf(key, sizeof(key), "K%019d", (i * 7919) % 2000);
+            if (!xdx_insert(xdx, key, (uint32_t)i)) FAIL("Insert failed");
+        }
+
+        /* Records shift down without removals: rewritten in place */
+        static uint32_t map[2001];
+        for (uint32_t r = 1; r <= 2000; r++) map[r] = r + 5;
+        if (!xdx_remap(xdx, map, 2000)) FAIL("In-place remap failed");
+        for (int i = 1; i <= 2000; i += 13) {
+            snprintf(key, sizeof(key), "K%019d", (i * 7919) % 2000);
+            if (!xdx_seek(xdx, key) || xdx_recno(xdx) != (uint32_t)i + 5) FAIL("Remapped record mismatch");
+        }
+
+        /* Every third record removed: entries are dropped */
+        uint32_t kept = 0;
+        static uint32_t map2[2006];
+        for (uint32_t r = 6; r <= 2005; r++) map2[r] = (r - 5) % 3 == 0 ? 0 : ++kept;
+        if (!xdx_remap(xdx, map2, 2005)) FAIL("Remap with removals failed");
+        xdx_close(xdx);
+
+        xdx = xdx_open(map_xdx);
+        for (int i = 1; i <= 2000; i++) {
+            snprintf(key, sizeof(key), "K%019d", (i * 7919) % 2000);
+            bool found = xdx_seek(xdx, key);
+            if (i % 3 == 0) {
+                if (found) FAIL("Removed record still indexed");
+            } else if (!found || xdx_recno(xdx) != map2[i + 5]) {
+                FAIL("Record mismatch after removals");
+            }
+        }
+        xdx_close(xdx);
+        unlink(map_xdx);
+        PASS();
+    }
+
+    /* Test inserting a batch of keys */
+    TEST("XDX batch insert");
+    {
+        const char *batch_xdx = "/tmp/test_batch.xdx";
+        XDX *xdx = xdx_create(batch_xdx, "NAME", XDX_KEY_CHAR, 20, true, false);
+        if (!xdx) FAIL("Create failed");
+
+        /* Keys arrive shuffled; one repeats an existing key */
+        char key[21];
+        snprintf(key, sizeof(key), "K%019d", 42);
+        if (!xdx_insert(xdx, key, 9999)) FAIL("Insert failed");
+
+        size_t size = 20 + sizeof(uint32_t);
+        static uint8_t entries[3000 * 24];
+        for (uint32_t i = 0; i < 3000; i++) {
+            snprintf(key, sizeof(key), "K%019u", (i * 7919) % 3000);
+            memcpy(entries + i * size, key, 20);
+            uint32_t recno = i + 1;
+            memcpy(entries + i * size + 20, &recno, sizeof(uint32_t));
+        }
+        error_clear();
+        uint32_t dups;
+        if (!xdx_insert_batch(xdx, entries, 3000, &dups)) FAIL("Batch insert failed");
+        if (g_last_error != ERR_NONE) FAIL("Duplicate left an error");
+        if (dups != 1) FAIL("Duplicate not counted");
+
+        snprintf(key, sizeof(key), "K%019d", 42);
+        if (!xdx_seek(xdx, key) || xdx_recno(xdx) != 9999) FAIL("Existing key replaced");
+        for (uint32_t i = 0; i < 3000; i += 41) {
+            snprintf(key, sizeof(key), "K%019u", (i * 7919) % 3000);
+            if ((i * 7919) % 3000 == 42) continue;
+            if (!xdx_seek(xdx, key) || xdx_recno(xdx) != i + 1) FAIL("Batch key not found");
+        }
+
+        /* A small batch goes in key by key */
+        for (uint32_t i = 0; i < 3; i++) {
+            snprintf(key, sizeof(key), "K%019u", i == 1 ? 7u : 5000 - i);
+            memcpy(entries + i * size, key, 20);
+            uint32_t recno = 4000 + i;
+            memcpy(entries + i * size + 20, &recno, sizeof(uint32_t));
+        }
+        if (!xdx_insert_batch(xdx, entries, 3, &dups)) FAIL("Small batch failed");
+        if (dups != 1) FAIL("Small batch duplicate not counted");
+        snprintf(key, sizeof(key), "K%019u", 4998u);
+        if (!xdx_seek(xdx, key) || xdx_recno(xdx) != 4002) FAIL("Small batch key not found");
+        xdx_close(xdx);
+        unlink(batch_xdx);
+        PASS();
+    }
+
+    /* Test building a whole tree from unsorted keys */
+    TEST("XDX bulk build");
+    {
+        const char *build_xdx = "/tmp/test_build.xdx";
+
+        /* Sizes where the last key ends up one and two levels up, built in
+         * memory and from runs merged off disk */
+        static const uint32_t sizes[] = {0, 1, 254, 255, 256, 510, 65025, 65026};
+        char key[16];
+        for (int m = 0; m < 2; m++) {
+            for (size_t t = 0; t < sizeof(sizes) / sizeof(sizes[0]); t++) {
+                uint32_t n = sizes[t];
+                XDX *xdx = xdx_create(build_xdx, "CODE", XDX_KEY_CHAR, 8, false, false);
+                if (!xdx) FAIL("Create failed");
+                XDXBuild *build = xdx_build_begin(xdx, m == 0 ? 0 : 1, 1);
+                if (!build) FAIL("Build begin failed");
+                for (uint32_t i = 0; i < n; i++) {
+                    uint32_t v = (uint32_t)(((uint64_t)i * 7919) % n);
+                    snprintf(key, sizeof(key), "%08u", v);
+                    if (!xdx_build_add(build, key, v + 1)) FAIL("Build add failed");
+                }
+                uint32_t keys = 0, dup = 1;
+                if (!xdx_build_finish(build, &keys, &dup)) FAIL("Build finish failed");
+                if (keys != n || dup != 0) FAIL("Wrong key count");
+                xdx_close(xdx);
+
+                /* Every key is found, and the tree still takes inserts */
+                xdx = xdx_open(build_xdx);
+                if (!xdx) FAIL("Open failed");
+                if (n > 0 && (!xdx_go_top(xdx) || xdx_recno(xdx) != 1)) FAIL("Wrong top");
+                if (n > 0 && (!xdx_go_bottom(xdx) || xdx_recno(xdx) != n)) FAIL("Wrong bottom");
+                for (uint32_t i = 0; i <= n; i++) {
+                    snprintf(key, sizeof(key), "%08u", i);
+                    if (xdx_seek(xdx, key) != (i < n)) FAIL("Built key not found");
+                    if (i < n && xdx_recno(xdx) != i + 1) FAIL("Built key has wrong record");
+                }
+                for (uint32_t i = 0; i < 300; i++) {
+                    snprintf(key, sizeof(key), "X%07u", i * 2);
+                    if (!xdx_insert(xdx, key, 100000 + i)) FAIL("Insert after build failed");
+                }
+                for (uint32_t i = 0; i < n; i += 97) {
+                    snprintf(key, sizeof(key), "%08u", i);
+                    if (!xdx_seek(xdx, key) || xdx_recno(xdx) != i + 1) FAIL("Key lost after insert");
+                }
+                xdx_close(xdx);
+            }
+        }
+
+        /* A unique index keeps the first record of each key, also when the
+         * keys come through several parts and are merged on four threads */
+        for (int m = 0; m < 2; m++) {
+            XDX *xdx = xdx_create(build_xdx, "CODE", XDX_KEY_CHAR, 8, true, false);
+            if (!xdx) FAIL("Create failed");
+            XDXBuild *build = xdx_build_begin(xdx, m == 0 ? 0 : 1, 4);
+            XDXBuildPart *parts[3] = {xdx_build_part(build), xdx_build_part(build),
+                                      xdx_build_part(build)};
+            for (uint32_t i = 0; i < 5000; i++) {
+                snprintf(key, sizeof(key), "%08u", (5000 - i) % 1000);
+                if (!xdx_build_part_add(parts[(i / 700) % 3], key, i + 1)) FAIL("Build add failed");
+            }
+            uint32_t keys, dup;
+            if (!xdx_build_finish(build, &keys, &dup)) FAIL("Build finish failed");
+            if (keys != 1000 || dup != 4000) FAIL("Duplicates not left out");
+            for (uint32_t i = 0; i < 1000; i++) {
+                snprintf(key, sizeof(key), "%08u", i);
+                uint32_t first = (5000 - i) % 1000 + 1;
+                if (!xdx_seek(xdx, key) || xdx_recno(xdx) != first) FAIL("Wrong record kept");
+            }
+            xdx_close(xdx);
+        }
+        unlink(build_xdx);
+        PASS();
+    }
+
+    /* Test keys that compare byte for byte */
+    TEST("XDX binary keys");
+    {
+        const char *bin_xdx = "/tmp/test_binary.xdx";
+        static const double numbers[] = {-1e300, -1e9, -3.5, -0.25, 0, 0.25, 2, 3.5, 1e9, 1e300};
+        const int count = (int)(sizeof(numbers) / sizeof(numbers[0]));
+
+        for (int desc = 0; desc < 2; desc++) {
+            XDX *xdx = xdx_create(bin_xdx, "AMT", XDX_KEY_NUMERIC, 20, false, desc);
+            if (!xdx) FAIL("Create failed");
+            if (xdx_key_length(xdx) != XDX_NUMBER_KEY_LEN) FAIL("Numeric key not 8 bytes");
+
+            /* Encoded keys are in numeric order, reversed when descending */
+            uint8_t a[8], b[8];
+            for (int i = 0; i + 1 < count; i++) {
+                xdx_key_number(xdx, numbers[i], a);
+                xdx_key_number(xdx, numbers[i + 1], b);
+                int cmp = memcmp(a, b, 8);
+                if (desc ? cmp <= 0 : cmp >= 0) FAIL("Numbers out of order");
+            }
+            xdx_key_number(xdx, -0.0, a);
+            xdx_key_number(xdx, 0.0, b);
+            if (memcmp(a, b, 8) != 0) FAIL("-0 differs from 0");
+            xdx_key_text(xdx, "3.5", a);
+            xdx_key_number(xdx, 3.5, b);
+            if (memcmp(a, b, 8) != 0) FAIL("Text key differs from number");
+
+            for (int i = 0; i < count; i++) {
+                xdx_key_number(xdx, numbers[(i * 7) % count], a);
+                if (!xdx_insert(xdx, a, (uint32_t)((i * 7) % count) + 1)) FAIL("Insert failed");
+            }
+            xdx_go_top(xdx);
+            if (xdx_recno(xdx) != (desc ? (uint32_t)count : 1)) FAIL("Wrong top");
+            xdx_go_bottom(xdx);
+            if (xdx_recno(xdx) != (desc ? 1 : (uint32_t)count)) FAIL("Wrong bottom");
+            xdx_key_number(xdx, -0.25, a);
+            if (!xdx_seek(xdx, a) || xdx_recno(xdx) != 4) FAIL("Number not found");
+            xdx_close(xdx);
+        }
+
+        /* Dates are julian days; blank dates come first */
+        XDX *xdx = xdx_create(bin_xdx, "DUE", XDX_KEY_DATE, 8, false, false);
+        if (!xdx) FAIL("Create failed");
+        if (xdx_key_length(xdx) != XDX_DATE_KEY_LEN) FAIL("Date key not 4 bytes");
+        uint8_t d1[4], d2[4], d3[4];
+        xdx_key_text(xdx, "        ", d1);
+        xdx_key_text(xdx, "19991231", d2);
+        xdx_key_text(xdx, "20000101", d3);
+        if (memcmp(d1, d2, 4) >= 0 || memcmp(d2, d3, 4) >= 0) FAIL("Dates out of order");
+        xdx_close(xdx);
+
+        /* Descending text keys are stored inverted */
+        xdx = xdx_create(bin_xdx, "NAME", XDX_KEY_CHAR, 4, false, true);
+        if (!xdx) FAIL("Create failed");
+        uint8_t k1[4], k2[4];
+        xdx_key_text(xdx, "AB", k1);
+        xdx_key_text(xdx, "B", k2);
+        if (k1[0] != (uint8_t)~'A' || k1[3] != (uint8_t)~' ') FAIL("Key not inverted");
+        if (xdx_key_compare(xdx, k1, k2) <= 0) FAIL("Descending text out of order");
+        xdx_close(xdx);
+        unlink(bin_xdx);
+        PASS();
+    }
+
+    /* Test node cache */
+    TEST("XDX node cache");
+    {
+        const char *cache_xdx = "/tmp/test_cache.xdx";
+        XDX *xdx = xdx_create(cache_xdx, "NAME", XDX_KEY_CHAR, 20, false, false);
+        if (!xdx) FAIL("Create failed");
+
+        /* Enough keys for several times more leaves than are kept */
+        char key[21];
+        for (uint32_t i = 0; i < 40000; i++) {
+            snprintf(key, sizeof(key), "K%019u", (i * 7919) % 40000);
+            if (!xdx_insert(xdx, key, i + 1)) FAIL("Insert failed");
+        }
+
+        XDXCacheStats stats;
+        xdx_get_cache_stats(xdx, &stats);
+        if (stats.leaves > XDX_CACHE_LEAVES) FAIL("Leaves not evicted");
+        if (stats.internal == 0) FAIL("Internal nodes not cached");
+        xdx_close(xdx);
+
+        /* A reopened index decodes each node once; repeated seeks hit */
+        xdx = xdx_open(cache_xdx);
+        if (!xdx) FAIL("Open failed");
+        snprintf(key, sizeof(key), "K%019u", 12345u);
+        if (!xdx_seek(xdx, key)) FAIL("Seek failed");
+        XDXCacheStats first;
+        xdx_get_cache_stats(xdx, &first);
+        for (int i = 0; i < 100; i++) {
+            if (!xdx_seek(xdx, key)) FAIL("Repeated seek failed");
+        }
+        xdx_get_cache_stats(xdx, &stats);
+        if (stats.misses != first.misses) FAIL("Repeated seeks missed the cache");
+        if (stats.hits < first.hits + 100) FAIL("Repeated seeks not counted as hits");
+
+        /* Evicted leaves are read back correctly */
+        for (uint32_t i = 0; i < 40000; i += 97) {
+            snprintf(key, sizeof(key), "K%019u", (i * 7919) % 40000);
+            if (!xdx_seek(xdx, key) || xdx_recno(xdx) != i + 1) FAIL("Key lost after eviction");
+        }
+        xdx_close(xdx);
+        unlink(cache_xdx);
+        PASS();
+    }
+
+    /* Test reading, updating and rebuilding a version 1 file */
+    TEST("XDX version 1 files");
+    {
+        const char *v1_xdx = "/tmp/test_v1.xdx";
+        FILE *fp = fopen(v1_xdx, "wb");
+        if (!fp) FAIL("Cannot write version 1 file");
+
+        /* Header, then one leaf sized for order 50 holding three keys */
+        XDXHeader hdr = {0};
+        memcpy(hdr.magic, XDX_MAGIC, 4);
+        hdr.version = XDX_VERSION_1;
+        hdr.key_type = XDX_KEY_CHAR;
+        hdr.key_length = 4;
+        hdr.root_offset = XDX_HEADER_SIZE;
+        hdr.node_count = 1;
+        hdr.order = 50;
+        strcpy(hdr.key_expr, "NAME");
+        uint8_t file[XDX_HEADER_SIZE + 8 + 50 * 8] = {0};
+        memcpy(file, &hdr, sizeof(hdr));
+        XDXNodeHeader leaf = {3, 1, 0, 0};
+        memcpy(file + XDX_HEADER_SIZE, &leaf, sizeof(leaf));
+        for (uint32_t i = 0; i < 3; i++) {
+            uint8_t *entry = file + XDX_HEADER_SIZE + 8 + i * 8;
+            memset(entry, 'A' + (int)i, 4);
+            uint32_t recno = i + 1;
+            memcpy(entry + 4, &recno, sizeof(recno));
+        }
+        fwrite(file, sizeof(file), 1, fp);
+        fclose(fp);
+
+        XDX *xdx = xdx_open(v1_xdx);
+        if (!xdx) FAIL("Cannot open version 1 file");
+        if (!xdx_seek(xdx, "BBBB") || xdx_recno(xdx) != 2) FAIL("Version 1 key not found");
+
+        /* Updates split nodes in the version 1 layout */
+        char key[8];
+        for (uint32_t i = 0; i < 500; i++) {
+            snprintf(key, sizeof(key), "K%03u", (i * 37) % 500);
+            if (!xdx_insert(xdx, key, 100 + i)) FAIL("Version 1 insert failed");
+        }
+        xdx_close(xdx);
+
+        xdx = xdx_open(v1_xdx);
+        if (!xdx || xdx->header.version != XDX_VERSION_1) FAIL("Version 1 file not kept");
+        for (uint32_t i = 0; i < 500; i++) {
+            snprintf(key, sizeof(key), "K%03u", (i * 37) % 500);
+            if (!xdx_seek(xdx, key) || xdx_recno(xdx) != 100 + i) FAIL("Version 1 update lost");
+        }
+        if (!xdx_seek(xdx, "CCCC") || xdx_recno(xdx) != 3) FAIL("Original key lost");
+
+        /* Rebuilding writes pages */
+        DBF *names = dbf_open(test_dbf, true);
+        if (!names || !xdx_reindex(xdx, names, name_key, NULL)) FAIL("Reindex failed");
+        dbf_close(names);
+        if (xdx->header.version != XDX_VERSION) FAIL("Reindex did not upgrade");
+        xdx_close(xdx);
+
+        xdx = xdx_open(v1_xdx);
+        if (!xdx || xdx->header.version != XDX_VERSION) FAIL("Upgraded file not readable");
+        if (!xdx_seek(xdx, "Alic") || xdx_recno(xdx) != 2) FAIL("Rebuilt key not found");
+        if (xdx_seek(xdx, "BBBB")) FAIL("Old key survived rebuild");
+        xdx_close(xdx);
+        unlink(v1_xdx);
+        PASS();
+    }
+
     /* Cleanup */
     unlink(test_dbf);
     unlink(test_xdx);